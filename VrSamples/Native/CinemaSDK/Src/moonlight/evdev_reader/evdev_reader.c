@@ -5,13 +5,17 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <linux/input.h>
 #include <unistd.h>
-#include <poll.h>
 #include <errno.h>
 #include <dirent.h>
+#include <limits.h>
 #include <pthread.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
@@ -19,32 +23,62 @@
 
 #include <android/log.h>
 
-#define EVDEV_MAX_EVENT_SIZE 24
-
 #define REL_X 0x00
 #define REL_Y 0x01
 #define KEY_Q 16
 #define BTN_LEFT 0x110
 #define BTN_GAMEPAD 0x130
 
+// Events buffered per device while waiting for the end of a frame. A device
+// that sends this many events without a SYN_REPORT has them sent anyway.
+#define MAX_PENDING_EVENTS 256
+
+// Most epoll events handled per wakeup
+#define MAX_EPOLL_EVENTS 16
+
+// Each event takes two iovecs: its length prefix and the event itself
+#define MAX_SEND_IOVECS 512
+
 struct DeviceEntry {
     struct DeviceEntry *next;
-    pthread_t thread;
     int fd;
+    int synthetic;
+    int failed;
     char devName[128];
+
+    // Events read but not sent yet. The first readyCount of them make up
+    // complete frames.
+    struct input_event events[MAX_PENDING_EVENTS];
+    int eventCount;
+    int readyCount;
+
+    // Set after a SYN_DROPPED until the next SYN_REPORT
+    int dropping;
 };
 
 static struct DeviceEntry *DeviceListHead;
 static int grabbing = 1;
-static pthread_mutex_t DeviceListLock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t SocketSendLock = PTHREAD_MUTEX_INITIALIZER;
 static int sock;
+static int epollFd = -1;
+static int inotifyFd = -1;
+
+// Every event is preceded by its size on the socket
+static int eventSize = sizeof(struct input_event);
+
+// System calls made to read events and to send them
+static long long readCalls;
+static long long sendCalls;
 
 // This is a small executable that runs in a root shell. It reads input
 // devices and writes the evdev output packets to a socket. This allows
 // Moonlight to read input devices without having to muck with changing
 // device permissions or modifying SELinux policy (which is prevented in
 // Marshmallow anyway).
+//
+// A single thread waits on every device with epoll. Events are read in bulk
+// and held until their frame is completed by a SYN_REPORT, and then all
+// complete frames are sent with one writev(). New devices are picked up
+// through inotify on /dev/input.
 
 #define test_bit(bit, array)    (array[bit/8] & (1<<(bit%8)))
 
@@ -64,114 +98,223 @@ static int hasKey(int fd, short key) {
     return test_bit(key, keyBitmask);
 }
 
-static void outputEvdevData(char *data, int dataSize) {
-    char packetBuffer[EVDEV_MAX_EVENT_SIZE + sizeof(dataSize)];
+// Writes all of the iovecs, continuing after short writes
+static int writeAll(struct iovec *iov, int iovCount) {
+    ssize_t ret;
 
-    // Copy the full packet into our buffer
-    memcpy(packetBuffer, &dataSize, sizeof(dataSize));
-    memcpy(&packetBuffer[sizeof(dataSize)], data, dataSize);
+    while (iovCount > 0) {
+        ret = writev(sock, iov, iovCount);
+        sendCalls++;
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
 
-    // Lock to prevent other threads from sending at the same time
-    pthread_mutex_lock(&SocketSendLock);
-    send(sock, packetBuffer, dataSize + sizeof(dataSize), 0);
-    pthread_mutex_unlock(&SocketSendLock);
+            __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "writev() failed: %d", errno);
+            return -1;
+        }
+
+        // Skip past what was written
+        while (iovCount > 0 && (size_t)ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovCount--;
+        }
+        if (iovCount > 0) {
+            iov->iov_base = (char*)iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+
+    return 0;
 }
 
-void* pollThreadFunc(void* context) {
-    struct DeviceEntry *device = context;
-    struct pollfd pollinfo;
-    int pollres, ret;
-    char data[EVDEV_MAX_EVENT_SIZE];
+// Sends the complete frames of every device to our client
+static int outputReadyFrames(void) {
+    struct iovec iov[MAX_SEND_IOVECS];
+    struct DeviceEntry *device;
+    int iovCount = 0;
+    int i;
 
-    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "Polling /dev/input/%s", device->devName);
+    for (device = DeviceListHead; device != NULL; device = device->next) {
+        if (!grabbing) {
+            // Events are discarded while input isn't captured
+            continue;
+        }
 
-    if (grabbing) {
-        // Exclusively grab the input device (required to make the Android cursor disappear)
-        if (ioctl(device->fd, EVIOCGRAB, 1) < 0) {
-            __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
-                                "EVIOCGRAB failed for %s: %d", device->devName, errno);
-            goto cleanup;
+        for (i = 0; i < device->readyCount; i++) {
+            if (iovCount == MAX_SEND_IOVECS) {
+                if (writeAll(iov, iovCount) < 0) {
+                    return -1;
+                }
+                iovCount = 0;
+            }
+
+            iov[iovCount].iov_base = &eventSize;
+            iov[iovCount].iov_len = sizeof(eventSize);
+            iov[iovCount + 1].iov_base = &device->events[i];
+            iov[iovCount + 1].iov_len = sizeof(device->events[i]);
+            iovCount += 2;
         }
     }
 
-    for (;;) {
-        do {
-            // Unwait every 250 ms to return to caller if the fd is closed
-            pollinfo.fd = device->fd;
-            pollinfo.events = POLLIN;
-            pollinfo.revents = 0;
-            pollres = poll(&pollinfo, 1, 250);
+    if (iovCount > 0 && writeAll(iov, iovCount) < 0) {
+        return -1;
+    }
+
+    // Keep the start of any incomplete frame
+    for (device = DeviceListHead; device != NULL; device = device->next) {
+        if (device->readyCount > 0) {
+            memmove(device->events, &device->events[device->readyCount],
+                    (device->eventCount - device->readyCount) * sizeof(device->events[0]));
+            device->eventCount -= device->readyCount;
+            device->readyCount = 0;
         }
-        while (pollres == 0);
-
-        if (pollres > 0 && (pollinfo.revents & POLLIN)) {
-            // We'll have data available now
-            ret = read(device->fd, data, EVDEV_MAX_EVENT_SIZE);
-            if (ret < 0) {
-                __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
-                                    "read() failed: %d", errno);
-                goto cleanup;
-            }
-            else if (ret == 0) {
-                __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
-                                    "read() graceful EOF");
-                goto cleanup;
-            }
-            else if (grabbing) {
-                // Write out the data to our client
-                outputEvdevData(data, ret);
+    }
+
+    return 0;
+}
+
+// Reads the events waiting on a device. Returns -1 if the device is gone.
+static int readDeviceEvents(struct DeviceEntry *device) {
+    struct input_event *event;
+    ssize_t ret;
+    int writeIndex;
+    int endIndex;
+    int i;
+
+    ret = read(device->fd, &device->events[device->eventCount],
+               (MAX_PENDING_EVENTS - device->eventCount) * sizeof(device->events[0]));
+    readCalls++;
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return 0;
+        }
+
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
+                            "read() failed: %d", errno);
+        return -1;
+    }
+    else if (ret == 0) {
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
+                            "read() graceful EOF");
+        return -1;
+    }
+
+    // Evdev devices only return whole events
+    endIndex = device->eventCount + ret / sizeof(device->events[0]);
+    writeIndex = device->eventCount;
+    for (i = device->eventCount; i < endIndex; i++) {
+        event = &device->events[i];
+
+        if (event->type == EV_SYN && event->code == SYN_DROPPED) {
+            // The kernel's buffer overflowed. The frame in progress and
+            // everything up to the next SYN_REPORT are incomplete.
+            writeIndex = device->readyCount;
+            device->dropping = 1;
+        }
+        else if (device->dropping) {
+            if (event->type == EV_SYN && event->code == SYN_REPORT) {
+                device->dropping = 0;
             }
         }
         else {
-            if (pollres < 0) {
-                __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
-                                    "poll() failed: %d", errno);
-            }
-            else {
-                __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
-                                    "Unexpected revents: %d", pollinfo.revents);
+            device->events[writeIndex++] = *event;
+            if (event->type == EV_SYN && event->code == SYN_REPORT) {
+                device->readyCount = writeIndex;
             }
-
-            // Terminate this thread
-            goto cleanup;
         }
     }
+    device->eventCount = writeIndex;
 
-cleanup:
-    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "Closing /dev/input/%s", device->devName);
+    if (device->readyCount == 0 && device->eventCount == MAX_PENDING_EVENTS) {
+        // This frame will never fit, so send what we have
+        device->readyCount = device->eventCount;
+    }
 
-    // Remove the context from the linked list
-    {
-        struct DeviceEntry *lastEntry;
+    return 0;
+}
 
-        // Lock the device list
-        pthread_mutex_lock(&DeviceListLock);
+static void removeDevice(struct DeviceEntry *device) {
+    struct DeviceEntry *lastEntry;
 
-        if (DeviceListHead == device) {
-            DeviceListHead = device->next;
-        }
-        else {
-            lastEntry = DeviceListHead;
-            while (lastEntry->next != NULL) {
-                if (lastEntry->next == device) {
-                    lastEntry->next = device->next;
-                    break;
-                }
+    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "Closing /dev/input/%s", device->devName);
 
-                lastEntry = lastEntry->next;
+    // Remove the context from the linked list
+    if (DeviceListHead == device) {
+        DeviceListHead = device->next;
+    }
+    else {
+        lastEntry = DeviceListHead;
+        while (lastEntry->next != NULL) {
+            if (lastEntry->next == device) {
+                lastEntry->next = device->next;
+                break;
             }
-        }
 
-        // Unlock device list
-        pthread_mutex_unlock(&DeviceListLock);
+            lastEntry = lastEntry->next;
+        }
     }
 
     // Free the context
-    ioctl(device->fd, EVIOCGRAB, 0);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, device->fd, NULL);
+    if (!device->synthetic) {
+        ioctl(device->fd, EVIOCGRAB, 0);
+    }
     close(device->fd);
     free(device);
+}
 
-    return NULL;
+// Starts polling an open device. Synthetic devices stand in for real
+// ones and aren't grabbed.
+static int addDevice(int fd, const char* deviceName, int synthetic) {
+    struct DeviceEntry *currentEntry;
+    struct epoll_event event;
+
+    // Allocate a context
+    currentEntry = calloc(1, sizeof(*currentEntry));
+    if (currentEntry == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    // Populate context
+    currentEntry->fd = fd;
+    currentEntry->synthetic = synthetic;
+    strncpy(currentEntry->devName, deviceName, sizeof(currentEntry->devName) - 1);
+
+    if (grabbing && !synthetic) {
+        // Exclusively grab the input device (required to make the Android cursor disappear)
+        if (ioctl(fd, EVIOCGRAB, 1) < 0) {
+            __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
+                                "EVIOCGRAB failed for %s: %d", deviceName, errno);
+            free(currentEntry);
+            close(fd);
+            return -1;
+        }
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = currentEntry;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
+                            "epoll_ctl() failed for %s: %d", deviceName, errno);
+        if (grabbing && !synthetic) {
+            ioctl(fd, EVIOCGRAB, 0);
+        }
+        free(currentEntry);
+        close(fd);
+        return -1;
+    }
+
+    // Queue this onto the device list
+    currentEntry->next = DeviceListHead;
+    DeviceListHead = currentEntry;
+
+    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "Polling /dev/input/%s", deviceName);
+
+    return 0;
 }
 
 static int precheckDeviceForPolling(int fd) {
@@ -198,61 +341,33 @@ static void startPollForDevice(char* deviceName) {
     char fullPath[256];
     int fd;
 
-    // Lock the device list
-    pthread_mutex_lock(&DeviceListLock);
-
     // Check if the device is already being polled
     currentEntry = DeviceListHead;
     while (currentEntry != NULL) {
         if (strcmp(currentEntry->devName, deviceName) == 0) {
             // Already polling this device
-            goto unlock;
+            return;
         }
 
         currentEntry = currentEntry->next;
     }
 
-    // Open the device
-    sprintf(fullPath, "/dev/input/%s", deviceName);
-    fd = open(fullPath, O_RDWR);
+    // Open the device. Reads must not block the other devices.
+    snprintf(fullPath, sizeof(fullPath), "/dev/input/%s", deviceName);
+    fd = open(fullPath, O_RDWR | O_NONBLOCK);
     if (fd < 0) {
         __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "Couldn't open %s: %d", fullPath, errno);
-        goto unlock;
+        return;
     }
 
-    // Allocate a context
-    currentEntry = malloc(sizeof(*currentEntry));
-    if (currentEntry == NULL) {
-        close(fd);
-        goto unlock;
-    }
-
-    // Populate context
-    currentEntry->fd = fd;
-    strcpy(currentEntry->devName, deviceName);
-
     // Check if we support polling this device
     if (!precheckDeviceForPolling(fd)) {
         // Nope, get out
-        free(currentEntry);
         close(fd);
-        goto unlock;
+        return;
     }
 
-    // Start the polling thread
-    if (pthread_create(&currentEntry->thread, NULL, pollThreadFunc, currentEntry) != 0) {
-        free(currentEntry);
-        close(fd);
-        goto unlock;
-    }
-
-    // Queue this onto the device list
-    currentEntry->next = DeviceListHead;
-    DeviceListHead = currentEntry;
-
-unlock:
-    // Unlock and return
-    pthread_mutex_unlock(&DeviceListLock);
+    addDevice(fd, deviceName, 0);
 }
 
 static int enumerateDevices(void) {
@@ -284,6 +399,57 @@ static int enumerateDevices(void) {
     return 0;
 }
 
+// Watches /dev/input for new devices. Returns -1 if inotify is unavailable.
+static int startHotplugWatch(void) {
+    struct epoll_event event;
+
+    inotifyFd = inotify_init();
+    if (inotifyFd < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "inotify_init() failed: %d", errno);
+        return -1;
+    }
+
+    fcntl(inotifyFd, F_SETFL, fcntl(inotifyFd, F_GETFL) | O_NONBLOCK);
+
+    // Device nodes may not be usable until their permissions are set
+    if (inotify_add_watch(inotifyFd, "/dev/input", IN_CREATE | IN_ATTRIB) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "inotify_add_watch() failed: %d", errno);
+        close(inotifyFd);
+        inotifyFd = -1;
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &inotifyFd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, inotifyFd, &event) < 0) {
+        close(inotifyFd);
+        inotifyFd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void handleHotplugEvents(void) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct inotify_event *event;
+    ssize_t ret;
+    char *ptr;
+
+    ret = read(inotifyFd, buffer, sizeof(buffer));
+    if (ret <= 0) {
+        return;
+    }
+
+    for (ptr = buffer; ptr < buffer + ret; ptr += sizeof(struct inotify_event) + event->len) {
+        event = (struct inotify_event*)ptr;
+        if (event->len > 0 && strstr(event->name, "event") != NULL) {
+            startPollForDevice(event->name);
+        }
+    }
+}
+
 static int connectSocket(int port) {
     struct sockaddr_in saddr;
     int ret;
@@ -320,93 +486,320 @@ static int connectSocket(int port) {
 #define UNGRAB_REQ 1
 #define REGRAB_REQ 2
 
-int main(int argc, char* argv[]) {
+// Handles a request from the client. Returns non-zero if we should exit
+// with the code stored in exitCode.
+static int handleClientRequest(int *exitCode) {
+    struct DeviceEntry *currentEntry;
+    unsigned char requestId;
     int ret;
-    int pollres;
-    struct pollfd pollinfo;
-    int port;
 
-    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "Entered main()");
-
-    port = atoi(argv[1]);
-    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "Requested port number: %d", port);
+    ret = recv(sock, &requestId, sizeof(requestId), 0);
+    if (ret < (int)sizeof(requestId)) {
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "Short read on socket");
+        *exitCode = errno;
+        return 1;
+    }
 
-    // Connect to the app's socket
-    ret = connectSocket(port);
-    if (ret < 0) {
-        return ret;
+    if (requestId != UNGRAB_REQ && requestId != REGRAB_REQ) {
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "Unknown request");
+        *exitCode = requestId;
+        return 1;
     }
 
-    // Perform initial enumeration
-    ret = enumerateDevices();
-    if (ret < 0) {
-        return ret;
+    // Update state for future devices
+    grabbing = (requestId == REGRAB_REQ);
+
+    // Carry out the requested action on each device
+    currentEntry = DeviceListHead;
+    while (currentEntry != NULL) {
+        if (!currentEntry->synthetic) {
+            ioctl(currentEntry->fd, EVIOCGRAB, grabbing);
+        }
+        currentEntry = currentEntry->next;
     }
 
-    // Wait for requests from the client
+    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "New grab status is: %s",
+        grabbing ? "enabled" : "disabled");
+
+    return 0;
+}
+
+// Runs until the client disconnects, or until the last device is removed
+// if exitWithoutDevices is set
+static int runEventLoop(int exitWithoutDevices) {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    struct DeviceEntry *device, *nextDevice;
+    int eventCount;
+    int exitCode;
+    int i;
+
     for (;;) {
-        unsigned char requestId;
-
-        do {
-            // Every second we poll again for new devices if
-            // we haven't received any new events
-            pollinfo.fd = sock;
-            pollinfo.events = POLLIN;
-            pollinfo.revents = 0;
-            pollres = poll(&pollinfo, 1, 1000);
-            if (pollres == 0) {
-                // Timeout, re-enumerate devices
-                enumerateDevices();
+        // Without inotify, we poll again for new devices every second
+        // if we haven't received any new events
+        eventCount = epoll_wait(epollFd, events, MAX_EPOLL_EVENTS, inotifyFd < 0 ? 1000 : -1);
+        if (eventCount < 0) {
+            if (errno == EINTR) {
+                continue;
             }
+
+            __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "epoll_wait() failed: %d", errno);
+            return -1;
         }
-        while (pollres == 0);
-
-        if (pollres > 0 && (pollinfo.revents & POLLIN)) {
-            // We'll have data available now
-            ret = recv(sock, &requestId, sizeof(requestId), 0);
-            if (ret < sizeof(requestId)) {
-                __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "Short read on socket");
-                return errno;
+        else if (eventCount == 0) {
+            // Timeout, re-enumerate devices
+            enumerateDevices();
+            continue;
+        }
+
+        for (i = 0; i < eventCount; i++) {
+            if (events[i].data.ptr == &sock) {
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
+                                        "Socket poll unexpected revents: %d", events[i].events);
+                    return -1;
+                }
+
+                if (handleClientRequest(&exitCode)) {
+                    return exitCode;
+                }
+            }
+            else if (events[i].data.ptr == &inotifyFd) {
+                handleHotplugEvents();
             }
+            else {
+                device = events[i].data.ptr;
 
-            if (requestId != UNGRAB_REQ && requestId != REGRAB_REQ) {
-                __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "Unknown request");
-                return requestId;
+                // Devices are removed after their last frames are sent
+                if (events[i].events & EPOLLIN) {
+                    if (readDeviceEvents(device) < 0) {
+                        device->failed = 1;
+                    }
+                }
+                else {
+                    __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
+                                        "Unexpected revents: %d", events[i].events);
+                    device->failed = 1;
+                }
             }
+        }
 
-            {
-                struct DeviceEntry *currentEntry;
+        if (outputReadyFrames() < 0) {
+            return -1;
+        }
 
-                pthread_mutex_lock(&DeviceListLock);
+        for (device = DeviceListHead; device != NULL; device = nextDevice) {
+            nextDevice = device->next;
+            if (device->failed) {
+                removeDevice(device);
+            }
+        }
 
-                // Update state for future devices
-                grabbing = (requestId == REGRAB_REQ);
+        if (exitWithoutDevices && DeviceListHead == NULL) {
+            return 0;
+        }
+    }
+}
 
-                // Carry out the requested action on each device
-                currentEntry = DeviceListHead;
-                while (currentEntry != NULL) {
-                    ioctl(currentEntry->fd, EVIOCGRAB, grabbing);
-                    currentEntry = currentEntry->next;
-                }
+static int startEventLoop(void) {
+    struct epoll_event event;
 
-                pthread_mutex_unlock(&DeviceListLock);
+    epollFd = epoll_create(MAX_EPOLL_EVENTS);
+    if (epollFd < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "epoll_create() failed: %d", errno);
+        return -1;
+    }
 
-                __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "New grab status is: %s",
-                    grabbing ? "enabled" : "disabled");
-            }
+    // Wait for requests from the client
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = &sock;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, sock, &event) < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, "EvdevReader", "epoll_ctl() failed: %d", errno);
+        return -1;
+    }
+
+    return 0;
+}
+
+// The throughput benchmark feeds synthetic mouse frames through pipes that
+// stand in for input devices, so it needs neither root nor uinput. The
+// output goes to a socket pair that is drained like the app would.
+#define BENCHMARK_MAX_DEVICES 16
+
+struct BenchmarkDevice {
+    pthread_t thread;
+    int fd;
+    int frames;
+};
+
+static void* benchmarkWriterThreadFunc(void* context) {
+    struct BenchmarkDevice *device = context;
+    struct input_event frame[3];
+    int i;
+
+    // Relative motion as a high polling rate mouse would report it. Each
+    // frame is written at once, like the kernel does.
+    memset(frame, 0, sizeof(frame));
+    frame[0].type = EV_REL;
+    frame[0].code = REL_X;
+    frame[0].value = 1;
+    frame[1].type = EV_REL;
+    frame[1].code = REL_Y;
+    frame[1].value = -1;
+    frame[2].type = EV_SYN;
+    frame[2].code = SYN_REPORT;
+
+    for (i = 0; i < device->frames; i++) {
+        if (write(device->fd, frame, sizeof(frame)) != sizeof(frame)) {
+            break;
         }
-        else {
-            // Terminate this thread
-            if (pollres < 0) {
-                __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
-                                    "Socket recv poll() failed: %d", errno);
-            }
-            else {
-                __android_log_print(ANDROID_LOG_ERROR, "EvdevReader",
-                                    "Socket poll unexpected revents: %d", pollinfo.revents);
-            }
+    }
+
+    close(device->fd);
+    return NULL;
+}
+
+static void* benchmarkReaderThreadFunc(void* context) {
+    int fd = *(int*)context;
+    static long long bytesRead;
+    char buffer[65536];
+    ssize_t ret;
+
+    while ((ret = read(fd, buffer, sizeof(buffer))) > 0) {
+        bytesRead += ret;
+    }
+
+    return &bytesRead;
+}
+
+static uint64_t getClockMicros(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int runBenchmark(int deviceCount, int framesPerDevice) {
+    struct BenchmarkDevice devices[BENCHMARK_MAX_DEVICES];
+    pthread_t readerThread;
+    long long *bytesRead;
+    long long eventCount;
+    uint64_t startTime, startCpuTime, elapsedUs, cpuUs;
+    char deviceName[32];
+    int socketPair[2];
+    int pipeFds[2];
+    int ret;
+    int i;
+
+    if (deviceCount < 1 || deviceCount > BENCHMARK_MAX_DEVICES || framesPerDevice < 1) {
+        fprintf(stderr, "Usage: evdev_reader --benchmark [1-%d devices] [frames per device]\n",
+                BENCHMARK_MAX_DEVICES);
+        return -1;
+    }
 
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socketPair) < 0) {
+        return -1;
+    }
+    sock = socketPair[0];
+
+    ret = startEventLoop();
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (i = 0; i < deviceCount; i++) {
+        if (pipe(pipeFds) < 0) {
             return -1;
         }
+        fcntl(pipeFds[0], F_SETFL, fcntl(pipeFds[0], F_GETFL) | O_NONBLOCK);
+
+        snprintf(deviceName, sizeof(deviceName), "benchmark%d", i);
+        if (addDevice(pipeFds[0], deviceName, 1) < 0) {
+            return -1;
+        }
+
+        devices[i].fd = pipeFds[1];
+        devices[i].frames = framesPerDevice;
+    }
+
+    pthread_create(&readerThread, NULL, benchmarkReaderThreadFunc, &socketPair[1]);
+
+    startTime = getClockMicros(CLOCK_MONOTONIC);
+    startCpuTime = getClockMicros(CLOCK_THREAD_CPUTIME_ID);
+
+    for (i = 0; i < deviceCount; i++) {
+        pthread_create(&devices[i].thread, NULL, benchmarkWriterThreadFunc, &devices[i]);
+    }
+
+    // Returns once every writer has finished and its pipe has been drained
+    ret = runEventLoop(1);
+
+    elapsedUs = getClockMicros(CLOCK_MONOTONIC) - startTime;
+    cpuUs = getClockMicros(CLOCK_THREAD_CPUTIME_ID) - startCpuTime;
+
+    for (i = 0; i < deviceCount; i++) {
+        pthread_join(devices[i].thread, NULL);
+    }
+
+    shutdown(sock, SHUT_WR);
+    pthread_join(readerThread, (void**)&bytesRead);
+    close(socketPair[0]);
+    close(socketPair[1]);
+    close(epollFd);
+
+    if (ret != 0) {
+        return ret;
+    }
+
+    eventCount = (long long)deviceCount * framesPerDevice * 3;
+    if (*bytesRead != eventCount * (long long)(sizeof(eventSize) + sizeof(struct input_event))) {
+        fprintf(stderr, "Expected %lld events but received %lld bytes\n", eventCount, *bytesRead);
+        return -1;
     }
-}
\ No newline at end of file
+
+    printf("%d devices, %lld events in %llu ms: %.0f events/s\n",
+           deviceCount, eventCount, (unsigned long long)(elapsedUs / 1000),
+           eventCount * 1000000.0 / (elapsedUs ? elapsedUs : 1));
+    printf("%lld reads and %lld writes (%.3f system calls per event), %.3f us of CPU per event\n",
+           readCalls, sendCalls, (double)(readCalls + sendCalls) / eventCount,
+           (double)cpuUs / eventCount);
+
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int ret;
+    int port;
+
+    if (argc >= 2 && strcmp(argv[1], "--benchmark") == 0) {
+        return runBenchmark(argc >= 3 ? atoi(argv[2]) : 1,
+                            argc >= 4 ? atoi(argv[3]) : 100000);
+    }
+
+    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "Entered main()");
+
+    port = atoi(argv[1]);
+    __android_log_print(ANDROID_LOG_INFO, "EvdevReader", "Requested port number: %d", port);
+
+    // Connect to the app's socket
+    ret = connectSocket(port);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = startEventLoop();
+    if (ret < 0) {
+        return ret;
+    }
+
+    // Fall back to enumerating devices every second without inotify
+    startHotplugWatch();
+
+    // Perform initial enumeration
+    ret = enumerateDevices();
+    if (ret < 0) {
+        return ret;
+    }
+
+    return runEventLoop(0);
+}
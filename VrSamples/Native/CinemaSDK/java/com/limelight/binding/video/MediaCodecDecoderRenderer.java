@@ -18,7 +18,10 @@ import android.media.MediaFormat;
 import android.media.MediaCodec.BufferInfo;
 import android.media.MediaCodec.CodecException;
 import android.os.Build;
+import android.os.Handler;
+import android.os.HandlerThread;
 import android.util.Range;
+import android.view.Choreographer;
 import android.view.SurfaceHolder;
 
 public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
@@ -35,11 +38,13 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
     private byte[] vpsBuffer;
     private byte[] spsBuffer;
     private byte[] ppsBuffer;
+    private byte[] parameterSetBuffer;
     private boolean submittedCsd;
     private boolean submitCsdNextCall;
 
     private MediaCodec videoDecoder;
     private Thread rendererThread;
+    private HandlerThread vsyncThread;
     private boolean needsSpsBitstreamFixup, isExynos4;
     private boolean adaptivePlayback, directSubmit;
     private boolean constrainedHighProfile;
@@ -491,9 +496,40 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
         return index;
     }
 
+    private final Choreographer.FrameCallback vsyncCallback = new Choreographer.FrameCallback() {
+        @Override
+        public void doFrame(long frameTimeNanos) {
+            if (stopping) {
+                return;
+            }
+
+            MoonBridge.reportDisplayVsync(frameTimeNanos);
+            Choreographer.getInstance().postFrameCallback(this);
+        }
+    };
+
+    // Choreographer callbacks run on the thread that requested them, so
+    // vsyncs are reported from a thread of their own
+    private void startVsyncThread() {
+        vsyncThread = new HandlerThread("Video - Vsync");
+        vsyncThread.start();
+
+        new Handler(vsyncThread.getLooper()).post(new Runnable() {
+            @Override
+            public void run() {
+                Choreographer.getInstance().postFrameCallback(vsyncCallback);
+            }
+        });
+    }
+
     @Override
     public void start() {
         startRendererThread();
+
+        // The common library paces frames for us unless we submit directly
+        if (!directSubmit) {
+            startVsyncThread();
+        }
     }
 
     // !!! May be called even if setup()/start() fails !!!
@@ -516,6 +552,14 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
         try {
             rendererThread.join();
         } catch (InterruptedException ignored) { }
+
+        if (vsyncThread != null) {
+            vsyncThread.quit();
+            try {
+                vsyncThread.join();
+            } catch (InterruptedException ignored) { }
+            vsyncThread = null;
+        }
     }
 
     @Override
@@ -575,15 +619,8 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
         }
     }
 
-    @SuppressWarnings("deprecation")
-    @Override
-    public int submitDecodeUnit(byte[] decodeUnitData, int decodeUnitLength, int decodeUnitType,
-                                int frameNumber, long receiveTimeMs) {
-        if (stopping) {
-            // Don't bother if we're stopping
-            return MoonBridge.DR_OK;
-        }
-
+    // Updates the frame statistics for a decode unit and returns its presentation timestamp
+    private long startDecodeUnit(int frameNumber, long receiveTimeMs) {
         totalFramesReceived++;
 
         // We can receive the same "frame" multiple times if it's an IDR frame.
@@ -595,9 +632,6 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
 
         lastFrameNumber = frameNumber;
 
-        int inputBufferIndex;
-        ByteBuffer buf;
-
         long timestampUs = System.nanoTime() / 1000;
 
         if (!FRAME_RENDER_TIME_ONLY) {
@@ -613,7 +647,18 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
 
         lastTimestampUs = timestampUs;
 
-        int codecFlags = 0;
+        return timestampUs;
+    }
+
+    @Override
+    public int submitDecodeUnit(byte[] decodeUnitData, int decodeUnitLength, int decodeUnitType,
+                                int frameNumber, long receiveTimeMs) {
+        if (stopping) {
+            // Don't bother if we're stopping
+            return MoonBridge.DR_OK;
+        }
+
+        long timestampUs = startDecodeUnit(frameNumber, receiveTimeMs);
 
         // H264 SPS
         if (decodeUnitData[4] == 0x67) {
@@ -744,7 +789,65 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
             System.arraycopy(decodeUnitData, 0, spsBuffer, 0, decodeUnitLength);
             return MoonBridge.DR_OK;
         }
-        else if (decodeUnitType == MoonBridge.BUFFER_TYPE_PPS) {
+
+        return queueDecodeUnit(ByteBuffer.wrap(decodeUnitData, 0, decodeUnitLength), -1, decodeUnitLength,
+                decodeUnitType, timestampUs);
+    }
+
+    // This is called once per decode unit. Parameter sets are copied out and take the array
+    // path above, since they may be patched and are batched until the PPS arrives. The
+    // picture data is gathered from the native receive buffers straight into the codec's
+    // input buffer.
+    @Override
+    public int submitDecodeUnit(int[] nalInfo, int nalCount, int frameNumber, int flags, long receiveTimeUs) {
+        boolean skipParameterSets = (flags & MoonBridge.DU_FLAG_PARAMETER_SETS_UNCHANGED) != 0 &&
+                canSkipUnchangedParameterSets();
+
+        for (int i = 0; i < nalCount; i++) {
+            int type = nalInfo[i * MoonBridge.NAL_INFO_FIELDS + MoonBridge.NAL_INFO_BUFFER_TYPE];
+            int length = nalInfo[i * MoonBridge.NAL_INFO_FIELDS + MoonBridge.NAL_INFO_LENGTH];
+            int ret;
+
+            if (type != MoonBridge.BUFFER_TYPE_PICDATA) {
+                if (skipParameterSets) {
+                    continue;
+                }
+
+                if (parameterSetBuffer == null || parameterSetBuffer.length < length) {
+                    parameterSetBuffer = new byte[Math.max(length, 128)];
+                }
+                MoonBridge.getDecodeUnitData(parameterSetBuffer, i);
+
+                ret = submitDecodeUnit(parameterSetBuffer, length, type, frameNumber, receiveTimeUs / 1000);
+            }
+            else if (stopping) {
+                // Don't bother if we're stopping
+                ret = MoonBridge.DR_OK;
+            }
+            else {
+                ret = queueDecodeUnit(null, i, length, type,
+                        startDecodeUnit(frameNumber, receiveTimeUs / 1000));
+            }
+
+            if (ret != MoonBridge.DR_OK) {
+                return ret;
+            }
+        }
+
+        return MoonBridge.DR_OK;
+    }
+
+    // Queues a PPS or picture data along with any batched parameter sets. The data is read
+    // from decodeUnitData's position to its limit or, if decodeUnitData is null, NAL nal of
+    // the decode unit being submitted is gathered from native memory.
+    @SuppressWarnings("deprecation")
+    private int queueDecodeUnit(ByteBuffer decodeUnitData, int nal, int decodeUnitLength,
+                                int decodeUnitType, long timestampUs) {
+        int inputBufferIndex;
+        ByteBuffer buf;
+        int codecFlags = 0;
+
+        if (decodeUnitType == MoonBridge.BUFFER_TYPE_PPS) {
             numPpsIn++;
 
             // If this is the first CSD blob or we aren't supporting
@@ -778,7 +881,7 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
             else {
                 // Batch this to submit together with the next I-frame
                 ppsBuffer = new byte[decodeUnitLength];
-                System.arraycopy(decodeUnitData, 0, ppsBuffer, 0, decodeUnitLength);
+                decodeUnitData.get(ppsBuffer);
 
                 // Next call will be I-frame data
                 submitCsdNextCall = true;
@@ -824,8 +927,19 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
             throw new RendererException(this, exception);
         }
 
-        // Copy data from our buffer list into the input buffer
-        buf.put(decodeUnitData, 0, decodeUnitLength);
+        // Copy the decode unit into the input buffer
+        if (decodeUnitData != null) {
+            buf.put(decodeUnitData);
+        }
+        else if (MoonBridge.copyDecodeUnitData(buf, buf.position(), nal) == decodeUnitLength) {
+            buf.position(buf.position() + decodeUnitLength);
+        }
+        else {
+            // Codec input buffers are direct, but copy through an array if one isn't
+            byte[] pictureData = new byte[decodeUnitLength];
+            MoonBridge.getDecodeUnitData(pictureData, nal);
+            buf.put(pictureData);
+        }
 
         if (!queueInputBuffer(inputBufferIndex,
                 0, buf.position(),
@@ -885,6 +999,13 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
                 MediaCodec.BUFFER_FLAG_CODEC_CONFIG);
     }
 
+    @Override
+    protected boolean canSkipUnchangedParameterSets() {
+        // The codec keeps its configuration until it is torn down, and
+        // unchanged parameter sets would only be submitted to it again
+        return submittedCsd;
+    }
+
     @Override
     public int getCapabilities() {
         int capabilities = 0;
@@ -900,10 +1021,14 @@ public class MediaCodecDecoderRenderer extends VideoDecoderRenderer {
             capabilities |= MoonBridge.CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC;
         }
 
-        // Enable direct submit on supported hardware
+        // Enable direct submit on supported hardware. Otherwise frames are
+        // paced to the vsyncs we report.
         if (directSubmit) {
             capabilities |= MoonBridge.CAPABILITY_DIRECT_SUBMIT;
         }
+        else {
+            capabilities |= MoonBridge.CAPABILITY_FRAME_PACING;
+        }
 
         return capabilities;
     }
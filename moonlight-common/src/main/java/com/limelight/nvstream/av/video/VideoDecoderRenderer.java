@@ -1,6 +1,10 @@
 package com.limelight.nvstream.av.video;
 
+import com.limelight.nvstream.jni.MoonBridge;
+
 public abstract class VideoDecoderRenderer {
+	private byte[] legacyDecodeUnitBuffer;
+
 	public abstract int setup(int format, int width, int height, int redrawRate);
 
 	public abstract void start();
@@ -11,7 +15,48 @@ public abstract class VideoDecoderRenderer {
 	// for an IDR frame which contains several parameter sets and the I-frame data.
 	public abstract int submitDecodeUnit(byte[] decodeUnitData, int decodeUnitLength, int decodeUnitType,
 										 int frameNumber, long receiveTimeMs);
+
+	// This is called once per decode unit. nalInfo describes each parameter set and then the
+	// picture data as laid out in MoonBridge and is only valid during the call. The NALs stay
+	// in the native receive buffers, and MoonBridge.copyDecodeUnitData() or
+	// MoonBridge.getDecodeUnitData() copies them out during the call. flags holds
+	// MoonBridge.DU_FLAG_XXX values and receiveTimeUs is on the same clock as
+	// System.nanoTime() / 1000. The default implementation copies each NAL into an array
+	// and passes it to the array version above.
+	public int submitDecodeUnit(int[] nalInfo, int nalCount, int frameNumber, int flags, long receiveTimeUs) {
+		boolean skipParameterSets = (flags & MoonBridge.DU_FLAG_PARAMETER_SETS_UNCHANGED) != 0 &&
+				canSkipUnchangedParameterSets();
+
+		for (int i = 0; i < nalCount; i++) {
+			int type = nalInfo[i * MoonBridge.NAL_INFO_FIELDS + MoonBridge.NAL_INFO_BUFFER_TYPE];
+			if (skipParameterSets && type != MoonBridge.BUFFER_TYPE_PICDATA) {
+				continue;
+			}
+
+			int length = nalInfo[i * MoonBridge.NAL_INFO_FIELDS + MoonBridge.NAL_INFO_LENGTH];
+
+			if (legacyDecodeUnitBuffer == null || legacyDecodeUnitBuffer.length < length) {
+				legacyDecodeUnitBuffer = new byte[Math.max(length, 32768)];
+			}
+
+			MoonBridge.getDecodeUnitData(legacyDecodeUnitBuffer, i);
+
+			int ret = submitDecodeUnit(legacyDecodeUnitBuffer, length, type, frameNumber, receiveTimeUs / 1000);
+			if (ret != MoonBridge.DR_OK) {
+				return ret;
+			}
+		}
+
+		return MoonBridge.DR_OK;
+	}
 	
+	// Renderers that return true aren't passed parameter sets by the array version of
+	// submitDecodeUnit() when they are identical to the ones it was last given. This
+	// should only return true while the decoder holds its current configuration.
+	protected boolean canSkipUnchangedParameterSets() {
+		return false;
+	}
+
 	public abstract void cleanup();
 
 	public abstract int getCapabilities();
@@ -4,6 +4,8 @@ import com.limelight.nvstream.NvConnectionListener;
 import com.limelight.nvstream.av.audio.AudioRenderer;
 import com.limelight.nvstream.av.video.VideoDecoderRenderer;
 
+import java.nio.ByteBuffer;
+
 public class MoonBridge {
     /* See documentation in Limelight.h for information about these functions and constants */
 
@@ -25,10 +27,55 @@ public class MoonBridge {
     public static final int CAPABILITY_DIRECT_SUBMIT = 1;
     public static final int CAPABILITY_REFERENCE_FRAME_INVALIDATION_AVC = 2;
     public static final int CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC = 4;
+    // Renderers that set this must call reportDisplayVsync() on each vsync
+    public static final int CAPABILITY_FRAME_PACING = 0x40;
 
     public static final int DR_OK = 0;
     public static final int DR_NEED_IDR = -1;
 
+    public static final int DU_FLAG_END_OF_FRAME = 0x1;
+    public static final int DU_FLAG_PARAMETER_SETS_UNCHANGED = 0x2;
+    public static final int DU_FLAG_PARAMETER_SETS_CHANGED = 0x4;
+
+    // Layout of the NAL info array passed with each decode unit. Each NAL
+    // occupies NAL_INFO_FIELDS entries starting at nal * NAL_INFO_FIELDS.
+    public static final int NAL_INFO_BUFFER_TYPE = 0;
+    public static final int NAL_INFO_LENGTH = 1;
+    public static final int NAL_INFO_FIELDS = 2;
+
+    // Layout of the array filled by getPipelineStats(). Each stage occupies
+    // PIPELINE_STATS_PER_STAGE entries starting at stage * PIPELINE_STATS_PER_STAGE.
+    public static final int PIPELINE_STAGE_RECEIVE = 0;
+    public static final int PIPELINE_STAGE_FEC_RECOVERY = 1;
+    public static final int PIPELINE_STAGE_REASSEMBLY = 2;
+    public static final int PIPELINE_STAGE_DECODE_UNIT_QUEUE = 3;
+    public static final int PIPELINE_STAGE_SUBMIT = 4;
+    public static final int PIPELINE_STAGE_TOTAL = 5;
+    public static final int PIPELINE_STAGE_COUNT = 6;
+
+    public static final int PIPELINE_STAT_SAMPLES = 0;
+    public static final int PIPELINE_STAT_P50_US = 1;
+    public static final int PIPELINE_STAT_P95_US = 2;
+    public static final int PIPELINE_STAT_P99_US = 3;
+    public static final int PIPELINE_STAT_MAX_US = 4;
+    public static final int PIPELINE_STATS_PER_STAGE = 5;
+
+    // Where decoded audio is played. The Java sink passes each decoded packet
+    // to the AudioRenderer. The native sink plays audio with OpenSL ES without
+    // calling into Java, and the AudioRenderer is not used.
+    public static final int AUDIO_SINK_JAVA = 0;
+    public static final int AUDIO_SINK_NATIVE = 1;
+
+    // Layout of the array filled by getAudioSinkStats(). Levels are in frames
+    // and the rest are counts since the stream started.
+    public static final int AUDIO_SINK_STAT_FILL_FRAMES = 0;
+    public static final int AUDIO_SINK_STAT_TARGET_FRAMES = 1;
+    public static final int AUDIO_SINK_STAT_UNDERRUNS = 2;
+    public static final int AUDIO_SINK_STAT_OVERFLOWS = 3;
+    public static final int AUDIO_SINK_STAT_FRAMES_DROPPED = 4;
+    public static final int AUDIO_SINK_STAT_FRAMES_INSERTED = 5;
+    public static final int AUDIO_SINK_STATS_FIELDS = 6;
+
     private static AudioRenderer audioRenderer;
     private static VideoDecoderRenderer videoRenderer;
     private static NvConnectionListener connectionListener;
@@ -69,12 +116,10 @@ public class MoonBridge {
         }
     }
 
-    public static int bridgeDrSubmitDecodeUnit(byte[] decodeUnitData, int decodeUnitLength,
-                                               int decodeUnitType,
-                                               int frameNumber, long receiveTimeMs) {
+    public static int bridgeDrSubmitDecodeUnit(int[] nalInfo, int nalCount,
+                                               int frameNumber, int flags, long receiveTimeUs) {
         if (videoRenderer != null) {
-            return videoRenderer.submitDecodeUnit(decodeUnitData, decodeUnitLength,
-                    decodeUnitType, frameNumber, receiveTimeMs);
+            return videoRenderer.submitDecodeUnit(nalInfo, nalCount, frameNumber, flags, receiveTimeUs);
         }
         else {
             return DR_OK;
@@ -205,5 +250,28 @@ public class MoonBridge {
 
     public static native String findExternalAddressIP4(String stunHostName, int stunPort);
 
+    // stats must have room for PIPELINE_STAGE_COUNT * PIPELINE_STATS_PER_STAGE entries
+    public static native void getPipelineStats(int[] stats);
+
+    public static native void resetPipelineStats();
+
+    // Tells the frame pacer when the display last refreshed. vsyncTimeNanos is
+    // on the System.nanoTime() clock, like Choreographer frame times.
+    public static native void reportDisplayVsync(long vsyncTimeNanos);
+
+    // Selects AUDIO_SINK_JAVA or AUDIO_SINK_NATIVE for the next connection
+    public static native void setAudioSink(int audioSink);
+
+    // stats must have room for AUDIO_SINK_STATS_FIELDS entries. They are
+    // all zero unless the native sink is in use.
+    public static native void getAudioSinkStats(int[] stats);
+
+    // These copy a NAL of the decode unit being passed to VideoDecoderRenderer.submitDecodeUnit()
+    // and may only be called from within that call. copyDecodeUnitData() writes into a direct
+    // buffer at the given position and leaves the buffer's position alone. Both return the
+    // length of the NAL or -1 if it doesn't fit.
+    public static native int copyDecodeUnitData(ByteBuffer buffer, int position, int nal);
+    public static native int getDecodeUnitData(byte[] data, int nal);
+
     public static native void init();
 }
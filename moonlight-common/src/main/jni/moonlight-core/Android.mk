@@ -8,20 +8,31 @@ LOCAL_PATH := $(MY_LOCAL_PATH)
 include $(CLEAR_VARS)
 LOCAL_MODULE    := moonlight-core
 
-LOCAL_SRC_FILES := moonlight-common-c/src/AudioStream.c \
+LOCAL_SRC_FILES := moonlight-common-c/src/AnnexB.c \
+                   moonlight-common-c/src/AudioJitterBuffer.c \
+                   moonlight-common-c/src/AudioStream.c \
                    moonlight-common-c/src/ByteBuffer.c \
                    moonlight-common-c/src/Connection.c \
                    moonlight-common-c/src/ControlStream.c \
                    moonlight-common-c/src/FakeCallbacks.c \
+                   moonlight-common-c/src/FramePacer.c \
                    moonlight-common-c/src/InputStream.c \
+                   moonlight-common-c/src/JitterEstimator.c \
+                   moonlight-common-c/src/LatencyHistogram.c \
                    moonlight-common-c/src/LinkedBlockingQueue.c \
                    moonlight-common-c/src/Misc.c \
+                   moonlight-common-c/src/PacketPool.c \
+                   moonlight-common-c/src/ParameterSetCache.c \
+                   moonlight-common-c/src/PcmRing.c \
                    moonlight-common-c/src/Platform.c \
                    moonlight-common-c/src/PlatformSockets.c \
+                   moonlight-common-c/src/RingBlockingQueue.c \
+                   moonlight-common-c/src/RtpCapture.c \
                    moonlight-common-c/src/RtpFecQueue.c \
                    moonlight-common-c/src/RtpReorderQueue.c \
                    moonlight-common-c/src/RtspConnection.c \
                    moonlight-common-c/src/RtspParser.c \
+                   moonlight-common-c/src/SchedulingLatency.c \
                    moonlight-common-c/src/SdpGenerator.c \
                    moonlight-common-c/src/SimpleStun.c \
                    moonlight-common-c/src/VideoDepacketizer.c \
@@ -50,7 +61,7 @@ ifeq ($(NDK_DEBUG),1)
 LOCAL_CFLAGS += -DLC_DEBUG
 endif
 
-LOCAL_LDLIBS := -llog
+LOCAL_LDLIBS := -llog -lOpenSLES
 
 LOCAL_STATIC_LIBRARIES := libopus libssl libcrypto
 LOCAL_LDFLAGS += -Wl,--exclude-libs,ALL
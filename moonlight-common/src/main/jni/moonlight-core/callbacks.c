@@ -1,15 +1,44 @@
 #include <jni.h>
 
 #include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <Limelight.h>
 
 #include <opus_multistream.h>
 #include <android/log.h>
+#include <SLES/OpenSLES.h>
+#include <SLES/OpenSLES_Android.h>
+
+#include "PcmRing.h"
 
 #define PCM_FRAME_SIZE 240
 
+// Where decoded audio goes. This must match MoonBridge.
+#define AUDIO_SINK_JAVA 0
+#define AUDIO_SINK_NATIVE 1
+
+// The native sink pulls 10 ms periods from the PCM ring
+#define NATIVE_SINK_PERIOD_FRAMES 480
+#define NATIVE_SINK_BUFFER_COUNT 2
+#define NATIVE_SINK_RING_FRAMES 8192
+
+// Keep at least a period and a decoded packet buffered, and never more
+// than about 85 ms however bad the network gets
+#define NATIVE_SINK_MIN_TARGET_FRAMES (NATIVE_SINK_PERIOD_FRAMES + PCM_FRAME_SIZE)
+#define NATIVE_SINK_MAX_TARGET_FRAMES 4096
+
+// Entries in the array filled by getAudioSinkStats(). This must match
+// the layout described in MoonBridge.
+#define AUDIO_SINK_STATS_FIELDS 6
+
+// Entries per NAL in the array passed with each decode unit. This must
+// match the layout described in MoonBridge.
+#define NAL_INFO_FIELDS 2
+
 static OpusMSDecoder* Decoder;
 static OPUS_MULTISTREAM_CONFIGURATION OpusConfig;
 
@@ -34,9 +63,28 @@ static jmethodID BridgeClConnectionStartedMethod;
 static jmethodID BridgeClConnectionTerminatedMethod;
 static jmethodID BridgeClDisplayMessageMethod;
 static jmethodID BridgeClDisplayTransientMessageMethod;
-static jbyteArray DecodedFrameBuffer;
 static jbyteArray DecodedAudioBuffer;
 
+static int RequestedAudioSink = AUDIO_SINK_JAVA;
+static int ActiveAudioSink;
+static short* NativeDecodeBuffer;
+static PCM_RING NativeAudioRing;
+static short* NativeSinkBuffers[NATIVE_SINK_BUFFER_COUNT];
+static int NextNativeSinkBuffer;
+static SLObjectItf SlEngineObject;
+static SLObjectItf SlOutputMixObject;
+static SLObjectItf SlPlayerObject;
+static SLPlayItf SlPlay;
+static SLAndroidSimpleBufferQueueItf SlBufferQueue;
+
+// The decode unit being passed to Java and the NALs it was described as.
+// These are only used on the decoder thread.
+static PDECODE_UNIT SubmittingDecodeUnit;
+static int SubmittingNalCount;
+static jintArray DecodeUnitNalInfo;
+static jint* NalInfo;
+static int NalInfoCapacity;
+
 void DetachThread(void* context) {
     (*JVM)->DetachCurrentThread(JVM);
 }
@@ -81,7 +129,7 @@ Java_com_limelight_nvstream_jni_MoonBridge_init(JNIEnv *env, jclass clazz) {
     BridgeDrStartMethod = (*env)->GetStaticMethodID(env, clazz, "bridgeDrStart", "()V");
     BridgeDrStopMethod = (*env)->GetStaticMethodID(env, clazz, "bridgeDrStop", "()V");
     BridgeDrCleanupMethod = (*env)->GetStaticMethodID(env, clazz, "bridgeDrCleanup", "()V");
-    BridgeDrSubmitDecodeUnitMethod = (*env)->GetStaticMethodID(env, clazz, "bridgeDrSubmitDecodeUnit", "([BIIIJ)I");
+    BridgeDrSubmitDecodeUnitMethod = (*env)->GetStaticMethodID(env, clazz, "bridgeDrSubmitDecodeUnit", "([IIIIJ)I");
     BridgeArInitMethod = (*env)->GetStaticMethodID(env, clazz, "bridgeArInit", "(I)I");
     BridgeArStartMethod = (*env)->GetStaticMethodID(env, clazz, "bridgeArStart", "()V");
     BridgeArStopMethod = (*env)->GetStaticMethodID(env, clazz, "bridgeArStop", "()V");
@@ -112,9 +160,6 @@ int BridgeDrSetup(int videoFormat, int width, int height, int redrawRate, void*
         return err;
     }
 
-    // Use a 32K frame buffer that will increase if needed
-    DecodedFrameBuffer = (*env)->NewGlobalRef(env, (*env)->NewByteArray(env, 32768));
-
     return 0;
 }
 
@@ -141,63 +186,304 @@ void BridgeDrStop(void) {
 void BridgeDrCleanup(void) {
     JNIEnv* env = GetThreadEnv();
 
-    (*env)->DeleteGlobalRef(env, DecodedFrameBuffer);
+    if (!(*env)->ExceptionCheck(env)) {
+        (*env)->CallStaticVoidMethod(env, GlobalBridgeClass, BridgeDrCleanupMethod);
+    }
 
-    if ((*env)->ExceptionCheck(env)) {
-        return;
+    if (DecodeUnitNalInfo != NULL) {
+        (*env)->DeleteGlobalRef(env, DecodeUnitNalInfo);
+        DecodeUnitNalInfo = NULL;
+    }
+    free(NalInfo);
+    NalInfo = NULL;
+    NalInfoCapacity = 0;
+}
+
+// Makes sure the NAL info arrays can describe the given number of NALs
+static int ensureNalInfoCapacity(JNIEnv* env, int nalCount) {
+    jintArray nalInfoArray;
+    jint* nalInfo;
+
+    if (nalCount <= NalInfoCapacity) {
+        return 0;
+    }
+
+    nalInfo = realloc(NalInfo, nalCount * NAL_INFO_FIELDS * sizeof(*nalInfo));
+    if (nalInfo == NULL) {
+        return -1;
     }
+    NalInfo = nalInfo;
 
-    (*env)->CallStaticVoidMethod(env, GlobalBridgeClass, BridgeDrCleanupMethod);
+    nalInfoArray = (*env)->NewIntArray(env, nalCount * NAL_INFO_FIELDS);
+    if (nalInfoArray == NULL) {
+        return -1;
+    }
+
+    if (DecodeUnitNalInfo != NULL) {
+        (*env)->DeleteGlobalRef(env, DecodeUnitNalInfo);
+    }
+    DecodeUnitNalInfo = (*env)->NewGlobalRef(env, nalInfoArray);
+    (*env)->DeleteLocalRef(env, nalInfoArray);
+
+    NalInfoCapacity = nalCount;
+    return 0;
+}
+
+static void addNalInfo(int index, int bufferType, int length) {
+    NalInfo[index * NAL_INFO_FIELDS] = bufferType;
+    NalInfo[index * NAL_INFO_FIELDS + 1] = length;
+}
+
+// Copies a NAL of the decode unit being submitted into native memory or, if data is
+// NULL, into a Java array. Each parameter set is its own NAL, and the last NAL is all
+// of the picture data.
+static void gatherNal(JNIEnv* env, int nal, char* data, jbyteArray array) {
+    PLENTRY entry;
+    int parameterSet;
+    int offset;
+
+    parameterSet = 0;
+    offset = 0;
+    for (entry = SubmittingDecodeUnit->bufferList; entry != NULL; entry = entry->next) {
+        if (entry->bufferType != BUFFER_TYPE_PICDATA) {
+            if (parameterSet++ != nal) {
+                continue;
+            }
+        }
+        else if (nal != SubmittingNalCount - 1) {
+            continue;
+        }
+
+        if (data != NULL) {
+            memcpy(&data[offset], entry->data, entry->length);
+        }
+        else {
+            (*env)->SetByteArrayRegion(env, array, offset, entry->length, (jbyte*)entry->data);
+        }
+        offset += entry->length;
+    }
+}
+
+// Returns the length of a NAL of the decode unit being submitted or -1 if there is no such NAL
+static int getNalLength(int nal) {
+    if (SubmittingDecodeUnit == NULL || nal < 0 || nal >= SubmittingNalCount) {
+        return -1;
+    }
+
+    return NalInfo[nal * NAL_INFO_FIELDS + 1];
 }
 
 int BridgeDrSubmitDecodeUnit(PDECODE_UNIT decodeUnit) {
     JNIEnv* env = GetThreadEnv();
+    PLENTRY currentEntry;
+    int nalCount;
+    int pictureLength;
     int ret;
 
     if ((*env)->ExceptionCheck(env)) {
         return DR_OK;
     }
 
-    // Increase the size of our frame data buffer if our frame won't fit
-    if ((*env)->GetArrayLength(env, DecodedFrameBuffer) < decodeUnit->fullLength) {
-        (*env)->DeleteGlobalRef(env, DecodedFrameBuffer);
-        DecodedFrameBuffer = (*env)->NewGlobalRef(env, (*env)->NewByteArray(env, decodeUnit->fullLength));
+    // Each parameter set is passed as its own NAL followed by all of the
+    // picture data as one NAL
+    nalCount = 1;
+    for (currentEntry = decodeUnit->bufferList; currentEntry != NULL; currentEntry = currentEntry->next) {
+        if (currentEntry->bufferType != BUFFER_TYPE_PICDATA) {
+            nalCount++;
+        }
     }
 
-    PLENTRY currentEntry;
-    int offset;
+    if (ensureNalInfoCapacity(env, nalCount) < 0) {
+        return DR_NEED_IDR;
+    }
 
-    currentEntry = decodeUnit->bufferList;
-    offset = 0;
-    while (currentEntry != NULL) {
-        // Submit parameter set NALUs separately from picture data
+    nalCount = 0;
+    pictureLength = 0;
+    for (currentEntry = decodeUnit->bufferList; currentEntry != NULL; currentEntry = currentEntry->next) {
         if (currentEntry->bufferType != BUFFER_TYPE_PICDATA) {
-            // Use the beginning of the buffer each time since this is a separate
-            // invocation of the decoder each time.
-            (*env)->SetByteArrayRegion(env, DecodedFrameBuffer, 0, currentEntry->length, (jbyte*)currentEntry->data);
-
-            ret = (*env)->CallStaticIntMethod(env, GlobalBridgeClass, BridgeDrSubmitDecodeUnitMethod,
-                                              DecodedFrameBuffer, currentEntry->length, currentEntry->bufferType,
-                                              decodeUnit->frameNumber, decodeUnit->receiveTimeMs);
-            if ((*env)->ExceptionCheck(env)) {
-                return DR_OK;
-            }
-            else if (ret != DR_OK) {
-                return ret;
-            }
+            addNalInfo(nalCount++, currentEntry->bufferType, currentEntry->length);
         }
         else {
-            (*env)->SetByteArrayRegion(env, DecodedFrameBuffer, offset, currentEntry->length, (jbyte*)currentEntry->data);
-            offset += currentEntry->length;
+            pictureLength += currentEntry->length;
         }
+    }
+    addNalInfo(nalCount++, BUFFER_TYPE_PICDATA, pictureLength);
+
+    (*env)->SetIntArrayRegion(env, DecodeUnitNalInfo, 0, nalCount * NAL_INFO_FIELDS, NalInfo);
+
+    // Java copies each NAL out of the decode unit during the call, usually
+    // straight into the codec's input buffer
+    SubmittingDecodeUnit = decodeUnit;
+    SubmittingNalCount = nalCount;
+
+    ret = (*env)->CallStaticIntMethod(env, GlobalBridgeClass, BridgeDrSubmitDecodeUnitMethod,
+                                      DecodeUnitNalInfo, nalCount,
+                                      decodeUnit->frameNumber, decodeUnit->flags,
+                                      decodeUnit->receiveTimeUs);
+
+    SubmittingDecodeUnit = NULL;
+
+    if ((*env)->ExceptionCheck(env)) {
+        return DR_OK;
+    }
+
+    return ret;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_limelight_nvstream_jni_MoonBridge_copyDecodeUnitData(JNIEnv *env, jclass clazz, jobject buffer, jint position, jint nal) {
+    char* data = (*env)->GetDirectBufferAddress(env, buffer);
+    int length = getNalLength(nal);
+
+    if (data == NULL || length < 0 || position < 0 ||
+            position + length > (*env)->GetDirectBufferCapacity(env, buffer)) {
+        return -1;
+    }
 
-        currentEntry = currentEntry->next;
+    gatherNal(env, nal, &data[position], NULL);
+    return length;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_limelight_nvstream_jni_MoonBridge_getDecodeUnitData(JNIEnv *env, jclass clazz, jbyteArray data, jint nal) {
+    int length = getNalLength(nal);
+
+    if (length < 0 || length > (*env)->GetArrayLength(env, data)) {
+        return -1;
     }
 
-    return (*env)->CallStaticIntMethod(env, GlobalBridgeClass, BridgeDrSubmitDecodeUnitMethod,
-                                       DecodedFrameBuffer, offset, BUFFER_TYPE_PICDATA,
-                                       decodeUnit->frameNumber,
-                                       decodeUnit->receiveTimeMs);
+    gatherNal(env, nal, NULL, data);
+    return length;
+}
+
+// Called on an OpenSL ES thread each time the player finishes a buffer. The
+// ring always produces a full period, so the player never runs dry.
+static void nativeSinkBufferCallback(SLAndroidSimpleBufferQueueItf bufferQueue, void* context) {
+    short* buffer = NativeSinkBuffers[NextNativeSinkBuffer];
+
+    NextNativeSinkBuffer = (NextNativeSinkBuffer + 1) % NATIVE_SINK_BUFFER_COUNT;
+
+    PcmrReadFrames(&NativeAudioRing, buffer, NATIVE_SINK_PERIOD_FRAMES);
+    (*bufferQueue)->Enqueue(bufferQueue, buffer,
+                            NATIVE_SINK_PERIOD_FRAMES * NativeAudioRing.channelCount * sizeof(short));
+}
+
+static void destroyNativeSink(void) {
+    int i;
+
+    if (SlPlayerObject != NULL) {
+        (*SlPlayerObject)->Destroy(SlPlayerObject);
+        SlPlayerObject = NULL;
+        SlPlay = NULL;
+        SlBufferQueue = NULL;
+    }
+    if (SlOutputMixObject != NULL) {
+        (*SlOutputMixObject)->Destroy(SlOutputMixObject);
+        SlOutputMixObject = NULL;
+    }
+    if (SlEngineObject != NULL) {
+        (*SlEngineObject)->Destroy(SlEngineObject);
+        SlEngineObject = NULL;
+    }
+
+    for (i = 0; i < NATIVE_SINK_BUFFER_COUNT; i++) {
+        free(NativeSinkBuffers[i]);
+        NativeSinkBuffers[i] = NULL;
+    }
+
+    free(NativeDecodeBuffer);
+    NativeDecodeBuffer = NULL;
+
+    PcmrDestroyRing(&NativeAudioRing);
+}
+
+static int createNativeSink(int channelCount, int sampleRate) {
+    SLEngineItf engine;
+    SLDataLocator_AndroidSimpleBufferQueue bufferQueueLocator = { SL_DATALOCATOR_ANDROIDSIMPLEBUFFERQUEUE, NATIVE_SINK_BUFFER_COUNT };
+    SLDataFormat_PCM pcmFormat;
+    SLDataSource audioSource = { &bufferQueueLocator, &pcmFormat };
+    SLDataLocator_OutputMix outputMixLocator = { SL_DATALOCATOR_OUTPUTMIX, NULL };
+    SLDataSink audioSink = { &outputMixLocator, NULL };
+    const SLInterfaceID interfaceIds[] = { SL_IID_ANDROIDSIMPLEBUFFERQUEUE };
+    const SLboolean interfacesRequired[] = { SL_BOOLEAN_TRUE };
+    int i;
+
+    if (PcmrInitializeRing(&NativeAudioRing, channelCount, NATIVE_SINK_RING_FRAMES,
+                           NATIVE_SINK_MIN_TARGET_FRAMES, NATIVE_SINK_MAX_TARGET_FRAMES) != 0) {
+        return -1;
+    }
+
+    NativeDecodeBuffer = malloc(channelCount * PCM_FRAME_SIZE * sizeof(short));
+    if (NativeDecodeBuffer == NULL) {
+        destroyNativeSink();
+        return -1;
+    }
+
+    for (i = 0; i < NATIVE_SINK_BUFFER_COUNT; i++) {
+        NativeSinkBuffers[i] = malloc(channelCount * NATIVE_SINK_PERIOD_FRAMES * sizeof(short));
+        if (NativeSinkBuffers[i] == NULL) {
+            destroyNativeSink();
+            return -1;
+        }
+    }
+
+    if (slCreateEngine(&SlEngineObject, 0, NULL, 0, NULL, NULL) != SL_RESULT_SUCCESS ||
+            (*SlEngineObject)->Realize(SlEngineObject, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS ||
+            (*SlEngineObject)->GetInterface(SlEngineObject, SL_IID_ENGINE, &engine) != SL_RESULT_SUCCESS ||
+            (*engine)->CreateOutputMix(engine, &SlOutputMixObject, 0, NULL, NULL) != SL_RESULT_SUCCESS ||
+            (*SlOutputMixObject)->Realize(SlOutputMixObject, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS) {
+        __android_log_print(ANDROID_LOG_ERROR, "moonlight-common-c", "Unable to create OpenSL ES engine");
+        destroyNativeSink();
+        return -1;
+    }
+
+    outputMixLocator.outputMix = SlOutputMixObject;
+
+    pcmFormat.formatType = SL_DATAFORMAT_PCM;
+    pcmFormat.numChannels = channelCount;
+    pcmFormat.samplesPerSec = sampleRate * 1000; // In milliHertz
+    pcmFormat.bitsPerSample = SL_PCMSAMPLEFORMAT_FIXED_16;
+    pcmFormat.containerSize = SL_PCMSAMPLEFORMAT_FIXED_16;
+    pcmFormat.endianness = SL_BYTEORDER_LITTLEENDIAN;
+    pcmFormat.channelMask = SL_SPEAKER_FRONT_LEFT | SL_SPEAKER_FRONT_RIGHT;
+    if (channelCount == 6) {
+        // Same channel order as the Opus decoder output
+        pcmFormat.channelMask |= SL_SPEAKER_FRONT_CENTER | SL_SPEAKER_LOW_FREQUENCY |
+                SL_SPEAKER_BACK_LEFT | SL_SPEAKER_BACK_RIGHT;
+    }
+
+    if ((*engine)->CreateAudioPlayer(engine, &SlPlayerObject, &audioSource, &audioSink,
+                                     1, interfaceIds, interfacesRequired) != SL_RESULT_SUCCESS ||
+            (*SlPlayerObject)->Realize(SlPlayerObject, SL_BOOLEAN_FALSE) != SL_RESULT_SUCCESS ||
+            (*SlPlayerObject)->GetInterface(SlPlayerObject, SL_IID_PLAY, &SlPlay) != SL_RESULT_SUCCESS ||
+            (*SlPlayerObject)->GetInterface(SlPlayerObject, SL_IID_ANDROIDSIMPLEBUFFERQUEUE, &SlBufferQueue) != SL_RESULT_SUCCESS ||
+            (*SlBufferQueue)->RegisterCallback(SlBufferQueue, nativeSinkBufferCallback, NULL) != SL_RESULT_SUCCESS) {
+        __android_log_print(ANDROID_LOG_ERROR, "moonlight-common-c", "Unable to create OpenSL ES audio player");
+        destroyNativeSink();
+        return -1;
+    }
+
+    return 0;
+}
+
+static void startNativeSink(void) {
+    int i;
+
+    // Start the player with silence. The callback keeps the queue full
+    // from then on.
+    NextNativeSinkBuffer = 0;
+    for (i = 0; i < NATIVE_SINK_BUFFER_COUNT; i++) {
+        memset(NativeSinkBuffers[i], 0, NATIVE_SINK_PERIOD_FRAMES * NativeAudioRing.channelCount * sizeof(short));
+        (*SlBufferQueue)->Enqueue(SlBufferQueue, NativeSinkBuffers[i],
+                                  NATIVE_SINK_PERIOD_FRAMES * NativeAudioRing.channelCount * sizeof(short));
+    }
+
+    (*SlPlay)->SetPlayState(SlPlay, SL_PLAYSTATE_PLAYING);
+}
+
+static void stopNativeSink(void) {
+    (*SlPlay)->SetPlayState(SlPlay, SL_PLAYSTATE_STOPPED);
+    (*SlBufferQueue)->Clear(SlBufferQueue);
 }
 
 int BridgeArInit(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusConfig, void* context, int flags) {
@@ -208,9 +494,17 @@ int BridgeArInit(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusCon
         return -1;
     }
 
-    err = (*env)->CallStaticIntMethod(env, GlobalBridgeClass, BridgeArInitMethod, audioConfiguration);
-    if ((*env)->ExceptionCheck(env)) {
-        err = -1;
+    // The sink can't change while a stream is running
+    ActiveAudioSink = RequestedAudioSink;
+
+    if (ActiveAudioSink == AUDIO_SINK_NATIVE) {
+        err = createNativeSink(opusConfig->channelCount, opusConfig->sampleRate);
+    }
+    else {
+        err = (*env)->CallStaticIntMethod(env, GlobalBridgeClass, BridgeArInitMethod, audioConfiguration);
+        if ((*env)->ExceptionCheck(env)) {
+            err = -1;
+        }
     }
     if (err == 0) {
         memcpy(&OpusConfig, opusConfig, sizeof(*opusConfig));
@@ -221,20 +515,33 @@ int BridgeArInit(int audioConfiguration, POPUS_MULTISTREAM_CONFIGURATION opusCon
                                                   opusConfig->mapping,
                                                   &err);
         if (Decoder == NULL) {
-            (*env)->CallStaticVoidMethod(env, GlobalBridgeClass, BridgeArCleanupMethod);
+            if (ActiveAudioSink == AUDIO_SINK_NATIVE) {
+                destroyNativeSink();
+            }
+            else {
+                (*env)->CallStaticVoidMethod(env, GlobalBridgeClass, BridgeArCleanupMethod);
+            }
             return -1;
         }
 
-        // We know ahead of time what the buffer size will be for decoded audio, so pre-allocate it
-        DecodedAudioBuffer = (*env)->NewGlobalRef(env, (*env)->NewByteArray(env, opusConfig->channelCount * PCM_FRAME_SIZE * sizeof(short)));
+        if (ActiveAudioSink == AUDIO_SINK_JAVA) {
+            // We know ahead of time what the buffer size will be for decoded audio, so pre-allocate it
+            DecodedAudioBuffer = (*env)->NewGlobalRef(env, (*env)->NewByteArray(env, opusConfig->channelCount * PCM_FRAME_SIZE * sizeof(short)));
+        }
     }
 
     return err;
 }
 
 void BridgeArStart(void) {
-    JNIEnv* env = GetThreadEnv();
+    JNIEnv* env;
 
+    if (ActiveAudioSink == AUDIO_SINK_NATIVE) {
+        startNativeSink();
+        return;
+    }
+
+    env = GetThreadEnv();
     if ((*env)->ExceptionCheck(env)) {
         return;
     }
@@ -243,8 +550,14 @@ void BridgeArStart(void) {
 }
 
 void BridgeArStop(void) {
-    JNIEnv* env = GetThreadEnv();
+    JNIEnv* env;
 
+    if (ActiveAudioSink == AUDIO_SINK_NATIVE) {
+        stopNativeSink();
+        return;
+    }
+
+    env = GetThreadEnv();
     if ((*env)->ExceptionCheck(env)) {
         return;
     }
@@ -253,10 +566,17 @@ void BridgeArStop(void) {
 }
 
 void BridgeArCleanup() {
-    JNIEnv* env = GetThreadEnv();
+    JNIEnv* env;
 
     opus_multistream_decoder_destroy(Decoder);
 
+    if (ActiveAudioSink == AUDIO_SINK_NATIVE) {
+        destroyNativeSink();
+        return;
+    }
+
+    env = GetThreadEnv();
+
     (*env)->DeleteGlobalRef(env, DecodedAudioBuffer);
 
     if ((*env)->ExceptionCheck(env)) {
@@ -266,9 +586,32 @@ void BridgeArCleanup() {
     (*env)->CallStaticVoidMethod(env, GlobalBridgeClass, BridgeArCleanupMethod);
 }
 
-void BridgeArDecodeAndPlaySample(char* sampleData, int sampleLength) {
-    JNIEnv* env = GetThreadEnv();
+// Decodes straight into native memory and hands the PCM to the ring
+// without entering the JVM
+static void decodeToNativeSink(char* sampleData, int sampleLength, int decodeFec) {
+    int decodeLen = opus_multistream_decode(Decoder,
+                                            (const unsigned char*)sampleData,
+                                            sampleLength,
+                                            NativeDecodeBuffer,
+                                            PCM_FRAME_SIZE,
+                                            decodeFec);
+    if (decodeLen > 0) {
+        // If the sink has stalled, the ring counts the overflow and we drop this packet
+        PcmrWriteFrames(&NativeAudioRing, NativeDecodeBuffer, decodeLen);
+    }
+}
 
+// With decodeFec set, this decodes the FEC data in the packet to recover
+// the lost packet before it
+static void decodeAndPlay(char* sampleData, int sampleLength, int decodeFec) {
+    JNIEnv* env;
+
+    if (ActiveAudioSink == AUDIO_SINK_NATIVE) {
+        decodeToNativeSink(sampleData, sampleLength, decodeFec);
+        return;
+    }
+
+    env = GetThreadEnv();
     if ((*env)->ExceptionCheck(env)) {
         return;
     }
@@ -280,7 +623,7 @@ void BridgeArDecodeAndPlaySample(char* sampleData, int sampleLength) {
                                             sampleLength,
                                             (opus_int16*)decodedData,
                                             PCM_FRAME_SIZE,
-                                            0);
+                                            decodeFec);
     if (decodeLen > 0) {
         // We must release the array elements first to ensure the data is copied before the callback
         (*env)->ReleaseByteArrayElements(env, DecodedAudioBuffer, decodedData, 0);
@@ -293,6 +636,46 @@ void BridgeArDecodeAndPlaySample(char* sampleData, int sampleLength) {
     }
 }
 
+void BridgeArDecodeAndPlaySample(char* sampleData, int sampleLength) {
+    decodeAndPlay(sampleData, sampleLength, 0);
+}
+
+void BridgeArDecodeAndPlayFecSample(char* sampleData, int sampleLength) {
+    decodeAndPlay(sampleData, sampleLength, 1);
+}
+
+JNIEXPORT void JNICALL
+Java_com_limelight_nvstream_jni_MoonBridge_setAudioSink(JNIEnv *env, jclass clazz, jint audioSink) {
+    // Takes effect when the next stream's audio is initialized
+    RequestedAudioSink = audioSink;
+}
+
+JNIEXPORT void JNICALL
+Java_com_limelight_nvstream_jni_MoonBridge_getAudioSinkStats(JNIEnv *env, jclass clazz, jintArray stats) {
+    PCM_RING_STATS ringStats;
+    jint values[AUDIO_SINK_STATS_FIELDS];
+    jsize length;
+
+    memset(&ringStats, 0, sizeof(ringStats));
+    if (ActiveAudioSink == AUDIO_SINK_NATIVE) {
+        PcmrGetStats(&NativeAudioRing, &ringStats);
+    }
+
+    // This must match the layout described in MoonBridge
+    values[0] = ringStats.fillFrames;
+    values[1] = ringStats.targetFrames;
+    values[2] = ringStats.underruns;
+    values[3] = ringStats.overflows;
+    values[4] = ringStats.framesDropped;
+    values[5] = ringStats.framesInserted;
+
+    length = (*env)->GetArrayLength(env, stats);
+    if (length > AUDIO_SINK_STATS_FIELDS) {
+        length = AUDIO_SINK_STATS_FIELDS;
+    }
+    (*env)->SetIntArrayRegion(env, stats, 0, length, values);
+}
+
 void BridgeClStageStarting(int stage) {
     JNIEnv* env = GetThreadEnv();
 
@@ -384,6 +767,8 @@ static AUDIO_RENDERER_CALLBACKS BridgeAudioRendererCallbacks = {
         .stop = BridgeArStop,
         .cleanup = BridgeArCleanup,
         .decodeAndPlaySample = BridgeArDecodeAndPlaySample,
+        .capabilities = CAPABILITY_AUDIO_JITTER_BUFFER,
+        .decodeAndPlayFecSample = BridgeArDecodeAndPlayFecSample,
 };
 
 static CONNECTION_LISTENER_CALLBACKS BridgeConnListenerCallbacks = {
@@ -397,6 +782,51 @@ static CONNECTION_LISTENER_CALLBACKS BridgeConnListenerCallbacks = {
         .logMessage = BridgeClLogMessage,
 };
 
+// Returns a mask of the CPUs outside the slowest cluster of a big.LITTLE device,
+// or 0 if every CPU is equally fast or the frequencies can't be read
+static unsigned long long getBigCoreMask(void) {
+    long cpuCount = sysconf(_SC_NPROCESSORS_CONF);
+    long maxFreqs[64];
+    long slowestFreq = 0;
+    unsigned long long mask = 0;
+    char path[64];
+    int i;
+
+    if (cpuCount <= 0) {
+        return 0;
+    }
+    if (cpuCount > 64) {
+        cpuCount = 64;
+    }
+
+    for (i = 0; i < cpuCount; i++) {
+        FILE* f;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/cpuinfo_max_freq", i);
+        f = fopen(path, "r");
+        if (f == NULL) {
+            return 0;
+        }
+        if (fscanf(f, "%ld", &maxFreqs[i]) != 1) {
+            fclose(f);
+            return 0;
+        }
+        fclose(f);
+
+        if (slowestFreq == 0 || maxFreqs[i] < slowestFreq) {
+            slowestFreq = maxFreqs[i];
+        }
+    }
+
+    for (i = 0; i < cpuCount; i++) {
+        if (maxFreqs[i] > slowestFreq) {
+            mask |= 1ULL << i;
+        }
+    }
+
+    return mask;
+}
+
 JNIEXPORT jint JNICALL
 Java_com_limelight_nvstream_jni_MoonBridge_startConnection(JNIEnv *env, jclass clazz,
                                                            jstring address, jstring appVersion, jstring gfeVersion,
@@ -424,9 +854,23 @@ Java_com_limelight_nvstream_jni_MoonBridge_startConnection(JNIEnv *env, jclass c
             .supportsHevc = supportsHevc,
             .enableHdr = enableHdr,
             .hevcBitratePercentageMultiplier = hevcBitratePercentageMultiplier,
-            .clientRefreshRateX100 = clientRefreshRateX100
+            .clientRefreshRateX100 = clientRefreshRateX100,
+            .lockFreeQueues = LOCK_FREE_QUEUE_VIDEO | LOCK_FREE_QUEUE_AUDIO | LOCK_FREE_QUEUE_INPUT,
+            .coalesceInput = 1
     };
 
+    // Raise the streaming threads to the priorities Android uses for display
+    // and audio work, and keep the video threads off the little cores so they
+    // aren't migrated there and stalled. Apps can't use real-time scheduling.
+    unsigned long long bigCoreMask = getBigCoreMask();
+    streamConfig.threadScheduling[THREAD_ROLE_VIDEO_RECEIVE].niceValue = -10;
+    streamConfig.threadScheduling[THREAD_ROLE_VIDEO_RECEIVE].cpuAffinityMask = bigCoreMask;
+    streamConfig.threadScheduling[THREAD_ROLE_VIDEO_DECODE].niceValue = -8;
+    streamConfig.threadScheduling[THREAD_ROLE_VIDEO_DECODE].cpuAffinityMask = bigCoreMask;
+    streamConfig.threadScheduling[THREAD_ROLE_AUDIO_RECEIVE].niceValue = -16;
+    streamConfig.threadScheduling[THREAD_ROLE_AUDIO_DECODE].niceValue = -16;
+    streamConfig.threadScheduling[THREAD_ROLE_INPUT].niceValue = -4;
+
     jbyte* riAesKeyBuf = (*env)->GetByteArrayElements(env, riAesKey, NULL);
     memcpy(streamConfig.remoteInputAesKey, riAesKeyBuf, sizeof(streamConfig.remoteInputAesKey));
     (*env)->ReleaseByteArrayElements(env, riAesKey, riAesKeyBuf, JNI_ABORT);
@@ -46,6 +46,15 @@
 #define alloca(x) _alloca(x)
 #endif
 
+#if defined(__aarch64__) || (defined(__arm__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)))
+#include <arm_neon.h>
+#define RS_SIMD_NEON
+#elif (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#include <cpuid.h>
+#define RS_SIMD_X86
+#endif
+
 typedef unsigned char gf;
 
 #define GF_BITS  8
@@ -93,28 +102,219 @@ static inline gf modnn(int x) {
     return x;
 }
 
-static void addmul(gf *dst1, gf *src1, gf c, int sz) {
+static void addmul_scalar(gf *dst1, gf *src1, gf c, int sz) {
     USE_GF_MULC;
-    if (c != 0) {
-        register gf *dst = dst1, *src = src1;
-        gf *lim = &dst[sz];
+    register gf *dst = dst1, *src = src1;
+    gf *lim = &dst[sz];
 
-        GF_MULC0(c);
-        for (; dst < lim; dst++, src++)
-            GF_ADDMULC(*dst, *src);
-    }
+    GF_MULC0(c);
+    for (; dst < lim; dst++, src++)
+        GF_ADDMULC(*dst, *src);
 }
 
-static void mul(gf *dst1, gf *src1, gf c, int sz) {
+static void mul_scalar(gf *dst1, gf *src1, gf c, int sz) {
     USE_GF_MULC;
-    if (c != 0) {
-        register gf *dst = dst1, *src = src1;
-        gf *lim = &dst[sz];
-        GF_MULC0(c);
-        for (; dst < lim; dst++, src++)
-            GF_MULC(*dst , *src);
-    } else
-        memset(dst1, 0, c);
+    register gf *dst = dst1, *src = src1;
+    gf *lim = &dst[sz];
+
+    GF_MULC0(c);
+    for (; dst < lim; dst++, src++)
+        GF_MULC(*dst , *src);
+}
+
+/*
+ * Vectorized multiply by a constant.
+ *
+ * Multiplication by c is linear over GF(2), so
+ * c*x == c*(x & 0x0f) ^ c*(x & 0xf0). Each half only has 16 possible
+ * values, so two 16 byte tables and a byte shuffle instruction multiply
+ * a whole vector of bytes at once ("split nibble" method).
+ *
+ * The kernels process as many whole vectors as fit in sz and return the
+ * number of bytes done, the remaining tail is left to the scalar code.
+ * If add is set the product is xored into dst, otherwise it replaces it.
+ */
+typedef int (*gf_mul_kernel)(gf *dst, gf *src, gf c, int sz, int add);
+
+/* selected by reed_solomon_init(), NULL if only the scalar code is usable */
+static gf_mul_kernel simd_mul = NULL;
+
+static void gf_nibble_tables(gf c, gf *lo, gf *hi) {
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        lo[i] = gf_mul(c, i);
+        hi[i] = gf_mul(c, (i << 4));
+    }
+}
+
+#if defined(RS_SIMD_NEON)
+#if defined(__aarch64__)
+typedef uint8x16_t neon_table;
+
+static inline neon_table neon_load_table(gf *t) {
+    return vld1q_u8(t);
+}
+
+static inline uint8x16_t neon_lookup(neon_table t, uint8x16_t idx) {
+    return vqtbl1q_u8(t, idx);
+}
+#else
+/* ARMv7 only has 8 byte wide table lookups */
+typedef uint8x8x2_t neon_table;
+
+static inline neon_table neon_load_table(gf *t) {
+    neon_table r;
+    r.val[0] = vld1_u8(t);
+    r.val[1] = vld1_u8(t + 8);
+    return r;
+}
+
+static inline uint8x16_t neon_lookup(neon_table t, uint8x16_t idx) {
+    return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)), vtbl2_u8(t, vget_high_u8(idx)));
+}
+#endif
+
+static int mul_neon(gf *dst, gf *src, gf c, int sz, int add) {
+    gf lo[16], hi[16];
+    neon_table tlo, thi;
+    uint8x16_t mask, x, p;
+    int i;
+
+    gf_nibble_tables(c, lo, hi);
+    tlo = neon_load_table(lo);
+    thi = neon_load_table(hi);
+    mask = vdupq_n_u8(0x0f);
+
+    for (i = 0; i + 16 <= sz; i += 16) {
+        x = vld1q_u8(&src[i]);
+        p = veorq_u8(neon_lookup(tlo, vandq_u8(x, mask)),
+                     neon_lookup(thi, vshrq_n_u8(x, 4)));
+        if (add)
+            p = veorq_u8(p, vld1q_u8(&dst[i]));
+        vst1q_u8(&dst[i], p);
+    }
+
+    return i;
+}
+#endif
+
+#if defined(RS_SIMD_X86)
+__attribute__((target("ssse3")))
+static int mul_ssse3(gf *dst, gf *src, gf c, int sz, int add) {
+    gf lo[16], hi[16];
+    __m128i tlo, thi, mask, x, p;
+    int i;
+
+    gf_nibble_tables(c, lo, hi);
+    tlo = _mm_loadu_si128((__m128i*)lo);
+    thi = _mm_loadu_si128((__m128i*)hi);
+    mask = _mm_set1_epi8(0x0f);
+
+    for (i = 0; i + 16 <= sz; i += 16) {
+        x = _mm_loadu_si128((__m128i*)&src[i]);
+        p = _mm_xor_si128(_mm_shuffle_epi8(tlo, _mm_and_si128(x, mask)),
+                          _mm_shuffle_epi8(thi, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+        if (add)
+            p = _mm_xor_si128(p, _mm_loadu_si128((__m128i*)&dst[i]));
+        _mm_storeu_si128((__m128i*)&dst[i], p);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static int mul_avx2(gf *dst, gf *src, gf c, int sz, int add) {
+    gf lo[16], hi[16];
+    __m256i tlo, thi, mask, x, p;
+    int i;
+
+    gf_nibble_tables(c, lo, hi);
+    /* vpshufb works within 128 bit lanes, so both lanes get the table */
+    tlo = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)lo));
+    thi = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*)hi));
+    mask = _mm256_set1_epi8(0x0f);
+
+    for (i = 0; i + 32 <= sz; i += 32) {
+        x = _mm256_loadu_si256((__m256i*)&src[i]);
+        p = _mm256_xor_si256(_mm256_shuffle_epi8(tlo, _mm256_and_si256(x, mask)),
+                             _mm256_shuffle_epi8(thi, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+        if (add)
+            p = _mm256_xor_si256(p, _mm256_loadu_si256((__m256i*)&dst[i]));
+        _mm256_storeu_si256((__m256i*)&dst[i], p);
+    }
+
+    return i;
+}
+
+static void x86_cpu_features(int *ssse3, int *avx2) {
+    unsigned int eax, ebx, ecx, edx;
+    unsigned int xcr0_lo, xcr0_hi;
+
+    *ssse3 = 0;
+    *avx2 = 0;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return;
+
+    *ssse3 = (ecx & bit_SSSE3) != 0;
+
+    /* AVX2 also needs the OS to save the YMM registers */
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return;
+    __asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+    if ((xcr0_lo & 0x6) != 0x6 || __get_cpuid_max(0, NULL) < 7)
+        return;
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    *avx2 = (ebx & bit_AVX2) != 0;
+}
+#endif
+
+static void select_simd_kernel(void) {
+#if defined(RS_SIMD_NEON)
+    simd_mul = mul_neon;
+#elif defined(RS_SIMD_X86)
+    int ssse3, avx2;
+
+    x86_cpu_features(&ssse3, &avx2);
+    if (avx2)
+        simd_mul = mul_avx2;
+    else if (ssse3)
+        simd_mul = mul_ssse3;
+    else
+        simd_mul = NULL;
+#else
+    simd_mul = NULL;
+#endif
+}
+
+static void addmul(gf *dst, gf *src, gf c, int sz) {
+    int done = 0;
+
+    if (c == 0)
+        return;
+
+    if (simd_mul != NULL)
+        done = simd_mul(dst, src, c, sz, 1);
+
+    if (done < sz)
+        addmul_scalar(dst + done, src + done, c, sz - done);
+}
+
+static void mul(gf *dst, gf *src, gf c, int sz) {
+    int done = 0;
+
+    if (c == 0) {
+        memset(dst, 0, sz);
+        return;
+    }
+
+    if (simd_mul != NULL)
+        done = simd_mul(dst, src, c, sz, 0);
+
+    if (done < sz)
+        mul_scalar(dst + done, src + done, c, sz - done);
 }
 
 /* y = a.dot(b) */
@@ -380,6 +580,7 @@ static inline int code_some_shards(gf* matrixRows, gf** inputs, gf** outputs, in
 void reed_solomon_init(void) {
     generate_gf();
     init_mul_table();
+    select_simd_kernel();
 }
 
 reed_solomon* reed_solomon_new(int data_shards, int parity_shards) {
@@ -398,6 +599,10 @@ reed_solomon* reed_solomon_new(int data_shards, int parity_shards) {
         rs->shards = (data_shards + parity_shards);
         rs->m = NULL;
         rs->parity = NULL;
+        memset(rs->decode_cache, 0, sizeof(rs->decode_cache));
+        rs->decode_cache_clock = 0;
+        rs->decode_cache_hits = 0;
+        rs->decode_cache_misses = 0;
 
         if (rs->shards > DATA_SHARDS_MAX || data_shards <= 0 || parity_shards <= 0) {
             err = 1;
@@ -472,6 +677,8 @@ reed_solomon* reed_solomon_new(int data_shards, int parity_shards) {
 }
 
 void reed_solomon_release(reed_solomon* rs) {
+    int i;
+
     if (NULL != rs) {
         if (NULL != rs->m)
             free(rs->m);
@@ -479,10 +686,43 @@ void reed_solomon_release(reed_solomon* rs) {
         if (NULL != rs->parity)
             free(rs->parity);
 
+        for (i = 0; i < DECODE_CACHE_SIZE; i++) {
+            if (NULL != rs->decode_cache[i].matrix)
+                free(rs->decode_cache[i].matrix);
+        }
+
         free(rs);
     }
 }
 
+/*
+ * Look up the decode matrix inverted from the given shard rows.
+ * On a miss, return the least recently used entry for the caller to fill.
+ * */
+static reed_solomon_decode_entry* find_decode_entry(reed_solomon* rs, unsigned char* rows, int* hit) {
+    reed_solomon_decode_entry* entry;
+    reed_solomon_decode_entry* victim = &rs->decode_cache[0];
+    int i;
+
+    rs->decode_cache_clock++;
+    for (i = 0; i < DECODE_CACHE_SIZE; i++) {
+        entry = &rs->decode_cache[i];
+        if (NULL != entry->matrix && 0 == memcmp(entry->rows, rows, sizeof(entry->rows))) {
+            entry->last_used = rs->decode_cache_clock;
+            rs->decode_cache_hits++;
+            *hit = 1;
+            return entry;
+        }
+
+        if (NULL == entry->matrix || (NULL != victim->matrix && entry->last_used < victim->last_used))
+            victim = entry;
+    }
+
+    rs->decode_cache_misses++;
+    *hit = 0;
+    return victim;
+}
+
 /**
  * decode one shard
  * input:
@@ -498,8 +738,10 @@ static int reed_solomon_decode(reed_solomon* rs, unsigned char **data_blocks, in
     gf dataDecodeMatrix[DATA_SHARDS_MAX*DATA_SHARDS_MAX];
     unsigned char* subShards[DATA_SHARDS_MAX];
     unsigned char* outputs[DATA_SHARDS_MAX];
+    unsigned char rows[(DATA_SHARDS_MAX + 7) / 8];
+    reed_solomon_decode_entry* cached;
     gf* m = rs->m;
-    int i, j, c, swap, subMatrixRow, dataShards, nos, nshards;
+    int i, j, c, swap, subMatrixRow, dataShards, nos, nshards, hit;
 
     /* the erased_blocks should always sorted
      * if sorted, nr_fec_blocks times to check it
@@ -521,6 +763,9 @@ static int reed_solomon_decode(reed_solomon* rs, unsigned char **data_blocks, in
             break;
     }
 
+    /* the rows used for the sub matrix fully determine its inverse */
+    memset(rows, 0, sizeof(rows));
+
     j = 0;
     subMatrixRow = 0;
     nos = 0;
@@ -531,34 +776,60 @@ static int reed_solomon_decode(reed_solomon* rs, unsigned char **data_blocks, in
             j++;
         else {
             /* this row is ok */
-            for (c = 0; c < dataShards; c++)
-                dataDecodeMatrix[subMatrixRow*dataShards + c] = m[i*dataShards + c];
-
+            rows[i >> 3] |= 1 << (i & 7);
             subShards[subMatrixRow] = data_blocks[i];
             subMatrixRow++;
         }
     }
 
     for (i = 0; i < nr_fec_blocks && subMatrixRow < dataShards; i++) {
-        subShards[subMatrixRow] = dec_fec_blocks[i];
         j = dataShards + fec_block_nos[i];
-        for (c = 0; c < dataShards; c++)
-            dataDecodeMatrix[subMatrixRow*dataShards + c] = m[j*dataShards + c];
-
+        rows[j >> 3] |= 1 << (j & 7);
+        subShards[subMatrixRow] = dec_fec_blocks[i];
         subMatrixRow++;
     }
 
     if (subMatrixRow < dataShards)
         return -1;
 
-    invert_mat(dataDecodeMatrix, dataShards);
+    for (i = 0; i < nr_fec_blocks; i++)
+        outputs[i] = data_blocks[erased_blocks[i]];
+
+    cached = find_decode_entry(rs, rows, &hit);
+    if (hit)
+        return code_some_shards(cached->matrix, subShards, outputs, dataShards, nr_fec_blocks, block_size);
+
+    subMatrixRow = 0;
+    for (i = 0; i < rs->shards; i++) {
+        if (rows[i >> 3] & (1 << (i & 7))) {
+            for (c = 0; c < dataShards; c++)
+                dataDecodeMatrix[subMatrixRow*dataShards + c] = m[i*dataShards + c];
+
+            subMatrixRow++;
+        }
+    }
+
+    if (invert_mat(dataDecodeMatrix, dataShards) != 0)
+        return -1;
 
     for (i = 0; i < nr_fec_blocks; i++) {
         j = erased_blocks[i];
-        outputs[i] = data_blocks[j];
         memmove(dataDecodeMatrix+i*dataShards, dataDecodeMatrix+j*dataShards, dataShards);
     }
 
+    /* remember the rows for the erased blocks, the loss pattern is likely to repeat */
+    if (NULL == cached->matrix || cached->nr_rows < nr_fec_blocks) {
+        if (NULL != cached->matrix)
+            free(cached->matrix);
+        cached->matrix = (gf*)malloc(nr_fec_blocks * dataShards);
+    }
+    if (NULL != cached->matrix) {
+        memcpy(cached->rows, rows, sizeof(rows));
+        memcpy(cached->matrix, dataDecodeMatrix, nr_fec_blocks * dataShards);
+        cached->nr_rows = nr_fec_blocks;
+        cached->last_used = rs->decode_cache_clock;
+    }
+
     return code_some_shards(dataDecodeMatrix, subShards, outputs, dataShards, nr_fec_blocks, block_size);
 }
 
@@ -627,7 +898,8 @@ int reed_solomon_reconstruct(reed_solomon* rs, unsigned char** shards, unsigned
             }
 
             if (dn == pn) {
-                reed_solomon_decode(rs, data_blocks, block_size, dec_fec_blocks, fec_block_nos, erased_blocks, dn);
+                if (reed_solomon_decode(rs, data_blocks, block_size, dec_fec_blocks, fec_block_nos, erased_blocks, dn) != 0)
+                    err = -1;
             } else
                 err = -1;
         }
@@ -4,12 +4,29 @@
 /* use small value to save memory */
 #define DATA_SHARDS_MAX 255
 
+/* number of inverted decode matrices remembered per reed_solomon */
+#define DECODE_CACHE_SIZE 8
+
+typedef struct _reed_solomon_decode_entry {
+    /* bitmap of the shard rows the matrix was inverted from, 0 if unused */
+    unsigned char rows[(DATA_SHARDS_MAX + 7) / 8];
+    int nr_rows;
+    /* nr_rows rows of data_shards coefficients, one per erased block */
+    unsigned char* matrix;
+    unsigned int last_used;
+} reed_solomon_decode_entry;
+
 typedef struct _reed_solomon {
     int data_shards;
     int parity_shards;
     int shards;
     unsigned char* m;
     unsigned char* parity;
+
+    reed_solomon_decode_entry decode_cache[DECODE_CACHE_SIZE];
+    unsigned int decode_cache_clock;
+    unsigned int decode_cache_hits;
+    unsigned int decode_cache_misses;
 } reed_solomon;
 
 /**
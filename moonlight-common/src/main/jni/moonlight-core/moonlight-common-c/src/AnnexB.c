@@ -0,0 +1,91 @@
+#include "AnnexB.h"
+
+#if defined(__aarch64__) || (defined(__arm__) && (defined(__ARM_NEON) || defined(__ARM_NEON__)))
+#include <arm_neon.h>
+#define ANNEXB_SIMD_NEON
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ANNEXB_SIMD_SSE2
+#endif
+
+// Number of starting positions tested by each SIMD iteration. Each one
+// reads 2 bytes beyond that to see the whole 3 byte sequence.
+#define SIMD_WIDTH 16
+
+static int isSpecialSequence(const unsigned char* data) {
+    return data[0] == 0 && data[1] == 0 && data[2] <= 1;
+}
+
+// Scalar search using memchr() to skip quickly between zero bytes
+static int findSpecialSequenceScalar(const unsigned char* data, int offset, int length) {
+    while (length - offset >= 3) {
+        // Only positions with 2 bytes after them can start a sequence
+        const unsigned char* zero = (const unsigned char*)memchr(&data[offset], 0, length - offset - 2);
+        if (zero == NULL) {
+            break;
+        }
+
+        offset = (int)(zero - data);
+        if (isSpecialSequence(zero)) {
+            return offset;
+        }
+
+        offset++;
+    }
+
+    return length;
+}
+
+int AnnexBFindSpecialSequence(const unsigned char* data, int length) {
+    int offset = 0;
+
+#if defined(ANNEXB_SIMD_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    while (offset + SIMD_WIDTH + 2 <= length) {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)&data[offset]);
+        __m128i b1 = _mm_loadu_si128((const __m128i*)&data[offset + 1]);
+        __m128i b2 = _mm_loadu_si128((const __m128i*)&data[offset + 2]);
+
+        // b0 == 0 && b1 == 0 && b2 <= 1 at each position
+        __m128i match = _mm_and_si128(_mm_cmpeq_epi8(_mm_or_si128(b0, b1), zero),
+                                      _mm_cmpeq_epi8(_mm_min_epu8(b2, one), b2));
+        int mask = _mm_movemask_epi8(match);
+        if (mask != 0) {
+            while ((mask & 1) == 0) {
+                mask >>= 1;
+                offset++;
+            }
+            return offset;
+        }
+
+        offset += SIMD_WIDTH;
+    }
+#elif defined(ANNEXB_SIMD_NEON)
+    const uint8x16_t zero = vdupq_n_u8(0);
+    const uint8x16_t one = vdupq_n_u8(1);
+
+    while (offset + SIMD_WIDTH + 2 <= length) {
+        uint8x16_t b0 = vld1q_u8(&data[offset]);
+        uint8x16_t b1 = vld1q_u8(&data[offset + 1]);
+        uint8x16_t b2 = vld1q_u8(&data[offset + 2]);
+
+        // b0 == 0 && b1 == 0 && b2 <= 1 at each position
+        uint8x16_t match = vandq_u8(vceqq_u8(vorrq_u8(b0, b1), zero), vcleq_u8(b2, one));
+#if defined(__aarch64__)
+        if (vmaxvq_u8(match) != 0) {
+#else
+        uint8x8_t folded = vorr_u8(vget_low_u8(match), vget_high_u8(match));
+        if (vget_lane_u64(vreinterpret_u64_u8(folded), 0) != 0) {
+#endif
+            // The first match is within this block
+            return findSpecialSequenceScalar(data, offset, length);
+        }
+
+        offset += SIMD_WIDTH;
+    }
+#endif
+
+    return findSpecialSequenceScalar(data, offset, length);
+}
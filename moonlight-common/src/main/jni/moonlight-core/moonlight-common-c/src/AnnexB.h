@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Platform.h"
+
+// Returns the offset of the first position in data that starts a 00 00 00 or
+// 00 00 01 sequence (the start of a start code or padding), or length if there
+// isn't one. Large payloads are scanned 16 bytes at a time where SIMD is available.
+int AnnexBFindSpecialSequence(const unsigned char* data, int length);
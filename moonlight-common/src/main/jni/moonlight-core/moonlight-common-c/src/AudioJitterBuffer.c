@@ -0,0 +1,254 @@
+#include "Limelight-internal.h"
+#include "AudioJitterBuffer.h"
+
+// Playout stops after this many packets in a row are concealed with nothing
+// buffered, since the stream has most likely paused. It restarts once the
+// buffer fills back up to the target depth.
+#define AJB_MAX_EMPTY_PACKETS 20
+
+// At most one packet is discarded per this many packets played, so trimming
+// the delay after a burst doesn't cause a run of audible gaps
+#define AJB_DISCARD_INTERVAL 10
+
+int AjbInitialize(PAUDIO_JITTER_BUFFER jitterBuffer, PPACKET_POOL packetPool,
+                  int minDepth, int maxDepth, int useFec) {
+    int err;
+
+    LC_ASSERT(minDepth >= 1 && minDepth <= maxDepth);
+    LC_ASSERT(maxDepth + AJB_DEPTH_HYSTERESIS < AJB_SLOT_COUNT);
+
+    memset(jitterBuffer, 0, sizeof(*jitterBuffer));
+
+    err = PltCreateMutex(&jitterBuffer->mutex);
+    if (err != 0) {
+        return err;
+    }
+
+    jitterBuffer->packetPool = packetPool;
+    jitterBuffer->minDepth = minDepth;
+    jitterBuffer->maxDepth = maxDepth;
+    jitterBuffer->targetDepth = minDepth;
+    jitterBuffer->useFec = useFec;
+
+    return 0;
+}
+
+static PRTP_PACKET* getSlot(PAUDIO_JITTER_BUFFER jitterBuffer, unsigned short sequenceNumber) {
+    return &jitterBuffer->slots[sequenceNumber & (AJB_SLOT_COUNT - 1)];
+}
+
+// The mutex must be held unless no other thread is using the buffer
+static void flushPackets(PAUDIO_JITTER_BUFFER jitterBuffer) {
+    int i;
+
+    for (i = 0; i < AJB_SLOT_COUNT; i++) {
+        if (jitterBuffer->slots[i] != NULL) {
+            PpFreeBuffer(jitterBuffer->packetPool, jitterBuffer->slots[i]);
+            jitterBuffer->slots[i] = NULL;
+        }
+    }
+
+    jitterBuffer->bufferedPackets = 0;
+}
+
+void AjbCleanup(PAUDIO_JITTER_BUFFER jitterBuffer) {
+    flushPackets(jitterBuffer);
+    PltDeleteMutex(&jitterBuffer->mutex);
+}
+
+// Sets how many packets playout should keep buffered. This is clamped to
+// the limits the buffer was initialized with.
+void AjbSetTargetDepth(PAUDIO_JITTER_BUFFER jitterBuffer, int targetDepth) {
+    if (targetDepth < jitterBuffer->minDepth) {
+        targetDepth = jitterBuffer->minDepth;
+    }
+    else if (targetDepth > jitterBuffer->maxDepth) {
+        targetDepth = jitterBuffer->maxDepth;
+    }
+
+    PltLockMutex(&jitterBuffer->mutex);
+    jitterBuffer->targetDepth = targetDepth;
+    PltUnlockMutex(&jitterBuffer->mutex);
+}
+
+// The mutex must be held
+static int getDepth(PAUDIO_JITTER_BUFFER jitterBuffer) {
+    if (jitterBuffer->bufferedPackets == 0 ||
+        isBefore16(jitterBuffer->highestSequenceNumber, jitterBuffer->nextSequenceNumber)) {
+        return 0;
+    }
+
+    return U16(jitterBuffer->highestSequenceNumber - jitterBuffer->nextSequenceNumber) + 1;
+}
+
+// Takes ownership of the packet. Packets that can't be played are freed.
+void AjbAddPacket(PAUDIO_JITTER_BUFFER jitterBuffer, PRTP_PACKET packet) {
+    unsigned short sequenceNumber = packet->sequenceNumber;
+    PRTP_PACKET* slot;
+
+    PltLockMutex(&jitterBuffer->mutex);
+
+    if (!jitterBuffer->receivedFirstPacket) {
+        jitterBuffer->receivedFirstPacket = 1;
+        jitterBuffer->nextSequenceNumber = sequenceNumber;
+    }
+    else if (isBefore16(sequenceNumber, jitterBuffer->nextSequenceNumber)) {
+        if (!jitterBuffer->playing && jitterBuffer->bufferedPackets > 0 &&
+            U16(jitterBuffer->highestSequenceNumber - sequenceNumber) < AJB_SLOT_COUNT) {
+            // Playout hasn't started, so this can still be played first
+            jitterBuffer->nextSequenceNumber = sequenceNumber;
+        }
+        else {
+            // Its playout time has passed
+            jitterBuffer->latePackets++;
+            PltUnlockMutex(&jitterBuffer->mutex);
+            PpFreeBuffer(jitterBuffer->packetPool, packet);
+            return;
+        }
+    }
+    else if (U16(sequenceNumber - jitterBuffer->nextSequenceNumber) >= AJB_SLOT_COUNT) {
+        // The stream jumped too far ahead to keep waiting for the packets
+        // before this one. Start over once the playout thread resets.
+        Limelog("Resetting audio jitter buffer after jump to %d\n", sequenceNumber);
+        jitterBuffer->resyncPending = 1;
+        PltUnlockMutex(&jitterBuffer->mutex);
+        PpFreeBuffer(jitterBuffer->packetPool, packet);
+        return;
+    }
+
+    slot = getSlot(jitterBuffer, sequenceNumber);
+    if (*slot != NULL) {
+        // Duplicate packet
+        PltUnlockMutex(&jitterBuffer->mutex);
+        PpFreeBuffer(jitterBuffer->packetPool, packet);
+        return;
+    }
+
+    if (jitterBuffer->bufferedPackets == 0 ||
+        isBefore16(jitterBuffer->highestSequenceNumber, sequenceNumber)) {
+        jitterBuffer->highestSequenceNumber = sequenceNumber;
+    }
+
+    *slot = packet;
+    jitterBuffer->bufferedPackets++;
+
+    PltUnlockMutex(&jitterBuffer->mutex);
+}
+
+// The mutex must be held and the slot must hold a packet
+static PRTP_PACKET removePacket(PAUDIO_JITTER_BUFFER jitterBuffer, unsigned short sequenceNumber) {
+    PRTP_PACKET* slot = getSlot(jitterBuffer, sequenceNumber);
+    PRTP_PACKET packet = *slot;
+
+    LC_ASSERT(packet != NULL);
+
+    *slot = NULL;
+    jitterBuffer->bufferedPackets--;
+    return packet;
+}
+
+// This must be called once per packet duration by the playout thread.
+// Returns one of the AJB_RET_XXX values.
+int AjbGetNextPacket(PAUDIO_JITTER_BUFFER jitterBuffer, PRTP_PACKET* packet) {
+    PRTP_PACKET nextPacket;
+    int ret;
+
+    *packet = NULL;
+
+    PltLockMutex(&jitterBuffer->mutex);
+
+    if (jitterBuffer->resyncPending) {
+        flushPackets(jitterBuffer);
+        jitterBuffer->resyncPending = 0;
+        jitterBuffer->receivedFirstPacket = 0;
+        jitterBuffer->playing = 0;
+        PltUnlockMutex(&jitterBuffer->mutex);
+        return AJB_RET_WAIT;
+    }
+
+    if (!jitterBuffer->playing) {
+        if (jitterBuffer->bufferedPackets == 0) {
+            PltUnlockMutex(&jitterBuffer->mutex);
+            return AJB_RET_WAIT;
+        }
+
+        // Start from the earliest packet buffered
+        while (*getSlot(jitterBuffer, jitterBuffer->nextSequenceNumber) == NULL) {
+            jitterBuffer->nextSequenceNumber++;
+        }
+
+        if (getDepth(jitterBuffer) < jitterBuffer->targetDepth) {
+            PltUnlockMutex(&jitterBuffer->mutex);
+            return AJB_RET_WAIT;
+        }
+
+        jitterBuffer->playing = 1;
+        jitterBuffer->emptyPackets = 0;
+        jitterBuffer->packetsSinceDiscard = 0;
+    }
+
+    if (*getSlot(jitterBuffer, jitterBuffer->nextSequenceNumber) != NULL) {
+        if (getDepth(jitterBuffer) > jitterBuffer->targetDepth + AJB_DEPTH_HYSTERESIS &&
+            jitterBuffer->packetsSinceDiscard >= AJB_DISCARD_INTERVAL &&
+            *getSlot(jitterBuffer, jitterBuffer->nextSequenceNumber + 1) != NULL) {
+            // Reduce the delay by skipping a packet
+            PpFreeBuffer(jitterBuffer->packetPool, removePacket(jitterBuffer, jitterBuffer->nextSequenceNumber));
+            jitterBuffer->nextSequenceNumber++;
+            jitterBuffer->discardedPackets++;
+            jitterBuffer->packetsSinceDiscard = 0;
+        }
+
+        *packet = removePacket(jitterBuffer, jitterBuffer->nextSequenceNumber);
+        jitterBuffer->emptyPackets = 0;
+        ret = AJB_RET_PLAY;
+    }
+    else if (jitterBuffer->bufferedPackets == 0) {
+        if (++jitterBuffer->emptyPackets > AJB_MAX_EMPTY_PACKETS) {
+            jitterBuffer->playing = 0;
+            PltUnlockMutex(&jitterBuffer->mutex);
+            return AJB_RET_WAIT;
+        }
+
+        // Nothing after the missing packet has arrived, so it's more likely
+        // late than lost. Conceal in the meantime but keep waiting for it,
+        // which stretches the playout delay to cover it.
+        jitterBuffer->concealedPackets++;
+        PltUnlockMutex(&jitterBuffer->mutex);
+        return AJB_RET_CONCEAL;
+    }
+    else {
+        // Later packets have arrived, so this one is lost
+        jitterBuffer->emptyPackets = 0;
+        jitterBuffer->concealedPackets++;
+
+        nextPacket = *getSlot(jitterBuffer, jitterBuffer->nextSequenceNumber + 1);
+        if (jitterBuffer->useFec && nextPacket != NULL) {
+            // Only the playout thread removes packets, so this one stays
+            // valid after we drop the lock
+            jitterBuffer->fecRecoveredPackets++;
+            *packet = nextPacket;
+            ret = AJB_RET_FEC;
+        }
+        else {
+            ret = AJB_RET_CONCEAL;
+        }
+    }
+
+    jitterBuffer->nextSequenceNumber++;
+    jitterBuffer->packetsSinceDiscard++;
+
+    PltUnlockMutex(&jitterBuffer->mutex);
+    return ret;
+}
+
+// This may be called from any thread. It doesn't take the mutex, so it's
+// safe to call while the buffer is being torn down, but the values may be
+// slightly inconsistent with each other.
+void AjbGetStats(PAUDIO_JITTER_BUFFER jitterBuffer, PAUDIO_JITTER_BUFFER_STATS stats) {
+    stats->depth = getDepth(jitterBuffer);
+    stats->targetDepth = jitterBuffer->targetDepth;
+    stats->concealedPackets = jitterBuffer->concealedPackets;
+    stats->fecRecoveredPackets = jitterBuffer->fecRecoveredPackets;
+    stats->latePackets = jitterBuffer->latePackets;
+    stats->discardedPackets = jitterBuffer->discardedPackets;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Video.h"
+#include "PacketPool.h"
+#include "PlatformThreads.h"
+
+// Packets may be buffered at most this many sequence numbers ahead of the
+// next one to play. This must be a power of two.
+#define AJB_SLOT_COUNT 32
+
+// The depth may exceed the target by this many packets before packets are
+// discarded to bring the delay back down
+#define AJB_DEPTH_HYSTERESIS 2
+
+typedef struct _AUDIO_JITTER_BUFFER_STATS {
+    // Packets currently buffered from the next one to play up to the newest
+    // one received, and the depth that playout aims for
+    int depth;
+    int targetDepth;
+
+    // Packets that were missing at their playout time. Some of them were
+    // recovered from the FEC data in the following packet and the rest
+    // were replaced by packet loss concealment.
+    unsigned int concealedPackets;
+    unsigned int fecRecoveredPackets;
+
+    // Packets that arrived after their playout time, and packets discarded
+    // to reduce the playout delay
+    unsigned int latePackets;
+    unsigned int discardedPackets;
+} AUDIO_JITTER_BUFFER_STATS, *PAUDIO_JITTER_BUFFER_STATS;
+
+// Holds received audio packets until their playout time. The receive thread
+// adds packets and a playout thread takes one packet's worth of audio at a
+// time on its own clock. Missing packets are reported so they can be
+// concealed, and the depth is trimmed back when it grows past the target.
+typedef struct _AUDIO_JITTER_BUFFER {
+    PLT_MUTEX mutex;
+
+    // Packets are allocated from this pool
+    PPACKET_POOL packetPool;
+
+    int minDepth;
+    int maxDepth;
+    int targetDepth;
+    int useFec;
+
+    // Buffered packets indexed by sequence number modulo AJB_SLOT_COUNT
+    PRTP_PACKET slots[AJB_SLOT_COUNT];
+    int bufferedPackets;
+    unsigned short highestSequenceNumber;
+
+    // Set once the first packet has been received since the buffer was last
+    // reset, and once playout has started from it
+    int receivedFirstPacket;
+    int playing;
+    unsigned short nextSequenceNumber;
+
+    // Set by the receive thread when the stream jumps too far ahead. The
+    // playout thread resets the buffer on its next call.
+    int resyncPending;
+
+    // Consecutive packets concealed because nothing was buffered and
+    // packets played since the last discard
+    int emptyPackets;
+    int packetsSinceDiscard;
+
+    unsigned int concealedPackets;
+    unsigned int fecRecoveredPackets;
+    unsigned int latePackets;
+    unsigned int discardedPackets;
+} AUDIO_JITTER_BUFFER, *PAUDIO_JITTER_BUFFER;
+
+// Nothing is ready to play yet
+#define AJB_RET_WAIT     0
+
+// The returned packet should be played and then freed
+#define AJB_RET_PLAY     1
+
+// The packet due now is missing and should be concealed
+#define AJB_RET_CONCEAL  2
+
+// The packet due now is missing, but the returned packet follows it and
+// carries FEC data for it. The returned packet stays in the buffer.
+#define AJB_RET_FEC      3
+
+int AjbInitialize(PAUDIO_JITTER_BUFFER jitterBuffer, PPACKET_POOL packetPool,
+                  int minDepth, int maxDepth, int useFec);
+void AjbCleanup(PAUDIO_JITTER_BUFFER jitterBuffer);
+void AjbSetTargetDepth(PAUDIO_JITTER_BUFFER jitterBuffer, int targetDepth);
+void AjbAddPacket(PAUDIO_JITTER_BUFFER jitterBuffer, PRTP_PACKET packet);
+int AjbGetNextPacket(PAUDIO_JITTER_BUFFER jitterBuffer, PRTP_PACKET* packet);
+void AjbGetStats(PAUDIO_JITTER_BUFFER jitterBuffer, PAUDIO_JITTER_BUFFER_STATS stats);
@@ -3,17 +3,25 @@
 #include "PlatformThreads.h"
 #include "LinkedBlockingQueue.h"
 #include "RtpReorderQueue.h"
+#include "JitterEstimator.h"
+#include "PacketPool.h"
+#include "AudioJitterBuffer.h"
 
 static SOCKET rtpSocket = INVALID_SOCKET;
 
+static PACKET_POOL packetPool;
 static LINKED_BLOCKING_QUEUE packetQueue;
 static RTP_REORDER_QUEUE rtpReorderQueue;
+static JITTER_ESTIMATOR jitterEstimator;
+static AUDIO_JITTER_BUFFER jitterBuffer;
+static int useJitterBuffer;
 
 static PLT_THREAD udpPingThread;
 static PLT_THREAD receiveThread;
 static PLT_THREAD decoderThread;
 
 static unsigned short lastSeq;
+static unsigned int packetsDroppedNoBuffer;
 
 #define RTP_PORT 48000
 
@@ -24,8 +32,34 @@ static unsigned short lastSeq;
 // for longer than normal.
 #define RTP_RECV_BUFFER (64 * 1024)
 
+// Audio arrives every few milliseconds, so we only need a small batch
+// to drain packets that queued up while we were busy.
+#define RTP_RECV_BATCH_SIZE 8
+
+// Maximum number of packets waiting for the decoder thread
+#define PACKET_QUEUE_SIZE 30
+
+// Packets can be in the receive batch, the reorder queue, the decoder
+// queue and the decoder thread at the same time. This also covers the
+// receive batch and a full jitter buffer when that is used instead.
+#define PACKET_POOL_SIZE (RTP_RECV_BATCH_SIZE + RTPQ_DEFAULT_MAX_SIZE + PACKET_QUEUE_SIZE + 1)
+
 #define SAMPLE_RATE 48000
 
+// Each audio packet holds 5 ms of audio
+#define PACKET_DURATION_US 5000
+
+// If the playout thread falls this far behind, it restarts its schedule
+// rather than playing a burst of packets to catch up
+#define MAX_PLAYOUT_LAG_US 100000
+
+// Audio RTP timestamps count milliseconds
+#define RTP_CLOCK_RATE 1000
+
+// Upper bound on how long the reorder queue waits for a missing packet
+// unless the stream configuration specifies one
+#define DEFAULT_MAX_REORDER_WINDOW_MS 60
+
 static OPUS_MULTISTREAM_CONFIGURATION opusStereoConfig = {
     .sampleRate = SAMPLE_RATE,
     .channelCount = 2,
@@ -61,13 +95,63 @@ typedef struct _QUEUED_AUDIO_PACKET {
     } q;
 } QUEUED_AUDIO_PACKET, *PQUEUED_AUDIO_PACKET;
 
+// Returns how many packets the jitter buffer must hold to cover a wait for
+// late packets of the given length, including the packet due now
+static int getJitterBufferDepth(int windowUs) {
+    return 1 + (windowUs + PACKET_DURATION_US - 1) / PACKET_DURATION_US;
+}
+
 // Initialize the audio stream
 void initializeAudioStream(void) {
-    if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-        LbqInitializeLinkedBlockingQueue(&packetQueue, 30);
+    int maxReorderWindowMs;
+    int minDepth;
+    int maxDepth;
+
+    if (PpInitializeFixedPool(&packetPool, sizeof(QUEUED_AUDIO_PACKET), PACKET_POOL_SIZE) < 0) {
+        // Every packet will be dropped and counted in the stats
+        Limelog("Audio packet pool allocation failed\n");
     }
-    RtpqInitializeQueue(&rtpReorderQueue, RTPQ_DEFAULT_MAX_SIZE, RTPQ_DEFAULT_QUEUE_TIME);
+
+    // The jitter buffer needs its own thread to play packets out
+    useJitterBuffer = (AudioCallbacks.capabilities & CAPABILITY_AUDIO_JITTER_BUFFER) != 0 &&
+        (AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0;
+
+    if (useJitterBuffer) {
+        maxReorderWindowMs = StreamConfig.maxReorderWindowMs != 0 ?
+            StreamConfig.maxReorderWindowMs : DEFAULT_MAX_REORDER_WINDOW_MS;
+        maxDepth = getJitterBufferDepth(maxReorderWindowMs * 1000);
+        if (maxDepth > AJB_SLOT_COUNT - AJB_DEPTH_HYSTERESIS - 1) {
+            maxDepth = AJB_SLOT_COUNT - AJB_DEPTH_HYSTERESIS - 1;
+        }
+
+        // FEC recovery needs the packet after a lost one to be buffered
+        // by the time the lost one is due
+        minDepth = AudioCallbacks.decodeAndPlayFecSample != NULL ? 2 : 1;
+
+        if (AjbInitialize(&jitterBuffer, &packetPool, minDepth, maxDepth,
+                          AudioCallbacks.decodeAndPlayFecSample != NULL) != 0) {
+            // Fall back to the decoder queue
+            Limelog("Audio jitter buffer initialization failed\n");
+            useJitterBuffer = 0;
+        }
+    }
+
+    if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0 && !useJitterBuffer) {
+        if (StreamConfig.lockFreeQueues & LOCK_FREE_QUEUE_AUDIO) {
+            LbqInitializeLockFreeQueue(&packetQueue, PACKET_QUEUE_SIZE);
+        }
+        else {
+            LbqInitializeLinkedBlockingQueue(&packetQueue, PACKET_QUEUE_SIZE);
+        }
+    }
+    JeInitialize(&jitterEstimator, RTP_CLOCK_RATE,
+                 StreamConfig.minReorderWindowMs,
+                 StreamConfig.maxReorderWindowMs != 0 ?
+                     StreamConfig.maxReorderWindowMs : DEFAULT_MAX_REORDER_WINDOW_MS);
+    RtpqInitializeQueue(&rtpReorderQueue, &packetPool, RTPQ_DEFAULT_MAX_SIZE,
+                        JeGetWindowUs(&jitterEstimator));
     lastSeq = 0;
+    packetsDroppedNoBuffer = 0;
 }
 
 static void freePacketList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
@@ -76,8 +160,8 @@ static void freePacketList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
     while (entry != NULL) {
         nextEntry = entry->flink;
 
-        // The entry is stored within the data allocation
-        free(entry->data);
+        // The entry is stored within the packet buffer
+        PpFreeBuffer(&packetPool, entry->data);
 
         entry = nextEntry;
     }
@@ -85,10 +169,41 @@ static void freePacketList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
 
 // Tear down the audio stream once we're done with it
 void destroyAudioStream(void) {
-    if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+    if (useJitterBuffer) {
+        AjbCleanup(&jitterBuffer);
+    }
+    else if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
         freePacketList(LbqDestroyLinkedBlockingQueue(&packetQueue));
     }
     RtpqCleanupQueue(&rtpReorderQueue);
+    PpDestroyPool(&packetPool);
+}
+
+void LiGetAudioStreamStats(PAUDIO_STREAM_STATS stats) {
+    PACKET_POOL_STATS poolStats;
+    AUDIO_JITTER_BUFFER_STATS jitterBufferStats;
+
+    memset(stats, 0, sizeof(*stats));
+
+    PpGetPoolStats(&packetPool, &poolStats);
+    stats->packetPoolBuffers = poolStats.totalBuffers;
+    stats->packetPoolBuffersInUse = poolStats.buffersInUse;
+    stats->packetPoolPeakBuffersInUse = poolStats.peakBuffersInUse;
+    stats->packetPoolDroppedPackets = packetsDroppedNoBuffer;
+
+    stats->reorderWindowUs = JeGetWindowUs(&jitterEstimator);
+    stats->jitterUs = JeGetJitterUs(&jitterEstimator);
+    stats->reorderDepth = JeGetReorderDepth(&jitterEstimator);
+
+    if (useJitterBuffer) {
+        AjbGetStats(&jitterBuffer, &jitterBufferStats);
+        stats->jitterBufferDepth = jitterBufferStats.depth;
+        stats->jitterBufferTargetDepth = jitterBufferStats.targetDepth;
+        stats->concealedPackets = jitterBufferStats.concealedPackets;
+        stats->fecRecoveredPackets = jitterBufferStats.fecRecoveredPackets;
+        stats->latePackets = jitterBufferStats.latePackets;
+        stats->discardedPackets = jitterBufferStats.discardedPackets;
+    }
 }
 
 static void UdpPingThreadProc(void* context) {
@@ -147,13 +262,93 @@ static void decodeInputData(PQUEUED_AUDIO_PACKET packet) {
     AudioCallbacks.decodeAndPlaySample((char*)(rtp + 1), packet->size - sizeof(*rtp));
 }
 
-static void ReceiveThreadProc(void* context) {
+// Passes a received packet to the reorder queue and submits any packets that are ready.
+// Returns 0 if an exit signal was received. *packet is set to NULL if the packet
+// is no longer owned by the caller.
+static int handleReceivedPacket(PQUEUED_AUDIO_PACKET* packet) {
     PRTP_PACKET rtp;
-    PQUEUED_AUDIO_PACKET packet;
+    PQUEUED_AUDIO_PACKET queuedPacket;
     int queueStatus;
+    int ret;
+
+    if ((*packet)->size < sizeof(RTP_PACKET)) {
+        // Runt packet
+        return 1;
+    }
+
+    rtp = (PRTP_PACKET)&(*packet)->data[0];
+    if (rtp->packetType != 97) {
+        // Not audio
+        return 1;
+    }
+
+    // RTP sequence number must be in host order for the RTP queue
+    rtp->sequenceNumber = htons(rtp->sequenceNumber);
+
+    JeAddPacket(&jitterEstimator, rtp->sequenceNumber, ntohl(rtp->timestamp), PltGetMicros());
+
+    if (useJitterBuffer) {
+        // The jitter buffer puts packets back in order itself
+        AjbSetTargetDepth(&jitterBuffer, getJitterBufferDepth(JeGetWindowUs(&jitterEstimator)));
+        AjbAddPacket(&jitterBuffer, (PRTP_PACKET)*packet);
+        *packet = NULL;
+        return 1;
+    }
+
+    RtpqSetMaxQueueTime(&rtpReorderQueue, JeGetWindowUs(&jitterEstimator));
+
+    queueStatus = RtpqAddPacket(&rtpReorderQueue, (PRTP_PACKET)*packet, &(*packet)->q.rentry);
+    if (RTPQ_HANDLE_NOW(queueStatus)) {
+        if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+            return queuePacketToLbq(packet);
+        }
+        else {
+            decodeInputData(*packet);
+        }
+    }
+    else {
+        if (RTPQ_PACKET_CONSUMED(queueStatus)) {
+            // The queue consumed our packet, so we must allocate a new one
+            *packet = NULL;
+        }
+
+        if (RTPQ_PACKET_READY(queueStatus)) {
+            // If packets are ready, pull them and send them to the decoder
+            while ((queuedPacket = (PQUEUED_AUDIO_PACKET)RtpqGetQueuedPacket(&rtpReorderQueue)) != NULL) {
+                if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+                    ret = queuePacketToLbq(&queuedPacket);
+                }
+                else {
+                    decodeInputData(queuedPacket);
+                    ret = 1;
+                }
+
+                // The LBQ takes ownership of the packet if it was queued
+                if (queuedPacket != NULL) {
+                    PpFreeBuffer(&packetPool, queuedPacket);
+                }
+
+                if (!ret) {
+                    // An exit signal was received
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return 1;
+}
+
+static void ReceiveThreadProc(void* context) {
+    PQUEUED_AUDIO_PACKET packets[RTP_RECV_BATCH_SIZE];
+    char* buffers[RTP_RECV_BATCH_SIZE];
+    char discardBuffer[MAX_PACKET_SIZE];
+    int lengths[RTP_RECV_BATCH_SIZE];
+    int count;
+    int i;
     int useSelect;
 
-    packet = NULL;
+    memset(packets, 0, sizeof(packets));
 
     if (setNonFatalRecvTimeoutMs(rtpSocket, UDP_RECV_POLL_TIMEOUT_MS) < 0) {
         // SO_RCVTIMEO failed, so use select() to wait
@@ -165,83 +360,42 @@ static void ReceiveThreadProc(void* context) {
     }
 
     while (!PltIsThreadInterrupted(&receiveThread)) {
-        if (packet == NULL) {
-            packet = (PQUEUED_AUDIO_PACKET)malloc(sizeof(*packet));
-            if (packet == NULL) {
-                Limelog("Audio Receive: malloc() failed\n");
-                ListenerCallbacks.connectionTerminated(-1);
-                break;
+        for (i = 0; i < RTP_RECV_BATCH_SIZE; i++) {
+            if (packets[i] == NULL) {
+                packets[i] = (PQUEUED_AUDIO_PACKET)PpAllocateBuffer(&packetPool);
             }
+
+            // If the pool is exhausted, keep draining the socket so we don't
+            // fall further behind and drop what arrives in the meantime
+            buffers[i] = packets[i] != NULL ? &packets[i]->data[0] : discardBuffer;
         }
 
-        packet->size = recvUdpSocket(rtpSocket, &packet->data[0], MAX_PACKET_SIZE, useSelect);
-        if (packet->size < 0) {
-            Limelog("Audio Receive: recvUdpSocket() failed: %d\n", (int)LastSocketError());
+        count = recvUdpSocketBatch(rtpSocket, buffers, lengths, RTP_RECV_BATCH_SIZE, MAX_PACKET_SIZE, useSelect);
+        if (count < 0) {
+            Limelog("Audio Receive: recvUdpSocketBatch() failed: %d\n", (int)LastSocketError());
             ListenerCallbacks.connectionTerminated(LastSocketError());
             break;
         }
-        else if (packet->size == 0) {
-            // Receive timed out; try again
-            continue;
-        }
-
-        if (packet->size < sizeof(RTP_PACKET)) {
-            // Runt packet
-            continue;
-        }
-
-        rtp = (PRTP_PACKET)&packet->data[0];
-        if (rtp->packetType != 97) {
-            // Not audio
-            continue;
-        }
 
-        // RTP sequence number must be in host order for the RTP queue
-        rtp->sequenceNumber = htons(rtp->sequenceNumber);
-
-        queueStatus = RtpqAddPacket(&rtpReorderQueue, (PRTP_PACKET)packet, &packet->q.rentry);
-        if (RTPQ_HANDLE_NOW(queueStatus)) {
-            if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                if (!queuePacketToLbq(&packet)) {
-                    // An exit signal was received
-                    break;
-                }
-            }
-            else {
-                decodeInputData(packet);
-            }
-        }
-        else {
-            if (RTPQ_PACKET_CONSUMED(queueStatus)) {
-                // The queue consumed our packet, so we must allocate a new one
-                packet = NULL;
+        for (i = 0; i < count; i++) {
+            if (packets[i] == NULL) {
+                packetsDroppedNoBuffer++;
+                continue;
             }
 
-            if (RTPQ_PACKET_READY(queueStatus)) {
-                // If packets are ready, pull them and send them to the decoder
-                while ((packet = (PQUEUED_AUDIO_PACKET)RtpqGetQueuedPacket(&rtpReorderQueue)) != NULL) {
-                    if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                        if (!queuePacketToLbq(&packet)) {
-                            // An exit signal was received
-                            break;
-                        }
-                    }
-                    else {
-                        decodeInputData(packet);
-                        free(packet);
-                    }
-                }
-                
-                // Break on exit
-                if (packet != NULL) {
-                    break;
-                }
+            packets[i]->size = lengths[i];
+            if (!handleReceivedPacket(&packets[i])) {
+                // An exit signal was received
+                goto Exit;
             }
         }
     }
-    
-    if (packet != NULL) {
-        free(packet);
+
+Exit:
+    for (i = 0; i < RTP_RECV_BATCH_SIZE; i++) {
+        if (packets[i] != NULL) {
+            PpFreeBuffer(&packetPool, packets[i]);
+        }
     }
 }
 
@@ -258,7 +412,51 @@ static void DecoderThreadProc(void* context) {
 
         decodeInputData(packet);
 
-        free(packet);
+        PpFreeBuffer(&packetPool, packet);
+    }
+}
+
+// Passes one packet's worth of audio from the jitter buffer to the renderer
+// per packet duration, on a schedule kept against the start time so that
+// sleep overshoot doesn't accumulate
+static void PlayoutThreadProc(void* context) {
+    PQUEUED_AUDIO_PACKET packet;
+    uint64_t scheduleStartUs = PltGetMicros();
+    uint64_t packetsScheduled = 0;
+    uint64_t deadlineUs;
+    uint64_t nowUs;
+
+    while (!PltIsThreadInterrupted(&decoderThread)) {
+        switch (AjbGetNextPacket(&jitterBuffer, (PRTP_PACKET*)&packet)) {
+        case AJB_RET_PLAY:
+            AudioCallbacks.decodeAndPlaySample((char*)((PRTP_PACKET)packet + 1), packet->size - sizeof(RTP_PACKET));
+            PpFreeBuffer(&packetPool, packet);
+            break;
+
+        case AJB_RET_FEC:
+            // The packet remains in the jitter buffer to be played next
+            AudioCallbacks.decodeAndPlayFecSample((char*)((PRTP_PACKET)packet + 1), packet->size - sizeof(RTP_PACKET));
+            break;
+
+        case AJB_RET_CONCEAL:
+            AudioCallbacks.decodeAndPlaySample(NULL, 0);
+            break;
+
+        default:
+            break;
+        }
+
+        packetsScheduled++;
+        deadlineUs = scheduleStartUs + packetsScheduled * PACKET_DURATION_US;
+        nowUs = PltGetMicros();
+        if (nowUs > deadlineUs + MAX_PLAYOUT_LAG_US) {
+            // The renderer blocked for a long time, so don't try to catch up
+            scheduleStartUs = nowUs;
+            packetsScheduled = 0;
+        }
+        else if (deadlineUs > nowUs) {
+            PltSleepMs((int)((deadlineUs - nowUs + 999) / 1000));
+        }
     }
 }
 
@@ -267,7 +465,10 @@ void stopAudioStream(void) {
 
     PltInterruptThread(&udpPingThread);
     PltInterruptThread(&receiveThread);
-    if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {        
+    if (useJitterBuffer) {
+        PltInterruptThread(&decoderThread);
+    }
+    else if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {        
         // Signal threads waiting on the LBQ
         LbqSignalQueueShutdown(&packetQueue);
         PltInterruptThread(&decoderThread);
@@ -325,7 +526,7 @@ int startAudioStream(void* audioContext, int arFlags) {
         return err;
     }
 
-    err = PltCreateThread(UdpPingThreadProc, NULL, &udpPingThread);
+    err = PltCreateThread("AudioPing", THREAD_ROLE_DEFAULT, UdpPingThreadProc, NULL, &udpPingThread);
     if (err != 0) {
         AudioCallbacks.cleanup();
         closeSocket(rtpSocket);
@@ -334,7 +535,7 @@ int startAudioStream(void* audioContext, int arFlags) {
 
     AudioCallbacks.start();
 
-    err = PltCreateThread(ReceiveThreadProc, NULL, &receiveThread);
+    err = PltCreateThread("AudioRecv", THREAD_ROLE_AUDIO_RECEIVE, ReceiveThreadProc, NULL, &receiveThread);
     if (err != 0) {
         AudioCallbacks.stop();
         PltInterruptThread(&udpPingThread);
@@ -346,7 +547,8 @@ int startAudioStream(void* audioContext, int arFlags) {
     }
 
     if ((AudioCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-        err = PltCreateThread(DecoderThreadProc, NULL, &decoderThread);
+        err = PltCreateThread(useJitterBuffer ? "AudioPlayout" : "AudioDec", THREAD_ROLE_AUDIO_DECODE,
+                              useJitterBuffer ? PlayoutThreadProc : DecoderThreadProc, NULL, &decoderThread);
         if (err != 0) {
             AudioCallbacks.stop();
             PltInterruptThread(&udpPingThread);
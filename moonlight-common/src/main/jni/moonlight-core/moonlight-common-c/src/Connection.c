@@ -151,7 +151,7 @@ static void ClInternalConnectionTerminated(long errorCode)
     alreadyTerminated = 1;
 
     // Invoke the termination callback on a separate thread
-    err = PltCreateThread(terminationCallbackThreadFunc, NULL, &terminationCallbackThread);
+    err = PltCreateThread("AsyncTerm", THREAD_ROLE_DEFAULT, terminationCallbackThreadFunc, NULL, &terminationCallbackThread);
     if (err != 0) {
         // Nothing we can safely do here, so we'll just assert on debug builds
         Limelog("Failed to create termination thread: %d\n", err);
@@ -182,6 +182,9 @@ int LiStartConnection(PSERVER_INFORMATION serverInfo, PSTREAM_CONFIGURATION stre
         err = -1;
         goto Cleanup;
     }
+
+    // Threads created from here on are scheduled according to their role
+    PltSetThreadScheduling(StreamConfig.threadScheduling);
     
     // Extract the appversion from the supplied string
     if (extractVersionQuadFromString(serverInfo->serverInfoAppVersion,
@@ -1,11 +1,18 @@
 #include "Limelight-internal.h"
 #include "PlatformSockets.h"
 #include "PlatformThreads.h"
+#include "PlatformAtomics.h"
+#include "LatencyHistogram.h"
 
 #include "ByteBuffer.h"
 
 #include <enet/enet.h>
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
 // NV control stream packet header for TCP
 typedef struct _NVCTL_TCP_PACKET_HEADER {
     unsigned short type;
@@ -25,19 +32,40 @@ typedef struct _QUEUED_FRAME_INVALIDATION_TUPLE {
 static SOCKET ctlSock = INVALID_SOCKET;
 static ENetHost* client;
 static ENetPeer* peer;
-static PLT_MUTEX enetMutex;
 
+// Gen 3 and 4 servers use these threads to send loss stats and invalidation
+// requests over TCP
 static PLT_THREAD lossStatsThread;
 static PLT_THREAD invalidateRefFramesThread;
 static PLT_EVENT invalidateRefFramesEvent;
+
+// Gen 5+ servers use a single thread that owns the ENet host instead. Other
+// threads hand it packets through a lock-free list linked through the
+// packets' userData, newest first.
+static PLT_THREAD controlIoThread;
+static void* volatile queuedPackets;
+static volatile int controlIoWakePending;
+static volatile int invalidationPending;
+static volatile int controlIoFailed;
+static unsigned int ioWakeups;
+#if defined(__linux__)
+static int controlIoEpollFd = -1;
+static int controlIoWakeFd = -1;
+#endif
+
 static int lossCountSinceLastReport;
 static long lastGoodFrame;
 static long lastSeenFrame;
 static int stopping;
 
 static int idrFrameRequired;
+static uint64_t idrRequestTimeUs;
 static LINKED_BLOCKING_QUEUE invalidReferenceFrameTuples;
 
+static unsigned int idrRequests;
+static unsigned int invalidationRequests;
+static LATENCY_HISTOGRAM idrRequestLatency;
+
 #define IDX_START_A 0
 #define IDX_REQUEST_IDR_FRAME 0
 #define IDX_START_B 1
@@ -145,12 +173,18 @@ static char**preconstructedPayloads;
 
 #define LOSS_REPORT_INTERVAL_MS 50
 
+// Without an eventfd, the control stream I/O thread looks for queued work
+// this often
+#define CONTROL_IO_POLL_INTERVAL_MS 5
+
 // Initializes the control stream
 int initializeControlStream(void) {
     stopping = 0;
     PltCreateEvent(&invalidateRefFramesEvent);
     LbqInitializeLinkedBlockingQueue(&invalidReferenceFrameTuples, 20);
-    PltCreateMutex(&enetMutex);
+    controlIoWakePending = 0;
+    invalidationPending = 0;
+    controlIoFailed = 0;
 
     if (AppVersionQuad[0] == 3) {
         packetTypes = (short*)packetTypesGen3;
@@ -174,10 +208,13 @@ int initializeControlStream(void) {
     }
 
     idrFrameRequired = 0;
+    idrRequestTimeUs = 0;
     lastGoodFrame = 0;
     lastSeenFrame = 0;
     lossCountSinceLastReport = 0;
 
+    LiResetControlStreamStats();
+
     return 0;
 }
 
@@ -191,12 +228,55 @@ void freeFrameInvalidationList(PLINKED_BLOCKING_QUEUE_ENTRY entry) {
     }
 }
 
+// Stop a control stream that was initialized but never started
+void stopIdleControlStream(void) {
+    stopping = 1;
+    LbqSignalQueueShutdown(&invalidReferenceFrameTuples);
+}
+
 // Cleans up control stream
 void destroyControlStream(void) {
     LC_ASSERT(stopping);
     PltCloseEvent(&invalidateRefFramesEvent);
     freeFrameInvalidationList(LbqDestroyLinkedBlockingQueue(&invalidReferenceFrameTuples));
-    PltDeleteMutex(&enetMutex);
+}
+
+// Wakes the control stream I/O thread. Only the first wakeup since the
+// thread last woke needs to be signalled.
+static void wakeControlIoThread(void) {
+#if defined(__linux__)
+    uint64_t count = 1;
+#endif
+
+    if (PltAtomicCompareExchangeInt(&controlIoWakePending, 0, 1) != 0) {
+        return;
+    }
+
+#if defined(__linux__)
+    if (write(controlIoWakeFd, &count, sizeof(count)) < 0) {
+        // The thread isn't running yet and will look at the queue when it starts
+    }
+#endif
+}
+
+// Wakes the thread that sends invalidation and IDR frame requests
+static void signalInvalidationRequest(void) {
+    if (AppVersionQuad[0] >= 5) {
+        PltAtomicCompareExchangeInt(&invalidationPending, 0, 1);
+        wakeControlIoThread();
+    }
+    else {
+        PltSetEvent(&invalidateRefFramesEvent);
+    }
+}
+
+// Records that an IDR frame is needed. The time of the first request is kept
+// until the IDR frame request is sent.
+static void setIdrFrameRequired(void) {
+    if (!idrFrameRequired) {
+        idrRequestTimeUs = PltGetMicros();
+        idrFrameRequired = 1;
+    }
 }
 
 int getNextFrameInvalidationTuple(PQUEUED_FRAME_INVALIDATION_TUPLE* qfit) {
@@ -216,24 +296,24 @@ void queueFrameInvalidationTuple(int startFrame, int endFrame) {
             if (LbqOfferQueueItem(&invalidReferenceFrameTuples, qfit, &qfit->entry) == LBQ_BOUND_EXCEEDED) {
                 // Too many invalidation tuples, so we need an IDR frame now
                 free(qfit);
-                idrFrameRequired = 1;
+                setIdrFrameRequired();
             }
         }
         else {
-            idrFrameRequired = 1;
+            setIdrFrameRequired();
         }
     }
     else {
-        idrFrameRequired = 1;
+        setIdrFrameRequired();
     }
 
-    PltSetEvent(&invalidateRefFramesEvent);
+    signalInvalidationRequest();
 }
 
 // Request an IDR frame on demand by the decoder
 void requestIdrOnDemand(void) {
-    idrFrameRequired = 1;
-    PltSetEvent(&invalidateRefFramesEvent);
+    setIdrFrameRequired();
+    signalInvalidationRequest();
 }
 
 // Invalidate reference frames lost by the network
@@ -283,9 +363,10 @@ static PNVCTL_TCP_PACKET_HEADER readNvctlPacketTcp(void) {
     return fullPacket;
 }
 
-static int sendMessageEnet(short ptype, short paylen, const void* payload) {
-    PNVCTL_ENET_PACKET_HEADER packet;
-    ENetPacket* enetPacket;
+// Processes incoming ENet events before sending. Servicing the host also
+// transmits any queued messages. This must be called on the thread that
+// owns the ENet host.
+static int serviceEnetHostForSend(void) {
     ENetEvent event;
     int err;
 
@@ -307,34 +388,125 @@ static int sendMessageEnet(short ptype, short paylen, const void* payload) {
         return 0;
     }
 
-    packet = malloc(sizeof(*packet) + paylen);
-    if (packet == NULL) {
-        return 0;
+    return 1;
+}
+
+// Builds a control message in a new ENet packet. This doesn't touch the
+// ENet host, so it may be called from any thread.
+static ENetPacket* createMessageEnet(short ptype, short paylen, const void* payload) {
+    PNVCTL_ENET_PACKET_HEADER packet;
+    ENetPacket* enetPacket;
+
+    enetPacket = enet_packet_create(NULL, sizeof(*packet) + paylen, ENET_PACKET_FLAG_RELIABLE);
+    if (enetPacket == NULL) {
+        return NULL;
     }
 
+    packet = (PNVCTL_ENET_PACKET_HEADER)enetPacket->data;
     packet->type = ptype;
     memcpy(&packet[1], payload, paylen);
 
-    enetPacket = enet_packet_create(packet, sizeof(*packet) + paylen, ENET_PACKET_FLAG_RELIABLE);
-    if (enetPacket == NULL) {
-        free(packet);
-        return 0;
-    }
+    return enetPacket;
+}
 
+// Queues a packet for the next flush of the ENet host. The packet is
+// destroyed if it can't be queued. This must be called on the thread that
+// owns the ENet host.
+static int queuePacketEnet(ENetPacket* enetPacket) {
     if (enet_peer_send(peer, 0, enetPacket) < 0) {
         Limelog("Failed to send ENet control packet\n");
         enet_packet_destroy(enetPacket);
-        free(packet);
         return 0;
     }
-    
-    enet_host_flush(client);
 
-    free(packet);
+    return 1;
+}
+
+// Sends a message right away. This must be called on the thread that owns
+// the ENet host.
+static int sendMessageEnet(short ptype, short paylen, const void* payload) {
+    ENetPacket* enetPacket;
+
+    if (!serviceEnetHostForSend()) {
+        return 0;
+    }
+
+    enetPacket = createMessageEnet(ptype, paylen, payload);
+    if (enetPacket == NULL || !queuePacketEnet(enetPacket)) {
+        return 0;
+    }
+
+    enet_host_flush(client);
 
     return 1;
 }
 
+// Hands packets built by another thread to the control stream I/O thread.
+// The packets are linked from newest to oldest through their userData.
+static void queuePacketsForControlIo(ENetPacket* newestPacket, ENetPacket* oldestPacket) {
+    void* head;
+
+    do {
+        head = PltAtomicLoadPtr(&queuedPackets);
+        oldestPacket->userData = head;
+    } while (PltAtomicCompareExchangePtr(&queuedPackets, head, newestPacket) != head);
+
+    wakeControlIoThread();
+}
+
+// Takes every packet queued by other threads, oldest first
+static ENetPacket* takeQueuedPackets(void) {
+    ENetPacket* enetPacket;
+    ENetPacket* nextPacket;
+    ENetPacket* oldestPacket;
+
+    enetPacket = PltAtomicExchangePtr(&queuedPackets, NULL);
+
+    // Reverse the list to restore the order they were queued in
+    oldestPacket = NULL;
+    while (enetPacket != NULL) {
+        nextPacket = enetPacket->userData;
+        enetPacket->userData = oldestPacket;
+        oldestPacket = enetPacket;
+        enetPacket = nextPacket;
+    }
+
+    return oldestPacket;
+}
+
+// Queues every packet handed to the I/O thread for the next flush of the
+// ENet host. This must be called on the control stream I/O thread.
+static int queuePacketsFromOtherThreads(void) {
+    ENetPacket* enetPacket;
+    ENetPacket* nextPacket;
+    int ret;
+
+    ret = 1;
+    for (enetPacket = takeQueuedPackets(); enetPacket != NULL; enetPacket = nextPacket) {
+        nextPacket = enetPacket->userData;
+        enetPacket->userData = NULL;
+
+        if (!ret) {
+            enet_packet_destroy(enetPacket);
+        }
+        else if (!queuePacketEnet(enetPacket)) {
+            ret = 0;
+        }
+    }
+
+    return ret;
+}
+
+static void destroyQueuedPackets(void) {
+    ENetPacket* enetPacket;
+    ENetPacket* nextPacket;
+
+    for (enetPacket = takeQueuedPackets(); enetPacket != NULL; enetPacket = nextPacket) {
+        nextPacket = enetPacket->userData;
+        enet_packet_destroy(enetPacket);
+    }
+}
+
 static int sendMessageTcp(short ptype, short paylen, const void* payload) {
     PNVCTL_TCP_PACKET_HEADER packet;
     SOCK_RET err;
@@ -360,15 +532,15 @@ static int sendMessageTcp(short ptype, short paylen, const void* payload) {
     return 1;
 }
 
+// Unlike regular sockets, ENet sockets aren't safe to invoke from multiple
+// threads at once. On Gen 5+ servers, these must only be called on the thread
+// that owns the ENet host: the control stream I/O thread once it is running,
+// or the thread starting the control stream before then.
 static int sendMessageAndForget(short ptype, short paylen, const void* payload) {
     int ret;
 
-    // Unlike regular sockets, ENet sockets aren't safe to invoke from multiple
-    // threads at once. We have to synchronize them with a lock.
     if (AppVersionQuad[0] >= 5) {
-        PltLockMutex(&enetMutex);
         ret = sendMessageEnet(ptype, paylen, payload);
-        PltUnlockMutex(&enetMutex);
     }
     else {
         ret = sendMessageTcp(ptype, paylen, payload);
@@ -379,14 +551,9 @@ static int sendMessageAndForget(short ptype, short paylen, const void* payload)
 
 static int sendMessageAndDiscardReply(short ptype, short paylen, const void* payload) {
     if (AppVersionQuad[0] >= 5) {
-        PltLockMutex(&enetMutex);
-
         if (!sendMessageEnet(ptype, paylen, payload)) {
-            PltUnlockMutex(&enetMutex);
             return 0;
         }
-
-        PltUnlockMutex(&enetMutex);
     }
     else {
         PNVCTL_TCP_PACKET_HEADER reply;
@@ -407,9 +574,34 @@ static int sendMessageAndDiscardReply(short ptype, short paylen, const void* pay
     return 1;
 }
 
+static int sendLossStats(char* lossStatsPayload) {
+    BYTE_BUFFER byteBuffer;
+
+    // Construct the payload
+    BbInitializeWrappedBuffer(&byteBuffer, lossStatsPayload, 0, payloadLengths[IDX_LOSS_STATS], BYTE_ORDER_LITTLE);
+    BbPutInt(&byteBuffer, lossCountSinceLastReport);
+    BbPutInt(&byteBuffer, LOSS_REPORT_INTERVAL_MS);
+    BbPutInt(&byteBuffer, 1000);
+    BbPutLong(&byteBuffer, lastGoodFrame);
+    BbPutInt(&byteBuffer, 0);
+    BbPutInt(&byteBuffer, 0);
+    BbPutInt(&byteBuffer, 0x14);
+
+    // Send the message (and don't expect a response)
+    if (!sendMessageAndForget(packetTypes[IDX_LOSS_STATS],
+        payloadLengths[IDX_LOSS_STATS], lossStatsPayload)) {
+        Limelog("Loss Stats: Transaction failed: %d\n", (int)LastSocketError());
+        return 0;
+    }
+
+    // Clear the transient state
+    lossCountSinceLastReport = 0;
+
+    return 1;
+}
+
 static void lossStatsThreadFunc(void* context) {
     char*lossStatsPayload;
-    BYTE_BUFFER byteBuffer;
 
     lossStatsPayload = malloc(payloadLengths[IDX_LOSS_STATS]);
     if (lossStatsPayload == NULL) {
@@ -419,28 +611,12 @@ static void lossStatsThreadFunc(void* context) {
     }
 
     while (!PltIsThreadInterrupted(&lossStatsThread)) {
-        // Construct the payload
-        BbInitializeWrappedBuffer(&byteBuffer, lossStatsPayload, 0, payloadLengths[IDX_LOSS_STATS], BYTE_ORDER_LITTLE);
-        BbPutInt(&byteBuffer, lossCountSinceLastReport);
-        BbPutInt(&byteBuffer, LOSS_REPORT_INTERVAL_MS);
-        BbPutInt(&byteBuffer, 1000);
-        BbPutLong(&byteBuffer, lastGoodFrame);
-        BbPutInt(&byteBuffer, 0);
-        BbPutInt(&byteBuffer, 0);
-        BbPutInt(&byteBuffer, 0x14);
-
-        // Send the message (and don't expect a response)
-        if (!sendMessageAndForget(packetTypes[IDX_LOSS_STATS],
-            payloadLengths[IDX_LOSS_STATS], lossStatsPayload)) {
+        if (!sendLossStats(lossStatsPayload)) {
             free(lossStatsPayload);
-            Limelog("Loss Stats: Transaction failed: %d\n", (int)LastSocketError());
             ListenerCallbacks.connectionTerminated(LastSocketError());
             return;
         }
 
-        // Clear the transient state
-        lossCountSinceLastReport = 0;
-
         // Wait a bit
         PltSleepMs(LOSS_REPORT_INTERVAL_MS);
     }
@@ -448,7 +624,7 @@ static void lossStatsThreadFunc(void* context) {
     free(lossStatsPayload);
 }
 
-static void requestIdrFrame(void) {
+static void requestIdrFrame(uint64_t requestTimeUs) {
     long long payload[3];
 
     if (AppVersionQuad[0] >= 5) {
@@ -482,6 +658,9 @@ static void requestIdrFrame(void) {
         }
     }
 
+    idrRequests++;
+    LhAddSample(&idrRequestLatency, PltGetMicros() - requestTimeUs);
+
     Limelog("IDR frame request sent\n");
 }
 
@@ -516,9 +695,30 @@ static void requestInvalidateReferenceFrames(void) {
         return;
     }
 
+    invalidationRequests++;
+
     Limelog("Invalidate reference frame request sent (%d to %d)\n", (int)payload[0], (int)payload[1]);
 }
 
+static void processInvalidationRequests(void) {
+    // Sometimes we absolutely need an IDR frame
+    if (idrFrameRequired) {
+        // Empty invalidate reference frames tuples
+        PQUEUED_FRAME_INVALIDATION_TUPLE qfit;
+        while (getNextFrameInvalidationTuple(&qfit)) {
+            free(qfit);
+        }
+
+        // Send an IDR frame request
+        idrFrameRequired = 0;
+        requestIdrFrame(idrRequestTimeUs);
+    }
+    else {
+        // Otherwise invalidate reference frames
+        requestInvalidateReferenceFrames();
+    }
+}
+
 static void invalidateRefFramesFunc(void* context) {
     while (!PltIsThreadInterrupted(&invalidateRefFramesThread)) {
         // Wait for a request to invalidate reference frames
@@ -530,46 +730,173 @@ static void invalidateRefFramesFunc(void* context) {
             break;
         }
 
-        // Sometimes we absolutely need an IDR frame
-        if (idrFrameRequired) {
-            // Empty invalidate reference frames tuples
-            PQUEUED_FRAME_INVALIDATION_TUPLE qfit;
-            while (getNextFrameInvalidationTuple(&qfit)) {
-                free(qfit);
+        processInvalidationRequests();
+    }
+}
+
+// Waits until another thread hands work to the control stream I/O thread,
+// the server sends something, or the timeout expires
+static void waitForControlIo(int timeoutMs) {
+#if defined(__linux__)
+    struct epoll_event events[2];
+    uint64_t count;
+    int eventCount;
+    int i;
+
+    eventCount = epoll_wait(controlIoEpollFd, events, 2, timeoutMs);
+    for (i = 0; i < eventCount; i++) {
+        if (events[i].data.fd == controlIoWakeFd) {
+            // Reset the eventfd for the next wakeup
+            if (read(controlIoWakeFd, &count, sizeof(count)) < 0) {
+                // Another read already reset it
             }
+        }
+    }
+#else
+    enet_uint32 condition = ENET_SOCKET_WAIT_RECEIVE;
+
+    // Without an eventfd to wait on, look for queued work every few milliseconds
+    if (timeoutMs > CONTROL_IO_POLL_INTERVAL_MS) {
+        timeoutMs = CONTROL_IO_POLL_INTERVAL_MS;
+    }
+    enet_socket_wait(client->socket, &condition, timeoutMs);
+#endif
+}
 
-            // Send an IDR frame request
-            idrFrameRequired = 0;
-            requestIdrFrame();
+// On Gen 5+ servers, this thread owns the ENet host. It sends the messages
+// handed to it by other threads, the loss stats and invalidation requests,
+// and runs ENet's receive and retransmission processing. It sleeps until
+// one of those needs attention rather than polling the host.
+static void controlIoThreadFunc(void* context) {
+    char* lossStatsPayload;
+    uint64_t nextLossStatsTimeUs;
+    uint64_t now;
+
+    lossStatsPayload = malloc(payloadLengths[IDX_LOSS_STATS]);
+    if (lossStatsPayload == NULL) {
+        Limelog("Loss Stats: malloc() failed\n");
+        PltAtomicStoreInt(&controlIoFailed, 1);
+        ListenerCallbacks.connectionTerminated(-1);
+        return;
+    }
+
+    nextLossStatsTimeUs = PltGetMicros();
+    while (!PltIsThreadInterrupted(&controlIoThread)) {
+        // Allow the next wakeup to be signalled before looking for work.
+        // Work handed over after this point will wake us again.
+        PltAtomicStoreInt(&controlIoWakePending, 0);
+        PltAtomicMemoryBarrier();
+
+        if (PltAtomicCompareExchangeInt(&invalidationPending, 1, 0) == 1 && !stopping) {
+            processInvalidationRequests();
         }
-        else {
-            // Otherwise invalidate reference frames
-            requestInvalidateReferenceFrames();
+
+        now = PltGetMicros();
+        if (now >= nextLossStatsTimeUs) {
+            if (!sendLossStats(lossStatsPayload)) {
+                break;
+            }
+
+            nextLossStatsTimeUs = now + LOSS_REPORT_INTERVAL_MS * 1000;
+        }
+
+        // Receive from the server and send the other threads' messages with
+        // a single flush. Servicing the host also runs retransmissions.
+        if (!serviceEnetHostForSend() || !queuePacketsFromOtherThreads()) {
+            Limelog("Control stream: Transaction failed: %d\n", (int)LastSocketError());
+            break;
         }
+        enet_host_flush(client);
+
+        now = PltGetMicros();
+        waitForControlIo(now < nextLossStatsTimeUs ?
+                         (int)((nextLossStatsTimeUs - now + 999) / 1000) : 0);
+        ioWakeups++;
     }
+
+    free(lossStatsPayload);
+
+    if (!PltIsThreadInterrupted(&controlIoThread)) {
+        // Input sent from now on will fail
+        PltAtomicStoreInt(&controlIoFailed, 1);
+        ListenerCallbacks.connectionTerminated(LastSocketError());
+    }
+}
+
+static void closeControlIoHandles(void) {
+#if defined(__linux__)
+    if (controlIoEpollFd >= 0) {
+        close(controlIoEpollFd);
+        controlIoEpollFd = -1;
+    }
+    if (controlIoWakeFd >= 0) {
+        close(controlIoWakeFd);
+        controlIoWakeFd = -1;
+    }
+#endif
+}
+
+static int startControlIoThread(void) {
+#if defined(__linux__)
+    struct epoll_event event;
+
+    controlIoWakeFd = eventfd(0, EFD_NONBLOCK);
+    controlIoEpollFd = epoll_create(2);
+    if (controlIoWakeFd < 0 || controlIoEpollFd < 0) {
+        Limelog("Control stream: Failed to create epoll or eventfd: %d\n", errno);
+        closeControlIoHandles();
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = controlIoWakeFd;
+    if (epoll_ctl(controlIoEpollFd, EPOLL_CTL_ADD, controlIoWakeFd, &event) < 0) {
+        closeControlIoHandles();
+        return -1;
+    }
+
+    event.data.fd = client->socket;
+    if (epoll_ctl(controlIoEpollFd, EPOLL_CTL_ADD, client->socket, &event) < 0) {
+        closeControlIoHandles();
+        return -1;
+    }
+#endif
+
+    return PltCreateThread("ControlIO", THREAD_ROLE_CONTROL, controlIoThreadFunc, NULL, &controlIoThread);
 }
 
 // Stops the control stream
 int stopControlStream(void) {
     stopping = 1;
     LbqSignalQueueShutdown(&invalidReferenceFrameTuples);
-    PltSetEvent(&invalidateRefFramesEvent);
 
     // This must be set to stop in a timely manner
     LC_ASSERT(ConnectionInterrupted);
 
-    if (ctlSock != INVALID_SOCKET) {
-        shutdownTcpSocket(ctlSock);
+    if (AppVersionQuad[0] >= 5) {
+        PltInterruptThread(&controlIoThread);
+        wakeControlIoThread();
+
+        PltJoinThread(&controlIoThread);
+        PltCloseThread(&controlIoThread);
+
+        closeControlIoHandles();
+        destroyQueuedPackets();
     }
-    
-    PltInterruptThread(&lossStatsThread);
-    PltInterruptThread(&invalidateRefFramesThread);
+    else {
+        PltSetEvent(&invalidateRefFramesEvent);
+        shutdownTcpSocket(ctlSock);
+
+        PltInterruptThread(&lossStatsThread);
+        PltInterruptThread(&invalidateRefFramesThread);
 
-    PltJoinThread(&lossStatsThread);
-    PltJoinThread(&invalidateRefFramesThread);
+        PltJoinThread(&lossStatsThread);
+        PltJoinThread(&invalidateRefFramesThread);
 
-    PltCloseThread(&lossStatsThread);
-    PltCloseThread(&invalidateRefFramesThread);
+        PltCloseThread(&lossStatsThread);
+        PltCloseThread(&invalidateRefFramesThread);
+    }
 
     if (peer != NULL) {
         // We use enet_peer_disconnect_now() so the host knows immediately
@@ -592,14 +919,49 @@ int stopControlStream(void) {
 
 // Called by the input stream to send a packet for Gen 5+ servers
 int sendInputPacketOnControlStream(unsigned char* data, int length) {
+    return sendInputPacketBatchOnControlStream(data, &length, 1);
+}
+
+// Called by the input stream to send several packets for Gen 5+ servers. The
+// packets are stored back to back in data. They are handed to the control
+// stream I/O thread together, which sends them with a single flush so ENet
+// can pack them into as few datagrams as it can.
+int sendInputPacketBatchOnControlStream(unsigned char* data, int* lengths, int count) {
+    ENetPacket* enetPacket;
+    ENetPacket* newestPacket;
+    ENetPacket* oldestPacket;
+    int i;
+
     LC_ASSERT(AppVersionQuad[0] >= 5);
 
-    // Send the input data (no reply expected)
-    if (sendMessageAndForget(packetTypes[IDX_INPUT_DATA], length, data) == 0) {
+    if (PltAtomicLoadInt(&controlIoFailed)) {
         return -1;
     }
 
-    return 0;
+    // The packets are built here so the I/O thread only has to queue them
+    newestPacket = NULL;
+    oldestPacket = NULL;
+    for (i = 0; i < count; i++) {
+        enetPacket = createMessageEnet(packetTypes[IDX_INPUT_DATA], lengths[i], data);
+        if (enetPacket == NULL) {
+            break;
+        }
+
+        enetPacket->userData = newestPacket;
+        newestPacket = enetPacket;
+        if (oldestPacket == NULL) {
+            oldestPacket = enetPacket;
+        }
+
+        data += lengths[i];
+    }
+
+    // Send whatever was built, even if a later packet failed
+    if (newestPacket != NULL) {
+        queuePacketsForControlIo(newestPacket, oldestPacket);
+    }
+
+    return i == count ? 0 : -1;
 }
 
 // Starts the control stream
@@ -694,50 +1056,59 @@ int startControlStream(void) {
         return err;
     }
 
-    err = PltCreateThread(lossStatsThreadFunc, NULL, &lossStatsThread);
-    if (err != 0) {
-        stopping = 1;
-        if (ctlSock != INVALID_SOCKET) {
-            closeSocket(ctlSock);
-            ctlSock = INVALID_SOCKET;
-        }
-        else {
+    if (AppVersionQuad[0] >= 5) {
+        // The I/O thread owns the ENet host from here on
+        err = startControlIoThread();
+        if (err != 0) {
+            stopping = 1;
+            closeControlIoHandles();
             enet_peer_disconnect_now(peer, 0);
             peer = NULL;
             enet_host_destroy(client);
             client = NULL;
+            return err;
         }
-        return err;
+
+        return 0;
     }
 
-    err = PltCreateThread(invalidateRefFramesFunc, NULL, &invalidateRefFramesThread);
+    err = PltCreateThread("LossStats", THREAD_ROLE_CONTROL, lossStatsThreadFunc, NULL, &lossStatsThread);
     if (err != 0) {
         stopping = 1;
+        closeSocket(ctlSock);
+        ctlSock = INVALID_SOCKET;
+        return err;
+    }
 
-        if (ctlSock != INVALID_SOCKET) {
-            shutdownTcpSocket(ctlSock);
-        }
-        else {
-            ConnectionInterrupted = 1;
-        }
+    err = PltCreateThread("InvRefFrames", THREAD_ROLE_CONTROL, invalidateRefFramesFunc, NULL, &invalidateRefFramesThread);
+    if (err != 0) {
+        stopping = 1;
+        shutdownTcpSocket(ctlSock);
 
         PltInterruptThread(&lossStatsThread);
         PltJoinThread(&lossStatsThread);
         PltCloseThread(&lossStatsThread);
 
-        if (ctlSock != INVALID_SOCKET) {
-            closeSocket(ctlSock);
-            ctlSock = INVALID_SOCKET;
-        }
-        else {
-            enet_peer_disconnect_now(peer, 0);
-            peer = NULL;
-            enet_host_destroy(client);
-            client = NULL;
-        }
-
+        closeSocket(ctlSock);
+        ctlSock = INVALID_SOCKET;
         return err;
     }
 
     return 0;
 }
+
+void LiGetControlStreamStats(PCONTROL_STREAM_STATS stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    stats->idrRequests = idrRequests;
+    stats->invalidationRequests = invalidationRequests;
+    stats->ioWakeups = ioWakeups;
+    LhGetPercentiles(&idrRequestLatency, &stats->idrRequestLatency);
+}
+
+void LiResetControlStreamStats(void) {
+    idrRequests = 0;
+    invalidationRequests = 0;
+    ioWakeups = 0;
+    LhResetHistogram(&idrRequestLatency);
+}
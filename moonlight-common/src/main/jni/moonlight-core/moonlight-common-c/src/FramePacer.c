@@ -0,0 +1,69 @@
+#include "Limelight-internal.h"
+#include "FramePacer.h"
+#include "PlatformAtomics.h"
+
+// The refresh rate is in hundredths of a hertz
+void FpInitialize(PFRAME_PACER pacer, int refreshRateX100) {
+    memset(pacer, 0, sizeof(*pacer));
+
+    LC_ASSERT(refreshRateX100 > 0);
+
+    pacer->refreshPeriodUs = 100000000 / refreshRateX100;
+}
+
+// Records the time of a display refresh. Only its phase within the refresh
+// period is kept, so this may be called for any vsync and from any thread.
+void FpReportVsync(PFRAME_PACER pacer, unsigned long long vsyncTimeUs) {
+    PltAtomicStoreInt(&pacer->vsyncPhaseUs, (int)(vsyncTimeUs % pacer->refreshPeriodUs));
+    PltAtomicStoreInt(&pacer->vsyncReported, 1);
+}
+
+// Returns when a frame that is ready at nowUs should be submitted so that it
+// is decoded just before the first display refresh it can still make. This
+// is never earlier than nowUs.
+unsigned long long FpGetSubmitTimeUs(PFRAME_PACER pacer, unsigned long long nowUs) {
+    unsigned long long readyTimeUs;
+    int leadTimeUs;
+    int sinceVsyncUs;
+
+    // Without vsync timing, frames are submitted as soon as possible
+    if (!PltAtomicLoadInt(&pacer->vsyncReported)) {
+        return nowUs;
+    }
+
+    // If decoding takes a whole refresh period, holding a frame back would
+    // only make it miss a refresh
+    leadTimeUs = FpGetDecodeTimeUs(pacer) + FP_SAFETY_MARGIN_US;
+    if (leadTimeUs >= pacer->refreshPeriodUs) {
+        return nowUs;
+    }
+
+    // Find the first vsync at or after the time the frame could be decoded
+    readyTimeUs = nowUs + leadTimeUs;
+    sinceVsyncUs = (int)((readyTimeUs + pacer->refreshPeriodUs -
+                          PltAtomicLoadInt(&pacer->vsyncPhaseUs)) % pacer->refreshPeriodUs);
+    if (sinceVsyncUs == 0) {
+        return nowUs;
+    }
+
+    return nowUs + pacer->refreshPeriodUs - sinceVsyncUs;
+}
+
+// Adds the time the renderer took to accept a frame to the smoothed decode time
+void FpAddDecodeTime(PFRAME_PACER pacer, unsigned long long decodeTimeUs) {
+    if (decodeTimeUs > (unsigned long long)pacer->refreshPeriodUs * 4) {
+        // Outliers this large are stalls rather than decode time
+        decodeTimeUs = (unsigned long long)pacer->refreshPeriodUs * 4;
+    }
+
+    if (pacer->scaledDecodeTimeUs == 0) {
+        pacer->scaledDecodeTimeUs = (int)decodeTimeUs << 3;
+    }
+    else {
+        pacer->scaledDecodeTimeUs += (int)decodeTimeUs - ((pacer->scaledDecodeTimeUs + 4) >> 3);
+    }
+}
+
+int FpGetDecodeTimeUs(PFRAME_PACER pacer) {
+    return pacer->scaledDecodeTimeUs >> 3;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "Platform.h"
+
+// Frames are submitted this long before they must be decoded to allow for
+// scheduling delays on the decoder thread
+#define FP_SAFETY_MARGIN_US 1000
+
+// Times frame submission so each frame is decoded just in time for a display
+// refresh. The vsync phase may be reported from any thread. Everything else
+// is only used by the decoder thread, but the statistics may be read from
+// any thread.
+typedef struct _FRAME_PACER {
+    int refreshPeriodUs;
+
+    // Time of the most recent vsync modulo the refresh period, once one has
+    // been reported
+    volatile int vsyncPhaseUs;
+    volatile int vsyncReported;
+
+    // Smoothed time taken by the renderer to accept a frame, scaled by 8
+    int scaledDecodeTimeUs;
+
+    unsigned int framesPaced;
+    unsigned int framesDropped;
+} FRAME_PACER, *PFRAME_PACER;
+
+void FpInitialize(PFRAME_PACER pacer, int refreshRateX100);
+void FpReportVsync(PFRAME_PACER pacer, unsigned long long vsyncTimeUs);
+unsigned long long FpGetSubmitTimeUs(PFRAME_PACER pacer, unsigned long long nowUs);
+void FpAddDecodeTime(PFRAME_PACER pacer, unsigned long long decodeTimeUs);
+int FpGetDecodeTimeUs(PFRAME_PACER pacer);
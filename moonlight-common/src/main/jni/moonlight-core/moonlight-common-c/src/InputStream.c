@@ -1,7 +1,10 @@
 #include "Limelight-internal.h"
 #include "PlatformSockets.h"
 #include "PlatformThreads.h"
+#include "PlatformAtomics.h"
 #include "LinkedBlockingQueue.h"
+#include "LatencyHistogram.h"
+#include "PacketPool.h"
 #include "Input.h"
 
 #include <openssl/evp.h>
@@ -15,14 +18,38 @@ static int cipherInitialized;
 static LINKED_BLOCKING_QUEUE packetQueue;
 static PLT_THREAD inputSendThread;
 
+// Packet holders are allocated from a pool rather than the heap. Input may
+// be sent from any thread, but the pool only allows one allocating thread
+// at a time.
+static PACKET_POOL holderPool;
+static PLT_MUTEX holderPoolMutex;
+
+// The counters are written by the input threads and the send thread and
+// read or reset from any thread
+static volatile int eventsQueued;
+static volatile int eventsMerged;
+static volatile int messagesSent;
+static volatile int flushes;
+static LATENCY_HISTOGRAM sendLatency;
+static unsigned long long sendThreadCpuTimeUs;
+static unsigned long long resetCpuTimeUs;
+
 #define MAX_INPUT_PACKET_SIZE 128
 #define INPUT_STREAM_TIMEOUT_SEC 10
 
+// The packet queue holds at most this many events
+#define INPUT_QUEUE_SIZE 30
+
+// Most messages sent with one flush when coalescing input. This keeps a
+// batch within a single datagram.
+#define MAX_COALESCED_PACKETS 16
+
 #define ROUND_TO_PKCS7_PADDED_LEN(x) ((((x) + 15) / 16) * 16)
 
 // Contains input stream packets
 typedef struct _PACKET_HOLDER {
     int packetLength;
+    uint64_t enqueueTimeUs;
     union {
         NV_KEYBOARD_PACKET keyboard;
         NV_MOUSE_MOVE_PACKET mouseMove;
@@ -34,10 +61,6 @@ typedef struct _PACKET_HOLDER {
     LINKED_BLOCKING_QUEUE_ENTRY entry;
 } PACKET_HOLDER, *PPACKET_HOLDER;
 
-#if OPENSSL_VERSION_NUMBER < 0x10100000L
-#define EVP_CIPHER_CTX_reset(x) EVP_CIPHER_CTX_cleanup(x); EVP_CIPHER_CTX_init(x)
-#endif
-
 // Initializes the input stream
 int initializeInputStream(void) {
     memcpy(currentAesIv, StreamConfig.remoteInputAesIv, sizeof(currentAesIv));
@@ -45,7 +68,19 @@ int initializeInputStream(void) {
     // Initialized on first packet
     cipherInitialized = 0;
     
-    LbqInitializeLinkedBlockingQueue(&packetQueue, 30);
+    if (StreamConfig.lockFreeQueues & LOCK_FREE_QUEUE_INPUT) {
+        LbqInitializeLockFreeQueue(&packetQueue, INPUT_QUEUE_SIZE);
+    }
+    else {
+        LbqInitializeLinkedBlockingQueue(&packetQueue, INPUT_QUEUE_SIZE);
+    }
+
+    // One slab covers a full queue plus an event being filled and one being sent
+    PpInitializePool(&holderPool, sizeof(PACKET_HOLDER), INPUT_QUEUE_SIZE + 2);
+    PltCreateMutex(&holderPoolMutex);
+
+    sendThreadCpuTimeUs = 0;
+    LiResetInputStreamStats();
 
     initialized = 1;
     return 0;
@@ -66,14 +101,43 @@ void destroyInputStream(void) {
         nextEntry = entry->flink;
 
         // The entry is stored in the data buffer
-        free(entry->data);
+        PpFreeBuffer(&holderPool, entry->data);
 
         entry = nextEntry;
     }
 
+    PpDestroyPool(&holderPool);
+    PltDeleteMutex(&holderPoolMutex);
+
     initialized = 0;
 }
 
+static PPACKET_HOLDER allocatePacketHolder(void) {
+    PPACKET_HOLDER holder;
+
+    PltLockMutex(&holderPoolMutex);
+    holder = (PPACKET_HOLDER)PpAllocateBuffer(&holderPool);
+    PltUnlockMutex(&holderPoolMutex);
+
+    return holder;
+}
+
+// Hands a filled packet holder to the input send thread
+static int queuePacketHolder(PPACKET_HOLDER holder) {
+    int err;
+
+    holder->enqueueTimeUs = PltGetMicros();
+
+    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
+    if (err != LBQ_SUCCESS) {
+        PpFreeBuffer(&holderPool, holder);
+        return err;
+    }
+
+    PltAtomicAddInt(&eventsQueued, 1);
+    return err;
+}
+
 static int addPkcs7PaddingInPlace(unsigned char* plaintext, int plaintextLen) {
     int i;
     int paddedLength = ROUND_TO_PKCS7_PADDED_LEN(plaintextLen);
@@ -97,23 +161,30 @@ static int encryptData(const unsigned char* plaintext, int plaintextLen,
                 return -1;
             }
             cipherInitialized = 1;
-        }
 
-        // Gen 7 servers use 128-bit AES GCM
-        if (EVP_EncryptInit_ex(cipherContext, EVP_aes_128_gcm(), NULL, NULL, NULL) != 1) {
-            ret = -1;
-            goto gcm_cleanup;
-        }
-        
-        // Gen 7 servers uses 16 byte IVs
-        if (EVP_CIPHER_CTX_ctrl(cipherContext, EVP_CTRL_GCM_SET_IVLEN, 16, NULL) != 1) {
-            ret = -1;
-            goto gcm_cleanup;
+            // Gen 7 servers use 128-bit AES GCM
+            if (EVP_EncryptInit_ex(cipherContext, EVP_aes_128_gcm(), NULL, NULL, NULL) != 1) {
+                ret = -1;
+                goto gcm_cleanup;
+            }
+
+            // Gen 7 servers uses 16 byte IVs
+            if (EVP_CIPHER_CTX_ctrl(cipherContext, EVP_CTRL_GCM_SET_IVLEN, 16, NULL) != 1) {
+                ret = -1;
+                goto gcm_cleanup;
+            }
+
+            // The key is the same for the whole stream, so its key schedule is
+            // computed once here. Each packet only supplies a new IV.
+            if (EVP_EncryptInit_ex(cipherContext, NULL, NULL,
+                                   (const unsigned char*)StreamConfig.remoteInputAesKey, NULL) != 1) {
+                ret = -1;
+                goto gcm_cleanup;
+            }
         }
-        
-        // Initialize again but now provide our key and current IV
-        if (EVP_EncryptInit_ex(cipherContext, NULL, NULL,
-                               (const unsigned char*)StreamConfig.remoteInputAesKey, currentAesIv) != 1) {
+
+        // Start a new message with the current IV
+        if (EVP_EncryptInit_ex(cipherContext, NULL, NULL, NULL, currentAesIv) != 1) {
             ret = -1;
             goto gcm_cleanup;
         }
@@ -143,7 +214,11 @@ static int encryptData(const unsigned char* plaintext, int plaintextLen,
         ret = 0;
         
     gcm_cleanup:
-        EVP_CIPHER_CTX_reset(cipherContext);
+        if (ret != 0) {
+            // Start over with a new context if this one failed part way
+            EVP_CIPHER_CTX_free(cipherContext);
+            cipherInitialized = 0;
+        }
     }
     else {
         unsigned char paddedData[MAX_INPUT_PACKET_SIZE];
@@ -183,138 +258,193 @@ static int encryptData(const unsigned char* plaintext, int plaintextLen,
     return ret;
 }
 
+// Merges the mouse move or controller events queued behind this holder's
+// event into it where possible
+static void batchQueuedEvents(PPACKET_HOLDER holder) {
+    // If it's a multi-controller packet we can do batching
+    if (holder->packet.multiController.header.packetType == htonl(PACKET_TYPE_MULTI_CONTROLLER)) {
+        PPACKET_HOLDER controllerBatchHolder;
+        PNV_MULTI_CONTROLLER_PACKET origPkt;
+
+        origPkt = &holder->packet.multiController;
+        for (;;) {
+            PNV_MULTI_CONTROLLER_PACKET newPkt;
+
+            // Peek at the next packet
+            if (LbqPeekQueueElement(&packetQueue, (void**)&controllerBatchHolder) != LBQ_SUCCESS) {
+                break;
+            }
+
+            // If it's not a controller packet, we're done
+            if (controllerBatchHolder->packet.multiController.header.packetType != htonl(PACKET_TYPE_MULTI_CONTROLLER)) {
+                break;
+            }
+
+            // Check if it's able to be batched
+            // NB: GFE does some discarding of gamepad packets received very soon after another.
+            // Thus, this batching is needed for correctness in some cases, as GFE will inexplicably
+            // drop *newer* packets in that scenario. The brokenness can be tested with consecutive
+            // calls to LiSendMultiControllerEvent() with different values for analog sticks (max -> zero).
+            newPkt = &controllerBatchHolder->packet.multiController;
+            if (newPkt->buttonFlags != origPkt->buttonFlags ||
+                newPkt->controllerNumber != origPkt->controllerNumber ||
+                newPkt->activeGamepadMask != origPkt->activeGamepadMask) {
+                // Batching not allowed
+                break;
+            }
+
+            // Remove the batchable controller packet
+            if (LbqPollQueueElement(&packetQueue, (void**)&controllerBatchHolder) != LBQ_SUCCESS) {
+                break;
+            }
+
+            // Update the original packet
+            origPkt->leftTrigger = newPkt->leftTrigger;
+            origPkt->rightTrigger = newPkt->rightTrigger;
+            origPkt->leftStickX = newPkt->leftStickX;
+            origPkt->leftStickY = newPkt->leftStickY;
+            origPkt->rightStickX = newPkt->rightStickX;
+            origPkt->rightStickY = newPkt->rightStickY;
+
+            // Free the batched packet holder
+            PpFreeBuffer(&holderPool, controllerBatchHolder);
+            PltAtomicAddInt(&eventsMerged, 1);
+        }
+    }
+    // If it's a mouse move packet, we can also do batching
+    else if (holder->packet.mouseMove.header.packetType == htonl(PACKET_TYPE_MOUSE_MOVE)) {
+        PPACKET_HOLDER mouseBatchHolder;
+        int totalDeltaX = (short)htons(holder->packet.mouseMove.deltaX);
+        int totalDeltaY = (short)htons(holder->packet.mouseMove.deltaY);
+
+        for (;;) {
+            int partialDeltaX;
+            int partialDeltaY;
+
+            // Peek at the next packet
+            if (LbqPeekQueueElement(&packetQueue, (void**)&mouseBatchHolder) != LBQ_SUCCESS) {
+                break;
+            }
+
+            // If it's not a mouse move packet, we're done
+            if (mouseBatchHolder->packet.mouseMove.header.packetType != htonl(PACKET_TYPE_MOUSE_MOVE)) {
+                break;
+            }
+
+            partialDeltaX = (short)htons(mouseBatchHolder->packet.mouseMove.deltaX);
+            partialDeltaY = (short)htons(mouseBatchHolder->packet.mouseMove.deltaY);
+
+            // Check for overflow
+            if (partialDeltaX + totalDeltaX > INT16_MAX ||
+                partialDeltaX + totalDeltaX < INT16_MIN ||
+                partialDeltaY + totalDeltaY > INT16_MAX ||
+                partialDeltaY + totalDeltaY < INT16_MIN) {
+                // Total delta would overflow our 16-bit short
+                break;
+            }
+
+            // Remove the batchable mouse move packet
+            if (LbqPollQueueElement(&packetQueue, (void**)&mouseBatchHolder) != LBQ_SUCCESS) {
+                break;
+            }
+
+            totalDeltaX += partialDeltaX;
+            totalDeltaY += partialDeltaY;
+
+            // Free the batched packet holder
+            PpFreeBuffer(&holderPool, mouseBatchHolder);
+            PltAtomicAddInt(&eventsMerged, 1);
+        }
+
+        // Update the original packet
+        holder->packet.mouseMove.deltaX = htons((short)totalDeltaX);
+        holder->packet.mouseMove.deltaY = htons((short)totalDeltaY);
+    }
+}
+
+// Encrypts the holder's event into a length-prefixed message. Returns the
+// length of the message or a negative value on failure.
+static int encryptMessage(PPACKET_HOLDER holder, char* message, int maxLength) {
+    int encryptedLengthPrefix;
+    int encryptedSize;
+    int err;
+
+    // Encrypt the message into the output buffer while leaving room for the length
+    encryptedSize = maxLength - 4;
+    err = encryptData((const unsigned char*)&holder->packet, holder->packetLength,
+        (unsigned char*)&message[4], &encryptedSize);
+    if (err != 0) {
+        return err;
+    }
+
+    // Prepend the length to the message
+    encryptedLengthPrefix = htonl((unsigned long)encryptedSize);
+    memcpy(&message[0], &encryptedLengthPrefix, 4);
+
+    // For reasons that I can't understand, NVIDIA decides to use the last 16
+    // bytes of ciphertext in the most recent game controller packet as the IV for
+    // future encryption. I think it may be a buffer overrun on their end but we'll have
+    // to mimic it to work correctly.
+    if (AppVersionQuad[0] >= 7 && encryptedSize >= 16 + sizeof(currentAesIv)) {
+        memcpy(currentAesIv,
+               &message[4 + encryptedSize - sizeof(currentAesIv)],
+               sizeof(currentAesIv));
+    }
+
+    return encryptedSize + sizeof(encryptedLengthPrefix);
+}
+
 // Input thread proc
 static void inputSendThreadProc(void* context) {
     SOCK_RET err;
     PPACKET_HOLDER holder;
-    char encryptedBuffer[MAX_INPUT_PACKET_SIZE];
+    char encryptedBuffer[MAX_COALESCED_PACKETS * MAX_INPUT_PACKET_SIZE];
+    int messageLengths[MAX_COALESCED_PACKETS];
+    uint64_t enqueueTimesUs[MAX_COALESCED_PACKETS];
+    int messageCount;
     int encryptedSize;
+    uint64_t lastCpuTimeUs, cpuTimeUs, now;
+    int i;
 
-    while (!PltIsThreadInterrupted(&inputSendThread)) {
-        int encryptedLengthPrefix;
+    lastCpuTimeUs = PltGetThreadCpuTimeUs();
 
+    while (!PltIsThreadInterrupted(&inputSendThread)) {
         err = LbqWaitForQueueElement(&packetQueue, (void**)&holder);
         if (err != LBQ_SUCCESS) {
             return;
         }
 
-        // If it's a multi-controller packet we can do batching
-        if (holder->packet.multiController.header.packetType == htonl(PACKET_TYPE_MULTI_CONTROLLER)) {
-            PPACKET_HOLDER controllerBatchHolder;
-            PNV_MULTI_CONTROLLER_PACKET origPkt;
-
-            origPkt = &holder->packet.multiController;
-            for (;;) {
-                PNV_MULTI_CONTROLLER_PACKET newPkt;
-
-                // Peek at the next packet
-                if (LbqPeekQueueElement(&packetQueue, (void**)&controllerBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
-
-                // If it's not a controller packet, we're done
-                if (controllerBatchHolder->packet.multiController.header.packetType != htonl(PACKET_TYPE_MULTI_CONTROLLER)) {
-                    break;
-                }
-
-                // Check if it's able to be batched
-                // NB: GFE does some discarding of gamepad packets received very soon after another.
-                // Thus, this batching is needed for correctness in some cases, as GFE will inexplicably
-                // drop *newer* packets in that scenario. The brokenness can be tested with consecutive
-                // calls to LiSendMultiControllerEvent() with different values for analog sticks (max -> zero).
-                newPkt = &controllerBatchHolder->packet.multiController;
-                if (newPkt->buttonFlags != origPkt->buttonFlags ||
-                    newPkt->controllerNumber != origPkt->controllerNumber ||
-                    newPkt->activeGamepadMask != origPkt->activeGamepadMask) {
-                    // Batching not allowed
-                    break;
-                }
-
-                // Remove the batchable controller packet
-                if (LbqPollQueueElement(&packetQueue, (void**)&controllerBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
-
-                // Update the original packet
-                origPkt->leftTrigger = newPkt->leftTrigger;
-                origPkt->rightTrigger = newPkt->rightTrigger;
-                origPkt->leftStickX = newPkt->leftStickX;
-                origPkt->leftStickY = newPkt->leftStickY;
-                origPkt->rightStickX = newPkt->rightStickX;
-                origPkt->rightStickY = newPkt->rightStickY;
-
-                // Free the batched packet holder
-                free(controllerBatchHolder);
-            }
-        }
-        // If it's a mouse move packet, we can also do batching
-        else if (holder->packet.mouseMove.header.packetType == htonl(PACKET_TYPE_MOUSE_MOVE)) {
-            PPACKET_HOLDER mouseBatchHolder;
-            int totalDeltaX = (short)htons(holder->packet.mouseMove.deltaX);
-            int totalDeltaY = (short)htons(holder->packet.mouseMove.deltaY);
-
-            for (;;) {
-                int partialDeltaX;
-                int partialDeltaY;
-
-                // Peek at the next packet
-                if (LbqPeekQueueElement(&packetQueue, (void**)&mouseBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
-
-                // If it's not a mouse move packet, we're done
-                if (mouseBatchHolder->packet.mouseMove.header.packetType != htonl(PACKET_TYPE_MOUSE_MOVE)) {
-                    break;
-                }
-
-                partialDeltaX = (short)htons(mouseBatchHolder->packet.mouseMove.deltaX);
-                partialDeltaY = (short)htons(mouseBatchHolder->packet.mouseMove.deltaY);
-
-                // Check for overflow
-                if (partialDeltaX + totalDeltaX > INT16_MAX ||
-                    partialDeltaX + totalDeltaX < INT16_MIN ||
-                    partialDeltaY + totalDeltaY > INT16_MAX ||
-                    partialDeltaY + totalDeltaY < INT16_MIN) {
-                    // Total delta would overflow our 16-bit short
-                    break;
-                }
-
-                // Remove the batchable mouse move packet
-                if (LbqPollQueueElement(&packetQueue, (void**)&mouseBatchHolder) != LBQ_SUCCESS) {
-                    break;
-                }
-
-                totalDeltaX += partialDeltaX;
-                totalDeltaY += partialDeltaY;
-
-                // Free the batched packet holder
-                free(mouseBatchHolder);
+        encryptedSize = 0;
+        messageCount = 0;
+        for (;;) {
+            int messageLength;
+
+            batchQueuedEvents(holder);
+
+            enqueueTimesUs[messageCount] = holder->enqueueTimeUs;
+            messageLength = encryptMessage(holder, &encryptedBuffer[encryptedSize], MAX_INPUT_PACKET_SIZE);
+            PpFreeBuffer(&holderPool, holder);
+            if (messageLength < 0) {
+                Limelog("Input: Encryption failed: %d\n", messageLength);
+                ListenerCallbacks.connectionTerminated(messageLength);
+                return;
             }
 
-            // Update the original packet
-            holder->packet.mouseMove.deltaX = htons((short)totalDeltaX);
-            holder->packet.mouseMove.deltaY = htons((short)totalDeltaY);
-        }
+            messageLengths[messageCount++] = messageLength;
+            encryptedSize += messageLength;
 
-        // Encrypt the message into the output buffer while leaving room for the length
-        encryptedSize = sizeof(encryptedBuffer) - 4;
-        err = encryptData((const unsigned char*)&holder->packet, holder->packetLength,
-            (unsigned char*)&encryptedBuffer[4], &encryptedSize);
-        free(holder);
-        if (err != 0) {
-            Limelog("Input: Encryption failed: %d\n", (int)err);
-            ListenerCallbacks.connectionTerminated(err);
-            return;
+            // When coalescing, pick up whatever else has been queued. The
+            // IV chain means the messages must still be encrypted in order.
+            if (!StreamConfig.coalesceInput || messageCount == MAX_COALESCED_PACKETS ||
+                LbqPollQueueElement(&packetQueue, (void**)&holder) != LBQ_SUCCESS) {
+                break;
+            }
         }
 
-        // Prepend the length to the message
-        encryptedLengthPrefix = htonl((unsigned long)encryptedSize);
-        memcpy(&encryptedBuffer[0], &encryptedLengthPrefix, 4);
-
         if (AppVersionQuad[0] < 5) {
-            // Send the encrypted payload
-            err = send(inputSock, (const char*) encryptedBuffer,
-                (int) (encryptedSize + sizeof(encryptedLengthPrefix)), 0);
+            // Send the encrypted payload. The messages are length-prefixed so a
+            // batch can go in a single write on the TCP stream.
+            err = send(inputSock, (const char*) encryptedBuffer, encryptedSize, 0);
             if (err <= 0) {
                 Limelog("Input: send() failed: %d\n", (int) LastSocketError());
                 ListenerCallbacks.connectionTerminated(LastSocketError());
@@ -322,24 +452,30 @@ static void inputSendThreadProc(void* context) {
             }
         }
         else {
-            // For reasons that I can't understand, NVIDIA decides to use the last 16
-            // bytes of ciphertext in the most recent game controller packet as the IV for
-            // future encryption. I think it may be a buffer overrun on their end but we'll have
-            // to mimic it to work correctly.
-            if (AppVersionQuad[0] >= 7 && encryptedSize >= 16 + sizeof(currentAesIv)) {
-                memcpy(currentAesIv,
-                       &encryptedBuffer[4 + encryptedSize - sizeof(currentAesIv)],
-                       sizeof(currentAesIv));
+            if (messageCount == 1) {
+                err = (SOCK_RET)sendInputPacketOnControlStream((unsigned char*) encryptedBuffer, encryptedSize);
+            }
+            else {
+                err = (SOCK_RET)sendInputPacketBatchOnControlStream((unsigned char*) encryptedBuffer,
+                    messageLengths, messageCount);
             }
-            
-            err = (SOCK_RET)sendInputPacketOnControlStream((unsigned char*) encryptedBuffer,
-                (int) (encryptedSize + sizeof(encryptedLengthPrefix)));
             if (err < 0) {
                 Limelog("Input: sendInputPacketOnControlStream() failed: %d\n", (int) err);
                 ListenerCallbacks.connectionTerminated(LastSocketError());
                 return;
             }
         }
+
+        now = PltGetMicros();
+        for (i = 0; i < messageCount; i++) {
+            LhAddSample(&sendLatency, now - enqueueTimesUs[i]);
+        }
+        PltAtomicAddInt(&messagesSent, messageCount);
+        PltAtomicAddInt(&flushes, 1);
+
+        cpuTimeUs = PltGetThreadCpuTimeUs();
+        sendThreadCpuTimeUs += cpuTimeUs - lastCpuTimeUs;
+        lastCpuTimeUs = cpuTimeUs;
     }
 }
 
@@ -358,7 +494,7 @@ int startInputStream(void) {
         enableNoDelay(inputSock);
     }
 
-    err = PltCreateThread(inputSendThreadProc, NULL, &inputSendThread);
+    err = PltCreateThread("InputSend", THREAD_ROLE_INPUT, inputSendThreadProc, NULL, &inputSendThread);
     if (err != 0) {
         if (inputSock != INVALID_SOCKET) {
             closeSocket(inputSock);
@@ -394,13 +530,12 @@ int stopInputStream(void) {
 // Send a mouse move event to the streaming machine
 int LiSendMouseMoveEvent(short deltaX, short deltaY) {
     PPACKET_HOLDER holder;
-    int err;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
+    holder = allocatePacketHolder();
     if (holder == NULL) {
         return -1;
     }
@@ -415,24 +550,18 @@ int LiSendMouseMoveEvent(short deltaX, short deltaY) {
     holder->packet.mouseMove.deltaX = htons(deltaX);
     holder->packet.mouseMove.deltaY = htons(deltaY);
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queuePacketHolder(holder);
 }
 
 // Send a mouse button event to the streaming machine
 int LiSendMouseButtonEvent(char action, int button) {
     PPACKET_HOLDER holder;
-    int err;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
+    holder = allocatePacketHolder();
     if (holder == NULL) {
         return -1;
     }
@@ -445,24 +574,18 @@ int LiSendMouseButtonEvent(char action, int button) {
     }
     holder->packet.mouseButton.button = htonl(button);
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queuePacketHolder(holder);
 }
 
 // Send a key press event to the streaming machine
 int LiSendKeyboardEvent(short keyCode, char keyAction, char modifiers) {
     PPACKET_HOLDER holder;
-    int err;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
+    holder = allocatePacketHolder();
     if (holder == NULL) {
         return -1;
     }
@@ -475,12 +598,7 @@ int LiSendKeyboardEvent(short keyCode, char keyAction, char modifiers) {
     holder->packet.keyboard.modifiers = modifiers;
     holder->packet.keyboard.zero2 = 0;
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queuePacketHolder(holder);
 }
 
 static int sendControllerEventInternal(short controllerNumber, short activeGamepadMask,
@@ -488,13 +606,12 @@ static int sendControllerEventInternal(short controllerNumber, short activeGamep
     short leftStickX, short leftStickY, short rightStickX, short rightStickY)
 {
     PPACKET_HOLDER holder;
-    int err;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
+    holder = allocatePacketHolder();
     if (holder == NULL) {
         return -1;
     }
@@ -540,12 +657,7 @@ static int sendControllerEventInternal(short controllerNumber, short activeGamep
         holder->packet.multiController.tailB = MC_TAIL_B;
     }
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
-
-    return err;
+    return queuePacketHolder(holder);
 }
 
 // Send a controller event to the streaming machine
@@ -569,13 +681,12 @@ int LiSendMultiControllerEvent(short controllerNumber, short activeGamepadMask,
 // Send a scroll event to the streaming machine
 int LiSendScrollEvent(signed char scrollClicks) {
     PPACKET_HOLDER holder;
-    int err;
 
     if (!initialized) {
         return -2;
     }
 
-    holder = malloc(sizeof(*holder));
+    holder = allocatePacketHolder();
     if (holder == NULL) {
         return -1;
     }
@@ -593,10 +704,27 @@ int LiSendScrollEvent(signed char scrollClicks) {
     holder->packet.scroll.scrollAmt2 = holder->packet.scroll.scrollAmt1;
     holder->packet.scroll.zero3 = 0;
 
-    err = LbqOfferQueueItem(&packetQueue, holder, &holder->entry);
-    if (err != LBQ_SUCCESS) {
-        free(holder);
-    }
+    return queuePacketHolder(holder);
+}
 
-    return err;
+void LiGetInputStreamStats(PINPUT_STREAM_STATS stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    stats->eventsQueued = PltAtomicLoadInt(&eventsQueued);
+    stats->eventsMerged = PltAtomicLoadInt(&eventsMerged);
+    stats->messagesSent = PltAtomicLoadInt(&messagesSent);
+    stats->flushes = PltAtomicLoadInt(&flushes);
+    LhGetPercentiles(&sendLatency, &stats->sendLatency);
+    stats->cpuTimeUs = sendThreadCpuTimeUs - resetCpuTimeUs;
+}
+
+void LiResetInputStreamStats(void) {
+    PltAtomicStoreInt(&eventsQueued, 0);
+    PltAtomicStoreInt(&eventsMerged, 0);
+    PltAtomicStoreInt(&messagesSent, 0);
+    PltAtomicStoreInt(&flushes, 0);
+    LhResetHistogram(&sendLatency);
+
+    // The send thread owns the CPU time counter, so remember where it was
+    resetCpuTimeUs = sendThreadCpuTimeUs;
 }
@@ -0,0 +1,127 @@
+#include "Limelight-internal.h"
+#include "JitterEstimator.h"
+
+// The window covers this many multiples of the interarrival jitter
+#define JE_JITTER_MULTIPLIER 4
+
+// Reorder peaks lose a quarter of their value at this interval, rounded up
+// so they eventually reach zero
+#define JE_DECAY_INTERVAL_US 1000000
+
+// Transit time differences beyond this are treated as a stream pause
+// rather than jitter
+#define JE_MAX_TRANSIT_DELTA_US 1000000
+
+void JeInitialize(PJITTER_ESTIMATOR estimator, int clockRate, int minWindowMs, int maxWindowMs) {
+    memset(estimator, 0, sizeof(*estimator));
+
+    LC_ASSERT(clockRate > 0);
+    LC_ASSERT(minWindowMs <= maxWindowMs);
+
+    estimator->clockRate = clockRate;
+    estimator->minWindowUs = minWindowMs * 1000;
+    estimator->maxWindowUs = maxWindowMs * 1000;
+    estimator->windowUs = estimator->maxWindowUs;
+}
+
+static void updateWindow(PJITTER_ESTIMATOR estimator) {
+    long long windowUs;
+
+    // Wait as long as the latest reordered packets took to show up with
+    // some headroom, plus enough to ride out normal jitter
+    windowUs = estimator->reorderDelayUs + estimator->reorderDelayUs / 4 +
+        (long long)JE_JITTER_MULTIPLIER * (estimator->scaledJitterUs >> 4);
+
+    if (windowUs < estimator->minWindowUs) {
+        windowUs = estimator->minWindowUs;
+    }
+    else if (windowUs > estimator->maxWindowUs) {
+        windowUs = estimator->maxWindowUs;
+    }
+
+    estimator->windowUs = (int)windowUs;
+}
+
+void JeAddPacket(PJITTER_ESTIMATOR estimator, unsigned short sequenceNumber,
+                 unsigned int timestamp, unsigned long long arrivalUs) {
+    JE_ARRIVAL* arrival;
+
+    if (!estimator->initialized) {
+        estimator->initialized = 1;
+        estimator->highestSequenceNumber = sequenceNumber;
+        estimator->lastTimestamp = timestamp;
+        estimator->lastArrivalUs = arrivalUs;
+        estimator->lastDecayUs = arrivalUs;
+    }
+    else if (isBefore16(estimator->highestSequenceNumber, sequenceNumber)) {
+        long long transitDeltaUs;
+
+        // D(i-1,i) from RFC 3550 using the packets in sequence order. The
+        // timestamp difference is signed since B-frames or retransmissions
+        // may carry older timestamps.
+        transitDeltaUs = (long long)(arrivalUs - estimator->lastArrivalUs) -
+            (long long)(int)(timestamp - estimator->lastTimestamp) * 1000000 / estimator->clockRate;
+        if (transitDeltaUs < 0) {
+            transitDeltaUs = -transitDeltaUs;
+        }
+
+        if (transitDeltaUs <= JE_MAX_TRANSIT_DELTA_US) {
+            estimator->scaledJitterUs += (unsigned int)transitDeltaUs - ((estimator->scaledJitterUs + 8) >> 4);
+        }
+
+        estimator->highestSequenceNumber = sequenceNumber;
+        estimator->lastTimestamp = timestamp;
+        estimator->lastArrivalUs = arrivalUs;
+    }
+    else if (sequenceNumber != estimator->highestSequenceNumber) {
+        int depth = U16(estimator->highestSequenceNumber - sequenceNumber);
+        unsigned long long overdueSinceUs;
+        int i;
+
+        if (depth > estimator->reorderDepth) {
+            estimator->reorderDepth = depth;
+        }
+
+        // The packet was overdue once the first packet after it arrived. If that
+        // is too far back to remember, the latest arrival is a lower bound.
+        overdueSinceUs = estimator->lastArrivalUs;
+        for (i = 1; i <= depth && i < JE_HISTORY_SIZE; i++) {
+            arrival = &estimator->history[U16(sequenceNumber + i) % JE_HISTORY_SIZE];
+            if (arrival->valid && arrival->sequenceNumber == U16(sequenceNumber + i)) {
+                overdueSinceUs = arrival->arrivalUs;
+                break;
+            }
+        }
+
+        if (arrivalUs > overdueSinceUs &&
+                arrivalUs - overdueSinceUs > estimator->reorderDelayUs) {
+            estimator->reorderDelayUs = (unsigned int)(arrivalUs - overdueSinceUs);
+        }
+    }
+
+    arrival = &estimator->history[sequenceNumber % JE_HISTORY_SIZE];
+    arrival->arrivalUs = arrivalUs;
+    arrival->sequenceNumber = sequenceNumber;
+    arrival->valid = 1;
+
+    if (arrivalUs - estimator->lastDecayUs >= JE_DECAY_INTERVAL_US) {
+        estimator->reorderDepth -= (estimator->reorderDepth + 3) / 4;
+        estimator->reorderDelayUs -= (estimator->reorderDelayUs + 3) / 4;
+        estimator->lastDecayUs = arrivalUs;
+    }
+
+    updateWindow(estimator);
+}
+
+// Returns how long to wait for a missing packet before treating it as lost
+int JeGetWindowUs(PJITTER_ESTIMATOR estimator) {
+    return estimator->windowUs;
+}
+
+int JeGetJitterUs(PJITTER_ESTIMATOR estimator) {
+    return (int)(estimator->scaledJitterUs >> 4);
+}
+
+int JeGetReorderDepth(PJITTER_ESTIMATOR estimator) {
+    return estimator->reorderDepth;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Platform.h"
+
+// Number of recent packets whose arrival times are remembered to measure
+// how late reordered packets arrive
+#define JE_HISTORY_SIZE 64
+
+typedef struct _JE_ARRIVAL {
+    unsigned long long arrivalUs;
+    unsigned short sequenceNumber;
+    char valid;
+} JE_ARRIVAL;
+
+// Tracks the interarrival jitter (RFC 3550 section 6.4.1) and reordering of
+// one RTP stream and derives how long a receiver should wait for a missing
+// packet before treating it as lost. This is only updated by the thread
+// that receives the stream, but the statistics may be read from any thread.
+typedef struct _JITTER_ESTIMATOR {
+    // RTP timestamp units per second
+    int clockRate;
+
+    int minWindowUs;
+    int maxWindowUs;
+
+    int initialized;
+
+    // Highest sequence number received and the timing of the last packet
+    // received in sequence order
+    unsigned short highestSequenceNumber;
+    unsigned int lastTimestamp;
+    unsigned long long lastArrivalUs;
+
+    // Interarrival jitter in microseconds, scaled by 16 as in RFC 3550 A.8
+    unsigned int scaledJitterUs;
+
+    // Peak reorder depth in packets and peak time between a packet becoming
+    // overdue and its arrival. Both decay so the window shrinks again once
+    // the network settles down.
+    int reorderDepth;
+    unsigned int reorderDelayUs;
+    unsigned long long lastDecayUs;
+
+    JE_ARRIVAL history[JE_HISTORY_SIZE];
+
+    int windowUs;
+} JITTER_ESTIMATOR, *PJITTER_ESTIMATOR;
+
+void JeInitialize(PJITTER_ESTIMATOR estimator, int clockRate, int minWindowMs, int maxWindowMs);
+void JeAddPacket(PJITTER_ESTIMATOR estimator, unsigned short sequenceNumber,
+                 unsigned int timestamp, unsigned long long arrivalUs);
+int JeGetWindowUs(PJITTER_ESTIMATOR estimator);
+int JeGetJitterUs(PJITTER_ESTIMATOR estimator);
+int JeGetReorderDepth(PJITTER_ESTIMATOR estimator);
@@ -0,0 +1,122 @@
+#include "LatencyHistogram.h"
+#include "PlatformAtomics.h"
+
+static int getBucketIndex(unsigned int value) {
+    int msb;
+
+    if (value < LH_LINEAR_LIMIT) {
+        return value;
+    }
+
+    // Find the highest set bit. This is at least 4 here.
+    msb = 31;
+    while (!(value & (1U << msb))) {
+        msb--;
+    }
+
+    return LH_LINEAR_LIMIT + (msb - 4) * LH_SUB_BUCKETS +
+        ((value >> (msb - LH_SUB_BUCKET_BITS)) & (LH_SUB_BUCKETS - 1));
+}
+
+// Returns the middle of the range of values counted by a bucket
+static unsigned int getBucketValue(int index) {
+    int msb, sub;
+    unsigned int width;
+
+    if (index < LH_LINEAR_LIMIT) {
+        return index;
+    }
+
+    msb = 4 + (index - LH_LINEAR_LIMIT) / LH_SUB_BUCKETS;
+    sub = (index - LH_LINEAR_LIMIT) % LH_SUB_BUCKETS;
+    width = 1U << (msb - LH_SUB_BUCKET_BITS);
+
+    return (LH_SUB_BUCKETS + sub) * width + width / 2;
+}
+
+void LhResetHistogram(PLATENCY_HISTOGRAM histogram) {
+    int i;
+
+    // Samples added concurrently with a reset may or may not be kept
+    for (i = 0; i < LH_BUCKET_COUNT; i++) {
+        PltAtomicStoreInt(&histogram->buckets[i], 0);
+    }
+    PltAtomicStoreInt(&histogram->maxValue, 0);
+}
+
+void LhAddSample(PLATENCY_HISTOGRAM histogram, unsigned long long valueUs) {
+    unsigned int value;
+    int max;
+
+    // Clamp to what the buckets and maximum can hold
+    value = valueUs > INT32_MAX ? INT32_MAX : (unsigned int)valueUs;
+
+    PltAtomicAddInt(&histogram->buckets[getBucketIndex(value)], 1);
+
+    max = PltAtomicLoadInt(&histogram->maxValue);
+    while ((int)value > max) {
+        int previous = PltAtomicCompareExchangeInt(&histogram->maxValue, max, (int)value);
+        if (previous == max) {
+            break;
+        }
+        max = previous;
+    }
+}
+
+void LhGetPercentiles(PLATENCY_HISTOGRAM histogram, PLATENCY_PERCENTILES percentiles) {
+    int counts[LH_BUCKET_COUNT];
+    unsigned int total, seen;
+    unsigned int p50Rank, p95Rank, p99Rank;
+    unsigned int max;
+    int i;
+
+    memset(percentiles, 0, sizeof(*percentiles));
+
+    // Take a snapshot so the ranks are computed against consistent counts
+    total = 0;
+    for (i = 0; i < LH_BUCKET_COUNT; i++) {
+        counts[i] = PltAtomicLoadInt(&histogram->buckets[i]);
+        total += counts[i];
+    }
+    max = (unsigned int)PltAtomicLoadInt(&histogram->maxValue);
+
+    percentiles->samples = total;
+    percentiles->maxUs = max;
+    if (total == 0) {
+        return;
+    }
+
+    // Nearest-rank percentiles
+    p50Rank = (unsigned int)(((unsigned long long)total * 50 + 99) / 100);
+    p95Rank = (unsigned int)(((unsigned long long)total * 95 + 99) / 100);
+    p99Rank = (unsigned int)(((unsigned long long)total * 99 + 99) / 100);
+
+    seen = 0;
+    for (i = 0; i < LH_BUCKET_COUNT; i++) {
+        unsigned int value;
+
+        if (counts[i] == 0) {
+            continue;
+        }
+
+        // Don't report more than the largest sample seen
+        value = getBucketValue(i);
+        if (value > max) {
+            value = max;
+        }
+
+        // Each percentile is set by the first bucket that reaches its rank
+        if (seen < p50Rank && seen + counts[i] >= p50Rank) {
+            percentiles->p50Us = value;
+        }
+        if (seen < p95Rank && seen + counts[i] >= p95Rank) {
+            percentiles->p95Us = value;
+        }
+        if (seen < p99Rank && seen + counts[i] >= p99Rank) {
+            percentiles->p99Us = value;
+            break;
+        }
+
+        seen += counts[i];
+    }
+}
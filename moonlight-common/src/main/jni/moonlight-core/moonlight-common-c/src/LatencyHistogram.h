@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Platform.h"
+
+// Values below this are counted exactly. Above it, each power of 2 is split
+// into LH_SUB_BUCKETS buckets so the relative error stays below 1/8.
+#define LH_LINEAR_LIMIT 16
+#define LH_SUB_BUCKET_BITS 2
+#define LH_SUB_BUCKETS (1 << LH_SUB_BUCKET_BITS)
+#define LH_BUCKET_COUNT (LH_LINEAR_LIMIT + (32 - 4) * LH_SUB_BUCKETS)
+
+// A histogram of microsecond latencies. Samples may be added from any
+// thread without locking and read while they are being added.
+typedef struct _LATENCY_HISTOGRAM {
+    volatile int buckets[LH_BUCKET_COUNT];
+    volatile int maxValue;
+} LATENCY_HISTOGRAM, *PLATENCY_HISTOGRAM;
+
+void LhResetHistogram(PLATENCY_HISTOGRAM histogram);
+void LhAddSample(PLATENCY_HISTOGRAM histogram, unsigned long long valueUs);
+void LhGetPercentiles(PLATENCY_HISTOGRAM histogram, PLATENCY_PERCENTILES percentiles);
@@ -49,6 +49,7 @@ char* getSdpPayloadForStreamConfig(int rtspClientVersion, int* length);
 int initializeControlStream(void);
 int startControlStream(void);
 int stopControlStream(void);
+void stopIdleControlStream(void);
 void destroyControlStream(void);
 void requestIdrOnDemand(void);
 void connectionDetectedFrameLoss(int startFrame, int endFrame);
@@ -56,20 +57,32 @@ void connectionReceivedCompleteFrame(int frameIndex);
 void connectionSawFrame(int frameIndex);
 void connectionLostPackets(int lastReceivedPacket, int nextReceivedPacket);
 int sendInputPacketOnControlStream(unsigned char* data, int length);
+int sendInputPacketBatchOnControlStream(unsigned char* data, int* lengths, int count);
 
 int performRtspHandshake(void);
 
 void initializeVideoDepacketizer(int pktSize);
 void destroyVideoDepacketizer(void);
-void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long long receiveTimeMs);
+void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long long receiveTimeUs,
+    PRTPF_FRAME_TIMES frameTimes, PRTPFEC_QUEUE_ENTRY packetEntry);
 void queueRtpPacket(PRTPFEC_QUEUE_ENTRY queueEntry);
+void getVideoDepacketizerStats(PVIDEO_STREAM_STATS stats);
+void getVideoPipelineStats(PPIPELINE_STATS stats);
+void resetVideoPipelineStats(void);
 void stopVideoDepacketizer(void);
 void requestDecoderRefresh(void);
 
+void retainVideoPacket(PRTPFEC_QUEUE_ENTRY queueEntry);
+void releaseVideoPacket(PRTPFEC_QUEUE_ENTRY queueEntry);
 void initializeVideoStream(void);
 void destroyVideoStream(void);
 int startVideoStream(void* rendererContext, int drFlags);
 void stopVideoStream(void);
+#ifdef LC_RTP_REPLAY
+int startVideoReplay(void* rendererContext, int drFlags);
+int replayVideoPacket(char* data, int length);
+void stopVideoReplay(void);
+#endif
 
 void initializeAudioStream(void);
 void destroyAudioStream(void);
@@ -18,6 +18,43 @@ extern "C" {
 #define STREAM_CFG_REMOTE  1
 #define STREAM_CFG_AUTO    2
 
+// Values for the 'lockFreeQueues' field below
+#define LOCK_FREE_QUEUE_VIDEO 0x1
+#define LOCK_FREE_QUEUE_AUDIO 0x2
+#define LOCK_FREE_QUEUE_INPUT 0x4
+
+// Roles of the threads created by the library. The 'threadScheduling' field
+// below has an entry for each role.
+// Connection setup and teardown, pings, and any thread not listed below
+#define THREAD_ROLE_DEFAULT       0
+// Receives video packets and reassembles frames
+#define THREAD_ROLE_VIDEO_RECEIVE 1
+// Submits frames to the video decoder
+#define THREAD_ROLE_VIDEO_DECODE  2
+// Receives audio packets
+#define THREAD_ROLE_AUDIO_RECEIVE 3
+// Decodes and plays audio
+#define THREAD_ROLE_AUDIO_DECODE  4
+// Encrypts and sends input events
+#define THREAD_ROLE_INPUT         5
+// Sends loss statistics and reference frame invalidation requests
+#define THREAD_ROLE_CONTROL       6
+#define THREAD_ROLE_COUNT         7
+
+typedef struct _THREAD_SCHEDULING {
+    // Priority given to threads with this role. If realtimePriority is non-zero,
+    // threads are scheduled with SCHED_FIFO at that priority (1-99). If that isn't
+    // permitted or realtimePriority is zero, a non-zero niceValue (-20 to 19) is
+    // applied instead. Windows maps these onto its thread priority levels.
+    int realtimePriority;
+    int niceValue;
+
+    // Bitmask of the CPUs that threads with this role may run on, or 0 to allow
+    // any CPU. On big.LITTLE devices, this can keep latency-critical threads on
+    // the big cores. This is ignored on platforms without affinity control.
+    unsigned long long cpuAffinityMask;
+} THREAD_SCHEDULING, *PTHREAD_SCHEDULING;
+
 typedef struct _STREAM_CONFIGURATION {
     // Dimensions in pixels of the desired video stream
     int width;
@@ -68,6 +105,30 @@ typedef struct _STREAM_CONFIGURATION {
     // of GFE for enhanced frame pacing.
     int clientRefreshRateX100;
 
+    // Selects which internal queues use a lock-free ring buffer rather than
+    // a mutex-protected list. This reduces the cost of handing decode units,
+    // audio packets, and input events between threads. See LOCK_FREE_QUEUE_XXX
+    // constants above.
+    int lockFreeQueues;
+
+    // Bounds in milliseconds on how long the video and audio streams wait for
+    // a missing packet before treating it as lost. The wait adapts to the
+    // jitter and reordering measured on each stream within these bounds.
+    // A zero maximum selects a default suited to each stream.
+    int minReorderWindowMs;
+    int maxReorderWindowMs;
+
+    // If set, the input stream sends every input event waiting in its queue
+    // with a single flush of the control stream instead of one flush per event.
+    // Each event is still encrypted as its own message. This reduces the number
+    // of datagrams and system calls when input arrives at a high rate.
+    int coalesceInput;
+
+    // Scheduling for the threads the library creates, indexed by role. See
+    // THREAD_ROLE_XXX constants above. Zeroed entries leave threads with the
+    // platform's default scheduling.
+    THREAD_SCHEDULING threadScheduling[THREAD_ROLE_COUNT];
+
     // AES encryption data for the remote input stream. This must be
     // the same as what was passed as rikey and rikeyid
     // in /launch and /resume requests.
@@ -109,6 +170,19 @@ typedef struct _LENTRY {
 // after the codec configuration NALUs.
 #define FRAME_TYPE_IDR    0x01
 
+// Set on the last decode unit of a frame. Decode units always contain a whole frame
+// and have this flag set unless CAPABILITY_SLICE_SUBMIT is in use.
+#define DU_FLAG_END_OF_FRAME 0x1
+
+// Exactly one of these is set on each decode unit that leads with codec configuration
+// buffers. PARAMETER_SETS_UNCHANGED means they are byte-for-byte identical to the ones in
+// the last such decode unit given to the renderer, so a renderer whose decoder still holds
+// that configuration may skip them. PARAMETER_SETS_CHANGED means the decoder must be
+// (re)configured with them. The parameter sets are always reported as changed after the
+// renderer returns DR_NEED_IDR.
+#define DU_FLAG_PARAMETER_SETS_UNCHANGED 0x2
+#define DU_FLAG_PARAMETER_SETS_CHANGED   0x4
+
 // A decode unit describes a buffer chain of video data from multiple packets
 typedef struct _DECODE_UNIT {
     // Frame number
@@ -122,13 +196,173 @@ typedef struct _DECODE_UNIT {
     // shares the same epoch as this value.
     unsigned long long receiveTimeMs;
 
+    // Receive time of first buffer in microseconds. This shares the epoch of
+    // LiGetMicros() and is the same instant as receiveTimeMs.
+    unsigned long long receiveTimeUs;
+
     // Length of the entire buffer chain in bytes
     int fullLength;
 
     // Head of the buffer chain (never NULL)
     PLENTRY bufferList;
+
+    // Decode unit flags (see DU_FLAG_XXX constants above)
+    int flags;
 } DECODE_UNIT, *PDECODE_UNIT;
 
+typedef struct _VIDEO_STREAM_STATS {
+    // Video packet buffer pool occupancy. The pool grows in slabs when
+    // all buffers are in use and never shrinks while streaming.
+    int packetPoolBuffers;
+    int packetPoolBuffersInUse;
+    int packetPoolPeakBuffersInUse;
+    int packetPoolAllocationFailures;
+
+    // Number of frames handed to the decoder and the total number of payload
+    // bytes copied by the depacketizer to build them. This is zero when
+    // CAPABILITY_ZERO_COPY_DECODE_UNITS is in use.
+    unsigned int depacketizerFrames;
+    unsigned long long depacketizerBytesCopied;
+
+    // Number of IDR frames whose parameter sets were given to the renderer as
+    // changed and as identical to the previous ones
+    unsigned int parameterSetChanges;
+    unsigned int parameterSetRepeats;
+
+    // Number of socket receive calls that returned data and the number of
+    // packets they returned. More than one packet per call means batched
+    // receive is in effect.
+    unsigned int receiveBatches;
+    unsigned int packetsReceived;
+
+    // Number of frames that were completed using FEC parity packets and
+    // number of frames dropped because too many packets were lost.
+    unsigned int fecFramesRecovered;
+    unsigned int fecFramesUnrecoverable;
+
+    // Number of frames that were completed by packets that arrived after
+    // the next frame had started. These would have been dropped without
+    // waiting for reordered packets.
+    unsigned int fecFramesCompletedLate;
+
+    // How long in microseconds the FEC queue currently waits for missing
+    // packets, the RFC 3550 interarrival jitter in microseconds, and the
+    // recent peak number of packets by which arrivals were out of order.
+    int reorderWindowUs;
+    int jitterUs;
+    int reorderDepth;
+
+    // Frames submitted by the frame pacer, older frames it discarded because
+    // a newer IDR frame superseded them, and the decode time it currently
+    // allows for. These are zero unless CAPABILITY_FRAME_PACING is in use.
+    unsigned int pacedFrames;
+    unsigned int pacingDroppedFrames;
+    int pacingDecodeTimeUs;
+} VIDEO_STREAM_STATS, *PVIDEO_STREAM_STATS;
+
+typedef struct _AUDIO_STREAM_STATS {
+    // Audio packet buffer pool occupancy. All buffers are allocated when the
+    // stream starts, so packets that arrive while every buffer is in use are
+    // dropped and counted in packetPoolDroppedPackets.
+    int packetPoolBuffers;
+    int packetPoolBuffersInUse;
+    int packetPoolPeakBuffersInUse;
+    unsigned int packetPoolDroppedPackets;
+
+    // How long in microseconds the reorder queue currently waits for missing
+    // packets, the RFC 3550 interarrival jitter in microseconds, and the
+    // recent peak number of packets by which arrivals were out of order.
+    int reorderWindowUs;
+    int jitterUs;
+    int reorderDepth;
+
+    // Jitter buffer activity. These are zero unless CAPABILITY_AUDIO_JITTER_BUFFER is
+    // in use. The depth is the number of packets from the next one to play up to the
+    // newest one received, and the target depth follows the measured jitter.
+    // Concealed packets were missing at their playout time, and some of them were
+    // recovered from FEC data. Late packets arrived after their playout time and
+    // discarded packets were skipped to bring the delay back down to the target.
+    int jitterBufferDepth;
+    int jitterBufferTargetDepth;
+    unsigned int concealedPackets;
+    unsigned int fecRecoveredPackets;
+    unsigned int latePackets;
+    unsigned int discardedPackets;
+} AUDIO_STREAM_STATS, *PAUDIO_STREAM_STATS;
+
+// Distribution of the time in microseconds spent in one stage of the video pipeline.
+// Percentiles are accurate to within 1/8 of their value.
+typedef struct _LATENCY_PERCENTILES {
+    unsigned int samples;
+    unsigned int p50Us;
+    unsigned int p95Us;
+    unsigned int p99Us;
+    unsigned int maxUs;
+} LATENCY_PERCENTILES, *PLATENCY_PERCENTILES;
+
+// Per-frame latency of each stage of the video pipeline. Only frames that
+// reach the decoder are counted.
+typedef struct _PIPELINE_STATS {
+    // From the first packet of a frame to the packet that completed it
+    LATENCY_PERCENTILES receive;
+
+    // From the packet that completed the frame until FEC recovery finished
+    // and the data packets were released to the depacketizer
+    LATENCY_PERCENTILES fecRecovery;
+
+    // From FEC completion until the decode unit was assembled
+    LATENCY_PERCENTILES reassembly;
+
+    // Time spent waiting in the decode unit queue. This is zero when
+    // CAPABILITY_DIRECT_SUBMIT is in use.
+    LATENCY_PERCENTILES decodeUnitQueue;
+
+    // Time spent in the submitDecodeUnit callback
+    LATENCY_PERCENTILES submit;
+
+    // From the first packet of a frame until submitDecodeUnit returned
+    LATENCY_PERCENTILES total;
+} PIPELINE_STATS, *PPIPELINE_STATS;
+
+// Each counter is read atomically, but they are not read together, so events
+// that are in flight may be counted in one field and not yet in another.
+typedef struct _INPUT_STREAM_STATS {
+    // Input events queued by the LiSendXXX functions and events that were
+    // merged into an earlier queued mouse move or controller event
+    unsigned int eventsQueued;
+    unsigned int eventsMerged;
+
+    // Encrypted messages sent to the server and the number of times they were
+    // handed to the network. These are equal unless coalesceInput is set.
+    unsigned int messagesSent;
+    unsigned int flushes;
+
+    // From the LiSendXXX call for the oldest event in each message until the
+    // message was handed to the network. On Gen 5+ servers, messages are
+    // handed to the control stream I/O thread, which sends them.
+    LATENCY_PERCENTILES sendLatency;
+
+    // CPU time consumed by the input send thread. Dividing this by
+    // eventsQueued gives the cost of each event on that thread.
+    unsigned long long cpuTimeUs;
+} INPUT_STREAM_STATS, *PINPUT_STREAM_STATS;
+
+typedef struct _CONTROL_STREAM_STATS {
+    // IDR frame requests and reference frame invalidation requests sent to
+    // the server
+    unsigned int idrRequests;
+    unsigned int invalidationRequests;
+
+    // From the moment the video stream needed an IDR frame until the request
+    // was handed to the network. On Gen 3 and 4 servers, this also includes
+    // waiting for the server's reply.
+    LATENCY_PERCENTILES idrRequestLatency;
+
+    // Times the control stream I/O thread woke up to send or receive. This is
+    // zero on Gen 3 and 4 servers, which use a TCP control stream instead.
+    unsigned int ioWakeups;
+} CONTROL_STREAM_STATS, *PCONTROL_STREAM_STATS;
+
 // Specifies that the audio stream should be encoded in stereo (default)
 #define AUDIO_CONFIGURATION_STEREO 0
 
@@ -166,11 +400,50 @@ typedef struct _DECODE_UNIT {
 // supports reference frame invalidation for HEVC/H.265 streams. This flag is only valid on video renderers.
 #define CAPABILITY_REFERENCE_FRAME_INVALIDATION_HEVC 0x4
 
+// If set in the video renderer capabilities field, this flag causes the buffers in the
+// decode unit to reference the received packets directly rather than copies of them.
+// This avoids copying each frame in the depacketizer but keeps the receive buffers
+// in use until the decode unit has been submitted, so it increases memory usage
+// when the renderer falls behind. This flag is only valid on video renderers.
+#define CAPABILITY_ZERO_COPY_DECODE_UNITS 0x8
+
 // If set in the video renderer capabilities field, this macro specifies that the renderer
 // supports slicing to increase decoding performance. The parameter specifies the desired
 // number of slices per frame. This capability is only valid on video renderers.
 #define CAPABILITY_SLICES_PER_FRAME(x) (((unsigned char)(x)) << 24)
 
+// If set in the video renderer capabilities field, this flag causes each slice (or group of
+// NALs ending with a slice) to be submitted as its own decode unit as soon as the packets that
+// carry it have arrived in order, rather than waiting for the rest of the frame. This lets the
+// decoder work on a frame while it is still being received. All decode units of a frame share
+// its frame number and frame type, and only the last has DU_FLAG_END_OF_FRAME set. If a decode
+// unit for a different frame arrives before that, the rest of the earlier frame was lost and the
+// slices already submitted for it must be discarded. This should be combined with
+// CAPABILITY_SLICES_PER_FRAME since the stream otherwise has one slice per frame. This flag is
+// only valid on video renderers.
+#define CAPABILITY_SLICE_SUBMIT 0x10
+
+// If set in the audio renderer capabilities field, this flag causes audio packets to be held
+// in a jitter buffer and passed to the renderer at a steady pace of one per packet duration.
+// The playout delay follows the measured network jitter. Packets still missing at their
+// playout time are concealed, using the FEC data in the next packet if the renderer provides
+// decodeAndPlayFecSample. This flag is only valid on audio renderers and is ignored when
+// combined with CAPABILITY_DIRECT_SUBMIT.
+#define CAPABILITY_AUDIO_JITTER_BUFFER 0x20
+
+// If set in the video renderer capabilities field, this flag makes the decoder thread pace frames
+// to the display. Each frame is held until the last moment it can be submitted and still be
+// decoded before the next display refresh, and then the newest complete frame is submitted.
+// Older queued frames are discarded if a newer IDR frame supersedes them. Otherwise they are
+// submitted back to back, since the newest frame references them. Queued P-frames are not
+// discarded even when reference frame invalidation is supported, because the host doesn't mark
+// which frame recovers from an invalidation. Frames are timed against the vsyncs reported by
+// LiReportDisplayVsync() using the refresh rate in clientRefreshRateX100, or the stream's fps if
+// that is zero. The decode time is measured as the time submitDecodeUnit takes. This flag is
+// only valid on video renderers and is ignored when combined with CAPABILITY_DIRECT_SUBMIT or
+// CAPABILITY_SLICE_SUBMIT.
+#define CAPABILITY_FRAME_PACING 0x40
+
 // This callback is invoked to provide details about the video stream and allow configuration of the decoder.
 // Returns 0 on success, non-zero on failure.
 typedef int(*DecoderRendererSetup)(int videoFormat, int width, int height, int redrawRate, void* context, int drFlags);
@@ -241,8 +514,15 @@ typedef void(*AudioRendererStop)(void);
 typedef void(*AudioRendererCleanup)(void);
 
 // This callback provides Opus audio data to be decoded and played. sampleLength is in bytes.
+// sampleData is NULL if a packet was lost and its audio should be concealed.
 typedef void(*AudioRendererDecodeAndPlaySample)(char* sampleData, int sampleLength);
 
+// This optional callback provides the Opus packet that follows a lost one. The renderer
+// should decode the in-band FEC data it carries (decode_fec=1) and play that in place of
+// the lost packet. The packet itself is passed to AudioRendererDecodeAndPlaySample next.
+// This is only used with CAPABILITY_AUDIO_JITTER_BUFFER.
+typedef void(*AudioRendererDecodeAndPlayFecSample)(char* sampleData, int sampleLength);
+
 typedef struct _AUDIO_RENDERER_CALLBACKS {
     AudioRendererInit init;
     AudioRendererStart start;
@@ -250,6 +530,7 @@ typedef struct _AUDIO_RENDERER_CALLBACKS {
     AudioRendererCleanup cleanup;
     AudioRendererDecodeAndPlaySample decodeAndPlaySample;
     int capabilities;
+    AudioRendererDecodeAndPlayFecSample decodeAndPlayFecSample;
 } AUDIO_RENDERER_CALLBACKS, *PAUDIO_RENDERER_CALLBACKS;
 
 // Use this function to zero the audio callbacks when allocated on the stack or heap
@@ -403,11 +684,75 @@ int LiSendMultiControllerEvent(short controllerNumber, short activeGamepadMask,
 // This function queues a vertical scroll event to the remote server.
 int LiSendScrollEvent(signed char scrollClicks);
 
+// This function populates statistics about the video stream. It may be called from
+// any thread while streaming. All values are zero if no video stream is active.
+void LiGetVideoStreamStats(PVIDEO_STREAM_STATS stats);
+
+// This function tells the frame pacer when the display last refreshed. vsyncTimeUs is the time of
+// the vsync on the LiGetMicros() clock, so callbacks that are delivered late can pass the time the
+// display reports instead of the time they ran. It may be called from any thread and has no effect
+// unless CAPABILITY_FRAME_PACING is in use.
+void LiReportDisplayVsync(unsigned long long vsyncTimeUs);
+
+// This function populates statistics about the audio stream. It may be called from
+// any thread while streaming. All values are zero if no audio stream is active.
+void LiGetAudioStreamStats(PAUDIO_STREAM_STATS stats);
+
+// This function populates per-frame video pipeline latency statistics collected since
+// the stream started or LiResetPipelineStats() was last called. It may be called from
+// any thread while streaming and does not block the pipeline.
+void LiGetPipelineStats(PPIPELINE_STATS stats);
+
+// This function discards the samples collected for LiGetPipelineStats(). Callers that
+// display live values can call this after each LiGetPipelineStats() call.
+void LiResetPipelineStats(void);
+
+// This function populates statistics about the input stream collected since the stream
+// started or LiResetInputStreamStats() was last called. It may be called from any thread
+// while streaming.
+void LiGetInputStreamStats(PINPUT_STREAM_STATS stats);
+
+// This function discards the statistics collected for LiGetInputStreamStats().
+void LiResetInputStreamStats(void);
+
+// This function populates statistics about the control stream collected since the stream
+// started or LiResetControlStreamStats() was last called. It may be called from any thread
+// while streaming.
+void LiGetControlStreamStats(PCONTROL_STREAM_STATS stats);
+
+// This function discards the statistics collected for LiGetControlStreamStats().
+void LiResetControlStreamStats(void);
+
+// This function starts recording received video RTP packets and their arrival times
+// to the file at the given path. The capture covers every connection started until
+// LiStopRtpCapture() is called. These functions must not be called while a connection
+// is active. Returns 0 on success or an errno value if the file could not be created.
+int LiStartRtpCapture(const char* path);
+void LiStopRtpCapture(void);
+
+typedef struct _SCHEDULING_LATENCY_STATS {
+    // For each thread role, how much later than requested a thread with that
+    // role's scheduling woke up from a series of 1 ms sleeps
+    LATENCY_PERCENTILES wakeupLatency[THREAD_ROLE_COUNT];
+} SCHEDULING_LATENCY_STATS, *PSCHEDULING_LATENCY_STATS;
+
+// This function measures how promptly threads with each role are scheduled using the
+// threadScheduling settings in the stream configuration. One thread per role sleeps and
+// wakes repeatedly for durationMs while loadThreads CPU-bound threads compete with them.
+// The scheduling in effect before the call is restored before it returns. It must not be
+// called while a connection is active. Returns 0 on success.
+int LiMeasureSchedulingLatency(PSTREAM_CONFIGURATION streamConfig, int durationMs,
+                               int loadThreads, PSCHEDULING_LATENCY_STATS stats);
+
 // This function returns a time in milliseconds with an implementation-defined epoch.
 // NOTE: This will be populated from gettimeofday() if !HAVE_CLOCK_GETTIME and
 // populated from clock_gettime(CLOCK_MONOTONIC) if HAVE_CLOCK_GETTIME.
 uint64_t LiGetMillis(void);
 
+// This function returns a time in microseconds from the same clock and epoch as
+// LiGetMillis(). With HAVE_CLOCK_GETTIME, it matches System.nanoTime() / 1000.
+uint64_t LiGetMicros(void);
+
 // This is a simplistic STUN function that can assist clients in getting the WAN address
 // for machines they find using mDNS over IPv4. This can be used to pre-populate the external
 // address for streaming after GFE stopped sending it a while back. wanAddr is returned in
@@ -1,7 +1,17 @@
 #include "LinkedBlockingQueue.h"
+#include "RingBlockingQueue.h"
 
 // Destroy the linked blocking queue and associated mutex and event
 PLINKED_BLOCKING_QUEUE_ENTRY LbqDestroyLinkedBlockingQueue(PLINKED_BLOCKING_QUEUE queueHead) {
+    PLINKED_BLOCKING_QUEUE_ENTRY head;
+
+    if (queueHead->ring != NULL) {
+        head = RbqDestroyRingBlockingQueue(queueHead->ring);
+        free(queueHead->ring);
+        queueHead->ring = NULL;
+        return head;
+    }
+
     LC_ASSERT(queueHead->shutdown || queueHead->lifetimeSize == 0);
     
     PltDeleteMutex(&queueHead->mutex);
@@ -14,6 +24,10 @@ PLINKED_BLOCKING_QUEUE_ENTRY LbqDestroyLinkedBlockingQueue(PLINKED_BLOCKING_QUEU
 PLINKED_BLOCKING_QUEUE_ENTRY LbqFlushQueueItems(PLINKED_BLOCKING_QUEUE queueHead) {
     PLINKED_BLOCKING_QUEUE_ENTRY head;
 
+    if (queueHead->ring != NULL) {
+        return RbqFlushQueueItems(queueHead->ring);
+    }
+
     PltLockMutex(&queueHead->mutex);
 
     // Save the old head
@@ -51,12 +65,46 @@ int LbqInitializeLinkedBlockingQueue(PLINKED_BLOCKING_QUEUE queueHead, int sizeB
     return 0;
 }
 
+// Linked blocking queue init backed by a lock-free ring rather than a locked list.
+// All other Lbq functions behave the same on the resulting queue.
+int LbqInitializeLockFreeQueue(PLINKED_BLOCKING_QUEUE queueHead, int sizeBound) {
+    int err;
+
+    memset(queueHead, 0, sizeof(*queueHead));
+
+    queueHead->ring = (struct _RING_BLOCKING_QUEUE*)malloc(sizeof(*queueHead->ring));
+    if (queueHead->ring == NULL) {
+        return -1;
+    }
+
+    err = RbqInitializeRingBlockingQueue(queueHead->ring, sizeBound);
+    if (err != 0) {
+        free(queueHead->ring);
+        queueHead->ring = NULL;
+        return err;
+    }
+
+    queueHead->sizeBound = sizeBound;
+
+    return 0;
+}
+
 void LbqSignalQueueShutdown(PLINKED_BLOCKING_QUEUE queueHead) {
     queueHead->shutdown = 1;
-    PltSetEvent(&queueHead->containsDataEvent);
+
+    if (queueHead->ring != NULL) {
+        RbqSignalQueueShutdown(queueHead->ring);
+    }
+    else {
+        PltSetEvent(&queueHead->containsDataEvent);
+    }
 }
 
 int LbqOfferQueueItem(PLINKED_BLOCKING_QUEUE queueHead, void* data, PLINKED_BLOCKING_QUEUE_ENTRY entry) {
+    if (queueHead->ring != NULL) {
+        return RbqOfferQueueItem(queueHead->ring, data, entry);
+    }
+
     if (queueHead->shutdown) {
         return LBQ_INTERRUPTED;
     }
@@ -98,6 +146,10 @@ int LbqOfferQueueItem(PLINKED_BLOCKING_QUEUE queueHead, void* data, PLINKED_BLOC
 
 // This must be synchronized with LbqFlushQueueItems by the caller
 int LbqPeekQueueElement(PLINKED_BLOCKING_QUEUE queueHead, void** data) {
+    if (queueHead->ring != NULL) {
+        return RbqPeekQueueElement(queueHead->ring, data);
+    }
+
     if (queueHead->shutdown) {
         return LBQ_INTERRUPTED;
     }
@@ -123,6 +175,10 @@ int LbqPeekQueueElement(PLINKED_BLOCKING_QUEUE queueHead, void** data) {
 int LbqPollQueueElement(PLINKED_BLOCKING_QUEUE queueHead, void** data) {
     PLINKED_BLOCKING_QUEUE_ENTRY entry;
     
+    if (queueHead->ring != NULL) {
+        return RbqPollQueueElement(queueHead->ring, data);
+    }
+
     if (queueHead->shutdown) {
         return LBQ_INTERRUPTED;
     }
@@ -162,6 +218,10 @@ int LbqWaitForQueueElement(PLINKED_BLOCKING_QUEUE queueHead, void** data) {
     PLINKED_BLOCKING_QUEUE_ENTRY entry;
     int err;
     
+    if (queueHead->ring != NULL) {
+        return RbqWaitForQueueElement(queueHead->ring, data);
+    }
+
     if (queueHead->shutdown) {
         return LBQ_INTERRUPTED;
     }
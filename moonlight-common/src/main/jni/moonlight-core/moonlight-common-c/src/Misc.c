@@ -92,3 +92,7 @@ void LiInitializeServerInformation(PSERVER_INFORMATION serverInfo) {
 uint64_t LiGetMillis(void) {
     return PltGetMillis();
 }
+
+uint64_t LiGetMicros(void) {
+    return PltGetMicros();
+}
@@ -0,0 +1,139 @@
+#include "Limelight-internal.h"
+#include "PacketPool.h"
+#include "PlatformAtomics.h"
+
+// Buffer strides are padded so the queue entry at the end of each buffer stays aligned
+#define PP_BUFFER_ALIGNMENT 16
+
+int PpInitializePool(PPACKET_POOL pool, int bufferSize, int slabSize) {
+    memset(pool, 0, sizeof(*pool));
+
+    pool->bufferSize = bufferSize;
+    pool->bufferStride = (bufferSize + PP_BUFFER_ALIGNMENT - 1) & ~(PP_BUFFER_ALIGNMENT - 1);
+    pool->slabSize = slabSize;
+
+    return 0;
+}
+
+static int growPool(PPACKET_POOL pool);
+
+// Initializes a pool with all of its buffers allocated up front. Allocations
+// fail rather than growing the pool once every buffer is in use.
+int PpInitializeFixedPool(PPACKET_POOL pool, int bufferSize, int bufferCount) {
+    PpInitializePool(pool, bufferSize, bufferCount);
+    pool->maxSlabs = 1;
+
+    return growPool(pool);
+}
+
+// All buffers must have been returned before the pool is destroyed
+void PpDestroyPool(PPACKET_POOL pool) {
+    LC_ASSERT(pool->buffersInUse == 0);
+
+    if (pool->slabCount != 0) {
+        Limelog("Packet pool: %d buffers in %d slabs, peak usage %d, %d allocation failures\n",
+                pool->totalBuffers, pool->slabCount, pool->peakBuffersInUse,
+                pool->allocationFailures);
+    }
+
+    while (pool->slabs != NULL) {
+        PPACKET_POOL_SLAB slab = pool->slabs;
+        pool->slabs = slab->next;
+        free(slab);
+    }
+
+    pool->freeList = NULL;
+    pool->returnList = NULL;
+    pool->totalBuffers = 0;
+    pool->slabCount = 0;
+
+    // The stream statistics read as zero once the stream is gone
+    pool->peakBuffersInUse = 0;
+    pool->allocationFailures = 0;
+}
+
+static int growPool(PPACKET_POOL pool) {
+    PPACKET_POOL_SLAB slab;
+    char* buffers;
+    int i;
+
+    if (pool->maxSlabs != 0 && pool->slabCount >= pool->maxSlabs) {
+        return -1;
+    }
+
+    slab = (PPACKET_POOL_SLAB)malloc(PP_BUFFER_ALIGNMENT + (size_t)pool->bufferStride * pool->slabSize);
+    if (slab == NULL) {
+        return -1;
+    }
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slabCount++;
+    pool->totalBuffers += pool->slabSize;
+
+    // Chain the new buffers in address order so they're handed out sequentially
+    buffers = (char*)slab + PP_BUFFER_ALIGNMENT;
+    for (i = pool->slabSize - 1; i >= 0; i--) {
+        PPACKET_POOL_BUFFER buffer = (PPACKET_POOL_BUFFER)&buffers[(size_t)i * pool->bufferStride];
+        buffer->next = pool->freeList;
+        pool->freeList = buffer;
+    }
+
+    return 0;
+}
+
+// This may only be called by the thread that owns the pool
+void* PpAllocateBuffer(PPACKET_POOL pool) {
+    PPACKET_POOL_BUFFER buffer;
+    int inUse;
+
+    if (pool->freeList == NULL) {
+        // Take everything returned since the last time. Since the whole
+        // list is detached at once, this isn't subject to ABA problems.
+        pool->freeList = (PPACKET_POOL_BUFFER)PltAtomicExchangePtr(&pool->returnList, NULL);
+
+        if (pool->freeList == NULL && growPool(pool) < 0) {
+            pool->allocationFailures++;
+            return NULL;
+        }
+    }
+
+    buffer = pool->freeList;
+    pool->freeList = buffer->next;
+
+    inUse = PltAtomicAddInt(&pool->buffersInUse, 1);
+    if (inUse > pool->peakBuffersInUse) {
+        pool->peakBuffersInUse = inUse;
+    }
+
+    return buffer;
+}
+
+// This may be called from any thread
+void PpFreeBuffer(PPACKET_POOL pool, void* buffer) {
+    PPACKET_POOL_BUFFER entry = (PPACKET_POOL_BUFFER)buffer;
+    void* head;
+
+    head = PltAtomicLoadPtr(&pool->returnList);
+    for (;;) {
+        void* oldHead;
+
+        entry->next = (PPACKET_POOL_BUFFER)head;
+        oldHead = PltAtomicCompareExchangePtr(&pool->returnList, head, entry);
+        if (oldHead == head) {
+            break;
+        }
+
+        head = oldHead;
+    }
+
+    PltAtomicAddInt(&pool->buffersInUse, -1);
+}
+
+void PpGetPoolStats(PPACKET_POOL pool, PPACKET_POOL_STATS stats) {
+    stats->totalBuffers = pool->totalBuffers;
+    stats->buffersInUse = PltAtomicLoadInt(&pool->buffersInUse);
+    stats->peakBuffersInUse = pool->peakBuffersInUse;
+    stats->slabCount = pool->slabCount;
+    stats->allocationFailures = pool->allocationFailures;
+}
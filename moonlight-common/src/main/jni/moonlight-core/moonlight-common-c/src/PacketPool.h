@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Platform.h"
+
+// Buffers are handed out in allocation order from slabs of this many buffers
+#define PP_DEFAULT_SLAB_SIZE 64
+
+typedef struct _PACKET_POOL_BUFFER {
+    struct _PACKET_POOL_BUFFER* next;
+} PACKET_POOL_BUFFER, *PPACKET_POOL_BUFFER;
+
+typedef struct _PACKET_POOL_SLAB {
+    struct _PACKET_POOL_SLAB* next;
+} PACKET_POOL_SLAB, *PPACKET_POOL_SLAB;
+
+// A pool of fixed-size buffers. Allocation is only allowed from a single
+// owner thread, but buffers may be returned from any thread without locking.
+typedef struct _PACKET_POOL {
+    int bufferSize;
+    int bufferStride;
+    int slabSize;
+
+    // The pool never grows beyond this many slabs if it is non-zero
+    int maxSlabs;
+
+    // Owned by the allocating thread
+    PPACKET_POOL_SLAB slabs;
+    PPACKET_POOL_BUFFER freeList;
+
+    // Lock-free stack of buffers returned by any thread
+    void* volatile returnList;
+
+    volatile int buffersInUse;
+    int peakBuffersInUse;
+    int totalBuffers;
+    int slabCount;
+    int allocationFailures;
+} PACKET_POOL, *PPACKET_POOL;
+
+typedef struct _PACKET_POOL_STATS {
+    int totalBuffers;
+    int buffersInUse;
+    int peakBuffersInUse;
+    int slabCount;
+    int allocationFailures;
+} PACKET_POOL_STATS, *PPACKET_POOL_STATS;
+
+int PpInitializePool(PPACKET_POOL pool, int bufferSize, int slabSize);
+int PpInitializeFixedPool(PPACKET_POOL pool, int bufferSize, int bufferCount);
+void PpDestroyPool(PPACKET_POOL pool);
+void* PpAllocateBuffer(PPACKET_POOL pool);
+void PpFreeBuffer(PPACKET_POOL pool, void* buffer);
+void PpGetPoolStats(PPACKET_POOL pool, PPACKET_POOL_STATS stats);
@@ -0,0 +1,83 @@
+#include "Limelight-internal.h"
+#include "ParameterSetCache.h"
+
+// 32-bit FNV-1a
+static unsigned int hashParameterSet(const char* data, int length) {
+    unsigned int hash = 2166136261U;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619U;
+    }
+
+    return hash;
+}
+
+void PscInitialize(PPARAMETER_SET_CACHE cache) {
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Forgets the cached parameter sets so the next ones are reported as
+// changed. This is needed whenever the decoder may have lost its state.
+void PscInvalidate(PPARAMETER_SET_CACHE cache) {
+    cache->setCount = 0;
+}
+
+// Compares the parameter sets leading a buffer list with those of the previous
+// call and remembers the new ones. Returns 1 if they are identical and 0 if
+// they changed or there were none to compare against.
+int PscUpdate(PPARAMETER_SET_CACHE cache, PLENTRY bufferList) {
+    PLENTRY entry;
+    PPSC_ENTRY set;
+    unsigned int hash;
+    int unchanged;
+    int setCount;
+
+    unchanged = cache->setCount != 0;
+    setCount = 0;
+    for (entry = bufferList; entry != NULL && entry->bufferType != BUFFER_TYPE_PICDATA; entry = entry->next) {
+        if (setCount == PSC_MAX_SETS || entry->length > PSC_MAX_SET_SIZE) {
+            // Too much to remember, so the next frame can't be matched against it
+            unchanged = 0;
+            setCount = 0;
+            break;
+        }
+
+        set = &cache->sets[setCount];
+        hash = hashParameterSet(entry->data, entry->length);
+
+        // The hash rejects most changes without comparing the data itself
+        if (unchanged &&
+            (setCount >= cache->setCount ||
+             set->bufferType != entry->bufferType ||
+             set->length != entry->length ||
+             set->hash != hash ||
+             memcmp(set->data, entry->data, entry->length) != 0)) {
+            unchanged = 0;
+        }
+
+        if (!unchanged) {
+            set->bufferType = entry->bufferType;
+            set->length = entry->length;
+            set->hash = hash;
+            memcpy(set->data, entry->data, entry->length);
+        }
+
+        setCount++;
+    }
+
+    if (setCount != cache->setCount) {
+        unchanged = 0;
+    }
+    cache->setCount = setCount;
+
+    if (unchanged) {
+        cache->repeats++;
+    }
+    else {
+        cache->changes++;
+    }
+
+    return unchanged;
+}
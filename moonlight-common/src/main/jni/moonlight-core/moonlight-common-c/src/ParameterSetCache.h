@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Limelight.h"
+
+// Most parameter sets remembered from one IDR frame (VPS, SPS and PPS)
+#define PSC_MAX_SETS 4
+
+// Parameter sets larger than this are not remembered, so frames carrying
+// them are always reported as changed
+#define PSC_MAX_SET_SIZE 256
+
+typedef struct _PSC_ENTRY {
+    int bufferType;
+    int length;
+    unsigned int hash;
+    char data[PSC_MAX_SET_SIZE];
+} PSC_ENTRY, *PPSC_ENTRY;
+
+// Remembers the parameter sets last given to the decoder so an IDR frame
+// that repeats them can be told apart from one that changes them. This is
+// only used by the thread that submits decode units, but the statistics may
+// be read from any thread.
+typedef struct _PARAMETER_SET_CACHE {
+    // Parameter sets in the order they were submitted or zero if the
+    // decoder hasn't been given any since the cache was last invalidated
+    PSC_ENTRY sets[PSC_MAX_SETS];
+    int setCount;
+
+    unsigned int changes;
+    unsigned int repeats;
+} PARAMETER_SET_CACHE, *PPARAMETER_SET_CACHE;
+
+void PscInitialize(PPARAMETER_SET_CACHE cache);
+void PscInvalidate(PPARAMETER_SET_CACHE cache);
+int PscUpdate(PPARAMETER_SET_CACHE cache, PLENTRY bufferList);
@@ -0,0 +1,207 @@
+#include "Limelight-internal.h"
+#include "PcmRing.h"
+#include "PlatformAtomics.h"
+
+#include <limits.h>
+
+// The target fill level moves in steps of 5 ms of 48 KHz audio
+#define PCMR_TARGET_STEP_FRAMES 240
+
+// Drift compensation starts once the average fill level strays this far
+// from the target
+#define PCMR_DRIFT_TOLERANCE_FRAMES (PCMR_TARGET_STEP_FRAMES / 2)
+
+// The lowest fill level is measured over windows of 1 second of audio
+#define PCMR_WINDOW_FRAMES 48000
+
+// The target is lowered after this many windows without an underrun
+#define PCMR_STABLE_WINDOWS 10
+
+int PcmrInitializeRing(PPCM_RING ring, int channelCount, int capacityFrames,
+                       int minTargetFrames, int maxTargetFrames) {
+    memset(ring, 0, sizeof(*ring));
+
+    // The ring must be able to hold the largest target plus a write
+    LC_ASSERT((capacityFrames & (capacityFrames - 1)) == 0);
+    LC_ASSERT(minTargetFrames <= maxTargetFrames);
+    LC_ASSERT(maxTargetFrames < capacityFrames);
+
+    ring->samples = (short*)malloc((size_t)capacityFrames * channelCount * sizeof(short));
+    if (ring->samples == NULL) {
+        return -1;
+    }
+
+    ring->channelCount = channelCount;
+    ring->capacityFrames = capacityFrames;
+    ring->minTargetFrames = minTargetFrames;
+    ring->maxTargetFrames = maxTargetFrames;
+    ring->targetFrames = minTargetFrames;
+    ring->windowFramesLeft = PCMR_WINDOW_FRAMES;
+    ring->windowMinFillFrames = INT_MAX;
+
+    return 0;
+}
+
+void PcmrDestroyRing(PPCM_RING ring) {
+    free(ring->samples);
+    ring->samples = NULL;
+}
+
+// Frame counters wrap around, so differences are computed unsigned
+#define FRAME_DIFF(x, y) ((int)((unsigned int)(x) - (unsigned int)(y)))
+#define FRAME_ADD(x, y) ((int)((unsigned int)(x) + (unsigned int)(y)))
+
+// Copies frames between the ring and a linear buffer, wrapping around the end of the ring
+static void copyFrames(PPCM_RING ring, int ringFrame, short* samples, int frameCount, int toRing) {
+    int offset = (int)((unsigned int)ringFrame & (ring->capacityFrames - 1));
+    int firstFrames = frameCount;
+    short* ringSamples = &ring->samples[offset * ring->channelCount];
+    size_t frameSize = ring->channelCount * sizeof(short);
+
+    if (firstFrames > ring->capacityFrames - offset) {
+        firstFrames = ring->capacityFrames - offset;
+    }
+
+    if (toRing) {
+        memcpy(ringSamples, samples, firstFrames * frameSize);
+        memcpy(ring->samples, &samples[firstFrames * ring->channelCount], (frameCount - firstFrames) * frameSize);
+    }
+    else {
+        memcpy(samples, ringSamples, firstFrames * frameSize);
+        memcpy(&samples[firstFrames * ring->channelCount], ring->samples, (frameCount - firstFrames) * frameSize);
+    }
+}
+
+// This may only be called by the writer. Returns 0 if there was no room for the frames.
+int PcmrWriteFrames(PPCM_RING ring, const short* samples, int frameCount) {
+    int writeFrame = ring->writeFrame;
+    int fillFrames = FRAME_DIFF(writeFrame, PltAtomicLoadInt(&ring->readFrame));
+
+    if (frameCount > ring->capacityFrames - fillFrames) {
+        // The reader has stalled. Dropping new audio keeps the reader from
+        // seeing a partially written ring.
+        ring->overflows++;
+        return 0;
+    }
+
+    copyFrames(ring, writeFrame, (short*)samples, frameCount, 1);
+
+    // Publish the frames after they're written
+    PltAtomicStoreInt(&ring->writeFrame, FRAME_ADD(writeFrame, frameCount));
+    return 1;
+}
+
+static void adjustTarget(PPCM_RING ring, int deltaFrames) {
+    ring->targetFrames += deltaFrames;
+    if (ring->targetFrames < ring->minTargetFrames) {
+        ring->targetFrames = ring->minTargetFrames;
+    }
+    else if (ring->targetFrames > ring->maxTargetFrames) {
+        ring->targetFrames = ring->maxTargetFrames;
+    }
+}
+
+// Lowers the target if buffered audio went unused for long enough
+static void updateFillWindow(PPCM_RING ring, int fillFrames, int frameCount) {
+    if (fillFrames < ring->windowMinFillFrames) {
+        ring->windowMinFillFrames = fillFrames;
+    }
+
+    ring->windowFramesLeft -= frameCount;
+    if (ring->windowFramesLeft > 0) {
+        return;
+    }
+
+    // The fill level never dropped below windowMinFillFrames, so that much
+    // audio beyond what this read needed was never required
+    if (ring->windowMinFillFrames - frameCount >= PCMR_TARGET_STEP_FRAMES) {
+        ring->stableWindows++;
+        if (ring->stableWindows >= PCMR_STABLE_WINDOWS) {
+            adjustTarget(ring, -PCMR_TARGET_STEP_FRAMES);
+            ring->stableWindows = 0;
+        }
+    }
+    else {
+        ring->stableWindows = 0;
+    }
+
+    ring->windowFramesLeft = PCMR_WINDOW_FRAMES;
+    ring->windowMinFillFrames = INT_MAX;
+}
+
+// This may only be called by the reader. It always fills the buffer, using
+// silence while the ring is filling up to the target level.
+void PcmrReadFrames(PPCM_RING ring, short* samples, int frameCount) {
+    int readFrame = ring->readFrame;
+    int fillFrames = FRAME_DIFF(PltAtomicLoadInt(&ring->writeFrame), readFrame);
+    int channelCount = ring->channelCount;
+    int i;
+
+    if (!ring->primed) {
+        if (fillFrames < ring->targetFrames) {
+            memset(samples, 0, frameCount * channelCount * sizeof(short));
+            return;
+        }
+
+        ring->primed = 1;
+        ring->smoothedFillFrames = fillFrames * PCMR_FILL_SMOOTHING;
+    }
+
+    if (fillFrames < frameCount) {
+        // Play what we have and wait for more audio than before
+        copyFrames(ring, readFrame, samples, fillFrames, 0);
+        memset(&samples[fillFrames * channelCount], 0, (frameCount - fillFrames) * channelCount * sizeof(short));
+        PltAtomicStoreInt(&ring->readFrame, FRAME_ADD(readFrame, fillFrames));
+
+        ring->underruns++;
+        ring->primed = 0;
+        ring->stableWindows = 0;
+        adjustTarget(ring, PCMR_TARGET_STEP_FRAMES);
+        return;
+    }
+
+    updateFillWindow(ring, fillFrames, frameCount);
+
+    ring->smoothedFillFrames += fillFrames - ring->smoothedFillFrames / PCMR_FILL_SMOOTHING;
+
+    if (ring->smoothedFillFrames / PCMR_FILL_SMOOTHING > ring->targetFrames + PCMR_DRIFT_TOLERANCE_FRAMES &&
+            fillFrames > frameCount) {
+        // The writer is ahead, so consume an extra frame by blending the last two
+        short* lastFrame = &samples[(frameCount - 1) * channelCount];
+        short nextFrame[8];
+
+        LC_ASSERT(channelCount <= 8);
+
+        copyFrames(ring, readFrame, samples, frameCount, 0);
+        copyFrames(ring, FRAME_ADD(readFrame, frameCount), nextFrame, 1, 0);
+        for (i = 0; i < channelCount; i++) {
+            lastFrame[i] = (short)(((int)lastFrame[i] + nextFrame[i]) / 2);
+        }
+
+        PltAtomicStoreInt(&ring->readFrame, FRAME_ADD(readFrame, frameCount + 1));
+        ring->framesDropped++;
+    }
+    else if (ring->smoothedFillFrames / PCMR_FILL_SMOOTHING < ring->targetFrames - PCMR_DRIFT_TOLERANCE_FRAMES) {
+        // The reader is ahead, so stretch the audio by repeating the last frame
+        copyFrames(ring, readFrame, samples, frameCount - 1, 0);
+        memcpy(&samples[(frameCount - 1) * channelCount], &samples[(frameCount - 2) * channelCount],
+               channelCount * sizeof(short));
+
+        PltAtomicStoreInt(&ring->readFrame, FRAME_ADD(readFrame, frameCount - 1));
+        ring->framesInserted++;
+    }
+    else {
+        copyFrames(ring, readFrame, samples, frameCount, 0);
+        PltAtomicStoreInt(&ring->readFrame, FRAME_ADD(readFrame, frameCount));
+    }
+}
+
+// This may be called from any thread
+void PcmrGetStats(PPCM_RING ring, PPCM_RING_STATS stats) {
+    stats->fillFrames = FRAME_DIFF(PltAtomicLoadInt(&ring->writeFrame), PltAtomicLoadInt(&ring->readFrame));
+    stats->targetFrames = ring->targetFrames;
+    stats->underruns = ring->underruns;
+    stats->overflows = ring->overflows;
+    stats->framesDropped = ring->framesDropped;
+    stats->framesInserted = ring->framesInserted;
+}
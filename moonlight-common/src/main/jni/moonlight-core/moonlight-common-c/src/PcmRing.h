@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Platform.h"
+
+// Fill levels are averaged over this many reads for drift compensation
+#define PCMR_FILL_SMOOTHING 8
+
+typedef struct _PCM_RING_STATS {
+    // Frames currently buffered and the fill level the reader aims for
+    int fillFrames;
+    int targetFrames;
+
+    // Reads that ran out of audio and writes that found no room
+    unsigned int underruns;
+    unsigned int overflows;
+
+    // Frames removed or repeated to keep the fill level at the target
+    // when the writer and reader clocks drift apart
+    unsigned int framesDropped;
+    unsigned int framesInserted;
+} PCM_RING_STATS, *PPCM_RING_STATS;
+
+// A lock-free ring of interleaved 16-bit PCM frames between one writer
+// (the audio decoder) and one reader (the audio output). The reader keeps
+// an adaptive amount of audio buffered: the target grows after an
+// underrun and shrinks again after a long stretch without one. Clock
+// drift between the two sides is absorbed by dropping or repeating a
+// frame per read whenever the fill level strays from the target.
+typedef struct _PCM_RING {
+    short* samples;
+    int channelCount;
+    int capacityFrames;
+
+    // Only written by the writer
+    volatile int writeFrame;
+    unsigned int overflows;
+
+    // Only written by the reader
+    volatile int readFrame;
+    int primed;
+    int minTargetFrames;
+    int maxTargetFrames;
+    int targetFrames;
+    int smoothedFillFrames;
+    int windowFramesLeft;
+    int windowMinFillFrames;
+    int stableWindows;
+    unsigned int underruns;
+    unsigned int framesDropped;
+    unsigned int framesInserted;
+} PCM_RING, *PPCM_RING;
+
+int PcmrInitializeRing(PPCM_RING ring, int channelCount, int capacityFrames,
+                       int minTargetFrames, int maxTargetFrames);
+void PcmrDestroyRing(PPCM_RING ring);
+int PcmrWriteFrames(PPCM_RING ring, const short* samples, int frameCount);
+void PcmrReadFrames(PPCM_RING ring, short* samples, int frameCount);
+void PcmrGetStats(PPCM_RING ring, PPCM_RING_STATS stats);
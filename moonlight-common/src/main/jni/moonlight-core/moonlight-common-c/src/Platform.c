@@ -1,7 +1,24 @@
+#ifndef _GNU_SOURCE
+// For CPU affinity and thread naming on Linux
+#define _GNU_SOURCE
+#endif
+
+#include "Limelight-internal.h"
 #include "PlatformThreads.h"
 #include "Platform.h"
 
 #include <enet/enet.h>
+#include <time.h>
+
+#if defined(LC_POSIX) && !defined(__vita__)
+#include <sched.h>
+#endif
+
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
 
 int initializePlatformSockets(void);
 void cleanupPlatformSockets(void);
@@ -9,6 +26,8 @@ void cleanupPlatformSockets(void);
 struct thread_context {
     ThreadEntry entry;
     void* context;
+    const char* name;
+    int role;
 #if defined(__vita__)
     PLT_THREAD* thread;
 #endif
@@ -16,6 +35,115 @@ struct thread_context {
 
 static int running_threads = 0;
 
+// Scheduling applied to new threads by role
+static THREAD_SCHEDULING threadScheduling[THREAD_ROLE_COUNT];
+
+void PltSetThreadScheduling(const THREAD_SCHEDULING* scheduling) {
+    memcpy(threadScheduling, scheduling, sizeof(threadScheduling));
+}
+
+void PltGetThreadScheduling(THREAD_SCHEDULING* scheduling) {
+    memcpy(scheduling, threadScheduling, sizeof(threadScheduling));
+}
+
+// Names the calling thread and applies the scheduling for its role. This runs
+// on the new thread because some platforms can only name or pin the calling thread.
+static void setupCurrentThread(const char* name, int role) {
+    PTHREAD_SCHEDULING scheduling;
+
+    LC_ASSERT(role >= 0 && role < THREAD_ROLE_COUNT);
+    scheduling = &threadScheduling[role];
+
+#if defined(LC_WINDOWS)
+    {
+        int priority = THREAD_PRIORITY_NORMAL;
+
+        if (scheduling->realtimePriority != 0) {
+            priority = THREAD_PRIORITY_TIME_CRITICAL;
+        }
+        else if (scheduling->niceValue <= -10) {
+            priority = THREAD_PRIORITY_HIGHEST;
+        }
+        else if (scheduling->niceValue < 0) {
+            priority = THREAD_PRIORITY_ABOVE_NORMAL;
+        }
+        else if (scheduling->niceValue >= 10) {
+            priority = THREAD_PRIORITY_LOWEST;
+        }
+        else if (scheduling->niceValue > 0) {
+            priority = THREAD_PRIORITY_BELOW_NORMAL;
+        }
+
+        if (priority != THREAD_PRIORITY_NORMAL && !SetThreadPriority(GetCurrentThread(), priority)) {
+            Limelog("Unable to set priority of thread %s: %d\n", name, (int)GetLastError());
+        }
+
+        if (scheduling->cpuAffinityMask != 0 &&
+                SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)scheduling->cpuAffinityMask) == 0) {
+            Limelog("Unable to set CPU affinity of thread %s: %d\n", name, (int)GetLastError());
+        }
+    }
+#elif defined(__vita__)
+    // The name is given when the thread is created and scheduling isn't configurable
+#else
+    {
+        char shortName[16];
+        int useNice = scheduling->niceValue != 0;
+        int err;
+
+        // Linux limits names to 15 characters
+        strncpy(shortName, name, sizeof(shortName) - 1);
+        shortName[sizeof(shortName) - 1] = 0;
+#if defined(LC_DARWIN)
+        pthread_setname_np(shortName);
+#elif defined(__linux__)
+        pthread_setname_np(pthread_self(), shortName);
+#endif
+
+        if (scheduling->realtimePriority != 0) {
+            struct sched_param param;
+
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = scheduling->realtimePriority;
+            err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (err == 0) {
+                useNice = 0;
+            }
+            else {
+                // Unprivileged processes usually can't use real-time scheduling
+                Limelog("Unable to use SCHED_FIFO for thread %s: %d\n", name, err);
+            }
+        }
+
+#if defined(__linux__)
+        // Linux applies nice values to individual threads
+        if (useNice && setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), scheduling->niceValue) < 0) {
+            Limelog("Unable to set nice value of thread %s: %d\n", name, errno);
+        }
+
+        if (scheduling->cpuAffinityMask != 0) {
+            cpu_set_t cpuSet;
+            int i;
+
+            CPU_ZERO(&cpuSet);
+            for (i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+                if (scheduling->cpuAffinityMask & (1ULL << i)) {
+                    CPU_SET(i, &cpuSet);
+                }
+            }
+
+            // A pid of 0 means the calling thread
+            if (sched_setaffinity(0, sizeof(cpuSet), &cpuSet) < 0) {
+                Limelog("Unable to set CPU affinity of thread %s: %d\n", name, errno);
+            }
+        }
+#else
+        (void)useNice;
+#endif
+    }
+#endif
+}
+
 #if defined(LC_WINDOWS)
 DWORD WINAPI ThreadProc(LPVOID lpParameter) {
     struct thread_context* ctx = (struct thread_context*)lpParameter;
@@ -27,6 +155,8 @@ void* ThreadProc(void* context) {
     struct thread_context* ctx = (struct thread_context*)context;
 #endif
 
+    setupCurrentThread(ctx->name, ctx->role);
+
     ctx->entry(ctx->context);
 
 #if defined(__vita__)
@@ -53,6 +183,17 @@ void PltSleepMs(int ms) {
 #endif
 }
 
+void PltSleepUs(int us) {
+#if defined(LC_WINDOWS)
+    // Windows waits have millisecond resolution at best
+    WaitForSingleObjectEx(GetCurrentThread(), (us + 999) / 1000, FALSE);
+#elif defined(__vita__)
+    sceKernelDelayThread(us);
+#else
+    usleep(us);
+#endif
+}
+
 int PltCreateMutex(PLT_MUTEX* mutex) {
 #if defined(LC_WINDOWS)
     *mutex = CreateMutexEx(NULL, NULL, 0, MUTEX_ALL_ACCESS);
@@ -137,7 +278,9 @@ void PltInterruptThread(PLT_THREAD* thread) {
     thread->cancelled = 1;
 }
 
-int PltCreateThread(ThreadEntry entry, void* context, PLT_THREAD* thread) {
+// The name must remain valid while the thread is running. The role is one
+// of the THREAD_ROLE_XXX values and selects the thread's scheduling.
+int PltCreateThread(const char* name, int role, ThreadEntry entry, void* context, PLT_THREAD* thread) {
     struct thread_context* ctx;
 
     ctx = (struct thread_context*)malloc(sizeof(*ctx));
@@ -147,6 +290,8 @@ int PltCreateThread(ThreadEntry entry, void* context, PLT_THREAD* thread) {
 
     ctx->entry = entry;
     ctx->context = context;
+    ctx->name = name;
+    ctx->role = role;
     
     thread->cancelled = 0;
 
@@ -163,7 +308,7 @@ int PltCreateThread(ThreadEntry entry, void* context, PLT_THREAD* thread) {
         thread->alive = 1;
         thread->context = ctx;
         ctx->thread = thread;
-        thread->handle = sceKernelCreateThread("", ThreadProc, 0, 0x40000, 0, 0, NULL);
+        thread->handle = sceKernelCreateThread(name, ThreadProc, 0, 0x40000, 0, 0, NULL);
         if (thread->handle < 0) {
             free(ctx);
             return -1;
@@ -280,22 +425,61 @@ int PltWaitForEvent(PLT_EVENT* event) {
 #endif
 }
 
+// This shares an epoch with PltGetMicros()
 uint64_t PltGetMillis(void) {
+    return PltGetMicros() / 1000;
+}
+
+// CLOCK_MONOTONIC is used rather than CLOCK_MONOTONIC_RAW because it is the
+// clock behind System.nanoTime() and the VR runtime's timestamps, so values
+// can be compared with theirs directly
+uint64_t PltGetMicros(void) {
 #if defined(LC_WINDOWS)
-    return GetTickCount64();
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (counter.QuadPart / frequency.QuadPart) * 1000000 +
+        ((counter.QuadPart % frequency.QuadPart) * 1000000) / frequency.QuadPart;
 #elif HAVE_CLOCK_GETTIME
     struct timespec tv;
-    
+
     clock_gettime(CLOCK_MONOTONIC, &tv);
-    
-    return (tv.tv_sec * 1000) + (tv.tv_nsec / 1000000);
+
+    return ((uint64_t)tv.tv_sec * 1000000) + (tv.tv_nsec / 1000);
 #else
     struct timeval tv;
 
     gettimeofday(&tv, NULL);
 
-    return (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+    return ((uint64_t)tv.tv_sec * 1000000) + tv.tv_usec;
+#endif
+}
+
+// Returns the CPU time consumed by the calling thread or 0 if the platform can't measure it
+uint64_t PltGetThreadCpuTimeUs(void) {
+#if defined(LC_WINDOWS)
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    ULARGE_INTEGER kernel, user;
+
+    if (GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime)) {
+        kernel.LowPart = kernelTime.dwLowDateTime;
+        kernel.HighPart = kernelTime.dwHighDateTime;
+        user.LowPart = userTime.dwLowDateTime;
+        user.HighPart = userTime.dwHighDateTime;
+
+        // Thread times are in 100 ns units
+        return (kernel.QuadPart + user.QuadPart) / 10;
+    }
+#elif defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return ((uint64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+    }
 #endif
+    return 0;
 }
 
 int initializePlatform(void) {
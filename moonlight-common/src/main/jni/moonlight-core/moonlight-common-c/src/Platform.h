@@ -65,3 +65,5 @@ int initializePlatform(void);
 void cleanupPlatform(void);
 
 uint64_t PltGetMillis(void);
+uint64_t PltGetMicros(void);
+uint64_t PltGetThreadCpuTimeUs(void);
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Platform.h"
+
+// Minimal set of atomic operations used by the lock-free queues and pools.
+// All operations are sequentially consistent unless noted otherwise.
+
+#if defined(LC_WINDOWS)
+#include <intrin.h>
+
+static inline void* PltAtomicCompareExchangePtr(void* volatile* target, void* expected, void* desired) {
+    return InterlockedCompareExchangePointer(target, desired, expected);
+}
+
+static inline void* PltAtomicExchangePtr(void* volatile* target, void* value) {
+    return InterlockedExchangePointer(target, value);
+}
+
+static inline int PltAtomicAddInt(volatile int* target, int value) {
+    return InterlockedExchangeAdd((volatile LONG*)target, value) + value;
+}
+
+static inline int PltAtomicCompareExchangeInt(volatile int* target, int expected, int desired) {
+    return InterlockedCompareExchange((volatile LONG*)target, desired, expected);
+}
+
+static inline void PltAtomicMemoryBarrier(void) {
+    MemoryBarrier();
+}
+
+static inline int PltAtomicLoadInt(volatile int* target) {
+    int value = *target;
+    _ReadWriteBarrier();
+    return value;
+}
+
+static inline void PltAtomicStoreInt(volatile int* target, int value) {
+    _ReadWriteBarrier();
+    *target = value;
+}
+
+static inline void* PltAtomicLoadPtr(void* volatile* target) {
+    void* value = *target;
+    _ReadWriteBarrier();
+    return value;
+}
+
+// 64-bit accesses aren't single-copy atomic on 32-bit targets
+static inline unsigned long long PltAtomicLoadUint64(volatile unsigned long long* target) {
+    return (unsigned long long)InterlockedCompareExchange64((volatile LONG64*)target, 0, 0);
+}
+
+static inline void PltAtomicStoreUint64(volatile unsigned long long* target, unsigned long long value) {
+    InterlockedExchange64((volatile LONG64*)target, (LONG64)value);
+}
+#else
+// Returns the value of *target before the operation
+static inline void* PltAtomicCompareExchangePtr(void* volatile* target, void* expected, void* desired) {
+    __atomic_compare_exchange_n(target, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return expected;
+}
+
+static inline void* PltAtomicExchangePtr(void* volatile* target, void* value) {
+    return __atomic_exchange_n(target, value, __ATOMIC_SEQ_CST);
+}
+
+// Returns the new value of *target
+static inline int PltAtomicAddInt(volatile int* target, int value) {
+    return __atomic_add_fetch(target, value, __ATOMIC_SEQ_CST);
+}
+
+// Returns the value of *target before the operation
+static inline int PltAtomicCompareExchangeInt(volatile int* target, int expected, int desired) {
+    __atomic_compare_exchange_n(target, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return expected;
+}
+
+// Full memory barrier
+static inline void PltAtomicMemoryBarrier(void) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// Acquire load
+static inline int PltAtomicLoadInt(volatile int* target) {
+    return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+
+// Release store
+static inline void PltAtomicStoreInt(volatile int* target, int value) {
+    __atomic_store_n(target, value, __ATOMIC_RELEASE);
+}
+
+// Acquire load
+static inline void* PltAtomicLoadPtr(void* volatile* target) {
+    return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+
+// Acquire load that doesn't tear on 32-bit targets
+static inline unsigned long long PltAtomicLoadUint64(volatile unsigned long long* target) {
+    return __atomic_load_n(target, __ATOMIC_ACQUIRE);
+}
+
+// Release store that doesn't tear on 32-bit targets
+static inline void PltAtomicStoreUint64(volatile unsigned long long* target, unsigned long long value) {
+    __atomic_store_n(target, value, __ATOMIC_RELEASE);
+}
+#endif
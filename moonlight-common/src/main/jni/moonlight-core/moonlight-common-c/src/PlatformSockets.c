@@ -1,6 +1,30 @@
 #include "PlatformSockets.h"
 #include "Limelight-internal.h"
 
+#if defined(__linux__) && !defined(__vita__)
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// We go through syscall() because older Android API levels don't expose
+// recvmmsg() in libc even though the kernel supports it.
+#ifdef __NR_recvmmsg
+#define HAVE_RECVMMSG 1
+
+#ifndef MSG_WAITFORONE
+#define MSG_WAITFORONE 0x10000
+#endif
+
+// Matches the layout of the kernel's struct mmsghdr
+typedef struct _UDP_MMSGHDR {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+} UDP_MMSGHDR;
+
+static int recvmmsgUnsupported;
+#endif
+#endif
+
 #define TEST_PORT_TIMEOUT_SEC 3
 
 #define RCV_BUFFER_SIZE_MIN  32767
@@ -101,6 +125,79 @@ int recvUdpSocket(SOCKET s, char* buffer, int size, int useSelect) {
     }
 }
 
+// Receives up to count datagrams into the provided buffers. The first datagram
+// is waited for in the same way as recvUdpSocket(). Returns the number of
+// datagrams received (with their sizes in lengths), 0 on timeout, or
+// a negative value on error.
+int recvUdpSocketBatch(SOCKET s, char** buffers, int* lengths, int count, int size, int useSelect) {
+#ifdef HAVE_RECVMMSG
+    if (count > 1 && !recvmmsgUnsupported) {
+        UDP_MMSGHDR msgs[UDP_RECV_MAX_BATCH];
+        struct iovec iovs[UDP_RECV_MAX_BATCH];
+        fd_set readfds;
+        struct timeval tv;
+        int err;
+        int i;
+
+        if (count > UDP_RECV_MAX_BATCH) {
+            count = UDP_RECV_MAX_BATCH;
+        }
+
+        if (useSelect) {
+            FD_ZERO(&readfds);
+            FD_SET(s, &readfds);
+
+            tv.tv_sec = 0;
+            tv.tv_usec = UDP_RECV_POLL_TIMEOUT_MS * 1000;
+
+            err = select((int)(s) + 1, &readfds, NULL, NULL, &tv);
+            if (err <= 0) {
+                // Return if an error or timeout occurs
+                return err;
+            }
+        }
+
+        memset(msgs, 0, sizeof(msgs[0]) * count);
+        for (i = 0; i < count; i++) {
+            iovs[i].iov_base = buffers[i];
+            iovs[i].iov_len = size;
+            msgs[i].msg_hdr.msg_iov = &iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        // MSG_WAITFORONE only blocks (up to the SO_RCVTIMEO timeout) until the first
+        // datagram arrives. If select() already told us the socket is readable, we
+        // don't want to block at all.
+        err = (int)syscall(__NR_recvmmsg, s, msgs, count,
+                           useSelect ? MSG_DONTWAIT : MSG_WAITFORONE, NULL);
+        if (err > 0) {
+            for (i = 0; i < err; i++) {
+                lengths[i] = (int)msgs[i].msg_len;
+            }
+            return err;
+        }
+        else if (err < 0 && LastSocketError() == ENOSYS) {
+            // Use the single datagram path from now on
+            Limelog("recvmmsg() is unsupported; falling back to recv()\n");
+            recvmmsgUnsupported = 1;
+        }
+        else if (err < 0 &&
+                (LastSocketError() == EWOULDBLOCK ||
+                 LastSocketError() == EINTR ||
+                 LastSocketError() == EAGAIN)) {
+            // Return 0 for timeout
+            return 0;
+        }
+        else {
+            return err;
+        }
+    }
+#endif
+
+    lengths[0] = recvUdpSocket(s, buffers[0], size, useSelect);
+    return lengths[0] > 0 ? 1 : lengths[0];
+}
+
 void closeSocket(SOCKET s) {
 #if defined(LC_WINDOWS)
     closesocket(s);
@@ -68,6 +68,9 @@ typedef socklen_t SOCKADDR_LEN;
 
 #define LastSocketFail() ((LastSocketError() != 0) ? LastSocketError() : -1)
 
+// Maximum number of datagrams returned by a single recvUdpSocketBatch() call
+#define UDP_RECV_MAX_BATCH 32
+
 // IPv6 addresses have 2 extra characters for URL escaping
 #define URLSAFESTRING_LEN (INET6_ADDRSTRLEN+2)
 void addrToUrlSafeString(struct sockaddr_storage* addr, char* string);
@@ -77,6 +80,7 @@ SOCKET connectTcpSocket(struct sockaddr_storage* dstaddr, SOCKADDR_LEN addrlen,
 SOCKET bindUdpSocket(int addrfamily, int bufferSize);
 int enableNoDelay(SOCKET s);
 int recvUdpSocket(SOCKET s, char* buffer, int size, int useSelect);
+int recvUdpSocketBatch(SOCKET s, char** buffers, int* lengths, int count, int size, int useSelect);
 void shutdownTcpSocket(SOCKET s);
 int setNonFatalRecvTimeoutMs(SOCKET s, int timeoutMs);
 void setRecvTimeout(SOCKET s, int timeoutSec);
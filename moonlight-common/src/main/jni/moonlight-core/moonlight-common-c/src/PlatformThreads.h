@@ -45,7 +45,9 @@ void PltDeleteMutex(PLT_MUTEX* mutex);
 void PltLockMutex(PLT_MUTEX* mutex);
 void PltUnlockMutex(PLT_MUTEX* mutex);
 
-int PltCreateThread(ThreadEntry entry, void* context, PLT_THREAD*thread);
+int PltCreateThread(const char* name, int role, ThreadEntry entry, void* context, PLT_THREAD* thread);
+void PltSetThreadScheduling(const THREAD_SCHEDULING* scheduling);
+void PltGetThreadScheduling(THREAD_SCHEDULING* scheduling);
 void PltCloseThread(PLT_THREAD*thread);
 void PltInterruptThread(PLT_THREAD*thread);
 int PltIsThreadInterrupted(PLT_THREAD*thread);
@@ -62,4 +64,5 @@ void PltRunThreadProc(void);
 #define PLT_WAIT_SUCCESS 0
 #define PLT_WAIT_INTERRUPTED 1
 
-void PltSleepMs(int ms);
\ No newline at end of file
+void PltSleepMs(int ms);
+void PltSleepUs(int us);
\ No newline at end of file
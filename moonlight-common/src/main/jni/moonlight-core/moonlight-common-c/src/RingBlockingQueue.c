@@ -0,0 +1,282 @@
+#include "RingBlockingQueue.h"
+#include "PlatformAtomics.h"
+
+#ifdef RBQ_USE_FUTEX
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+// Indexes are free running counters, so all arithmetic on them must wrap
+static int addIndex(int index, int value) {
+    return (int)((unsigned int)index + (unsigned int)value);
+}
+
+static int diffIndex(int a, int b) {
+    return (int)((unsigned int)a - (unsigned int)b);
+}
+
+int RbqInitializeRingBlockingQueue(PRING_BLOCKING_QUEUE queue, int sizeBound) {
+    int capacity;
+    int i;
+
+    memset(queue, 0, sizeof(*queue));
+
+    // Round the capacity up to a power of 2 so slots can be found with a mask
+    capacity = 1;
+    while (capacity < sizeBound) {
+        capacity <<= 1;
+    }
+
+    queue->slots = (PRING_BLOCKING_QUEUE_SLOT)malloc(capacity * sizeof(*queue->slots));
+    if (queue->slots == NULL) {
+        return -1;
+    }
+
+    // Each slot starts out writable for the first lap
+    for (i = 0; i < capacity; i++) {
+        queue->slots[i].sequence = i;
+        queue->slots[i].entry = NULL;
+    }
+
+#ifndef RBQ_USE_FUTEX
+    {
+        int err = PltCreateEvent(&queue->wakeEvent);
+        if (err != 0) {
+            free(queue->slots);
+            queue->slots = NULL;
+            return err;
+        }
+    }
+#endif
+
+    queue->sizeBound = sizeBound;
+    queue->mask = capacity - 1;
+
+    return 0;
+}
+
+// Removes the oldest element if there is one. Returns 1 on success and 0 if empty.
+static int dequeueEntry(PRING_BLOCKING_QUEUE queue, PLINKED_BLOCKING_QUEUE_ENTRY* entry) {
+    PRING_BLOCKING_QUEUE_SLOT slot;
+    int pos, seq, diff, old;
+
+    pos = PltAtomicLoadInt(&queue->dequeueIndex);
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        seq = PltAtomicLoadInt(&slot->sequence);
+        diff = diffIndex(seq, addIndex(pos, 1));
+        if (diff == 0) {
+            old = PltAtomicCompareExchangeInt(&queue->dequeueIndex, pos, addIndex(pos, 1));
+            if (old == pos) {
+                break;
+            }
+
+            // Another consumer took it first
+            pos = old;
+        }
+        else if (diff < 0) {
+            // Nothing has been written to this slot yet
+            return 0;
+        }
+        else {
+            pos = PltAtomicLoadInt(&queue->dequeueIndex);
+        }
+    }
+
+    *entry = slot->entry;
+
+    // Hand the slot back to producers for the next lap
+    PltAtomicStoreInt(&slot->sequence, addIndex(pos, queue->mask + 1));
+    return 1;
+}
+
+static int isQueueEmpty(PRING_BLOCKING_QUEUE queue) {
+    int pos = PltAtomicLoadInt(&queue->dequeueIndex);
+    return PltAtomicLoadInt(&queue->slots[pos & queue->mask].sequence) != addIndex(pos, 1);
+}
+
+// Wakes any consumers sleeping on the queue. This is cheap when nobody is waiting.
+static void wakeWaiters(PRING_BLOCKING_QUEUE queue) {
+    // Pairs with the barrier in RbqWaitForQueueElement() so either the waiter
+    // sees our update or we see the waiter
+    PltAtomicMemoryBarrier();
+
+    if (PltAtomicLoadInt(&queue->waiters) != 0) {
+#ifdef RBQ_USE_FUTEX
+        PltAtomicAddInt(&queue->wakeSequence, 1);
+        syscall(__NR_futex, &queue->wakeSequence, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+        PltSetEvent(&queue->wakeEvent);
+#endif
+    }
+}
+
+PLINKED_BLOCKING_QUEUE_ENTRY RbqFlushQueueItems(PRING_BLOCKING_QUEUE queue) {
+    PLINKED_BLOCKING_QUEUE_ENTRY head, tail, entry;
+
+    head = tail = NULL;
+
+    // Return the flushed elements as a list like the linked blocking queue does
+    while (dequeueEntry(queue, &entry)) {
+        entry->flink = NULL;
+        entry->blink = tail;
+        if (tail == NULL) {
+            head = entry;
+        }
+        else {
+            tail->flink = entry;
+        }
+        tail = entry;
+    }
+
+    return head;
+}
+
+PLINKED_BLOCKING_QUEUE_ENTRY RbqDestroyRingBlockingQueue(PRING_BLOCKING_QUEUE queue) {
+    PLINKED_BLOCKING_QUEUE_ENTRY head;
+
+    head = RbqFlushQueueItems(queue);
+
+#ifndef RBQ_USE_FUTEX
+    PltCloseEvent(&queue->wakeEvent);
+#endif
+    free(queue->slots);
+    queue->slots = NULL;
+
+    return head;
+}
+
+void RbqSignalQueueShutdown(PRING_BLOCKING_QUEUE queue) {
+    PltAtomicStoreInt(&queue->shutdown, 1);
+    wakeWaiters(queue);
+}
+
+int RbqOfferQueueItem(PRING_BLOCKING_QUEUE queue, void* data, PLINKED_BLOCKING_QUEUE_ENTRY entry) {
+    PRING_BLOCKING_QUEUE_SLOT slot;
+    int pos, seq, diff, old;
+
+    if (PltAtomicLoadInt(&queue->shutdown)) {
+        return LBQ_INTERRUPTED;
+    }
+
+    entry->flink = NULL;
+    entry->blink = NULL;
+    entry->data = data;
+
+    pos = PltAtomicLoadInt(&queue->enqueueIndex);
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        seq = PltAtomicLoadInt(&slot->sequence);
+        diff = diffIndex(seq, pos);
+        if (diff == 0) {
+            // The capacity may be larger than the requested bound
+            if (diffIndex(pos, PltAtomicLoadInt(&queue->dequeueIndex)) >= queue->sizeBound) {
+                return LBQ_BOUND_EXCEEDED;
+            }
+
+            old = PltAtomicCompareExchangeInt(&queue->enqueueIndex, pos, addIndex(pos, 1));
+            if (old == pos) {
+                break;
+            }
+
+            // Another producer took it first
+            pos = old;
+        }
+        else if (diff < 0) {
+            // The slot hasn't been consumed since the last lap
+            return LBQ_BOUND_EXCEEDED;
+        }
+        else {
+            pos = PltAtomicLoadInt(&queue->enqueueIndex);
+        }
+    }
+
+    slot->entry = entry;
+
+    // Publish the element to consumers
+    PltAtomicStoreInt(&slot->sequence, addIndex(pos, 1));
+
+    wakeWaiters(queue);
+
+    return LBQ_SUCCESS;
+}
+
+// This is only safe to call from a single consumer that is synchronized with flushes
+int RbqPeekQueueElement(PRING_BLOCKING_QUEUE queue, void** data) {
+    PRING_BLOCKING_QUEUE_SLOT slot;
+    int pos;
+
+    if (PltAtomicLoadInt(&queue->shutdown)) {
+        return LBQ_INTERRUPTED;
+    }
+
+    pos = PltAtomicLoadInt(&queue->dequeueIndex);
+    slot = &queue->slots[pos & queue->mask];
+    if (PltAtomicLoadInt(&slot->sequence) != addIndex(pos, 1)) {
+        return LBQ_NO_ELEMENT;
+    }
+
+    *data = slot->entry->data;
+    return LBQ_SUCCESS;
+}
+
+int RbqPollQueueElement(PRING_BLOCKING_QUEUE queue, void** data) {
+    PLINKED_BLOCKING_QUEUE_ENTRY entry;
+
+    if (PltAtomicLoadInt(&queue->shutdown)) {
+        return LBQ_INTERRUPTED;
+    }
+
+    if (!dequeueEntry(queue, &entry)) {
+        return LBQ_NO_ELEMENT;
+    }
+
+    *data = entry->data;
+    return LBQ_SUCCESS;
+}
+
+int RbqWaitForQueueElement(PRING_BLOCKING_QUEUE queue, void** data) {
+    PLINKED_BLOCKING_QUEUE_ENTRY entry;
+#ifdef RBQ_USE_FUTEX
+    int wakeSequence;
+#else
+    int err;
+#endif
+
+    for (;;) {
+        if (PltAtomicLoadInt(&queue->shutdown)) {
+            return LBQ_INTERRUPTED;
+        }
+
+        if (dequeueEntry(queue, &entry)) {
+            *data = entry->data;
+            return LBQ_SUCCESS;
+        }
+
+        // Register as a waiter before checking the queue again, so an offer
+        // that races with us will either be seen here or will wake us.
+#ifdef RBQ_USE_FUTEX
+        wakeSequence = PltAtomicLoadInt(&queue->wakeSequence);
+#else
+        PltClearEvent(&queue->wakeEvent);
+#endif
+        PltAtomicAddInt(&queue->waiters, 1);
+        PltAtomicMemoryBarrier();
+
+        if (!PltAtomicLoadInt(&queue->shutdown) && isQueueEmpty(queue)) {
+#ifdef RBQ_USE_FUTEX
+            // This returns immediately if the wake sequence has changed since we read it
+            syscall(__NR_futex, &queue->wakeSequence, FUTEX_WAIT_PRIVATE, wakeSequence, NULL, NULL, 0);
+#else
+            err = PltWaitForEvent(&queue->wakeEvent);
+            if (err != PLT_WAIT_SUCCESS) {
+                PltAtomicAddInt(&queue->waiters, -1);
+                return LBQ_INTERRUPTED;
+            }
+#endif
+        }
+
+        PltAtomicAddInt(&queue->waiters, -1);
+    }
+}
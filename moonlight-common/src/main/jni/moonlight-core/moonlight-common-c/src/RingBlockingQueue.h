@@ -0,0 +1,54 @@
+#pragma once
+
+#include "LinkedBlockingQueue.h"
+
+#if defined(__linux__) && !defined(__vita__)
+// Consumers block on a futex rather than a mutex and condition variable
+#define RBQ_USE_FUTEX 1
+#endif
+
+// Assumed cache line size used to keep producer and consumer state apart
+#define RBQ_CACHE_LINE_SIZE 64
+
+typedef struct _RING_BLOCKING_QUEUE_SLOT {
+    // Tells whether the slot is ready to be written or read for a given lap
+    volatile int sequence;
+    PLINKED_BLOCKING_QUEUE_ENTRY entry;
+} RING_BLOCKING_QUEUE_SLOT, *PRING_BLOCKING_QUEUE_SLOT;
+
+// A bounded lock-free queue with the same semantics as the linked blocking
+// queue. Offers and polls never take a lock, and a waiting consumer only
+// sleeps when the queue is empty. Any thread may offer, poll, or flush.
+typedef struct _RING_BLOCKING_QUEUE {
+    char padStart[RBQ_CACHE_LINE_SIZE];
+
+    // Only written by producers
+    volatile int enqueueIndex;
+    char padEnqueue[RBQ_CACHE_LINE_SIZE];
+
+    // Only written by consumers
+    volatile int dequeueIndex;
+    char padDequeue[RBQ_CACHE_LINE_SIZE];
+
+    // Only touched when a consumer must wait for an element
+    volatile int waiters;
+    volatile int wakeSequence;
+    volatile int shutdown;
+#ifndef RBQ_USE_FUTEX
+    PLT_EVENT wakeEvent;
+#endif
+    char padWait[RBQ_CACHE_LINE_SIZE];
+
+    int sizeBound;
+    int mask;
+    PRING_BLOCKING_QUEUE_SLOT slots;
+} RING_BLOCKING_QUEUE, *PRING_BLOCKING_QUEUE;
+
+int RbqInitializeRingBlockingQueue(PRING_BLOCKING_QUEUE queue, int sizeBound);
+int RbqOfferQueueItem(PRING_BLOCKING_QUEUE queue, void* data, PLINKED_BLOCKING_QUEUE_ENTRY entry);
+int RbqWaitForQueueElement(PRING_BLOCKING_QUEUE queue, void** data);
+int RbqPollQueueElement(PRING_BLOCKING_QUEUE queue, void** data);
+int RbqPeekQueueElement(PRING_BLOCKING_QUEUE queue, void** data);
+PLINKED_BLOCKING_QUEUE_ENTRY RbqDestroyRingBlockingQueue(PRING_BLOCKING_QUEUE queue);
+PLINKED_BLOCKING_QUEUE_ENTRY RbqFlushQueueItems(PRING_BLOCKING_QUEUE queue);
+void RbqSignalQueueShutdown(PRING_BLOCKING_QUEUE queue);
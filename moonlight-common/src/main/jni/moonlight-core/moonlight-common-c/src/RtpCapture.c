@@ -0,0 +1,113 @@
+#include "Limelight-internal.h"
+#include "RtpCapture.h"
+#include "ByteBuffer.h"
+
+#include <errno.h>
+
+// Size of the stdio buffer for the capture file. The receive thread only
+// pays for a memcpy per packet until this fills.
+#define RTPC_WRITE_BUFFER_SIZE (256 * 1024)
+
+static FILE* captureFile;
+static char* captureBuffer;
+
+static void writeRecord(int type, char* payload, int length, unsigned long long timestampUs) {
+    char header[RTPC_RECORD_HEADER_SIZE];
+    BYTE_BUFFER bb;
+
+    BbInitializeWrappedBuffer(&bb, header, 0, sizeof(header), BYTE_ORDER_LITTLE);
+    BbPut(&bb, (char)type);
+    BbPut(&bb, 0);
+    BbPutShort(&bb, (short)length);
+    BbPutLong(&bb, (long long)timestampUs);
+
+    if (fwrite(header, sizeof(header), 1, captureFile) != 1 ||
+            fwrite(payload, length, 1, captureFile) != 1) {
+        // Stop capturing rather than leave a torn record behind
+        Limelog("RTP capture write failed: %d\n", errno);
+        fclose(captureFile);
+        captureFile = NULL;
+
+        // The buffer must outlive the file since fclose() flushes it
+        free(captureBuffer);
+        captureBuffer = NULL;
+    }
+}
+
+int LiStartRtpCapture(const char* path) {
+    char header[RTPC_FILE_HEADER_SIZE];
+    BYTE_BUFFER bb;
+    int err;
+
+    LiStopRtpCapture();
+
+    captureFile = fopen(path, "wb");
+    if (captureFile == NULL) {
+        return errno;
+    }
+
+    captureBuffer = malloc(RTPC_WRITE_BUFFER_SIZE);
+    if (captureBuffer != NULL) {
+        setvbuf(captureFile, captureBuffer, _IOFBF, RTPC_WRITE_BUFFER_SIZE);
+    }
+
+    BbInitializeWrappedBuffer(&bb, header, 0, sizeof(header), BYTE_ORDER_LITTLE);
+    BbPutInt(&bb, RTPC_MAGIC);
+    BbPutInt(&bb, RTPC_VERSION);
+    if (fwrite(header, sizeof(header), 1, captureFile) != 1) {
+        err = errno;
+        LiStopRtpCapture();
+        return err;
+    }
+
+    return 0;
+}
+
+void LiStopRtpCapture(void) {
+    if (captureFile != NULL) {
+        fclose(captureFile);
+        captureFile = NULL;
+    }
+
+    // The buffer must outlive the file since fclose() flushes it
+    if (captureBuffer != NULL) {
+        free(captureBuffer);
+        captureBuffer = NULL;
+    }
+}
+
+int RtpcIsCapturing(void) {
+    return captureFile != NULL;
+}
+
+// Records the parameters of the stream that is about to start
+void RtpcWriteStreamStart(void) {
+    char payload[RTPC_STREAM_INFO_SIZE];
+    BYTE_BUFFER bb;
+    int i;
+
+    if (captureFile == NULL) {
+        return;
+    }
+
+    BbInitializeWrappedBuffer(&bb, payload, 0, sizeof(payload), BYTE_ORDER_LITTLE);
+    BbPutInt(&bb, StreamConfig.packetSize);
+    BbPutInt(&bb, NegotiatedVideoFormat);
+    BbPutInt(&bb, StreamConfig.width);
+    BbPutInt(&bb, StreamConfig.height);
+    BbPutInt(&bb, StreamConfig.fps);
+    for (i = 0; i < 4; i++) {
+        BbPutInt(&bb, AppVersionQuad[i]);
+    }
+
+    writeRecord(RTPC_RECORD_STREAM_START, payload, sizeof(payload), PltGetMicros());
+}
+
+// Records a video datagram before any fields are converted to host byte order
+void RtpcWriteVideoPacket(char* data, int length, unsigned long long receiveTimeUs) {
+    if (captureFile == NULL) {
+        return;
+    }
+
+    writeRecord(RTPC_RECORD_VIDEO_PACKET, data, length, receiveTimeUs);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "Platform.h"
+
+// A capture file starts with the magic and version as little endian ints,
+// followed by records. Each record has a type byte, a reserved byte, a
+// 16-bit payload length, and a 64-bit timestamp in microseconds, all little
+// endian, followed by the payload.
+#define RTPC_MAGIC 0x5054524C // "LRTP"
+#define RTPC_VERSION 1
+
+#define RTPC_FILE_HEADER_SIZE 8
+#define RTPC_RECORD_HEADER_SIZE 12
+
+// Written when a video stream is initialized. The payload holds the
+// stream parameters needed to reproduce the receive path.
+#define RTPC_RECORD_STREAM_START 1
+
+// A video RTP datagram exactly as it was received
+#define RTPC_RECORD_VIDEO_PACKET 2
+
+typedef struct _RTP_CAPTURE_STREAM_INFO {
+    int packetSize;
+    int videoFormat;
+    int width;
+    int height;
+    int fps;
+    int appVersionQuad[4];
+} RTP_CAPTURE_STREAM_INFO, *PRTP_CAPTURE_STREAM_INFO;
+
+#define RTPC_STREAM_INFO_SIZE (9 * sizeof(int))
+
+int RtpcIsCapturing(void);
+void RtpcWriteStreamStart(void);
+void RtpcWriteVideoPacket(char* data, int length, unsigned long long receiveTimeUs);
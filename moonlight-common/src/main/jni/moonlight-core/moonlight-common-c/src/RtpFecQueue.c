@@ -1,74 +1,263 @@
 #include "Limelight-internal.h"
 #include "RtpFecQueue.h"
+#include "PlatformAtomics.h"
 #include "rs.h"
 
-void RtpfInitializeQueue(PRTP_FEC_QUEUE queue) {
+void RtpfInitializeQueue(PRTP_FEC_QUEUE queue, PPACKET_POOL packetPool) {
     reed_solomon_init();
     memset(queue, 0, sizeof(*queue));
+
+    queue->packetPool = packetPool;
     
     queue->currentFrameNumber = UINT16_MAX;
 }
 
+// Sets how long packets of a later frame are held while waiting for the
+// missing packets of the current frame
+void RtpfSetReorderWindow(PRTP_FEC_QUEUE queue, int windowUs) {
+    queue->reorderWindowUs = windowUs;
+}
+
+// Sets whether data packets are delivered as soon as every packet before them
+// in the frame has arrived instead of once the whole frame is complete
+void RtpfSetEarlyDelivery(PRTP_FEC_QUEUE queue, int enabled) {
+    queue->earlyDelivery = enabled;
+}
+
+// Drops the queue's reference on a packet. Packets delivered early are also
+// referenced by the depacketizer, which may release them on another thread.
+static void releaseEntry(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY entry) {
+    if (PltAtomicAddInt(&entry->refCount, -1) == 0) {
+        PpFreeBuffer(queue->packetPool, entry->packet);
+    }
+}
+
+static void releaseCachedRs(PRTP_FEC_QUEUE queue, int index) {
+    reed_solomon* rs = queue->rsCache[index];
+
+    // Fold the decode matrix counters into the queue totals
+    queue->decodeMatrixHits += rs->decode_cache_hits;
+    queue->decodeMatrixMisses += rs->decode_cache_misses;
+
+    reed_solomon_release(rs);
+    queue->rsCache[index] = NULL;
+}
+
+static int isPacketReceived(PRTP_FEC_QUEUE queue, int index) {
+    return (queue->bufferReceived[index / 32] >> (index % 32)) & 1;
+}
+
+// Frees all packets buffered for the current frame
+static void discardBufferedPackets(PRTP_FEC_QUEUE queue) {
+    int i;
+
+    for (i = 0; i < queue->bufferTotalPackets && queue->bufferSize != 0; i++) {
+        if (isPacketReceived(queue, i)) {
+            releaseEntry(queue, queue->bufferSlots[i]);
+            queue->bufferSize--;
+        }
+    }
+
+    LC_ASSERT(queue->bufferSize == 0);
+    queue->bufferSize = 0;
+}
+
+// Prepares the slot array and received bitmap for a frame with the given number of packets
+static int resetBufferSlots(PRTP_FEC_QUEUE queue, int totalPackets) {
+    if (totalPackets > queue->bufferSlotCapacity) {
+        int capacity = (totalPackets + 31) & ~31;
+        PRTPFEC_QUEUE_ENTRY* slots;
+        unsigned int* received;
+
+        slots = realloc(queue->bufferSlots, capacity * sizeof(*slots));
+        if (slots == NULL) {
+            return -1;
+        }
+        queue->bufferSlots = slots;
+
+        received = realloc(queue->bufferReceived, (capacity / 32) * sizeof(*received));
+        if (received == NULL) {
+            return -1;
+        }
+        queue->bufferReceived = received;
+
+        queue->bufferSlotCapacity = capacity;
+    }
+
+    memset(queue->bufferReceived, 0, ((totalPackets + 31) / 32) * sizeof(*queue->bufferReceived));
+    queue->bufferTotalPackets = totalPackets;
+    return 0;
+}
+
 void RtpfCleanupQueue(PRTP_FEC_QUEUE queue) {
-    while (queue->bufferHead != NULL) {
-        PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
-        queue->bufferHead = entry->next;
-        free(entry->packet);
+    int i;
+
+    for (i = 0; i < RTPF_RS_CACHE_SIZE; i++) {
+        if (queue->rsCache[i] != NULL) {
+            releaseCachedRs(queue, i);
+        }
     }
-    
+
+    if (queue->rsCacheHits + queue->rsCacheMisses != 0) {
+        Limelog("FEC cache: RS instances %u hits / %u misses, decode matrices %u hits / %u misses\n",
+                queue->rsCacheHits, queue->rsCacheMisses,
+                queue->decodeMatrixHits, queue->decodeMatrixMisses);
+    }
+
+    discardBufferedPackets(queue);
+
+    while (queue->heldHead != NULL) {
+        PRTPFEC_QUEUE_ENTRY entry = queue->heldHead;
+        queue->heldHead = entry->next;
+        PpFreeBuffer(queue->packetPool, entry->packet);
+    }
+
     while (queue->queueHead != NULL) {
         PRTPFEC_QUEUE_ENTRY entry = queue->queueHead;
         queue->queueHead = entry->next;
-        free(entry->packet);
+        releaseEntry(queue, entry);
     }
+
+    free(queue->bufferSlots);
+    free(queue->bufferReceived);
 }
 
-// newEntry is contained within the packet buffer so we free the whole entry by freeing entry->packet
-static int queuePacket(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY newEntry, int head, PRTP_PACKET packet, int length, int isParity) {
-    PRTPFEC_QUEUE_ENTRY entry;
-    
+// newEntry is contained within the packet buffer so we free the whole entry by returning entry->packet to the pool
+static int queuePacket(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY newEntry, PRTP_PACKET packet, int length, int isParity) {
+    int index;
+
     LC_ASSERT(!isBefore16(packet->sequenceNumber, queue->bufferLowestSequenceNumber));
 
-    // Don't queue duplicates either
-    entry = queue->bufferHead;
-    while (entry != NULL) {
-        if (entry->packet->sequenceNumber == packet->sequenceNumber) {
-            return 0;
-        }
+    index = U16(packet->sequenceNumber - queue->bufferLowestSequenceNumber);
+    if (index >= queue->bufferTotalPackets) {
+        // The FEC info in this packet doesn't match the frame
+        return 0;
+    }
 
-        entry = entry->next;
+    // Don't queue duplicates either
+    if (isPacketReceived(queue, index)) {
+        return 0;
     }
 
     newEntry->packet = packet;
     newEntry->length = length;
     newEntry->isParity = isParity;
-    newEntry->receiveTimeMs = PltGetMillis();
+    newEntry->refCount = 1;
     newEntry->prev = NULL;
     newEntry->next = NULL;
 
-    if (queue->bufferHead == NULL) {
-        LC_ASSERT(queue->bufferSize == 0);
-        queue->bufferHead = queue->bufferTail = newEntry;
-    }
-    else if (head) {
-        LC_ASSERT(queue->bufferSize > 0);
-        PRTPFEC_QUEUE_ENTRY oldHead = queue->bufferHead;
-        newEntry->next = oldHead;
-        LC_ASSERT(oldHead->prev == NULL);
-        oldHead->prev = newEntry;
-        queue->bufferHead = newEntry;
+    queue->bufferSlots[index] = newEntry;
+    queue->bufferReceived[index / 32] |= 1U << (index % 32);
+    queue->bufferSize++;
+
+    return 1;
+}
+
+static void appendReadyEntry(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY entry) {
+    entry->next = NULL;
+    entry->prev = queue->queueTail;
+    if (queue->queueTail == NULL) {
+        queue->queueHead = entry;
     }
     else {
-        LC_ASSERT(queue->bufferSize > 0);
-        PRTPFEC_QUEUE_ENTRY oldTail = queue->bufferTail;
-        newEntry->prev = oldTail;
-        LC_ASSERT(oldTail->next == NULL);
-        oldTail->next = newEntry;
-        queue->bufferTail = newEntry;
+        queue->queueTail->next = entry;
     }
-    queue->bufferSize++;
+    queue->queueTail = entry;
+    queue->queueSize++;
+}
 
-    return 1;
+// Moves data packets to the ready queue while they directly follow the
+// packets already delivered. Received data packets are used as they are,
+// so they can't change if the rest of the frame needs FEC recovery.
+static void deliverInOrderPackets(PRTP_FEC_QUEUE queue) {
+    while (queue->bufferNextDeliveryIndex < queue->bufferDataPackets &&
+           isPacketReceived(queue, queue->bufferNextDeliveryIndex)) {
+        PRTPFEC_QUEUE_ENTRY entry = queue->bufferSlots[queue->bufferNextDeliveryIndex];
+
+        // Keep our reference since recovering a later packet needs this one
+        PltAtomicAddInt(&entry->refCount, 1);
+        appendReadyEntry(queue, entry);
+
+        queue->bufferNextDeliveryIndex++;
+    }
+}
+
+// Moves the data packets of the completed frame to the ready queue in
+// sequence number order and frees the parity packets
+static void submitCompletedFrame(PRTP_FEC_QUEUE queue, unsigned long long lastPacketUs) {
+    unsigned long long completeUs = PltGetMicros();
+    int i;
+
+    for (i = 0; i < queue->bufferTotalPackets; i++) {
+        PRTPFEC_QUEUE_ENTRY entry;
+
+        if (!isPacketReceived(queue, i)) {
+            continue;
+        }
+
+        entry = queue->bufferSlots[i];
+        if (entry->isParity) {
+            PpFreeBuffer(queue->packetPool, entry->packet);
+            continue;
+        }
+
+        // The frame is handed to the decoder along with its last packet. That
+        // packet can't have been consumed yet even if it was delivered early
+        // since it completed the frame.
+        if (i == queue->bufferDataPackets - 1) {
+            entry->frameTimes.firstPacketUs = queue->bufferFirstReceiveTimeUs;
+            entry->frameTimes.lastPacketUs = lastPacketUs;
+            entry->frameTimes.completeUs = completeUs;
+        }
+
+        if (i < queue->bufferNextDeliveryIndex) {
+            // Already in the ready queue, so we only drop our reference
+            releaseEntry(queue, entry);
+        }
+        else {
+            appendReadyEntry(queue, entry);
+        }
+    }
+
+    memset(queue->bufferReceived, 0, ((queue->bufferTotalPackets + 31) / 32) * sizeof(*queue->bufferReceived));
+    queue->bufferSize = 0;
+}
+
+// Returns a reed_solomon instance for the current frame's shard counts, reusing
+// a cached one when possible. The queue retains ownership of the instance.
+static reed_solomon* getReedSolomon(PRTP_FEC_QUEUE queue) {
+    int i;
+    int victim = 0;
+
+    queue->rsCacheClock++;
+
+    for (i = 0; i < RTPF_RS_CACHE_SIZE; i++) {
+        reed_solomon* rs = queue->rsCache[i];
+
+        if (rs != NULL &&
+                rs->data_shards == queue->bufferDataPackets &&
+                rs->parity_shards == queue->bufferParityPackets) {
+            queue->rsCacheLastUsed[i] = queue->rsCacheClock;
+            queue->rsCacheHits++;
+            return rs;
+        }
+
+        // Prefer an empty slot, otherwise evict the least recently used one
+        if (queue->rsCache[victim] != NULL &&
+                (rs == NULL || queue->rsCacheLastUsed[i] < queue->rsCacheLastUsed[victim])) {
+            victim = i;
+        }
+    }
+
+    queue->rsCacheMisses++;
+
+    if (queue->rsCache[victim] != NULL) {
+        releaseCachedRs(queue, victim);
+    }
+
+    queue->rsCache[victim] = reed_solomon_new(queue->bufferDataPackets, queue->bufferParityPackets);
+    queue->rsCacheLastUsed[victim] = queue->rsCacheClock;
+    return queue->rsCache[victim];
 }
 
 #define PACKET_RECOVERY_FAILURE()                     \
@@ -76,12 +265,12 @@ static int queuePacket(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY newEntry, int h
     Limelog("FEC recovery returned corrupt packet %d" \
             " (frame %d)", rtpPacket->sequenceNumber, \
             queue->currentFrameNumber);               \
-    free(packets[i]);                                 \
+    PpFreeBuffer(queue->packetPool, packets[i]);      \
     continue
 
 // Returns 0 if the frame is completely constructed
 static int reconstructFrame(PRTP_FEC_QUEUE queue) {
-    int totalPackets = U16(queue->bufferHighestSequenceNumber - queue->bufferLowestSequenceNumber) + 1;
+    int totalPackets = queue->bufferTotalPackets;
     int ret;
     
     if (queue->bufferSize < queue->bufferDataPackets) {
@@ -95,14 +284,14 @@ static int reconstructFrame(PRTP_FEC_QUEUE queue) {
     }
 
     reed_solomon* rs = NULL;
-    unsigned char** packets = malloc(totalPackets * sizeof(unsigned char*));
+    unsigned char** packets = calloc(totalPackets, sizeof(unsigned char*));
     unsigned char* marks = malloc(totalPackets * sizeof(unsigned char));
     if (packets == NULL || marks == NULL) {
         ret = -2;
         goto cleanup;
     }
     
-    rs = reed_solomon_new(queue->bufferDataPackets, queue->bufferParityPackets);
+    rs = getReedSolomon(queue);
     
     // This could happen in an OOM condition, but it could also mean the FEC data
     // that we fed to reed_solomon_new() is bogus, so we'll assert to get a better look.
@@ -112,29 +301,33 @@ static int reconstructFrame(PRTP_FEC_QUEUE queue) {
         goto cleanup;
     }
     
-    memset(marks, 1, sizeof(char) * (totalPackets));
-    
     int receiveSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
-    int packetBufferSize = receiveSize + sizeof(RTPFEC_QUEUE_ENTRY);
 
-    PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
-    while (entry != NULL) {
-        int index = U16(entry->packet->sequenceNumber - queue->bufferLowestSequenceNumber);
-        packets[index] = (unsigned char*) entry->packet;
-        marks[index] = 0;
-        
-        //Set padding to zero
-        if (entry->length < receiveSize) {
-            memset(&packets[index][entry->length], 0, receiveSize - entry->length);
-        }
+    // Recovered packets take the RTP header byte from a packet we did receive
+    char rtpHeader = 0;
+
+    int i;
+    for (i = 0; i < totalPackets; i++) {
+        if (isPacketReceived(queue, i)) {
+            PRTPFEC_QUEUE_ENTRY entry = queue->bufferSlots[i];
+
+            packets[i] = (unsigned char*) entry->packet;
+            marks[i] = 0;
+            rtpHeader = entry->packet->header;
 
-        entry = entry->next;
+            //Set padding to zero
+            if (entry->length < receiveSize) {
+                memset(&packets[i][entry->length], 0, receiveSize - entry->length);
+            }
+        }
+        else {
+            marks[i] = 1;
+        }
     }
 
-    int i;
     for (i = 0; i < totalPackets; i++) {
         if (marks[i]) {
-            packets[i] = malloc(packetBufferSize);
+            packets[i] = PpAllocateBuffer(queue->packetPool);
             if (packets[i] == NULL) {
                 ret = -4;
                 goto cleanup_packets;
@@ -156,7 +349,7 @@ cleanup_packets:
                 PRTPFEC_QUEUE_ENTRY queueEntry = (PRTPFEC_QUEUE_ENTRY)&packets[i][receiveSize];
                 PRTP_PACKET rtpPacket = (PRTP_PACKET) packets[i];
                 rtpPacket->sequenceNumber = U16(i + queue->bufferLowestSequenceNumber);
-                rtpPacket->header = queue->bufferHead->packet->header;
+                rtpPacket->header = rtpHeader;
                 
                 int dataOffset = sizeof(*rtpPacket);
                 if (rtpPacket->header & FLAG_EXTENSION) {
@@ -190,16 +383,15 @@ cleanup_packets:
                 // it may be a legitimate part of the H.264 bytestream.
 
                 LC_ASSERT(isBefore16(rtpPacket->sequenceNumber, queue->bufferFirstParitySequenceNumber));
-                queuePacket(queue, queueEntry, 0, rtpPacket, StreamConfig.packetSize + dataOffset, 0);
+                queueEntry->receiveTimeUs = PltGetMicros();
+                queuePacket(queue, queueEntry, rtpPacket, StreamConfig.packetSize + dataOffset, 0);
             } else if (packets[i] != NULL) {
-                free(packets[i]);
+                PpFreeBuffer(queue->packetPool, packets[i]);
             }
         }
     }
 
 cleanup:
-    reed_solomon_release(rs);
-
     if (packets != NULL)
         free(packets);
 
@@ -209,29 +401,38 @@ cleanup:
     return ret;
 }
 
-static void removeEntry(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY entry) {
-    LC_ASSERT(entry != NULL);
-    LC_ASSERT(queue->queueSize > 0);
-    LC_ASSERT(queue->queueHead != NULL);
-    LC_ASSERT(queue->queueTail != NULL);
+// Drops the packets of the current frame after it could not be completed
+static void abandonCurrentFrame(PRTP_FEC_QUEUE queue) {
+    LC_ASSERT(queue->bufferSize != 0);
 
-    if (queue->queueHead == entry) {
-        queue->queueHead = entry->next;
-    }
-    if (queue->queueTail == entry) {
-        queue->queueTail = entry->prev;
-    }
+    Limelog("Unrecoverable frame %d: %d+%d=%d received < %d needed\n",
+            queue->currentFrameNumber, queue->receivedBufferDataPackets,
+            queue->bufferSize - queue->receivedBufferDataPackets,
+            queue->bufferSize,
+            queue->bufferDataPackets);
+    queue->framesUnrecoverable++;
+
+    discardBufferedPackets(queue);
+}
+
+static void holdPacket(PRTP_FEC_QUEUE queue, PRTPFEC_QUEUE_ENTRY entry, PRTP_PACKET packet, int length) {
+    entry->packet = packet;
+    entry->length = length;
+    entry->next = NULL;
+    entry->prev = queue->heldTail;
 
-    if (entry->prev != NULL) {
-        entry->prev->next = entry->next;
+    if (queue->heldTail == NULL) {
+        queue->heldHead = entry;
+        queue->heldSinceUs = entry->receiveTimeUs;
     }
-    if (entry->next != NULL) {
-        entry->next->prev = entry->prev;
+    else {
+        queue->heldTail->next = entry;
     }
-    queue->queueSize--;
+    queue->heldTail = entry;
+    queue->heldCount++;
 }
 
-int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
+static int addPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
     if (isBefore16(packet->sequenceNumber, queue->bufferLowestSequenceNumber)) {
         // Reject packets behind our current buffer window
         return RTPF_RET_REJECTED;
@@ -250,37 +451,49 @@ int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_
     }
 
     int fecIndex = (nvPacket->fecInfo & 0x3FF000) >> 12;
+
+    if (queue->bufferSize != 0 && queue->currentFrameNumber != nvPacket->frameIndex) {
+        // The next frame started before this one was finished. Unless we're not
+        // allowed to wait, hold the new packets in case the missing ones were
+        // only delayed or reordered.
+        if (queue->reorderWindowUs > 0 || queue->heldHead != NULL) {
+            holdPacket(queue, packetEntry, packet, length);
+
+            // Once the frame after that starts too, the missing packets are lost
+            if (U16(nvPacket->frameIndex - queue->currentFrameNumber) > 1) {
+                abandonCurrentFrame(queue);
+            }
+
+            return RTPF_RET_QUEUED_NOTHING_READY;
+        }
+
+        abandonCurrentFrame(queue);
+    }
+    else if (queue->bufferSize == 0 && queue->heldHead != NULL) {
+        // Stay behind the held packets so frames are started in arrival order
+        holdPacket(queue, packetEntry, packet, length);
+        return RTPF_RET_QUEUED_NOTHING_READY;
+    }
     
     // Reinitialize the queue if it's empty after a frame delivery or
-    // if we can't finish a frame before receiving the next one.
-    if (queue->bufferSize == 0 || queue->currentFrameNumber != nvPacket->frameIndex) {
-        if (queue->currentFrameNumber != nvPacket->frameIndex && queue->bufferSize != 0) {
-            Limelog("Unrecoverable frame %d: %d+%d=%d received < %d needed\n",
-                    queue->currentFrameNumber, queue->receivedBufferDataPackets,
-                    queue->bufferSize - queue->receivedBufferDataPackets,
-                    queue->bufferSize,
-                    queue->bufferDataPackets);
-        }
-        
+    // after we gave up on finishing the last frame.
+    if (queue->bufferSize == 0) {
         queue->currentFrameNumber = nvPacket->frameIndex;
-        
-        // Discard any unsubmitted buffers from the previous frame
-        while (queue->bufferHead != NULL) {
-            PRTPFEC_QUEUE_ENTRY entry = queue->bufferHead;
-            queue->bufferHead = entry->next;
-            free(entry->packet);
-        }
-        
-        queue->bufferTail = NULL;
-        queue->bufferSize = 0;
-        
+
         queue->bufferLowestSequenceNumber = U16(packet->sequenceNumber - fecIndex);
         queue->receivedBufferDataPackets = 0;
+        queue->bufferNextDeliveryIndex = 0;
         queue->bufferDataPackets = (nvPacket->fecInfo & 0xFFC00000) >> 22;
         queue->fecPercentage = (nvPacket->fecInfo & 0xFF0) >> 4;
         queue->bufferParityPackets = (queue->bufferDataPackets * queue->fecPercentage + 99) / 100;
         queue->bufferFirstParitySequenceNumber = U16(queue->bufferLowestSequenceNumber + queue->bufferDataPackets);
         queue->bufferHighestSequenceNumber = U16(queue->bufferFirstParitySequenceNumber + queue->bufferParityPackets - 1);
+
+        if (resetBufferSlots(queue, U16(queue->bufferHighestSequenceNumber - queue->bufferLowestSequenceNumber) + 1) < 0) {
+            // Leave the queue empty so the next packet tries again
+            queue->bufferTotalPackets = 0;
+            return RTPF_RET_REJECTED;
+        }
     } else if (isBefore16(queue->bufferHighestSequenceNumber, packet->sequenceNumber)) {
         // In rare cases, we get extra parity packets. It's rare enough that it's probably
         // not worth handling, so we'll just drop them.
@@ -291,78 +504,116 @@ int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_
     LC_ASSERT((nvPacket->fecInfo & 0xFF0) >> 4 == queue->fecPercentage);
     LC_ASSERT((nvPacket->fecInfo & 0xFFC00000) >> 22 == queue->bufferDataPackets);
 
-    if (!queuePacket(queue, packetEntry, 0, packet, length, !isBefore16(packet->sequenceNumber, queue->bufferFirstParitySequenceNumber))) {
+    if (!queuePacket(queue, packetEntry, packet, length, !isBefore16(packet->sequenceNumber, queue->bufferFirstParitySequenceNumber))) {
         return RTPF_RET_REJECTED;
     }
     else {
         if (isBefore16(packet->sequenceNumber, queue->bufferFirstParitySequenceNumber)) {
             queue->receivedBufferDataPackets++;
         }
+        if (queue->bufferSize == 1) {
+            queue->bufferFirstReceiveTimeUs = packetEntry->receiveTimeUs;
+        }
+
+        if (queue->earlyDelivery) {
+            deliverInOrderPackets(queue);
+        }
         
         // Try to submit this frame. If we haven't received enough packets,
         // this will fail and we'll keep waiting.
         if (reconstructFrame(queue) == 0) {
-            // Queue the pending frame data
-            if (queue->queueTail == NULL) {
-                queue->queueHead = queue->bufferHead;
-                queue->queueTail = queue->bufferTail;
-            } else {
-                queue->queueTail->next = queue->bufferHead;
-                queue->queueTail = queue->bufferTail;
+            if (queue->receivedBufferDataPackets != queue->bufferDataPackets) {
+                queue->framesRecovered++;
+            }
+            if (queue->heldHead != NULL) {
+                queue->framesCompletedLate++;
             }
-            queue->queueSize += queue->bufferSize;
-            
-            // Clear the buffer list
-            queue->bufferHead = NULL;
-            queue->bufferTail = NULL;
-            queue->bufferSize = 0;
-            
+
+            // Queue the pending frame data
+            submitCompletedFrame(queue, packetEntry->receiveTimeUs);
+
             // Ignore any more packets for this frame
             queue->currentFrameNumber++;
         }
 
-        return (queue->queueHead != NULL) ? RTPF_RET_QUEUED_PACKETS_READY : RTPF_RET_QUEUED_NOTHING_READY;
+        return RTPF_RET_QUEUED_NOTHING_READY;
     }
 }
 
-PRTPFEC_QUEUE_ENTRY RtpfGetQueuedPacket(PRTP_FEC_QUEUE queue) {
-    PRTPFEC_QUEUE_ENTRY queuedEntry, entry;
+// Gives up on the current frame if packets of a later frame have been held for too long
+static void expireHeldPackets(PRTP_FEC_QUEUE queue, unsigned long long nowUs) {
+    if (queue->heldHead != NULL && queue->bufferSize != 0 &&
+            nowUs - queue->heldSinceUs >= (unsigned long long)queue->reorderWindowUs) {
+        abandonCurrentFrame(queue);
+    }
+}
 
-    // Find the next queued packet
-    queuedEntry = NULL;
-    entry = queue->queueHead;
-    unsigned int lowestRtpSequenceNumber = UINT16_MAX;
-    
-    while (entry != NULL) {
-        // Never return parity packets
-        if (entry->isParity) {
-            PRTPFEC_QUEUE_ENTRY parityEntry = entry;
-            
-            // Skip this entry
-            entry = parityEntry->next;
-            
-            // Remove this entry
-            removeEntry(queue, parityEntry);
-            
-            // Free the entry and packet
-            free(parityEntry->packet);
-            
-            continue;
-        }
-        
-        if (queuedEntry == NULL || isBefore16(entry->packet->sequenceNumber, lowestRtpSequenceNumber)) {
-            lowestRtpSequenceNumber = entry->packet->sequenceNumber;
-            queuedEntry = entry;
+// Feeds held packets back through the queue once the frame they were waiting
+// on is complete or abandoned
+static void replayHeldPackets(PRTP_FEC_QUEUE queue) {
+    PRTPFEC_QUEUE_ENTRY entry, nextEntry;
+
+    // Replayed packets can complete frames and be held again, so repeat
+    // until the remaining held packets are waiting on an incomplete frame
+    while (queue->heldHead != NULL && queue->bufferSize == 0) {
+        entry = queue->heldHead;
+        queue->heldHead = queue->heldTail = NULL;
+        queue->heldCount = 0;
+
+        while (entry != NULL) {
+            nextEntry = entry->next;
+            if (addPacket(queue, entry->packet, entry->length, entry) == RTPF_RET_REJECTED) {
+                PpFreeBuffer(queue->packetPool, entry->packet);
+            }
+            entry = nextEntry;
         }
+    }
+}
+
+int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
+    int ret;
+
+    packetEntry->receiveTimeUs = PltGetMicros();
 
-        entry = entry->next;
+    expireHeldPackets(queue, packetEntry->receiveTimeUs);
+
+    ret = addPacket(queue, packet, length, packetEntry);
+
+    replayHeldPackets(queue);
+
+    if (ret == RTPF_RET_REJECTED) {
+        return RTPF_RET_REJECTED;
     }
 
+    return (queue->queueHead != NULL) ? RTPF_RET_QUEUED_PACKETS_READY : RTPF_RET_QUEUED_NOTHING_READY;
+}
+
+// Releases held packets whose wait window has passed. This must be called periodically
+// when no packets arrive since RtpfAddPacket() only checks the window for new packets.
+int RtpfServiceQueue(PRTP_FEC_QUEUE queue) {
+    expireHeldPackets(queue, PltGetMicros());
+    replayHeldPackets(queue);
+
+    return (queue->queueHead != NULL) ? RTPF_RET_QUEUED_PACKETS_READY : RTPF_RET_QUEUED_NOTHING_READY;
+}
+
+PRTPFEC_QUEUE_ENTRY RtpfGetQueuedPacket(PRTP_FEC_QUEUE queue) {
+    PRTPFEC_QUEUE_ENTRY queuedEntry;
+
+    // Completed frames are queued in sequence number order without parity packets
+    queuedEntry = queue->queueHead;
     if (queuedEntry != NULL) {
-        removeEntry(queue, queuedEntry);
+        queue->queueHead = queuedEntry->next;
+        if (queue->queueHead != NULL) {
+            queue->queueHead->prev = NULL;
+        }
+        else {
+            queue->queueTail = NULL;
+        }
+        queue->queueSize--;
+
         queuedEntry->prev = queuedEntry->next = NULL;
-        return queuedEntry;
-    } else {
-        return NULL;
     }
+
+    return queuedEntry;
 }
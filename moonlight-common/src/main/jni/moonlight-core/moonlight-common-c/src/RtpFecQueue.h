@@ -1,24 +1,51 @@
 #pragma once
 
 #include "Video.h"
+#include "PacketPool.h"
+
+// Microsecond timestamps of the stages a frame passes through in the FEC queue
+typedef struct _RTPF_FRAME_TIMES {
+    unsigned long long firstPacketUs;
+    unsigned long long lastPacketUs;
+    unsigned long long completeUs;
+} RTPF_FRAME_TIMES, *PRTPF_FRAME_TIMES;
 
 typedef struct _RTPFEC_QUEUE_ENTRY {
     PRTP_PACKET packet;
     int length;
     int isParity;
-    unsigned long long receiveTimeMs;
+    unsigned long long receiveTimeUs;
+
+    // Timing of the frame this packet belongs to. This is only set on the
+    // last data packet of a frame once the frame leaves the FEC queue.
+    RTPF_FRAME_TIMES frameTimes;
+
+    // References to the packet buffer that contains this entry. The buffer
+    // is returned to the pool when the last reference is released.
+    volatile int refCount;
 
     struct _RTPFEC_QUEUE_ENTRY* next;
     struct _RTPFEC_QUEUE_ENTRY* prev;
 } RTPFEC_QUEUE_ENTRY, *PRTPFEC_QUEUE_ENTRY;
 
+// Number of reed_solomon instances kept for reuse across frames
+#define RTPF_RS_CACHE_SIZE 4
+
 typedef struct _RTP_FEC_QUEUE {
+    // Packet buffers are allocated from and returned to this pool
+    PPACKET_POOL packetPool;
+
     PRTPFEC_QUEUE_ENTRY queueHead;
     PRTPFEC_QUEUE_ENTRY queueTail;
     int queueSize;
 
-    PRTPFEC_QUEUE_ENTRY bufferHead;
-    PRTPFEC_QUEUE_ENTRY bufferTail;
+    // Packets of the current frame indexed by their offset from
+    // bufferLowestSequenceNumber. A slot is only valid if its bit is
+    // set in the received bitmap, so only the bitmap is reset per frame.
+    PRTPFEC_QUEUE_ENTRY* bufferSlots;
+    unsigned int* bufferReceived;
+    int bufferSlotCapacity;
+    int bufferTotalPackets;
     int bufferSize;
     int bufferLowestSequenceNumber;
     int bufferHighestSequenceNumber;
@@ -28,14 +55,50 @@ typedef struct _RTP_FEC_QUEUE {
     int receivedBufferDataPackets;
     int fecPercentage;
 
+    // When set, data packets that arrive in order are moved to the ready
+    // queue before the rest of their frame. bufferNextDeliveryIndex is the
+    // slot of the first data packet of the current frame not yet delivered.
+    int earlyDelivery;
+    int bufferNextDeliveryIndex;
+
     int currentFrameNumber;
+    unsigned long long bufferFirstReceiveTimeUs;
+
+    // Packets of later frames that arrived while the current frame was still
+    // incomplete. They are held in arrival order until the current frame
+    // completes or reorderWindowUs passes since the first one arrived.
+    PRTPFEC_QUEUE_ENTRY heldHead;
+    PRTPFEC_QUEUE_ENTRY heldTail;
+    int heldCount;
+    unsigned long long heldSinceUs;
+    int reorderWindowUs;
+
+    // Frames that needed parity to complete, frames that were abandoned
+    // because too few packets arrived, and frames that were completed by
+    // packets which arrived after the next frame had started
+    unsigned int framesRecovered;
+    unsigned int framesUnrecoverable;
+    unsigned int framesCompletedLate;
+
+    // Reed-Solomon instances keyed by their shard counts. Each one also
+    // caches the inverted decode matrices for recent loss patterns.
+    struct _reed_solomon* rsCache[RTPF_RS_CACHE_SIZE];
+    unsigned int rsCacheLastUsed[RTPF_RS_CACHE_SIZE];
+    unsigned int rsCacheClock;
+    unsigned int rsCacheHits;
+    unsigned int rsCacheMisses;
+    unsigned int decodeMatrixHits;
+    unsigned int decodeMatrixMisses;
 } RTP_FEC_QUEUE, *PRTP_FEC_QUEUE;
 
 #define RTPF_RET_QUEUED_NOTHING_READY 0
 #define RTPF_RET_QUEUED_PACKETS_READY 1
 #define RTPF_RET_REJECTED             2
 
-void RtpfInitializeQueue(PRTP_FEC_QUEUE queue);
+void RtpfInitializeQueue(PRTP_FEC_QUEUE queue, PPACKET_POOL packetPool);
 void RtpfCleanupQueue(PRTP_FEC_QUEUE queue);
+void RtpfSetReorderWindow(PRTP_FEC_QUEUE queue, int windowUs);
+void RtpfSetEarlyDelivery(PRTP_FEC_QUEUE queue, int enabled);
 int RtpfAddPacket(PRTP_FEC_QUEUE queue, PRTP_PACKET packet, int length, PRTPFEC_QUEUE_ENTRY packetEntry);
+int RtpfServiceQueue(PRTP_FEC_QUEUE queue);
 PRTPFEC_QUEUE_ENTRY RtpfGetQueuedPacket(PRTP_FEC_QUEUE queue);
@@ -1,113 +1,79 @@
 #include "Limelight-internal.h"
 #include "RtpReorderQueue.h"
 
-void RtpqInitializeQueue(PRTP_REORDER_QUEUE queue, int maxSize, int maxQueueTimeMs) {
+void RtpqInitializeQueue(PRTP_REORDER_QUEUE queue, PPACKET_POOL packetPool, int maxSize, int maxQueueTimeUs) {
+    LC_ASSERT(maxSize > 1 && maxSize <= RTPQ_SLOT_COUNT);
+
     memset(queue, 0, sizeof(*queue));
+    queue->packetPool = packetPool;
     queue->maxSize = maxSize;
-    queue->maxQueueTimeMs = maxQueueTimeMs;
-    queue->nextRtpSequenceNumber = UINT16_MAX;
-    queue->oldestQueuedTimeMs = UINT64_MAX;
+    queue->maxQueueTimeUs = maxQueueTimeUs;
 }
 
-void RtpqCleanupQueue(PRTP_REORDER_QUEUE queue) {
-    while (queue->queueHead != NULL) {
-        PRTP_QUEUE_ENTRY entry = queue->queueHead;
-        queue->queueHead = entry->next;
-        free(entry->packet);
+// Changes how long packets may wait for a missing packet. This takes
+// effect for packets that are already queued too.
+void RtpqSetMaxQueueTime(PRTP_REORDER_QUEUE queue, int maxQueueTimeUs) {
+    queue->maxQueueTimeUs = maxQueueTimeUs;
+}
+
+// Entries are contained within the packet buffer so we free the whole entry by freeing entry->packet
+static void freeEntryList(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY entry) {
+    PRTP_QUEUE_ENTRY nextEntry;
+
+    while (entry != NULL) {
+        nextEntry = entry->next;
+        PpFreeBuffer(queue->packetPool, entry->packet);
+        entry = nextEntry;
     }
 }
 
-// newEntry is contained within the packet buffer so we free the whole entry by freeing entry->packet
-static int queuePacket(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY newEntry, int head, PRTP_PACKET packet) {
-    PRTP_QUEUE_ENTRY entry;
+void RtpqCleanupQueue(PRTP_REORDER_QUEUE queue) {
+    freeEntryList(queue, queue->queueHead);
+    freeEntryList(queue, queue->readyHead);
 
-    LC_ASSERT(!isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber));
+    queue->queueHead = queue->queueTail = NULL;
+    queue->readyHead = queue->readyTail = NULL;
+    queue->queueSize = 0;
+    memset(queue->slots, 0, sizeof(queue->slots));
+}
 
-    // Don't queue duplicates
-    entry = queue->queueHead;
-    while (entry != NULL) {
-        if (entry->packet->sequenceNumber == packet->sequenceNumber) {
-            return 0;
-        }
+static PRTP_QUEUE_ENTRY* getSlot(PRTP_REORDER_QUEUE queue, unsigned short sequenceNumber) {
+    return &queue->slots[sequenceNumber & (RTPQ_SLOT_COUNT - 1)];
+}
 
-        entry = entry->next;
-    }
+static void queuePacket(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY newEntry, PRTP_PACKET packet) {
+    PRTP_QUEUE_ENTRY* slot = getSlot(queue, packet->sequenceNumber);
+
+    LC_ASSERT(!isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber));
+    LC_ASSERT(U16(packet->sequenceNumber - queue->nextRtpSequenceNumber) < RTPQ_SLOT_COUNT);
+    LC_ASSERT(*slot == NULL);
 
     newEntry->packet = packet;
-    newEntry->queueTimeMs = PltGetMillis();
-    newEntry->prev = NULL;
+    newEntry->queueTimeUs = PltGetMicros();
     newEntry->next = NULL;
+    newEntry->prev = queue->queueTail;
 
-    if (queue->oldestQueuedTimeMs == UINT64_MAX) {
-        queue->oldestQueuedTimeMs = newEntry->queueTimeMs;
-    }
-
-    if (queue->queueHead == NULL) {
+    if (queue->queueTail == NULL) {
         LC_ASSERT(queue->queueSize == 0);
-        queue->queueHead = queue->queueTail = newEntry;
-    }
-    else if (head) {
-        LC_ASSERT(queue->queueSize > 0);
-        PRTP_QUEUE_ENTRY oldHead = queue->queueHead;
-        newEntry->next = oldHead;
-        LC_ASSERT(oldHead->prev == NULL);
-        oldHead->prev = newEntry;
         queue->queueHead = newEntry;
     }
     else {
         LC_ASSERT(queue->queueSize > 0);
-        PRTP_QUEUE_ENTRY oldTail = queue->queueTail;
-        newEntry->prev = oldTail;
-        LC_ASSERT(oldTail->next == NULL);
-        oldTail->next = newEntry;
-        queue->queueTail = newEntry;
+        queue->queueTail->next = newEntry;
     }
+    queue->queueTail = newEntry;
     queue->queueSize++;
 
-    return 1;
-}
-
-static void updateOldestQueued(PRTP_REORDER_QUEUE queue) {
-    PRTP_QUEUE_ENTRY entry;
-
-    queue->oldestQueuedTimeMs = UINT64_MAX;
-
-    entry = queue->queueHead;
-    while (entry != NULL) {
-        if (entry->queueTimeMs < queue->oldestQueuedTimeMs) {
-            queue->oldestQueuedTimeMs = entry->queueTimeMs;
-        }
-
-        entry = entry->next;
-    }
-}
-
-static PRTP_QUEUE_ENTRY getEntryByLowestSeq(PRTP_REORDER_QUEUE queue) {
-    PRTP_QUEUE_ENTRY lowestSeqEntry, entry;
-
-    lowestSeqEntry = queue->queueHead;
-    entry = queue->queueHead;
-    while (entry != NULL) {
-        if (isBefore16(entry->packet->sequenceNumber, lowestSeqEntry->packet->sequenceNumber)) {
-            lowestSeqEntry = entry;
-        }
-
-        entry = entry->next;
-    }
-
-    // Remember the updated lowest sequence number
-    if (lowestSeqEntry != NULL) {
-        queue->nextRtpSequenceNumber = lowestSeqEntry->packet->sequenceNumber;
-    }
-
-    return lowestSeqEntry;
+    *slot = newEntry;
 }
 
+// Removes a packet from its slot and from the arrival order list
 static void removeEntry(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY entry) {
     LC_ASSERT(entry != NULL);
     LC_ASSERT(queue->queueSize > 0);
-    LC_ASSERT(queue->queueHead != NULL);
-    LC_ASSERT(queue->queueTail != NULL);
+    LC_ASSERT(*getSlot(queue, entry->packet->sequenceNumber) == entry);
+
+    *getSlot(queue, entry->packet->sequenceNumber) = NULL;
 
     if (queue->queueHead == entry) {
         queue->queueHead = entry->next;
@@ -125,132 +91,139 @@ static void removeEntry(PRTP_REORDER_QUEUE queue, PRTP_QUEUE_ENTRY entry) {
     queue->queueSize--;
 }
 
-static PRTP_QUEUE_ENTRY enforceQueueConstraints(PRTP_REORDER_QUEUE queue) {
-    int dequeuePacket = 0;
+// Stops waiting for the missing packets before the lowest queued packet
+static void skipToLowestQueued(PRTP_REORDER_QUEUE queue) {
+    int i;
 
-    // Empty queue is fine
-    if (queue->queueHead == NULL) {
-        return NULL;
+    for (i = 0; i < RTPQ_SLOT_COUNT; i++) {
+        if (*getSlot(queue, queue->nextRtpSequenceNumber + i) != NULL) {
+            queue->nextRtpSequenceNumber += i;
+            return;
+        }
     }
+}
 
-    // Check that the queue's time constraint is satisfied
-    if (PltGetMillis() - queue->oldestQueuedTimeMs > queue->maxQueueTimeMs) {
-        Limelog("Returning RTP packet queued for too long\n");
-        dequeuePacket = 1;
-    }
+// Stops waiting for packets before the new sequence number and moves the
+// queued packets before it to the ready list in sequence order
+static void skipToSequenceNumber(PRTP_REORDER_QUEUE queue, unsigned short sequenceNumber) {
+    PRTP_QUEUE_ENTRY entry;
 
-    // Check that the queue's size constraint is satisfied. We subtract one
-    // because this is validating that the queue will meet constraints _after_
-    // the current packet is enqueued.
-    if (!dequeuePacket && queue->queueSize == queue->maxSize - 1) {
-        Limelog("Returning RTP packet after queue overgrowth\n");
-        dequeuePacket = 1;
-    }
+    while (queue->nextRtpSequenceNumber != sequenceNumber) {
+        entry = *getSlot(queue, queue->nextRtpSequenceNumber);
+        if (entry != NULL) {
+            removeEntry(queue, entry);
 
-    if (dequeuePacket) {
-        // Return the lowest seq queued
-        return getEntryByLowestSeq(queue);
-    }
-    else {
-        return NULL;
+            entry->next = NULL;
+            if (queue->readyTail == NULL) {
+                queue->readyHead = entry;
+            }
+            else {
+                queue->readyTail->next = entry;
+            }
+            queue->readyTail = entry;
+        }
+        else if (queue->queueSize == 0) {
+            // Nothing else to move
+            queue->nextRtpSequenceNumber = sequenceNumber;
+            break;
+        }
+
+        queue->nextRtpSequenceNumber++;
     }
 }
 
 int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY packetEntry) {
-    if (queue->nextRtpSequenceNumber != UINT16_MAX &&
+    int ret = 0;
+
+    if (queue->receivedFirstPacket &&
         isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber)) {
         // Reject packets behind our current sequence number
         return 0;
     }
 
-    if (queue->queueHead == NULL) {
+    if (queue->queueHead == NULL && queue->readyHead == NULL) {
         // Return immediately for an exact match with an empty queue
-        if (queue->nextRtpSequenceNumber == UINT16_MAX ||
+        if (!queue->receivedFirstPacket ||
             packet->sequenceNumber == queue->nextRtpSequenceNumber) {
+            queue->receivedFirstPacket = 1;
             queue->nextRtpSequenceNumber = packet->sequenceNumber + 1;
             return RTPQ_RET_HANDLE_NOW;
         }
-        else {
-            // Queue is empty currently so we'll put this packet on there
-            if (!queuePacket(queue, packetEntry, 0, packet)) {
-                return 0;
-            }
-            else {
-                return RTPQ_RET_PACKET_CONSUMED;
-            }
-        }
     }
-    else {
-        PRTP_QUEUE_ENTRY lowestEntry;
-
-        // Validate that the queue remains within our contraints
-        // and get the lowest element
-        lowestEntry = enforceQueueConstraints(queue);
+    else if (queue->queueHead != NULL) {
+        int dequeuePacket = 0;
 
-        // If the queue is now empty after validating queue constraints,
-        // this packet can be returned immediately
-        if (lowestEntry == NULL && queue->queueHead == NULL) {
-            queue->nextRtpSequenceNumber = packet->sequenceNumber + 1;
-            return RTPQ_RET_HANDLE_NOW;
-        }
-        else if (lowestEntry != NULL && queue->nextRtpSequenceNumber != UINT16_MAX &&
-                 isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber)) {
-            // The queue constraints were enforced and a new lowest entry was
-            // made available for retrieval. This packet was behind the new lowest
-            // so it will not be consumed by the queue.
-            return RTPQ_RET_PACKET_READY;
+        // Check that the queue's time constraint is satisfied
+        if (PltGetMicros() - queue->queueHead->queueTimeUs > (uint64_t)queue->maxQueueTimeUs) {
+            Limelog("Returning RTP packet queued for too long\n");
+            dequeuePacket = 1;
         }
 
-        // Queue has data inside, so we need to see where this packet fits
-        if (packet->sequenceNumber == queue->nextRtpSequenceNumber) {
-            // It fits in a hole where we need a packet, now we have some ready
-            if (!queuePacket(queue, packetEntry, 0, packet)) {
-                return 0;
-            }
-            else {
-                return RTPQ_RET_PACKET_READY | RTPQ_RET_PACKET_CONSUMED;
-            }
+        // Check that the queue's size constraint is satisfied. We subtract one
+        // because this is validating that the queue will meet constraints _after_
+        // the current packet is enqueued.
+        if (!dequeuePacket && queue->queueSize == queue->maxSize - 1) {
+            Limelog("Returning RTP packet after queue overgrowth\n");
+            dequeuePacket = 1;
         }
-        else {
-            if (!queuePacket(queue, packetEntry, 0, packet)) {
-                return 0;
-            }
-            else {
-                // Constraint validation may have changed the oldest packet to one that
-                // matches the next sequence number
-                return RTPQ_RET_PACKET_CONSUMED | ((lowestEntry != NULL) ? RTPQ_RET_PACKET_READY : 0);
+
+        if (dequeuePacket) {
+            skipToLowestQueued(queue);
+
+            if (isBefore16(packet->sequenceNumber, queue->nextRtpSequenceNumber)) {
+                // This packet was behind the new lowest so it will not be
+                // consumed by the queue.
+                return RTPQ_RET_PACKET_READY;
             }
         }
     }
+
+    if (U16(packet->sequenceNumber - queue->nextRtpSequenceNumber) >= RTPQ_SLOT_COUNT) {
+        // There's no slot for this packet unless we stop waiting for
+        // the packets that are too far behind it
+        Limelog("Returning RTP packets too far behind the latest\n");
+        skipToSequenceNumber(queue, packet->sequenceNumber - RTPQ_SLOT_COUNT + 1);
+    }
+
+    if (*getSlot(queue, packet->sequenceNumber) != NULL) {
+        // Don't queue duplicates
+        LC_ASSERT((*getSlot(queue, packet->sequenceNumber))->packet->sequenceNumber == packet->sequenceNumber);
+    }
+    else {
+        queuePacket(queue, packetEntry, packet);
+        ret |= RTPQ_RET_PACKET_CONSUMED;
+    }
+
+    if (queue->readyHead != NULL || *getSlot(queue, queue->nextRtpSequenceNumber) != NULL) {
+        ret |= RTPQ_RET_PACKET_READY;
+    }
+
+    return ret;
 }
 
 PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue) {
-    PRTP_QUEUE_ENTRY queuedEntry, entry;
-
-    // Find the next queued packet
-    queuedEntry = NULL;
-    entry = queue->queueHead;
-    while (entry != NULL) {
-        if (entry->packet->sequenceNumber == queue->nextRtpSequenceNumber) {
-            queue->nextRtpSequenceNumber++;
-            queuedEntry = entry;
-            removeEntry(queue, entry);
-            break;
+    PRTP_QUEUE_ENTRY queuedEntry;
+
+    // Packets pushed out of the queue go first since they're all behind
+    // the next sequence number
+    queuedEntry = queue->readyHead;
+    if (queuedEntry != NULL) {
+        queue->readyHead = queuedEntry->next;
+        if (queue->readyHead == NULL) {
+            queue->readyTail = NULL;
         }
 
-        entry = entry->next;
+        return queuedEntry->packet;
     }
 
-    // Bail if we found nothing
+    // Return the next packet if it has arrived
+    queuedEntry = *getSlot(queue, queue->nextRtpSequenceNumber);
     if (queuedEntry == NULL) {
-        // Update the oldest queued packet time
-        updateOldestQueued(queue);
-
         return NULL;
     }
 
-    // We don't update the oldest queued entry here, because we know
-    // the caller will call again until it receives null
+    removeEntry(queue, queuedEntry);
+    queue->nextRtpSequenceNumber++;
 
     return queuedEntry->packet;
-}
\ No newline at end of file
+}
@@ -1,30 +1,47 @@
 #pragma once
 
 #include "Video.h"
+#include "PacketPool.h"
 
 #define RTPQ_DEFAULT_MAX_SIZE   16
-#define RTPQ_DEFAULT_QUEUE_TIME 40
+
+// Packets may be queued at most this many sequence numbers ahead of the
+// next one expected. This must be a power of two.
+#define RTPQ_SLOT_COUNT         64
 
 typedef struct _RTP_QUEUE_ENTRY {
     PRTP_PACKET packet;
 
-    uint64_t queueTimeMs;
+    uint64_t queueTimeUs;
 
     struct _RTP_QUEUE_ENTRY* next;
     struct _RTP_QUEUE_ENTRY* prev;
 } RTP_QUEUE_ENTRY, *PRTP_QUEUE_ENTRY;
 
 typedef struct _RTP_REORDER_QUEUE {
+    // Packets are allocated from this pool
+    PPACKET_POOL packetPool;
+
     int maxSize;
-    int maxQueueTimeMs;
+    int maxQueueTimeUs;
+
+    // Queued packets indexed by sequence number modulo RTPQ_SLOT_COUNT. Every queued
+    // packet is within RTPQ_SLOT_COUNT of nextRtpSequenceNumber, so they never collide.
+    PRTP_QUEUE_ENTRY slots[RTPQ_SLOT_COUNT];
 
+    // Queued packets in the order they arrived, so the head is the oldest
     PRTP_QUEUE_ENTRY queueHead;
     PRTP_QUEUE_ENTRY queueTail;
     int queueSize;
 
-    unsigned short nextRtpSequenceNumber;
+    // Packets that were pushed out of the queue and are waiting to be returned
+    PRTP_QUEUE_ENTRY readyHead;
+    PRTP_QUEUE_ENTRY readyTail;
 
-    uint64_t oldestQueuedTimeMs;
+    // Set once the first packet has been received. Any sequence number
+    // is valid, so none of them can be used to indicate this.
+    int receivedFirstPacket;
+    unsigned short nextRtpSequenceNumber;
 } RTP_REORDER_QUEUE, *PRTP_REORDER_QUEUE;
 
 #define RTPQ_RET_PACKET_CONSUMED 0x1
@@ -35,7 +52,8 @@ typedef struct _RTP_REORDER_QUEUE {
 #define RTPQ_PACKET_READY(x)    ((x) & RTPQ_RET_PACKET_READY)
 #define RTPQ_HANDLE_NOW(x)      ((x) == RTPQ_RET_HANDLE_NOW)
 
-void RtpqInitializeQueue(PRTP_REORDER_QUEUE queue, int maxSize, int maxQueueTimeMs);
+void RtpqInitializeQueue(PRTP_REORDER_QUEUE queue, PPACKET_POOL packetPool, int maxSize, int maxQueueTimeUs);
 void RtpqCleanupQueue(PRTP_REORDER_QUEUE queue);
+void RtpqSetMaxQueueTime(PRTP_REORDER_QUEUE queue, int maxQueueTimeUs);
 int RtpqAddPacket(PRTP_REORDER_QUEUE queue, PRTP_PACKET packet, PRTP_QUEUE_ENTRY packetEntry);
-PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue);
\ No newline at end of file
+PRTP_PACKET RtpqGetQueuedPacket(PRTP_REORDER_QUEUE queue);
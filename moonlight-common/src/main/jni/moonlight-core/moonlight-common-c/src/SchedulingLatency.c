@@ -0,0 +1,122 @@
+#include "Limelight-internal.h"
+#include "PlatformThreads.h"
+#include "LatencyHistogram.h"
+
+// Each measuring thread asks to sleep for this long between wakeups
+#define WAKEUP_INTERVAL_MS 1
+
+// The most CPU-bound threads that can run alongside the measurement
+#define MAX_LOAD_THREADS 16
+
+static PLT_THREAD roleThreads[THREAD_ROLE_COUNT];
+static LATENCY_HISTOGRAM wakeupLatency[THREAD_ROLE_COUNT];
+static int roleIndexes[THREAD_ROLE_COUNT];
+static PLT_THREAD loadThreads[MAX_LOAD_THREADS];
+
+static const char* roleThreadNames[THREAD_ROLE_COUNT] = {
+    "SchedDefault",
+    "SchedVideoRecv",
+    "SchedVideoDec",
+    "SchedAudioRecv",
+    "SchedAudioDec",
+    "SchedInput",
+    "SchedControl",
+};
+
+static void WakeupThreadProc(void* context) {
+    int role = *(int*)context;
+    uint64_t deadline, now;
+
+    while (!PltIsThreadInterrupted(&roleThreads[role])) {
+        deadline = PltGetMicros() + WAKEUP_INTERVAL_MS * 1000;
+        PltSleepMs(WAKEUP_INTERVAL_MS);
+        now = PltGetMicros();
+
+        // The sleep may return early on some platforms
+        LhAddSample(&wakeupLatency[role], now > deadline ? now - deadline : 0);
+    }
+}
+
+static void LoadThreadProc(void* context) {
+    PLT_THREAD* thread = (PLT_THREAD*)context;
+    volatile unsigned int spin = 0;
+
+    while (!PltIsThreadInterrupted(thread)) {
+        spin++;
+    }
+}
+
+int LiMeasureSchedulingLatency(PSTREAM_CONFIGURATION streamConfig, int durationMs,
+                               int loadThreadCount, PSCHEDULING_LATENCY_STATS stats) {
+    THREAD_SCHEDULING previousScheduling[THREAD_ROLE_COUNT];
+    int roleThreadCount;
+    int loadThreadsStarted;
+    int err;
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (loadThreadCount > MAX_LOAD_THREADS) {
+        loadThreadCount = MAX_LOAD_THREADS;
+    }
+
+    // The threads pick up the scheduling for their role as they start
+    PltGetThreadScheduling(previousScheduling);
+    PltSetThreadScheduling(streamConfig->threadScheduling);
+
+    err = 0;
+    loadThreadsStarted = 0;
+    for (i = 0; i < loadThreadCount; i++) {
+        err = PltCreateThread("SchedLoad", THREAD_ROLE_DEFAULT, LoadThreadProc, &loadThreads[i], &loadThreads[i]);
+        if (err != 0) {
+            break;
+        }
+        loadThreadsStarted++;
+    }
+
+    roleThreadCount = 0;
+    if (err == 0) {
+        for (i = 0; i < THREAD_ROLE_COUNT; i++) {
+            LhResetHistogram(&wakeupLatency[i]);
+            roleIndexes[i] = i;
+
+            err = PltCreateThread(roleThreadNames[i], i, WakeupThreadProc, &roleIndexes[i], &roleThreads[i]);
+            if (err != 0) {
+                break;
+            }
+            roleThreadCount++;
+        }
+    }
+
+    if (err == 0) {
+        PltSleepMs(durationMs);
+    }
+
+    for (i = 0; i < roleThreadCount; i++) {
+        PltInterruptThread(&roleThreads[i]);
+    }
+    for (i = 0; i < loadThreadsStarted; i++) {
+        PltInterruptThread(&loadThreads[i]);
+    }
+
+    for (i = 0; i < roleThreadCount; i++) {
+        PltJoinThread(&roleThreads[i]);
+        PltCloseThread(&roleThreads[i]);
+    }
+    for (i = 0; i < loadThreadsStarted; i++) {
+        PltJoinThread(&loadThreads[i]);
+        PltCloseThread(&loadThreads[i]);
+    }
+
+    PltSetThreadScheduling(previousScheduling);
+
+    if (err != 0) {
+        return err;
+    }
+
+    for (i = 0; i < THREAD_ROLE_COUNT; i++) {
+        LhGetPercentiles(&wakeupLatency[i], &stats->wakeupLatency[i]);
+    }
+
+    return 0;
+}
@@ -5,10 +5,18 @@
 typedef struct _QUEUED_DECODE_UNIT {
     DECODE_UNIT decodeUnit;
     LINKED_BLOCKING_QUEUE_ENTRY entry;
+
+    // Microsecond timestamps for the pipeline latency statistics
+    unsigned long long firstPacketTimeUs;
+    unsigned long long lastPacketTimeUs;
+    unsigned long long fecCompleteTimeUs;
+    unsigned long long reassembledTimeUs;
 } QUEUED_DECODE_UNIT, *PQUEUED_DECODE_UNIT;
 
 void freeQueuedDecodeUnit(PQUEUED_DECODE_UNIT qdu);
 int getNextQueuedDecodeUnit(PQUEUED_DECODE_UNIT* qdu);
+int pollNextQueuedDecodeUnit(PQUEUED_DECODE_UNIT* qdu);
+int submitQueuedDecodeUnit(PQUEUED_DECODE_UNIT qdu);
 
 #pragma pack(push, 1)
 
@@ -33,7 +41,8 @@ typedef struct _RTP_PACKET {
     char header;
     char packetType;
     unsigned short sequenceNumber;
-    char reserved[8];
+    unsigned int timestamp;
+    unsigned int ssrc;
 } RTP_PACKET, *PRTP_PACKET;
 
 #pragma pack(pop)
@@ -1,10 +1,26 @@
 #include "Platform.h"
 #include "Limelight-internal.h"
+#include "PlatformAtomics.h"
 #include "LinkedBlockingQueue.h"
 #include "Video.h"
+#include "AnnexB.h"
+#include "LatencyHistogram.h"
+#include "ParameterSetCache.h"
 
 static PLENTRY nalChainHead;
 static int nalChainDataLength;
+static int zeroCopy;
+
+// Slice submission state. The NAL chain holds at most one slice at a time
+// and sliceInChain is set once it has one.
+static int submitSlices;
+static int sliceInChain;
+static int frameDecodeUnits;
+static int currentFrameType;
+
+// Written by the depacketizer and read from any thread
+static volatile int framesSubmitted;
+static volatile unsigned long long bytesCopied;
 
 static unsigned int nextFrameNumber;
 static unsigned int startFrameNumber;
@@ -13,7 +29,7 @@ static int waitingForIdrFrame;
 static unsigned int lastPacketInStream;
 static int decodingFrame;
 static int strictIdrFrameWait;
-static unsigned long long firstPacketReceiveTime;
+static unsigned long long firstPacketReceiveTimeUs;
 static int dropStatePending;
 
 #define CONSECUTIVE_DROP_LIMIT 120
@@ -21,16 +37,39 @@ static unsigned int consecutiveFrameDrops;
 
 static LINKED_BLOCKING_QUEUE decodeUnitQueue;
 
+// Parameter sets last given to the renderer
+static PARAMETER_SET_CACHE parameterSetCache;
+
+// Per-frame latency of each pipeline stage
+static LATENCY_HISTOGRAM receiveLatency;
+static LATENCY_HISTOGRAM fecLatency;
+static LATENCY_HISTOGRAM reassemblyLatency;
+static LATENCY_HISTOGRAM queueLatency;
+static LATENCY_HISTOGRAM submitLatency;
+static LATENCY_HISTOGRAM totalLatency;
+
 typedef struct _BUFFER_DESC {
     char* data;
     unsigned int offset;
     unsigned int length;
 } BUFFER_DESC, *PBUFFER_DESC;
 
+// In zero copy mode, each LENTRY is the head of one of these and its
+// data points into the referenced packet buffer.
+typedef struct _PACKET_SLICE {
+    LENTRY entry;
+    PRTPFEC_QUEUE_ENTRY packetEntry;
+} PACKET_SLICE, *PPACKET_SLICE;
+
 // Init
 void initializeVideoDepacketizer(int pktSize) {
     if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-        LbqInitializeLinkedBlockingQueue(&decodeUnitQueue, 15);
+        if (StreamConfig.lockFreeQueues & LOCK_FREE_QUEUE_VIDEO) {
+            LbqInitializeLockFreeQueue(&decodeUnitQueue, 15);
+        }
+        else {
+            LbqInitializeLinkedBlockingQueue(&decodeUnitQueue, 15);
+        }
     }
 
     nextFrameNumber = 1;
@@ -39,9 +78,56 @@ void initializeVideoDepacketizer(int pktSize) {
     waitingForIdrFrame = 1;
     lastPacketInStream = UINT32_MAX;
     decodingFrame = 0;
-    firstPacketReceiveTime = 0;
+    firstPacketReceiveTimeUs = 0;
     dropStatePending = 0;
     strictIdrFrameWait = !isReferenceFrameInvalidationEnabled();
+    zeroCopy = (VideoCallbacks.capabilities & CAPABILITY_ZERO_COPY_DECODE_UNITS) != 0;
+    submitSlices = (VideoCallbacks.capabilities & CAPABILITY_SLICE_SUBMIT) != 0;
+    sliceInChain = 0;
+    frameDecodeUnits = 0;
+    PltAtomicStoreInt(&framesSubmitted, 0);
+    PltAtomicStoreUint64(&bytesCopied, 0);
+    PscInitialize(&parameterSetCache);
+    resetVideoPipelineStats();
+}
+
+void getVideoDepacketizerStats(PVIDEO_STREAM_STATS stats) {
+    stats->depacketizerFrames = (unsigned int)PltAtomicLoadInt(&framesSubmitted);
+    stats->depacketizerBytesCopied = PltAtomicLoadUint64(&bytesCopied);
+    stats->parameterSetChanges = parameterSetCache.changes;
+    stats->parameterSetRepeats = parameterSetCache.repeats;
+}
+
+void getVideoPipelineStats(PPIPELINE_STATS stats) {
+    LhGetPercentiles(&receiveLatency, &stats->receive);
+    LhGetPercentiles(&fecLatency, &stats->fecRecovery);
+    LhGetPercentiles(&reassemblyLatency, &stats->reassembly);
+    LhGetPercentiles(&queueLatency, &stats->decodeUnitQueue);
+    LhGetPercentiles(&submitLatency, &stats->submit);
+    LhGetPercentiles(&totalLatency, &stats->total);
+}
+
+void resetVideoPipelineStats(void) {
+    LhResetHistogram(&receiveLatency);
+    LhResetHistogram(&fecLatency);
+    LhResetHistogram(&reassemblyLatency);
+    LhResetHistogram(&queueLatency);
+    LhResetHistogram(&submitLatency);
+    LhResetHistogram(&totalLatency);
+}
+
+// Adds the time from start to end to a histogram
+static void addLatencySample(PLATENCY_HISTOGRAM histogram, unsigned long long startUs, unsigned long long endUs) {
+    LhAddSample(histogram, endUs > startUs ? endUs - startUs : 0);
+}
+
+// Free a buffer list entry and drop its packet reference (if any)
+static void freeLentry(PLENTRY entry) {
+    if (zeroCopy) {
+        releaseVideoPacket(((PPACKET_SLICE)entry)->packetEntry);
+    }
+
+    free(entry);
 }
 
 // Free the NAL chain
@@ -51,10 +137,11 @@ static void cleanupFrameState(void) {
     while (nalChainHead != NULL) {
         lastEntry = nalChainHead;
         nalChainHead = lastEntry->next;
-        free(lastEntry);
+        freeLentry(lastEntry);
     }
 
     nalChainDataLength = 0;
+    sliceInChain = 0;
 }
 
 // Cleanup frame state and set that we're waiting for an IDR Frame
@@ -179,6 +266,64 @@ int getNextQueuedDecodeUnit(PQUEUED_DECODE_UNIT* qdu) {
     }
 }
 
+// Get the first decode unit if one is queued. Returns 0 if none is.
+int pollNextQueuedDecodeUnit(PQUEUED_DECODE_UNIT* qdu) {
+    return LbqPollQueueElement(&decodeUnitQueue, (void**)qdu) == LBQ_SUCCESS;
+}
+
+// Hands a decode unit to the renderer and records the latency of each
+// pipeline stage. Returns the renderer's result.
+int submitQueuedDecodeUnit(PQUEUED_DECODE_UNIT qdu) {
+    unsigned long long dequeueTimeUs, submitTimeUs;
+    int ret;
+
+    if (VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) {
+        dequeueTimeUs = qdu->reassembledTimeUs;
+    }
+    else {
+        dequeueTimeUs = PltGetMicros();
+    }
+
+    // Tell the renderer whether the parameter sets differ from the last ones it was given.
+    // This is done at submission so frames dropped before reaching it aren't counted.
+    if (qdu->decodeUnit.frameType == FRAME_TYPE_IDR &&
+            qdu->decodeUnit.bufferList->bufferType != BUFFER_TYPE_PICDATA) {
+        int hadParameterSets = parameterSetCache.setCount != 0;
+
+        if (PscUpdate(&parameterSetCache, qdu->decodeUnit.bufferList)) {
+            qdu->decodeUnit.flags |= DU_FLAG_PARAMETER_SETS_UNCHANGED;
+        }
+        else {
+            if (hadParameterSets) {
+                Limelog("Video parameter sets changed\n");
+            }
+            qdu->decodeUnit.flags |= DU_FLAG_PARAMETER_SETS_CHANGED;
+        }
+    }
+
+    ret = VideoCallbacks.submitDecodeUnit(&qdu->decodeUnit);
+    if (ret == DR_NEED_IDR) {
+        // The renderer may reset its decoder, so the next parameter sets must reach it
+        PscInvalidate(&parameterSetCache);
+    }
+
+    submitTimeUs = PltGetMicros();
+
+    // Slices submitted ahead of the rest of their frame aren't frames
+    if (!(qdu->decodeUnit.flags & DU_FLAG_END_OF_FRAME)) {
+        return ret;
+    }
+
+    addLatencySample(&receiveLatency, qdu->firstPacketTimeUs, qdu->lastPacketTimeUs);
+    addLatencySample(&fecLatency, qdu->lastPacketTimeUs, qdu->fecCompleteTimeUs);
+    addLatencySample(&reassemblyLatency, qdu->fecCompleteTimeUs, qdu->reassembledTimeUs);
+    addLatencySample(&queueLatency, qdu->reassembledTimeUs, dequeueTimeUs);
+    addLatencySample(&submitLatency, dequeueTimeUs, submitTimeUs);
+    addLatencySample(&totalLatency, qdu->firstPacketTimeUs, submitTimeUs);
+
+    return ret;
+}
+
 // Cleanup a decode unit by freeing the buffer chain and the holder
 void freeQueuedDecodeUnit(PQUEUED_DECODE_UNIT qdu) {
     PLENTRY lastEntry;
@@ -186,7 +331,7 @@ void freeQueuedDecodeUnit(PQUEUED_DECODE_UNIT qdu) {
     while (qdu->decodeUnit.bufferList != NULL) {
         lastEntry = qdu->decodeUnit.bufferList;
         qdu->decodeUnit.bufferList = lastEntry->next;
-        free(lastEntry);
+        freeLentry(lastEntry);
     }
 
     free(qdu);
@@ -223,35 +368,66 @@ static int isIdrFrameStart(PBUFFER_DESC buffer) {
          specialSeq.data[specialSeq.offset + specialSeq.length] == 0x40); // H265 VPS
 }
 
-// Reassemble the frame with the given frame number
-static void reassembleFrame(int frameNumber) {
+// Hands the NAL chain to the decoder as a decode unit. Flags are DU_FLAG_XXX values and
+// frame times are only needed for the decode unit that ends the frame.
+static void reassembleFrame(int frameNumber, PRTPF_FRAME_TIMES frameTimes, int flags) {
     if (nalChainHead != NULL) {
         PQUEUED_DECODE_UNIT qdu = (PQUEUED_DECODE_UNIT)malloc(sizeof(*qdu));
         if (qdu != NULL) {
             qdu->decodeUnit.bufferList = nalChainHead;
             qdu->decodeUnit.fullLength = nalChainDataLength;
             qdu->decodeUnit.frameNumber = frameNumber;
-            qdu->decodeUnit.receiveTimeMs = firstPacketReceiveTime;
-
-            // IDR frames will have leading CSD buffers
-            if (nalChainHead->bufferType != BUFFER_TYPE_PICDATA) {
-                qdu->decodeUnit.frameType = FRAME_TYPE_IDR;
+            qdu->decodeUnit.receiveTimeUs = firstPacketReceiveTimeUs;
+            qdu->decodeUnit.receiveTimeMs = firstPacketReceiveTimeUs / 1000;
+            qdu->decodeUnit.flags = flags;
+
+            qdu->reassembledTimeUs = PltGetMicros();
+            if (frameTimes != NULL) {
+                qdu->firstPacketTimeUs = frameTimes->firstPacketUs;
+                qdu->lastPacketTimeUs = frameTimes->lastPacketUs;
+                qdu->fecCompleteTimeUs = frameTimes->completeUs;
             }
             else {
-                qdu->decodeUnit.frameType = FRAME_TYPE_PFRAME;
+                qdu->firstPacketTimeUs = qdu->lastPacketTimeUs =
+                    qdu->fecCompleteTimeUs = qdu->reassembledTimeUs;
+            }
+
+            // IDR frames will have leading CSD buffers in their first decode unit
+            if (frameDecodeUnits == 0) {
+                if (nalChainHead->bufferType != BUFFER_TYPE_PICDATA) {
+                    currentFrameType = FRAME_TYPE_IDR;
+                }
+                else {
+                    currentFrameType = FRAME_TYPE_PFRAME;
+                }
             }
+            qdu->decodeUnit.frameType = currentFrameType;
 
             nalChainHead = NULL;
             nalChainDataLength = 0;
+            sliceInChain = 0;
 
             if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-                if (LbqOfferQueueItem(&decodeUnitQueue, qdu, &qdu->entry) == LBQ_BOUND_EXCEEDED) {
+                int err = LbqOfferQueueItem(&decodeUnitQueue, qdu, &qdu->entry);
+                if (err == LBQ_INTERRUPTED) {
+                    // The decoder thread is stopping and won't free this DU
+                    freeQueuedDecodeUnit(qdu);
+                    return;
+                }
+                else if (err == LBQ_BOUND_EXCEEDED) {
                     Limelog("Video decode unit queue overflow\n");
 
                     // Clear frame state and wait for an IDR
                     nalChainHead = qdu->decodeUnit.bufferList;
                     nalChainDataLength = qdu->decodeUnit.fullLength;
-                    dropFrameState();
+                    if (flags & DU_FLAG_END_OF_FRAME) {
+                        dropFrameState();
+                    }
+                    else {
+                        // We're in the middle of a frame, so drop the rest of it when it ends
+                        cleanupFrameState();
+                        dropStatePending = 1;
+                    }
 
                     // Free the DU
                     free(qdu);
@@ -265,7 +441,7 @@ static void reassembleFrame(int frameNumber) {
                 }
             }
             else {
-                int ret = VideoCallbacks.submitDecodeUnit(&qdu->decodeUnit);
+                int ret = submitQueuedDecodeUnit(qdu);
 
                 freeQueuedDecodeUnit(qdu);
 
@@ -275,11 +451,17 @@ static void reassembleFrame(int frameNumber) {
                 }
             }
 
-            // Notify the control connection
-            connectionReceivedCompleteFrame(frameNumber);
+            frameDecodeUnits++;
+
+            if (flags & DU_FLAG_END_OF_FRAME) {
+                PltAtomicStoreInt(&framesSubmitted, framesSubmitted + 1);
+
+                // Notify the control connection
+                connectionReceivedCompleteFrame(frameNumber);
 
-            // Clear frame drops
-            consecutiveFrameDrops = 0;
+                // Clear frame drops
+                consecutiveFrameDrops = 0;
+            }
         }
     }
 }
@@ -320,14 +502,31 @@ static int getBufferFlags(char* data, int length) {
     }
 }
 
-static void queueFragment(char* data, int offset, int length) {
-    PLENTRY entry = (PLENTRY)malloc(sizeof(*entry) + length);
+static void queueFragment(char* data, int offset, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
+    PLENTRY entry;
+
+    if (zeroCopy) {
+        // Reference the data in place and hold the packet until the DU is freed
+        PPACKET_SLICE slice = (PPACKET_SLICE)malloc(sizeof(*slice));
+        if (slice != NULL) {
+            retainVideoPacket(packetEntry);
+            slice->packetEntry = packetEntry;
+            slice->entry.data = &data[offset];
+        }
+        entry = (PLENTRY)slice;
+    }
+    else {
+        entry = (PLENTRY)malloc(sizeof(*entry) + length);
+        if (entry != NULL) {
+            entry->data = (char*)(entry + 1);
+            memcpy(entry->data, &data[offset], length);
+            PltAtomicStoreUint64(&bytesCopied, bytesCopied + length);
+        }
+    }
+
     if (entry != NULL) {
         entry->next = NULL;
         entry->length = length;
-        entry->data = (char*)(entry + 1);
-
-        memcpy(entry->data, &data[offset], entry->length);
 
         entry->bufferType = getBufferFlags(entry->data, entry->length);
 
@@ -348,8 +547,73 @@ static void queueFragment(char* data, int offset, int length) {
     }
 }
 
+// Returns 1 if the NAL unit header byte begins a coded slice
+static int isSliceNalHeader(unsigned char header) {
+    if (NegotiatedVideoFormat & VIDEO_FORMAT_MASK_H265) {
+        // NAL unit types 0-31 are VCL NAL units
+        return ((header >> 1) & 0x3F) < 32;
+    }
+    else {
+        // Coded slices and slice data partitions
+        return (header & 0x1F) >= 1 && (header & 0x1F) <= 5;
+    }
+}
+
+// Returns the offset of the first start code in [offset, end) that begins a slice or
+// end if there is none. Start codes split across packets are not found, so those
+// slices stay in the same decode unit as the slice before them.
+static int findSliceStart(char* data, int offset, int end) {
+    unsigned char* bytes = (unsigned char*)data;
+
+    for (;;) {
+        offset += AnnexBFindSpecialSequence(&bytes[offset], end - offset);
+        if (offset >= end) {
+            return end;
+        }
+
+        if (end - offset >= 4 && bytes[offset + 2] == 1 && isSliceNalHeader(bytes[offset + 3])) {
+            return offset;
+        }
+        if (end - offset >= 5 && bytes[offset + 2] == 0 && bytes[offset + 3] == 1 && isSliceNalHeader(bytes[offset + 4])) {
+            return offset;
+        }
+
+        offset++;
+    }
+}
+
+// Adds frame data to the NAL chain. If slices are submitted individually,
+// the chain is handed to the decoder before each new slice starts.
+static void queueFrameData(char* data, int offset, int length, PRTPFEC_QUEUE_ENTRY packetEntry) {
+    int end = offset + length;
+    int sliceStart;
+
+    if (!submitSlices) {
+        queueFragment(data, offset, length, packetEntry);
+        return;
+    }
+
+    do {
+        sliceStart = findSliceStart(data, offset, end);
+        if (sliceStart == offset && offset != end) {
+            // The slice in the chain is complete. Don't submit anything for
+            // frames that are going to be dropped.
+            if (sliceInChain && !waitingForIdrFrame && !dropStatePending) {
+                reassembleFrame(nextFrameNumber, NULL, 0);
+            }
+            sliceInChain = 1;
+
+            // Skip the start code we just found
+            sliceStart = findSliceStart(data, offset + 3, end);
+        }
+
+        queueFragment(data, offset, sliceStart - offset, packetEntry);
+        offset = sliceStart;
+    } while (offset != end);
+}
+
 // Process an RTP Payload
-static void processRtpPayloadSlow(PNV_VIDEO_PACKET videoPacket, PBUFFER_DESC currentPos) {
+static void processRtpPayloadSlow(PNV_VIDEO_PACKET videoPacket, PBUFFER_DESC currentPos, PRTPFEC_QUEUE_ENTRY packetEntry) {
     BUFFER_DESC specialSeq;
     int decodingVideo = 0;
 
@@ -393,6 +657,15 @@ static void processRtpPayloadSlow(PNV_VIDEO_PACKET videoPacket, PBUFFER_DESC cur
 
         // Move to the next special sequence
         while (currentPos->length != 0) {
+            // Skip the NAL data that can't contain one
+            int skip = AnnexBFindSpecialSequence((unsigned char*)&currentPos->data[currentPos->offset],
+                                                 (int)currentPos->length);
+            currentPos->offset += skip;
+            currentPos->length -= skip;
+            if (currentPos->length == 0) {
+                break;
+            }
+
             // Check if this should end the current NAL
             if (getSpecialSeq(currentPos, &specialSeq)) {
                 if (decodingVideo || !isSeqPadding(&specialSeq)) {
@@ -406,7 +679,7 @@ static void processRtpPayloadSlow(PNV_VIDEO_PACKET videoPacket, PBUFFER_DESC cur
         }
 
         if (decodingVideo) {
-            queueFragment(currentPos->data, start, currentPos->offset - start);
+            queueFrameData(currentPos->data, start, currentPos->offset - start, packetEntry);
         }
     }
 }
@@ -443,21 +716,22 @@ static int isFirstPacket(char flags) {
 }
 
 // Adds a fragment directly to the queue
-static void processRtpPayloadFast(BUFFER_DESC location) {
-    queueFragment(location.data, location.offset, location.length);
+static void processRtpPayloadFast(BUFFER_DESC location, PRTPFEC_QUEUE_ENTRY packetEntry) {
+    queueFrameData(location.data, location.offset, location.length, packetEntry);
 }
 
-// Process an RTP Payload
-void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long long receiveTimeMs) {
+// Process an RTP Payload. The packet entry owns the buffer that contains the payload.
+void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long long receiveTimeUs,
+                       PRTPF_FRAME_TIMES frameTimes, PRTPFEC_QUEUE_ENTRY packetEntry) {
     BUFFER_DESC currentPos;
     int frameIndex;
     char flags;
     unsigned int firstPacket;
     unsigned int streamPacketIndex;
 
-    // Mask the top 8 bits from the SPI
-    videoPacket->streamPacketIndex >>= 8;
-    videoPacket->streamPacketIndex &= 0xFFFFFF;
+    // Mask the top 8 bits from the SPI. The packet itself must not be modified
+    // since the FEC queue may still need it to recover the rest of the frame.
+    streamPacketIndex = (videoPacket->streamPacketIndex >> 8) & 0xFFFFFF;
 
     currentPos.data = (char*)(videoPacket + 1);
     currentPos.offset = 0;
@@ -468,8 +742,6 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long l
     firstPacket = isFirstPacket(flags);
 
     LC_ASSERT((flags & ~(FLAG_SOF | FLAG_EOF | FLAG_CONTAINS_PIC_DATA)) == 0);
-
-    streamPacketIndex = videoPacket->streamPacketIndex;
     
     // Drop packets from a previously corrupt frame
     if (isBefore32(frameIndex, nextFrameNumber)) {
@@ -491,6 +763,15 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long l
 
     // Notify the listener of the latest frame we've seen from the PC
     connectionSawFrame(frameIndex);
+
+    // When the FEC queue delivers packets before their frame is complete, it
+    // may give up on the rest of the frame. The sequencing check below then
+    // drops the partial frame.
+    if (firstPacket && decodingFrame) {
+        LC_ASSERT(submitSlices);
+        Limelog("Received the start of frame %d before the end of the last one\n", frameIndex);
+        decodingFrame = 0;
+    }
     
     // Verify that we didn't receive an incomplete frame
     LC_ASSERT(firstPacket ^ decodingFrame);
@@ -513,7 +794,8 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long l
 
         // We're now decoding a frame
         decodingFrame = 1;
-        firstPacketReceiveTime = receiveTimeMs;
+        firstPacketReceiveTimeUs = receiveTimeUs;
+        frameDecodeUnits = 0;
     }
 
     lastPacketInStream = streamPacketIndex;
@@ -547,11 +829,11 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long l
     if (firstPacket && isIdrFrameStart(&currentPos))
     {
         // SPS and PPS prefix is padded between NALs, so we must decode it with the slow path
-        processRtpPayloadSlow(videoPacket, &currentPos);
+        processRtpPayloadSlow(videoPacket, &currentPos, packetEntry);
     }
     else
     {
-        processRtpPayloadFast(currentPos);
+        processRtpPayloadFast(currentPos, packetEntry);
     }
 
     if (flags & FLAG_EOF) {
@@ -586,7 +868,7 @@ void processRtpPayload(PNV_VIDEO_PACKET videoPacket, int length, unsigned long l
             return;
         }
 
-        reassembleFrame(frameIndex);
+        reassembleFrame(frameIndex, frameTimes, DU_FLAG_END_OF_FRAME);
 
         startFrameNumber = nextFrameNumber;
     }
@@ -603,5 +885,7 @@ void queueRtpPacket(PRTPFEC_QUEUE_ENTRY queueEntry) {
 
     processRtpPayload((PNV_VIDEO_PACKET)(((char*)queueEntry->packet) + dataOffset),
                       queueEntry->length - dataOffset,
-                      queueEntry->receiveTimeMs);
+                      queueEntry->receiveTimeUs,
+                      &queueEntry->frameTimes,
+                      queueEntry);
 }
@@ -2,6 +2,11 @@
 #include "PlatformSockets.h"
 #include "PlatformThreads.h"
 #include "RtpFecQueue.h"
+#include "PacketPool.h"
+#include "PlatformAtomics.h"
+#include "RtpCapture.h"
+#include "JitterEstimator.h"
+#include "FramePacer.h"
 
 #define FIRST_FRAME_MAX 1500
 #define FIRST_FRAME_TIMEOUT_SEC 10
@@ -11,7 +16,17 @@
 
 #define RTP_RECV_BUFFER (512 * 1024)
 
+// Maximum number of packets read from the socket at once
+#define RTP_RECV_BATCH_SIZE UDP_RECV_MAX_BATCH
+
 static RTP_FEC_QUEUE rtpQueue;
+static PACKET_POOL packetPool;
+static JITTER_ESTIMATOR jitterEstimator;
+static FRAME_PACER framePacer;
+static int framePacing;
+
+static unsigned int receiveBatches;
+static unsigned int packetsReceived;
 
 static SOCKET rtpSocket = INVALID_SOCKET;
 static SOCKET firstFrameSocket = INVALID_SOCKET;
@@ -21,21 +36,102 @@ static PLT_THREAD receiveThread;
 static PLT_THREAD decoderThread;
 
 // We can't request an IDR frame until the depacketizer knows
-// that a packet was lost. This timeout bounds the time that
-// the RTP queue will wait for missing/reordered packets.
-#define RTP_QUEUE_DELAY 10
+// that a packet was lost. This bounds the time that the RTP
+// queue will wait for missing/reordered packets. The actual
+// wait adapts to the jitter and reordering we observe.
+#define DEFAULT_MAX_REORDER_WINDOW_MS 20
+
+// Video RTP timestamps use a 90 kHz clock
+#define RTP_CLOCK_RATE 90000
 
 
 // Initialize the video stream
 void initializeVideoStream(void) {
     initializeVideoDepacketizer(StreamConfig.packetSize);
-    RtpfInitializeQueue(&rtpQueue); //TODO RTP_QUEUE_DELAY
+
+    // Each buffer holds a received packet followed by its FEC queue entry
+    PpInitializePool(&packetPool,
+                     StreamConfig.packetSize + MAX_RTP_HEADER_SIZE + sizeof(RTPFEC_QUEUE_ENTRY),
+                     PP_DEFAULT_SLAB_SIZE);
+    RtpfInitializeQueue(&rtpQueue, &packetPool);
+
+    JeInitialize(&jitterEstimator, RTP_CLOCK_RATE,
+                 StreamConfig.minReorderWindowMs,
+                 StreamConfig.maxReorderWindowMs != 0 ?
+                     StreamConfig.maxReorderWindowMs : DEFAULT_MAX_REORDER_WINDOW_MS);
+    RtpfSetReorderWindow(&rtpQueue, JeGetWindowUs(&jitterEstimator));
+
+    // Slices can only be submitted early if their packets are delivered early
+    RtpfSetEarlyDelivery(&rtpQueue, (VideoCallbacks.capabilities & CAPABILITY_SLICE_SUBMIT) != 0);
+
+    // Pacing needs whole frames queued for the decoder thread
+    framePacing = (VideoCallbacks.capabilities & CAPABILITY_FRAME_PACING) &&
+        !(VideoCallbacks.capabilities & (CAPABILITY_DIRECT_SUBMIT | CAPABILITY_SLICE_SUBMIT));
+    FpInitialize(&framePacer, StreamConfig.clientRefreshRateX100 != 0 ?
+                 StreamConfig.clientRefreshRateX100 : StreamConfig.fps * 100);
+
+    receiveBatches = 0;
+    packetsReceived = 0;
+
+    RtpcWriteStreamStart();
 }
 
 // Clean up the video stream
 void destroyVideoStream(void) {
     destroyVideoDepacketizer();
     RtpfCleanupQueue(&rtpQueue);
+
+    // This must be last since the other components return buffers to the pool
+    PpDestroyPool(&packetPool);
+}
+
+// Take another reference on a received packet buffer. This may only be called
+// by a holder of an existing reference.
+void retainVideoPacket(PRTPFEC_QUEUE_ENTRY queueEntry) {
+    PltAtomicAddInt(&queueEntry->refCount, 1);
+}
+
+// Drop a reference on a received packet buffer. This may be called from any thread.
+void releaseVideoPacket(PRTPFEC_QUEUE_ENTRY queueEntry) {
+    if (PltAtomicAddInt(&queueEntry->refCount, -1) == 0) {
+        PpFreeBuffer(&packetPool, queueEntry->packet);
+    }
+}
+
+void LiGetVideoStreamStats(PVIDEO_STREAM_STATS stats) {
+    PACKET_POOL_STATS poolStats;
+
+    memset(stats, 0, sizeof(*stats));
+
+    getVideoDepacketizerStats(stats);
+
+    stats->receiveBatches = receiveBatches;
+    stats->packetsReceived = packetsReceived;
+    stats->fecFramesRecovered = rtpQueue.framesRecovered;
+    stats->fecFramesUnrecoverable = rtpQueue.framesUnrecoverable;
+    stats->fecFramesCompletedLate = rtpQueue.framesCompletedLate;
+
+    stats->reorderWindowUs = JeGetWindowUs(&jitterEstimator);
+    stats->jitterUs = JeGetJitterUs(&jitterEstimator);
+    stats->reorderDepth = JeGetReorderDepth(&jitterEstimator);
+
+    stats->pacedFrames = framePacer.framesPaced;
+    stats->pacingDroppedFrames = framePacer.framesDropped;
+    stats->pacingDecodeTimeUs = FpGetDecodeTimeUs(&framePacer);
+
+    PpGetPoolStats(&packetPool, &poolStats);
+    stats->packetPoolBuffers = poolStats.totalBuffers;
+    stats->packetPoolBuffersInUse = poolStats.buffersInUse;
+    stats->packetPoolPeakBuffersInUse = poolStats.peakBuffersInUse;
+    stats->packetPoolAllocationFailures = poolStats.allocationFailures;
+}
+
+void LiGetPipelineStats(PPIPELINE_STATS stats) {
+    getVideoPipelineStats(stats);
+}
+
+void LiResetPipelineStats(void) {
+    resetVideoPipelineStats();
 }
 
 // UDP Ping proc
@@ -59,18 +155,44 @@ static void UdpPingThreadProc(void* context) {
     }
 }
 
+// Passes a received packet to the FEC queue. Returns 1 if the queue took ownership
+// of the buffer or 0 if the caller must reuse or free it.
+static int addReceivedPacket(char* buffer, int length, unsigned long long receiveTimeUs) {
+    PRTP_PACKET packet = (PRTP_PACKET)buffer;
+
+    // RTP sequence number must be in host order for the RTP queue
+    packet->sequenceNumber = htons(packet->sequenceNumber);
+
+    JeAddPacket(&jitterEstimator, packet->sequenceNumber, ntohl(packet->timestamp), receiveTimeUs);
+    RtpfSetReorderWindow(&rtpQueue, JeGetWindowUs(&jitterEstimator));
+
+    return RtpfAddPacket(&rtpQueue, packet, length,
+                         (PRTPFEC_QUEUE_ENTRY)&buffer[StreamConfig.packetSize + MAX_RTP_HEADER_SIZE]) != RTPF_RET_REJECTED;
+}
+
+// Hands the packets of completed frames to the depacketizer
+static void processQueuedPackets(void) {
+    PRTPFEC_QUEUE_ENTRY queueEntry;
+
+    while ((queueEntry = RtpfGetQueuedPacket(&rtpQueue)) != NULL) {
+        // The depacketizer takes its own references if it keeps the packet
+        queueRtpPacket(queueEntry);
+        releaseVideoPacket(queueEntry);
+    }
+}
+
 // Receive thread proc
 static void ReceiveThreadProc(void* context) {
     int err;
-    int bufferSize, receiveSize;
-    char* buffer;
-    int queueStatus;
+    int receiveSize;
+    char* buffers[RTP_RECV_BATCH_SIZE];
+    int lengths[RTP_RECV_BATCH_SIZE];
+    int i;
     int useSelect;
-    PRTPFEC_QUEUE_ENTRY queueEntry;
+    unsigned long long receiveTimeUs;
 
     receiveSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
-    bufferSize = receiveSize + sizeof(RTPFEC_QUEUE_ENTRY);
-    buffer = NULL;
+    memset(buffers, 0, sizeof(buffers));
 
     if (setNonFatalRecvTimeoutMs(rtpSocket, UDP_RECV_POLL_TIMEOUT_MS) < 0) {
         // SO_RCVTIMEO failed, so use select() to wait
@@ -82,52 +204,141 @@ static void ReceiveThreadProc(void* context) {
     }
 
     while (!PltIsThreadInterrupted(&receiveThread)) {
-        PRTP_PACKET packet;
-
-        if (buffer == NULL) {
-            buffer = (char*)malloc(bufferSize);
-            if (buffer == NULL) {
-                Limelog("Video Receive: malloc() failed\n");
-                ListenerCallbacks.connectionTerminated(-1);
-                return;
+        // Replace the buffers that the FEC queue took from the last batch
+        for (i = 0; i < RTP_RECV_BATCH_SIZE; i++) {
+            if (buffers[i] == NULL) {
+                buffers[i] = (char*)PpAllocateBuffer(&packetPool);
+                if (buffers[i] == NULL) {
+                    Limelog("Video Receive: PpAllocateBuffer() failed\n");
+                    ListenerCallbacks.connectionTerminated(-1);
+                    goto Exit;
+                }
             }
         }
 
-        err = recvUdpSocket(rtpSocket, buffer, receiveSize, useSelect);
+        err = recvUdpSocketBatch(rtpSocket, buffers, lengths, RTP_RECV_BATCH_SIZE, receiveSize, useSelect);
         if (err < 0) {
-            Limelog("Video Receive: recvUdpSocket() failed: %d\n", (int)LastSocketError());
+            Limelog("Video Receive: recvUdpSocketBatch() failed: %d\n", (int)LastSocketError());
             ListenerCallbacks.connectionTerminated(LastSocketError());
             break;
         }
         else if  (err == 0) {
-            // Receive timed out; try again
+            // Receive timed out. Release any packets that were held
+            // waiting for a frame that will never complete.
+            if (RtpfServiceQueue(&rtpQueue) == RTPF_RET_QUEUED_PACKETS_READY) {
+                processQueuedPackets();
+            }
             continue;
         }
 
-        // RTP sequence number must be in host order for the RTP queue
-        packet = (PRTP_PACKET)&buffer[0];
-        packet->sequenceNumber = htons(packet->sequenceNumber);
-
-        queueStatus = RtpfAddPacket(&rtpQueue, packet, err, (PRTPFEC_QUEUE_ENTRY)&buffer[receiveSize]);
-        if (queueStatus == RTPF_RET_QUEUED_PACKETS_READY) {
-            // The packet queue now has packets ready
-            buffer = NULL;
-            while ((queueEntry = RtpfGetQueuedPacket(&rtpQueue)) != NULL) {
-                queueRtpPacket(queueEntry);
-                free(queueEntry->packet);
+        receiveBatches++;
+        packetsReceived += err;
+
+        receiveTimeUs = PltGetMicros();
+
+        if (RtpcIsCapturing()) {
+            for (i = 0; i < err; i++) {
+                RtpcWriteVideoPacket(buffers[i], lengths[i], receiveTimeUs);
             }
         }
-        else if (queueStatus == RTPF_RET_QUEUED_NOTHING_READY) {
-            // The queue owns the buffer
-            buffer = NULL;
+
+        // Feed the whole batch to the FEC queue before draining it
+        for (i = 0; i < err; i++) {
+            if (addReceivedPacket(buffers[i], lengths[i], receiveTimeUs)) {
+                // The queue owns the buffer now
+                buffers[i] = NULL;
+            }
         }
+
+        processQueuedPackets();
+    }
+
+Exit:
+    for (i = 0; i < RTP_RECV_BATCH_SIZE; i++) {
+        if (buffers[i] != NULL) {
+            PpFreeBuffer(&packetPool, buffers[i]);
+        }
+    }
+}
+
+void LiReportDisplayVsync(unsigned long long vsyncTimeUs) {
+    if (framePacing) {
+        FpReportVsync(&framePacer, vsyncTimeUs);
     }
+}
+
+// Submits and frees a decode unit taken from the queue
+static void submitDecodeUnitFromQueue(PQUEUED_DECODE_UNIT qdu) {
+    unsigned long long startTimeUs;
+    int ret;
 
-    if (buffer != NULL) {
-        free(buffer);
+    startTimeUs = PltGetMicros();
+    ret = submitQueuedDecodeUnit(qdu);
+    if (framePacing) {
+        FpAddDecodeTime(&framePacer, PltGetMicros() - startTimeUs);
+    }
+
+    freeQueuedDecodeUnit(qdu);
+
+    if (ret == DR_NEED_IDR) {
+        Limelog("Requesting IDR frame on behalf of DR\n");
+        requestDecoderRefresh();
     }
 }
 
+// Holds a frame until the last moment it can be decoded in time for the next
+// display refresh and then returns the newest frame queued by then. Older
+// frames are discarded if a newer IDR frame supersedes them and are
+// submitted otherwise. Dropping P-frames with reference frame invalidation
+// would need the frame that recovers from it, which the host doesn't mark.
+static PQUEUED_DECODE_UNIT paceDecodeUnit(PQUEUED_DECODE_UNIT qdu) {
+    PQUEUED_DECODE_UNIT newestQdu, nextQdu, idrQdu;
+    unsigned long long nowUs, submitTimeUs;
+
+    nowUs = PltGetMicros();
+    submitTimeUs = FpGetSubmitTimeUs(&framePacer, nowUs);
+    if (submitTimeUs > nowUs) {
+        PltSleepUs((int)(submitTimeUs - nowUs));
+    }
+
+    // Chain everything queued by now from oldest to newest. The queue entries
+    // are free for this once the frames have been dequeued.
+    idrQdu = qdu->decodeUnit.frameType == FRAME_TYPE_IDR ? qdu : NULL;
+    qdu->entry.flink = NULL;
+    qdu->entry.data = qdu;
+    newestQdu = qdu;
+    while (pollNextQueuedDecodeUnit(&nextQdu)) {
+        if (nextQdu->decodeUnit.frameType == FRAME_TYPE_IDR) {
+            idrQdu = nextQdu;
+        }
+
+        nextQdu->entry.flink = NULL;
+        nextQdu->entry.data = nextQdu;
+        newestQdu->entry.flink = &nextQdu->entry;
+        newestQdu = nextQdu;
+    }
+
+    // Nothing after an IDR frame references the frames before it
+    if (idrQdu != NULL) {
+        while (qdu != idrQdu) {
+            nextQdu = (PQUEUED_DECODE_UNIT)qdu->entry.flink->data;
+            freeQueuedDecodeUnit(qdu);
+            framePacer.framesDropped++;
+            qdu = nextQdu;
+        }
+    }
+
+    // The newest frame references the rest, so they must all be decoded
+    while (qdu != newestQdu) {
+        nextQdu = (PQUEUED_DECODE_UNIT)qdu->entry.flink->data;
+        submitDecodeUnitFromQueue(qdu);
+        qdu = nextQdu;
+    }
+
+    framePacer.framesPaced++;
+    return newestQdu;
+}
+
 // Decoder thread proc
 static void DecoderThreadProc(void* context) {
     PQUEUED_DECODE_UNIT qdu;
@@ -136,16 +347,82 @@ static void DecoderThreadProc(void* context) {
             return;
         }
 
-        int ret = VideoCallbacks.submitDecodeUnit(&qdu->decodeUnit);
+        if (framePacing) {
+            qdu = paceDecodeUnit(qdu);
+        }
+
+        submitDecodeUnitFromQueue(qdu);
+    }
+}
 
-        freeQueuedDecodeUnit(qdu);
+#ifdef LC_RTP_REPLAY
+// The replay hooks are only built for the host tests, which replay RTP
+// captures through the receive path without a connection
 
-        if (ret == DR_NEED_IDR) {
-            Limelog("Requesting IDR frame on behalf of DR\n");
-            requestDecoderRefresh();
+// Feeds a packet through the receive path as if it had just been read from the
+// socket. Returns 0 on success or -1 if no packet buffer was available.
+int replayVideoPacket(char* data, int length) {
+    char* buffer;
+
+    if (length > StreamConfig.packetSize + MAX_RTP_HEADER_SIZE) {
+        // Oversized datagrams would have been truncated by recv()
+        length = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
+    }
+
+    buffer = (char*)PpAllocateBuffer(&packetPool);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    memcpy(buffer, data, length);
+    if (!addReceivedPacket(buffer, length, PltGetMicros())) {
+        PpFreeBuffer(&packetPool, buffer);
+    }
+
+    processQueuedPackets();
+    return 0;
+}
+
+// Start the renderer and decoder thread for packets supplied by replayVideoPacket()
+int startVideoReplay(void* rendererContext, int drFlags) {
+    int err;
+
+    LC_ASSERT(NegotiatedVideoFormat != 0);
+    err = VideoCallbacks.setup(NegotiatedVideoFormat, StreamConfig.width,
+        StreamConfig.height, StreamConfig.fps, rendererContext, drFlags);
+    if (err != 0) {
+        return err;
+    }
+
+    VideoCallbacks.start();
+
+    if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+        err = PltCreateThread("VideoDec", THREAD_ROLE_VIDEO_DECODE, DecoderThreadProc, NULL, &decoderThread);
+        if (err != 0) {
+            VideoCallbacks.stop();
+            VideoCallbacks.cleanup();
+            return err;
         }
     }
+
+    return 0;
+}
+
+// Stop a video stream started by startVideoReplay()
+void stopVideoReplay(void) {
+    VideoCallbacks.stop();
+
+    stopVideoDepacketizer();
+
+    if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
+        PltInterruptThread(&decoderThread);
+        PltJoinThread(&decoderThread);
+        PltCloseThread(&decoderThread);
+    }
+
+    VideoCallbacks.cleanup();
 }
+#endif
 
 // Read the first frame of the video stream
 int readFirstFrame(void) {
@@ -222,7 +499,7 @@ int startVideoStream(void* rendererContext, int drFlags) {
 
     VideoCallbacks.start();
 
-    err = PltCreateThread(ReceiveThreadProc, NULL, &receiveThread);
+    err = PltCreateThread("VideoRecv", THREAD_ROLE_VIDEO_RECEIVE, ReceiveThreadProc, NULL, &receiveThread);
     if (err != 0) {
         VideoCallbacks.stop();
         closeSocket(rtpSocket);
@@ -231,7 +508,7 @@ int startVideoStream(void* rendererContext, int drFlags) {
     }
 
     if ((VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) == 0) {
-        err = PltCreateThread(DecoderThreadProc, NULL, &decoderThread);
+        err = PltCreateThread("VideoDec", THREAD_ROLE_VIDEO_DECODE, DecoderThreadProc, NULL, &decoderThread);
         if (err != 0) {
             VideoCallbacks.stop();
             PltInterruptThread(&receiveThread);
@@ -270,7 +547,7 @@ int startVideoStream(void* rendererContext, int drFlags) {
 
     // Start pinging before reading the first frame so GFE knows where
     // to send UDP data
-    err = PltCreateThread(UdpPingThreadProc, NULL, &udpPingThread);
+    err = PltCreateThread("VideoPing", THREAD_ROLE_DEFAULT, UdpPingThreadProc, NULL, &udpPingThread);
     if (err != 0) {
         VideoCallbacks.stop();
         stopVideoDepacketizer();
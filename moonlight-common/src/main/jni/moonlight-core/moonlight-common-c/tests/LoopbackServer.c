@@ -0,0 +1,1290 @@
+#include "LoopbackServer.h"
+
+#include "Limelight-internal.h"
+#include "PlatformAtomics.h"
+#include "PlatformSockets.h"
+#include "PlatformThreads.h"
+#include "Rtsp.h"
+#include "AnnexB.h"
+#include "rs.h"
+
+#include <enet/enet.h>
+#include <pthread.h>
+
+// A minimal stand-in for the streaming server. It speaks the Gen 7 protocol
+// (RTSP over TCP, control over ENet) on the loopback address so complete
+// sessions can be benchmarked without a PC, network, or GPU.
+//
+// The server threads are plain pthreads rather than PltCreateThread() threads
+// because they outlive each connection, and the library asserts that all of
+// its own threads have exited when a connection stops.
+
+#define HTTPS_PORT 47984
+#define RTSP_PORT 48010
+#define CONTROL_PORT 47999
+#define VIDEO_PORT 47998
+#define AUDIO_PORT 48000
+
+#define RTSP_MAX_REQUEST_SIZE 32768
+#define RTSP_TIMEOUT_SEC 10
+
+#define POLL_TIMEOUT_MS 100
+
+#define SESSION_ID "1234567890"
+
+#define DEFAULT_PACKET_SIZE 1024
+#define DEFAULT_FPS 60
+#define DEFAULT_IDR_FRAME_SIZE (64 * 1024)
+#define DEFAULT_FRAME_SIZE (16 * 1024)
+#define DEFAULT_FEC_PERCENTAGE 20
+
+// Synthetic frames are split into at most this many slices. Each slice
+// carries its index in the first byte of its body.
+#define MAX_SYNTHETIC_SLICES 16
+
+// The depacketizer skips this header at the start of each frame
+#define FRAME_HEADER_SIZE 8
+
+// Control stream packet types sent by Gen 7 clients
+#define CTL_TYPE_INVALIDATE_REF_FRAMES 0x0301
+#define CTL_TYPE_INPUT_DATA 0x0206
+
+// Audio is sent as 5 ms Opus frames. The payload is a CELT-only fullband
+// stereo TOC byte with an empty frame, which decoders treat as a lost frame.
+#define AUDIO_PACKET_DURATION_MS 5
+#define AUDIO_PAYLOAD_TYPE 97
+static const unsigned char emptyOpusFrame[] = { 0xEC };
+
+typedef struct _ES_FRAME {
+    unsigned char* data;
+    int length;
+    int idr;
+} ES_FRAME, *PES_FRAME;
+
+static LOOPBACK_SERVER_CONFIGURATION serverConfig;
+static LOOPBACK_SERVER_STATS serverStats;
+static PLT_MUTEX serverMutex;
+
+static SOCKET httpsSock = INVALID_SOCKET;
+static SOCKET rtspSock = INVALID_SOCKET;
+static SOCKET videoSock = INVALID_SOCKET;
+static SOCKET audioSock = INVALID_SOCKET;
+static ENetHost* controlHost;
+
+static pthread_t rtspThread;
+static pthread_t controlThread;
+static pthread_t videoThread;
+static pthread_t audioThread;
+static int serverStopping;
+
+// Loaded elementary stream frames, if one was supplied
+static unsigned char* esData;
+static PES_FRAME esFrames;
+static int esFrameCount;
+
+// Stream parameters announced by the client. These are protected by serverMutex.
+static int streamPacketSize;
+static int streamFps;
+static int streamSlicesPerFrame;
+
+// Incremented for each PLAY request. The stream threads reset when it changes.
+static int sessionNumber;
+static int streaming;
+static int idrRequested;
+static uint64_t idrRequestTime;
+static uint64_t handshakeStartTime;
+
+static int isServerStopping(void) {
+    return PltAtomicLoadInt(&serverStopping);
+}
+
+static void addServerCpuTime(unsigned long long* lastCpuTimeUs) {
+    unsigned long long now = PltGetThreadCpuTimeUs();
+
+    PltLockMutex(&serverMutex);
+    serverStats.serverCpuTimeUs += now - *lastCpuTimeUs;
+    PltUnlockMutex(&serverMutex);
+
+    *lastCpuTimeUs = now;
+}
+
+static SOCKET createServerSocket(int type, unsigned short port) {
+    struct sockaddr_in addr;
+    SOCKET s;
+    int val;
+    int err;
+
+    s = socket(AF_INET, type, type == SOCK_STREAM ? IPPROTO_TCP : IPPROTO_UDP);
+    if (s == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+
+    val = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char*)&val, sizeof(val));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+            (type == SOCK_STREAM && listen(s, 4) == SOCKET_ERROR)) {
+        err = LastSocketError();
+        Limelog("Loopback server: bind() to port %d failed: %d\n", port, err);
+        closeSocket(s);
+        SetLastSocketError(err);
+        return INVALID_SOCKET;
+    }
+
+    return s;
+}
+
+// Waits up to POLL_TIMEOUT_MS for the socket to become readable. Returns 1 if it is readable.
+static int waitForSocket(SOCKET s, int timeoutMs) {
+    struct timeval tv;
+    fd_set set;
+
+    FD_ZERO(&set);
+    FD_SET(s, &set);
+    tv.tv_sec = timeoutMs / 1000;
+    tv.tv_usec = (timeoutMs % 1000) * 1000;
+
+    return select((int)s + 1, &set, NULL, NULL, &tv) > 0;
+}
+
+// Returns the integer value of an SDP attribute or the default value if it is missing
+static int getSdpAttributeInt(const char* sdp, const char* name, int defaultValue) {
+    const char* attr = strstr(sdp, name);
+
+    if (attr == NULL || attr[strlen(name)] != ':') {
+        return defaultValue;
+    }
+
+    return atoi(&attr[strlen(name) + 1]);
+}
+
+static void sendRtspResponse(SOCKET s, int sequenceNumber, const char* extraHeaders, const char* payload) {
+    char response[1024];
+    int length;
+
+    length = snprintf(response, sizeof(response),
+                      "RTSP/1.0 200 OK\r\n"
+                      "CSeq: %d\r\n"
+                      "%s"
+                      "\r\n"
+                      "%s",
+                      sequenceNumber, extraHeaders, payload);
+    if (length > 0 && length < (int)sizeof(response)) {
+        send(s, response, length, 0);
+    }
+}
+
+static void handleRtspRequest(PRTSP_MESSAGE request, SOCKET s) {
+    char* command = request->message.request.command;
+    char* target = request->message.request.target;
+
+    if (strcmp(command, "OPTIONS") == 0) {
+        // This starts the handshake
+        handshakeStartTime = PltGetMillis();
+        sendRtspResponse(s, request->sequenceNumber, "", "");
+    }
+    else if (strcmp(command, "DESCRIBE") == 0) {
+        // The client only looks for the start of a base64 encoded VPS to detect HEVC support
+        sendRtspResponse(s, request->sequenceNumber, "",
+                         serverConfig.hevc ?
+                         "a=fmtp:96 sprop-parameter-sets=AAAAAUAB\r\n" :
+                         "a=fmtp:96 sprop-parameter-sets=AAAAAWdC\r\n");
+    }
+    else if (strcmp(command, "SETUP") == 0) {
+        sendRtspResponse(s, request->sequenceNumber, "Session: " SESSION_ID "\r\n", "");
+    }
+    else if (strcmp(command, "ANNOUNCE") == 0) {
+        if (request->payload != NULL) {
+            PltLockMutex(&serverMutex);
+            streamPacketSize = getSdpAttributeInt(request->payload, "x-nv-video[0].packetSize", DEFAULT_PACKET_SIZE);
+            streamFps = getSdpAttributeInt(request->payload, "x-nv-video[0].maxFPS", DEFAULT_FPS);
+            if (streamFps <= 0) {
+                streamFps = DEFAULT_FPS;
+            }
+            streamSlicesPerFrame = getSdpAttributeInt(request->payload, "x-nv-video[0].videoEncoderSlicesPerFrame", 1);
+            if (streamSlicesPerFrame <= 0) {
+                streamSlicesPerFrame = 1;
+            }
+            else if (streamSlicesPerFrame > MAX_SYNTHETIC_SLICES) {
+                streamSlicesPerFrame = MAX_SYNTHETIC_SLICES;
+            }
+            PltUnlockMutex(&serverMutex);
+        }
+        sendRtspResponse(s, request->sequenceNumber, "", "");
+    }
+    else if (strcmp(command, "PLAY") == 0) {
+        PltLockMutex(&serverMutex);
+        if (strstr(target, "audio") != NULL) {
+            // This is the last request of the handshake
+            serverStats.handshakeMs = (unsigned int)(PltGetMillis() - handshakeStartTime);
+        }
+        else {
+            sessionNumber++;
+            streaming = 1;
+            idrRequested = 0;
+        }
+        PltUnlockMutex(&serverMutex);
+        sendRtspResponse(s, request->sequenceNumber, "", "");
+    }
+    else {
+        const char notFound[] = "RTSP/1.0 404 Not Found\r\n\r\n";
+        send(s, notFound, sizeof(notFound) - 1, 0);
+    }
+}
+
+// Reads a request from a new RTSP connection, responds, and closes the connection
+static void serveRtspConnection(SOCKET s) {
+    RTSP_MESSAGE request;
+    char* buffer;
+    char* headerEnd;
+    char* contentLength;
+    int offset;
+    int expectedLength;
+    SOCK_RET err;
+
+    buffer = malloc(RTSP_MAX_REQUEST_SIZE + 1);
+    if (buffer == NULL) {
+        closeSocket(s);
+        return;
+    }
+
+    setRecvTimeout(s, RTSP_TIMEOUT_SEC);
+
+    // Read until we have the headers and any payload they describe
+    offset = 0;
+    expectedLength = -1;
+    while (offset < RTSP_MAX_REQUEST_SIZE) {
+        err = recv(s, &buffer[offset], RTSP_MAX_REQUEST_SIZE - offset, 0);
+        if (err <= 0) {
+            break;
+        }
+        offset += (int)err;
+        buffer[offset] = 0;
+
+        if (expectedLength < 0) {
+            headerEnd = strstr(buffer, "\r\n\r\n");
+            if (headerEnd != NULL) {
+                expectedLength = (int)(headerEnd - buffer) + 4;
+
+                contentLength = strstr(buffer, "Content-length:");
+                if (contentLength != NULL && contentLength < headerEnd) {
+                    expectedLength += atoi(&contentLength[strlen("Content-length:")]);
+                }
+            }
+        }
+
+        if (expectedLength >= 0 && offset >= expectedLength) {
+            break;
+        }
+    }
+
+    if (expectedLength >= 0 && offset >= expectedLength &&
+            parseRtspMessage(&request, buffer, offset) == RTSP_ERROR_SUCCESS) {
+        if (request.type == TYPE_REQUEST) {
+            PltLockMutex(&serverMutex);
+            serverStats.rtspRequests++;
+            PltUnlockMutex(&serverMutex);
+
+            handleRtspRequest(&request, s);
+        }
+        freeMessage(&request);
+    }
+    else {
+        Limelog("Loopback server: malformed RTSP request\n");
+    }
+
+    free(buffer);
+
+    // The client reads the response until we close the connection
+    shutdownTcpSocket(s);
+    closeSocket(s);
+}
+
+static void* RtspThreadProc(void* context) {
+    unsigned long long lastCpuTimeUs = PltGetThreadCpuTimeUs();
+    struct timeval tv;
+    fd_set set;
+    SOCKET maxSock;
+    SOCKET s;
+
+    maxSock = rtspSock > httpsSock ? rtspSock : httpsSock;
+
+    while (!isServerStopping()) {
+        FD_ZERO(&set);
+        FD_SET(rtspSock, &set);
+        FD_SET(httpsSock, &set);
+        tv.tv_sec = 0;
+        tv.tv_usec = POLL_TIMEOUT_MS * 1000;
+        if (select((int)maxSock + 1, &set, NULL, NULL, &tv) <= 0) {
+            continue;
+        }
+
+        if (FD_ISSET(httpsSock, &set)) {
+            // This port is only used to test that the server is reachable
+            s = accept(httpsSock, NULL, NULL);
+            if (s != INVALID_SOCKET) {
+                closeSocket(s);
+            }
+        }
+
+        if (FD_ISSET(rtspSock, &set)) {
+            s = accept(rtspSock, NULL, NULL);
+            if (s != INVALID_SOCKET) {
+                serveRtspConnection(s);
+            }
+        }
+
+        addServerCpuTime(&lastCpuTimeUs);
+    }
+
+    return NULL;
+}
+
+static void* ControlThreadProc(void* context) {
+    unsigned long long lastCpuTimeUs = PltGetThreadCpuTimeUs();
+    ENetEvent event;
+    unsigned short type;
+
+    while (!isServerStopping()) {
+        if (enet_host_service(controlHost, &event, POLL_TIMEOUT_MS) <= 0) {
+            continue;
+        }
+
+        switch (event.type) {
+        case ENET_EVENT_TYPE_RECEIVE:
+            if (event.packet->dataLength >= sizeof(type)) {
+                memcpy(&type, event.packet->data, sizeof(type));
+
+                PltLockMutex(&serverMutex);
+                serverStats.controlPacketsReceived++;
+                serverStats.controlDatagramsReceived = controlHost->totalReceivedPackets;
+                if (type == CTL_TYPE_INPUT_DATA) {
+                    serverStats.inputPacketsReceived++;
+                }
+                else if (type == CTL_TYPE_INVALIDATE_REF_FRAMES && !idrRequested) {
+                    // Reference frame invalidation is always answered with an IDR frame
+                    idrRequested = 1;
+                    idrRequestTime = PltGetMillis();
+                    serverStats.idrRequests++;
+                }
+                PltUnlockMutex(&serverMutex);
+            }
+            enet_packet_destroy(event.packet);
+            break;
+
+        case ENET_EVENT_TYPE_DISCONNECT:
+            // The client has stopped streaming
+            PltLockMutex(&serverMutex);
+            streaming = 0;
+            PltUnlockMutex(&serverMutex);
+            break;
+
+        default:
+            break;
+        }
+
+        addServerCpuTime(&lastCpuTimeUs);
+    }
+
+    return NULL;
+}
+
+// Waits for the client to ping the given socket and records the address it came from
+static int receivePing(SOCKET s, int timeoutMs, struct sockaddr_storage* clientAddr, SOCKADDR_LEN* clientAddrLen) {
+    char buffer[64];
+    SOCK_RET err;
+
+    if (!waitForSocket(s, timeoutMs)) {
+        return 0;
+    }
+
+    *clientAddrLen = sizeof(*clientAddr);
+    err = recvfrom(s, buffer, sizeof(buffer), 0, (struct sockaddr*)clientAddr, clientAddrLen);
+    return err == 4 && memcmp(buffer, "PING", 4) == 0;
+}
+
+// Checks whether the stream thread should stop sending and wait for a new session
+static int isSessionActive(int* currentSession) {
+    int active;
+
+    PltLockMutex(&serverMutex);
+    active = streaming && sessionNumber == *currentSession;
+    *currentSession = sessionNumber;
+    PltUnlockMutex(&serverMutex);
+
+    return active;
+}
+
+// Synthetic NAL unit bodies follow a pattern that depends on the frame index
+// and never contains a zero byte, so it can't form a start code
+static unsigned char getPatternByte(int frameIndex, int offset) {
+    return (unsigned char)(1 + ((unsigned int)frameIndex * 7 + offset) % 255);
+}
+
+// Slices have an index of 0 or more, and parameter sets pass -1
+static void appendNalUnit(unsigned char* buffer, int* length, const unsigned char* header, int headerLength,
+                          int frameIndex, int sliceIndex, int bodyLength) {
+    int i;
+
+    buffer[(*length)++] = 0;
+    buffer[(*length)++] = 0;
+    buffer[(*length)++] = 0;
+    buffer[(*length)++] = 1;
+    memcpy(&buffer[*length], header, headerLength);
+    *length += headerLength;
+
+    if (sliceIndex >= 0) {
+        buffer[(*length)++] = (unsigned char)(sliceIndex + 1);
+    }
+
+    for (i = 0; i < bodyLength; i++) {
+        buffer[(*length)++] = getPatternByte(frameIndex, i);
+    }
+}
+
+// Builds a synthetic frame with parameter sets ahead of IDR slices. The
+// parameter sets are the same in every IDR frame.
+static int buildSyntheticFrame(unsigned char* buffer, int idr, int frameIndex, int slices) {
+    static const unsigned char avcSps[] = { 0x67 }, avcPps[] = { 0x68 };
+    static const unsigned char avcIdr[] = { 0x65 }, avcSlice[] = { 0x41 };
+    static const unsigned char hevcVps[] = { 0x40, 0x01 }, hevcSps[] = { 0x42, 0x01 }, hevcPps[] = { 0x44, 0x01 };
+    static const unsigned char hevcIdr[] = { 0x26, 0x01 }, hevcSlice[] = { 0x02, 0x01 };
+    const unsigned char* sliceHeader;
+    int headerLength, frameSize;
+    int length = 0;
+    int i;
+
+    if (serverConfig.hevc) {
+        if (idr) {
+            appendNalUnit(buffer, &length, hevcVps, sizeof(hevcVps), 0, -1, 16);
+            appendNalUnit(buffer, &length, hevcSps, sizeof(hevcSps), 0, -1, 32);
+            appendNalUnit(buffer, &length, hevcPps, sizeof(hevcPps), 0, -1, 8);
+        }
+        sliceHeader = idr ? hevcIdr : hevcSlice;
+        headerLength = 2;
+    }
+    else {
+        if (idr) {
+            appendNalUnit(buffer, &length, avcSps, sizeof(avcSps), 0, -1, 16);
+            appendNalUnit(buffer, &length, avcPps, sizeof(avcPps), 0, -1, 8);
+        }
+        sliceHeader = idr ? avcIdr : avcSlice;
+        headerLength = 1;
+    }
+
+    // The last slice takes what doesn't divide evenly
+    frameSize = idr ? serverConfig.idrFrameSize : serverConfig.frameSize;
+    for (i = 0; i < slices; i++) {
+        appendNalUnit(buffer, &length, sliceHeader, headerLength, frameIndex, i,
+                      frameSize / slices + (i == slices - 1 ? frameSize % slices : 0));
+    }
+
+    return length;
+}
+
+// Splits a frame into RTP packets, adds FEC parity packets, and sends them.
+// Packets are dropped and reordered as the configuration asks. Returns the
+// number of packets sent.
+static int sendVideoFrame(unsigned char* frame, int frameLength, int frameIndex, unsigned int timestamp, int packetSize,
+                          unsigned short* sequenceNumber, unsigned int* streamPacketIndex,
+                          struct sockaddr_storage* clientAddr, SOCKADDR_LEN clientAddrLen) {
+    int payloadSize = packetSize - sizeof(NV_VIDEO_PACKET);
+    int shardSize = packetSize + MAX_RTP_HEADER_SIZE;
+    int dataShards, parityShards, fecPercentage;
+    unsigned char** shards;
+    int* lengths;
+    int* order;
+    int i, offset, sent, keptShards;
+    unsigned int dropped, reordered;
+
+    // Each frame is a single FEC block, so large frames may not have room for parity
+    dataShards = (frameLength + payloadSize - 1) / payloadSize;
+    fecPercentage = serverConfig.fecPercentage;
+    parityShards = (dataShards * fecPercentage + 99) / 100;
+    if (dataShards + parityShards > DATA_SHARDS_MAX) {
+        fecPercentage = 0;
+        parityShards = 0;
+    }
+    if (dataShards > 0x3FF) {
+        Limelog("Loopback server: frame %d is too large to send\n", frameIndex);
+        return 0;
+    }
+
+    shards = calloc(dataShards + parityShards, sizeof(*shards));
+    lengths = malloc((dataShards + parityShards) * sizeof(*lengths));
+    order = malloc((dataShards + parityShards) * sizeof(*order));
+    if (shards == NULL || lengths == NULL || order == NULL) {
+        free(shards);
+        free(lengths);
+        free(order);
+        return 0;
+    }
+
+    sent = 0;
+    for (i = 0; i < dataShards + parityShards; i++) {
+        shards[i] = calloc(1, shardSize);
+        if (shards[i] == NULL) {
+            goto Exit;
+        }
+    }
+
+    for (i = 0, offset = 0; i < dataShards; i++, offset += payloadSize) {
+        PRTP_PACKET rtp = (PRTP_PACKET)shards[i];
+        PNV_VIDEO_PACKET nv = (PNV_VIDEO_PACKET)(shards[i] + FIXED_RTP_HEADER_SIZE);
+        int length = frameLength - offset < payloadSize ? frameLength - offset : payloadSize;
+
+        rtp->header = (char)0x80;
+        rtp->packetType = 0x60;
+        rtp->sequenceNumber = U16(*sequenceNumber + i);
+        nv->streamPacketIndex = (*streamPacketIndex + i) << 8;
+        nv->frameIndex = frameIndex;
+        nv->flags = FLAG_CONTAINS_PIC_DATA | (i == 0 ? FLAG_SOF : 0) | (i == dataShards - 1 ? FLAG_EOF : 0);
+        nv->fecInfo = (dataShards << 22) | (i << 12) | (fecPercentage << 4);
+        memcpy(&nv[1], &frame[offset], length);
+        lengths[i] = FIXED_RTP_HEADER_SIZE + sizeof(*nv) + length;
+    }
+
+    if (parityShards != 0) {
+        reed_solomon* rs = reed_solomon_new(dataShards, parityShards);
+        if (rs == NULL) {
+            goto Exit;
+        }
+        reed_solomon_encode(rs, shards, dataShards + parityShards, shardSize);
+        reed_solomon_release(rs);
+
+        // Parity packets carry their own headers over the encoded header bytes
+        for (i = dataShards; i < dataShards + parityShards; i++) {
+            PRTP_PACKET rtp = (PRTP_PACKET)shards[i];
+            PNV_VIDEO_PACKET nv = (PNV_VIDEO_PACKET)(shards[i] + FIXED_RTP_HEADER_SIZE);
+
+            rtp->header = (char)0x80;
+            rtp->packetType = 0x60;
+            rtp->sequenceNumber = U16(*sequenceNumber + i);
+            nv->frameIndex = frameIndex;
+            nv->fecInfo = (dataShards << 22) | (i << 12) | (fecPercentage << 4);
+            lengths[i] = FIXED_RTP_HEADER_SIZE + packetSize;
+        }
+    }
+
+    // A lost frame keeps the packets that come before its second half, so
+    // the client may already have used some of them when it finds out
+    keptShards = dataShards + parityShards;
+    if (serverConfig.frameLossInterval > 0 && frameIndex % serverConfig.frameLossInterval == 0) {
+        keptShards = dataShards / 2;
+    }
+
+    // Packets are dropped and swapped with the next one by their sequence number
+    reordered = 0;
+    for (i = 0; i < dataShards + parityShards; i++) {
+        order[i] = i;
+    }
+    for (i = 0; i + 1 < dataShards + parityShards; i++) {
+        if (serverConfig.reorderInterval > 0 && U16(*sequenceNumber + i) % serverConfig.reorderInterval == 0) {
+            order[i] = i + 1;
+            order[i + 1] = i;
+            reordered++;
+            i++;
+        }
+    }
+
+    dropped = 0;
+    for (i = 0; i < dataShards + parityShards; i++) {
+        int index = order[i];
+        PRTP_PACKET rtp = (PRTP_PACKET)shards[index];
+
+        if (index >= keptShards || (serverConfig.packetLossInterval > 0 &&
+                                    U16(*sequenceNumber + index) % serverConfig.packetLossInterval == 0)) {
+            dropped++;
+            continue;
+        }
+
+        rtp->sequenceNumber = htons(rtp->sequenceNumber);
+        rtp->timestamp = htonl(timestamp);
+        if (sendto(videoSock, (char*)shards[index], lengths[index], 0, (struct sockaddr*)clientAddr, clientAddrLen) == lengths[index]) {
+            sent++;
+        }
+    }
+
+    PltLockMutex(&serverMutex);
+    serverStats.videoFramesSent++;
+    serverStats.videoPacketsSent += sent;
+    serverStats.videoPacketsDropped += dropped;
+    serverStats.videoPacketsReordered += reordered;
+    for (i = 0; i < dataShards + parityShards; i++) {
+        serverStats.videoBytesSent += lengths[i];
+    }
+    PltUnlockMutex(&serverMutex);
+
+    *sequenceNumber = U16(*sequenceNumber + dataShards + parityShards);
+    *streamPacketIndex += dataShards;
+
+Exit:
+    for (i = 0; i < dataShards + parityShards; i++) {
+        free(shards[i]);
+    }
+    free(shards);
+    free(lengths);
+    free(order);
+    return sent;
+}
+
+static void* VideoThreadProc(void* context) {
+    unsigned long long lastCpuTimeUs = PltGetThreadCpuTimeUs();
+    struct sockaddr_storage clientAddr;
+    SOCKADDR_LEN clientAddrLen;
+    unsigned char* frameBuffer;
+    unsigned char* frame;
+    int frameLength;
+    int maxFrameLength;
+    int currentSession;
+    int haveClient;
+    int frameIndex;
+    int esFrameIndex;
+    int packetSize, fps, slices;
+    int idr;
+    unsigned short sequenceNumber;
+    unsigned int streamPacketIndex;
+    unsigned int timestamp;
+    uint64_t nextFrameTime, now, requestTime;
+
+    maxFrameLength = serverConfig.idrFrameSize > serverConfig.frameSize ?
+        serverConfig.idrFrameSize : serverConfig.frameSize;
+    for (frameIndex = 0; frameIndex < esFrameCount; frameIndex++) {
+        if (esFrames[frameIndex].length > maxFrameLength) {
+            maxFrameLength = esFrames[frameIndex].length;
+        }
+    }
+
+    // Room for the frame header, synthetic parameter sets, and slice headers
+    frameBuffer = malloc(FRAME_HEADER_SIZE + maxFrameLength + 128 + MAX_SYNTHETIC_SLICES * 8);
+    if (frameBuffer == NULL) {
+        Limelog("Loopback server: malloc() failed\n");
+        return NULL;
+    }
+
+    currentSession = 0;
+    haveClient = 0;
+    frameIndex = esFrameIndex = 0;
+    sequenceNumber = 0;
+    streamPacketIndex = 0;
+    nextFrameTime = 0;
+
+    while (!isServerStopping()) {
+        if (!isSessionActive(&currentSession)) {
+            // Start over when the next session begins
+            haveClient = 0;
+            PltSleepMs(10);
+            continue;
+        }
+
+        if (!haveClient) {
+            // The client pings us from the port it expects video on
+            if (receivePing(videoSock, POLL_TIMEOUT_MS, &clientAddr, &clientAddrLen)) {
+                haveClient = 1;
+                frameIndex = 1;
+                esFrameIndex = 0;
+                sequenceNumber = 0;
+                streamPacketIndex = 0;
+                nextFrameTime = PltGetMillis();
+            }
+            continue;
+        }
+
+        // Drain later pings without blocking
+        while (waitForSocket(videoSock, 0)) {
+            receivePing(videoSock, 0, &clientAddr, &clientAddrLen);
+        }
+
+        PltLockMutex(&serverMutex);
+        packetSize = streamPacketSize;
+        fps = streamFps;
+        slices = streamSlicesPerFrame;
+        idr = idrRequested || frameIndex == 1 ||
+            (serverConfig.idrInterval > 0 && frameIndex % serverConfig.idrInterval == 0);
+        requestTime = idrRequestTime;
+        PltUnlockMutex(&serverMutex);
+
+        now = PltGetMillis();
+        if (nextFrameTime > now) {
+            PltSleepMs((int)(nextFrameTime - now));
+        }
+
+        // Video RTP timestamps use a 90 kHz clock
+        timestamp = (unsigned int)(nextFrameTime * 90);
+        nextFrameTime += 1000 / fps;
+
+        // The depacketizer skips a zeroed frame header on the first packet
+        memset(frameBuffer, 0, FRAME_HEADER_SIZE);
+        if (esFrameCount != 0) {
+            if (idr) {
+                // Restart at the first frame which is always an IDR frame
+                esFrameIndex = 0;
+            }
+
+            frame = esFrames[esFrameIndex].data;
+            frameLength = esFrames[esFrameIndex].length;
+            esFrameIndex = (esFrameIndex + 1) % esFrameCount;
+            memcpy(&frameBuffer[FRAME_HEADER_SIZE], frame, frameLength);
+        }
+        else {
+            frameLength = buildSyntheticFrame(&frameBuffer[FRAME_HEADER_SIZE], idr, frameIndex, slices);
+        }
+
+        sendVideoFrame(frameBuffer, FRAME_HEADER_SIZE + frameLength, frameIndex, timestamp, packetSize,
+                       &sequenceNumber, &streamPacketIndex, &clientAddr, clientAddrLen);
+        frameIndex++;
+
+        if (idr) {
+            PltLockMutex(&serverMutex);
+            if (idrRequested) {
+                unsigned int responseMs = (unsigned int)(PltGetMillis() - requestTime);
+
+                idrRequested = 0;
+                serverStats.totalIdrResponseMs += responseMs;
+                if (responseMs > serverStats.maxIdrResponseMs) {
+                    serverStats.maxIdrResponseMs = responseMs;
+                }
+            }
+            PltUnlockMutex(&serverMutex);
+        }
+
+        addServerCpuTime(&lastCpuTimeUs);
+    }
+
+    free(frameBuffer);
+
+    return NULL;
+}
+
+static void* AudioThreadProc(void* context) {
+    unsigned long long lastCpuTimeUs = PltGetThreadCpuTimeUs();
+    struct sockaddr_storage clientAddr;
+    SOCKADDR_LEN clientAddrLen;
+    char packet[sizeof(RTP_PACKET) + sizeof(emptyOpusFrame)];
+    PRTP_PACKET rtp = (PRTP_PACKET)packet;
+    unsigned short sequenceNumber;
+    unsigned int timestamp;
+    int currentSession;
+    int haveClient;
+    uint64_t nextPacketTime, now;
+
+    currentSession = 0;
+    haveClient = 0;
+    sequenceNumber = 0;
+    timestamp = 0;
+    nextPacketTime = 0;
+
+    memset(packet, 0, sizeof(packet));
+    rtp->header = (char)0x80;
+    rtp->packetType = AUDIO_PAYLOAD_TYPE;
+    memcpy(&rtp[1], emptyOpusFrame, sizeof(emptyOpusFrame));
+
+    while (!isServerStopping()) {
+        if (!isSessionActive(&currentSession)) {
+            haveClient = 0;
+            PltSleepMs(10);
+            continue;
+        }
+
+        if (!haveClient) {
+            if (receivePing(audioSock, POLL_TIMEOUT_MS, &clientAddr, &clientAddrLen)) {
+                haveClient = 1;
+                sequenceNumber = 0;
+                timestamp = 0;
+                nextPacketTime = PltGetMillis();
+            }
+            continue;
+        }
+
+        while (waitForSocket(audioSock, 0)) {
+            receivePing(audioSock, 0, &clientAddr, &clientAddrLen);
+        }
+
+        now = PltGetMillis();
+        if (nextPacketTime > now) {
+            PltSleepMs((int)(nextPacketTime - now));
+        }
+        nextPacketTime += AUDIO_PACKET_DURATION_MS;
+
+        rtp->sequenceNumber = htons(sequenceNumber);
+        timestamp += AUDIO_PACKET_DURATION_MS;
+        rtp->timestamp = htonl(timestamp);
+        sequenceNumber++;
+
+        if (sendto(audioSock, packet, sizeof(packet), 0, (struct sockaddr*)&clientAddr, clientAddrLen) == sizeof(packet)) {
+            PltLockMutex(&serverMutex);
+            serverStats.audioPacketsSent++;
+            PltUnlockMutex(&serverMutex);
+        }
+
+        addServerCpuTime(&lastCpuTimeUs);
+    }
+
+    return NULL;
+}
+
+// Returns 1 if the NAL unit at the given offset (just past its start code) begins a new picture
+static int isFirstSliceOfPicture(const unsigned char* nal, int length) {
+    int type;
+
+    if (serverConfig.hevc) {
+        if (length < 3) {
+            return 0;
+        }
+
+        // VCL NAL units have types below 32 and the first bit of the slice
+        // header is first_slice_segment_in_pic_flag
+        type = (nal[0] >> 1) & 0x3F;
+        return type < 32 && (nal[2] & 0x80);
+    }
+    else {
+        if (length < 2) {
+            return 0;
+        }
+
+        // Slices have types 1 to 5 and first_mb_in_slice is 0 when the
+        // first bit of the slice header is set
+        type = nal[0] & 0x1F;
+        return type >= 1 && type <= 5 && (nal[1] & 0x80);
+    }
+}
+
+// Returns 1 if the NAL unit is a parameter set that precedes the slices of the next picture
+static int isParameterSetNal(const unsigned char* nal) {
+    int type;
+
+    if (serverConfig.hevc) {
+        type = (nal[0] >> 1) & 0x3F;
+        return type >= 32 && type <= 34;
+    }
+    else {
+        type = nal[0] & 0x1F;
+        return type == 7 || type == 8;
+    }
+}
+
+// Returns 1 for access unit delimiters and SEI messages. These also mark the start of
+// a new picture but are left out of frames because the depacketizer expects IDR
+// frames to begin with parameter sets.
+static int isDroppedNal(const unsigned char* nal) {
+    int type;
+
+    if (serverConfig.hevc) {
+        type = (nal[0] >> 1) & 0x3F;
+        return type == 35 || type == 39 || type == 40;
+    }
+    else {
+        type = nal[0] & 0x1F;
+        return type == 6 || type == 9;
+    }
+}
+
+static int isIdrSetupNal(const unsigned char* nal) {
+    if (serverConfig.hevc) {
+        return ((nal[0] >> 1) & 0x3F) == 32; // VPS
+    }
+    else {
+        return (nal[0] & 0x1F) == 7; // SPS
+    }
+}
+
+static int addElementaryStreamFrame(int* capacity, int start, int end, int idr) {
+    if (esFrameCount == *capacity) {
+        PES_FRAME frames;
+
+        *capacity = *capacity ? *capacity * 2 : 256;
+        frames = realloc(esFrames, *capacity * sizeof(*esFrames));
+        if (frames == NULL) {
+            return -1;
+        }
+        esFrames = frames;
+    }
+
+    esFrames[esFrameCount].data = &esData[start];
+    esFrames[esFrameCount].length = end - start;
+    esFrames[esFrameCount].idr = idr;
+    esFrameCount++;
+    return 0;
+}
+
+// Returns the offset of the next start code at or after offset or -1 if there
+// are no more NAL units. nalStart is set to the offset of the NAL header.
+static int findStartCode(const unsigned char* data, int offset, int length, int* nalStart) {
+    int start;
+
+    while (offset < length) {
+        start = offset + AnnexBFindSpecialSequence(&data[offset], length - offset);
+        if (start + 3 >= length) {
+            // There's no room for a NAL header after this
+            break;
+        }
+
+        if (data[start + 2] == 1) {
+            *nalStart = start + 3;
+            return start;
+        }
+        else if (data[start + 3] == 1 && start + 4 < length) {
+            *nalStart = start + 4;
+            return start;
+        }
+
+        // Skip zero padding
+        offset = start + 1;
+    }
+
+    return -1;
+}
+
+// Splits an Annex B elementary stream into frames at picture boundaries
+static int loadElementaryStream(const char* path) {
+    FILE* file;
+    long size;
+    int offset, nalStart;
+    int frameStart, frameHasSlice, frameIsIdr;
+    int capacity;
+
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        Limelog("Loopback server: unable to open %s\n", path);
+        return -1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    if (size <= 0 || size > INT32_MAX) {
+        fclose(file);
+        return -1;
+    }
+
+    esData = malloc(size);
+    if (esData == NULL || fread(esData, size, 1, file) != 1) {
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    capacity = 0;
+    esFrameCount = 0;
+    frameStart = -1;
+    frameHasSlice = 0;
+    frameIsIdr = 0;
+
+    offset = findStartCode(esData, 0, (int)size, &nalStart);
+    while (offset >= 0) {
+        const unsigned char* nal = &esData[nalStart];
+
+        // The current frame ends at the first non-slice NAL or first slice of the next picture
+        if (frameHasSlice && (isDroppedNal(nal) || isParameterSetNal(nal) ||
+                              isFirstSliceOfPicture(nal, (int)size - nalStart))) {
+            if (addElementaryStreamFrame(&capacity, frameStart, offset, frameIsIdr) != 0) {
+                return -1;
+            }
+
+            frameStart = -1;
+            frameHasSlice = 0;
+            frameIsIdr = 0;
+        }
+
+        if (!isDroppedNal(nal)) {
+            if (frameStart < 0) {
+                frameStart = offset;
+            }
+
+            if (isIdrSetupNal(nal)) {
+                frameIsIdr = 1;
+            }
+            else if (!isParameterSetNal(nal)) {
+                frameHasSlice = 1;
+            }
+        }
+
+        offset = findStartCode(esData, nalStart, (int)size, &nalStart);
+    }
+
+    // The last frame runs to the end of the file
+    if (frameHasSlice && addElementaryStreamFrame(&capacity, frameStart, (int)size, frameIsIdr) != 0) {
+        return -1;
+    }
+
+    if (esFrameCount == 0 || !esFrames[0].idr) {
+        Limelog("Loopback server: %s must begin with an IDR frame\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void freeElementaryStream(void) {
+    free(esFrames);
+    esFrames = NULL;
+    free(esData);
+    esData = NULL;
+    esFrameCount = 0;
+}
+
+static void closeServerSockets(void) {
+    if (httpsSock != INVALID_SOCKET) {
+        closeSocket(httpsSock);
+        httpsSock = INVALID_SOCKET;
+    }
+    if (rtspSock != INVALID_SOCKET) {
+        closeSocket(rtspSock);
+        rtspSock = INVALID_SOCKET;
+    }
+    if (videoSock != INVALID_SOCKET) {
+        closeSocket(videoSock);
+        videoSock = INVALID_SOCKET;
+    }
+    if (audioSock != INVALID_SOCKET) {
+        closeSocket(audioSock);
+        audioSock = INVALID_SOCKET;
+    }
+    if (controlHost != NULL) {
+        enet_host_destroy(controlHost);
+        controlHost = NULL;
+    }
+}
+
+int LiStartLoopbackServer(PLOOPBACK_SERVER_CONFIGURATION config) {
+    struct sockaddr_in addr;
+    ENetAddress address;
+    int err;
+
+    memset(&serverConfig, 0, sizeof(serverConfig));
+    if (config != NULL) {
+        memcpy(&serverConfig, config, sizeof(serverConfig));
+    }
+    if (serverConfig.idrFrameSize <= 0) {
+        serverConfig.idrFrameSize = DEFAULT_IDR_FRAME_SIZE;
+    }
+    if (serverConfig.frameSize <= 0) {
+        serverConfig.frameSize = DEFAULT_FRAME_SIZE;
+    }
+    if (serverConfig.fecPercentage < 0) {
+        serverConfig.fecPercentage = 0;
+    }
+    else if (serverConfig.fecPercentage == 0) {
+        serverConfig.fecPercentage = DEFAULT_FEC_PERCENTAGE;
+    }
+
+    memset(&serverStats, 0, sizeof(serverStats));
+    streamPacketSize = DEFAULT_PACKET_SIZE;
+    streamFps = DEFAULT_FPS;
+    streamSlicesPerFrame = 1;
+    sessionNumber = 0;
+    streaming = 0;
+    idrRequested = 0;
+
+    if (serverConfig.elementaryStreamPath != NULL &&
+            loadElementaryStream(serverConfig.elementaryStreamPath) != 0) {
+        freeElementaryStream();
+        return -1;
+    }
+
+    reed_solomon_init();
+
+    err = enet_initialize();
+    if (err != 0) {
+        freeElementaryStream();
+        return err;
+    }
+
+    httpsSock = createServerSocket(SOCK_STREAM, HTTPS_PORT);
+    rtspSock = createServerSocket(SOCK_STREAM, RTSP_PORT);
+    videoSock = createServerSocket(SOCK_DGRAM, VIDEO_PORT);
+    audioSock = createServerSocket(SOCK_DGRAM, AUDIO_PORT);
+    if (httpsSock == INVALID_SOCKET || rtspSock == INVALID_SOCKET ||
+            videoSock == INVALID_SOCKET || audioSock == INVALID_SOCKET) {
+        err = LastSocketFail();
+        goto Fail;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    enet_address_set_address(&address, (struct sockaddr*)&addr, sizeof(addr));
+    enet_address_set_port(&address, CONTROL_PORT);
+
+    // Only one client is served at a time
+    controlHost = enet_host_create(AF_INET, &address, 1, 1, 0, 0);
+    if (controlHost == NULL) {
+        Limelog("Loopback server: unable to create the control stream host\n");
+        err = -1;
+        goto Fail;
+    }
+
+    err = PltCreateMutex(&serverMutex);
+    if (err != 0) {
+        goto Fail;
+    }
+
+    serverStopping = 0;
+
+    err = pthread_create(&rtspThread, NULL, RtspThreadProc, NULL);
+    if (err != 0) {
+        goto FailMutex;
+    }
+
+    err = pthread_create(&controlThread, NULL, ControlThreadProc, NULL);
+    if (err != 0) {
+        goto FailRtsp;
+    }
+
+    err = pthread_create(&videoThread, NULL, VideoThreadProc, NULL);
+    if (err != 0) {
+        goto FailControl;
+    }
+
+    err = pthread_create(&audioThread, NULL, AudioThreadProc, NULL);
+    if (err != 0) {
+        goto FailVideo;
+    }
+
+    return 0;
+
+FailVideo:
+    PltAtomicStoreInt(&serverStopping, 1);
+    pthread_join(videoThread, NULL);
+FailControl:
+    PltAtomicStoreInt(&serverStopping, 1);
+    pthread_join(controlThread, NULL);
+FailRtsp:
+    PltAtomicStoreInt(&serverStopping, 1);
+    pthread_join(rtspThread, NULL);
+FailMutex:
+    PltDeleteMutex(&serverMutex);
+Fail:
+    closeServerSockets();
+    enet_deinitialize();
+    freeElementaryStream();
+    return err;
+}
+
+// Returns 1 if the NAL unit header is for a slice rather than a parameter set
+static int isSyntheticSlice(const unsigned char* header) {
+    if (serverConfig.hevc) {
+        return ((header[0] >> 1) & 0x3F) < 32;
+    }
+    else {
+        return (header[0] & 0x1F) == 1 || (header[0] & 0x1F) == 5;
+    }
+}
+
+int LiCheckLoopbackDecodeUnit(PDECODE_UNIT decodeUnit, int* firstSliceIndex) {
+    int headerLength = serverConfig.hevc ? 2 : 1;
+    unsigned char* data;
+    PLENTRY entry;
+    int length, offset, bodyStart, slices, sliceIndex;
+
+    data = malloc(decodeUnit->fullLength);
+    if (data == NULL) {
+        return -1;
+    }
+
+    length = 0;
+    for (entry = decodeUnit->bufferList; entry != NULL; entry = entry->next) {
+        if (length + entry->length > decodeUnit->fullLength) {
+            free(data);
+            return -1;
+        }
+        memcpy(&data[length], entry->data, entry->length);
+        length += entry->length;
+    }
+
+    slices = 0;
+    sliceIndex = -1;
+    offset = 0;
+    while (offset < length) {
+        int frameIndex, zeroes;
+
+        // A packet recovered with FEC is padded with zeroes to the full packet
+        // size. Annex B allows these as trailing zero bytes after the last NAL unit.
+        zeroes = 0;
+        while (offset + zeroes < length && data[offset + zeroes] == 0) {
+            zeroes++;
+        }
+        if (offset + zeroes == length) {
+            break;
+        }
+
+        // Each NAL unit starts with a 3 or 4 byte start code, and the pattern
+        // never contains the zero bytes that would begin the next one
+        if (length - offset >= 4 && data[offset] == 0 && data[offset + 1] == 0 &&
+                data[offset + 2] == 0 && data[offset + 3] == 1) {
+            offset += 4;
+        }
+        else if (length - offset >= 3 && data[offset] == 0 && data[offset + 1] == 0 && data[offset + 2] == 1) {
+            offset += 3;
+        }
+        else {
+            slices = -1;
+            break;
+        }
+
+        if (length - offset < headerLength) {
+            slices = -1;
+            break;
+        }
+
+        if (isSyntheticSlice(&data[offset])) {
+            frameIndex = decodeUnit->frameNumber;
+            offset += headerLength;
+
+            // Slices in the same decode unit must be consecutive
+            if (offset == length || (slices != 0 && data[offset] != sliceIndex + 2)) {
+                slices = -1;
+                break;
+            }
+            sliceIndex = data[offset++] - 1;
+            if (slices++ == 0 && firstSliceIndex != NULL) {
+                *firstSliceIndex = sliceIndex;
+            }
+        }
+        else {
+            frameIndex = 0;
+            offset += headerLength;
+        }
+
+        bodyStart = offset;
+        while (offset < length && data[offset] != 0) {
+            if (data[offset] != getPatternByte(frameIndex, offset - bodyStart)) {
+                break;
+            }
+            offset++;
+        }
+        if (offset < length && data[offset] != 0) {
+            slices = -1;
+            break;
+        }
+    }
+
+    free(data);
+    return length == decodeUnit->fullLength ? slices : -1;
+}
+
+void LiGetLoopbackServerStats(PLOOPBACK_SERVER_STATS stats) {
+    PltLockMutex(&serverMutex);
+    memcpy(stats, &serverStats, sizeof(*stats));
+    PltUnlockMutex(&serverMutex);
+}
+
+void LiStopLoopbackServer(void) {
+    PltAtomicStoreInt(&serverStopping, 1);
+
+    // Each thread checks for the stop at least every POLL_TIMEOUT_MS
+    pthread_join(rtspThread, NULL);
+    pthread_join(controlThread, NULL);
+    pthread_join(videoThread, NULL);
+    pthread_join(audioThread, NULL);
+
+    PltDeleteMutex(&serverMutex);
+
+    closeServerSockets();
+    enet_deinitialize();
+    freeElementaryStream();
+}
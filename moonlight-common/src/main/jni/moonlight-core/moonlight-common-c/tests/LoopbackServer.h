@@ -0,0 +1,97 @@
+#pragma once
+
+// A stand-in for the streaming server used by the host benchmarks. It is not
+// part of the library.
+
+#include "Limelight.h"
+
+typedef struct _LOOPBACK_SERVER_CONFIGURATION {
+    // Path to an Annex B H.264 or H.265 elementary stream to send. The stream must
+    // begin with an IDR frame and is looped. If this is NULL, synthetic frames are sent.
+    const char* elementaryStreamPath;
+
+    // Set if the elementary stream (or the synthetic stream) is H.265
+    int hevc;
+
+    // Sizes of synthetic IDR frames and P-frames in bytes or 0 for the defaults
+    int idrFrameSize;
+    int frameSize;
+
+    // Percentage of FEC parity packets added to each video frame. Use 0 for
+    // the default of 20% or a negative value to send no parity packets.
+    int fecPercentage;
+
+    // Every Nth video packet is dropped, or 0 to drop none. Loss at this
+    // rate is normally recovered with FEC.
+    int packetLossInterval;
+
+    // Every Nth video packet is sent after the packet that follows it in
+    // the same frame, or 0 to send packets in order
+    int reorderInterval;
+
+    // Every Nth frame loses its second half and all of its parity packets,
+    // so it can't be recovered, or 0 to lose no whole frames
+    int frameLossInterval;
+
+    // Every Nth frame is an IDR frame even if the client didn't ask for one,
+    // or 0 to only send IDR frames on request
+    int idrInterval;
+} LOOPBACK_SERVER_CONFIGURATION, *PLOOPBACK_SERVER_CONFIGURATION;
+
+typedef struct _LOOPBACK_SERVER_STATS {
+    // Number of RTSP requests served and the time from the first request
+    // of the last handshake to its final PLAY request
+    unsigned int rtspRequests;
+    unsigned int handshakeMs;
+
+    unsigned int videoFramesSent;
+    unsigned int videoPacketsSent;
+    unsigned long long videoBytesSent;
+
+    // Video packets dropped and reordered as the configuration asked
+    unsigned int videoPacketsDropped;
+    unsigned int videoPacketsReordered;
+
+    unsigned int audioPacketsSent;
+
+    // Control stream packets received, including input and loss stats
+    unsigned int controlPacketsReceived;
+    unsigned int inputPacketsReceived;
+
+    // UDP datagrams received on the control stream. ENet can carry several
+    // control packets in one datagram, and acknowledgements and pings are
+    // also counted.
+    unsigned int controlDatagramsReceived;
+
+    // Number of IDR frame requests and the time from receiving each
+    // request to sending the last packet of the IDR frame
+    unsigned int idrRequests;
+    unsigned long long totalIdrResponseMs;
+    unsigned int maxIdrResponseMs;
+
+    // CPU time consumed by the server's own threads. This can be subtracted
+    // from the process CPU time to find the cost of the client.
+    unsigned long long serverCpuTimeUs;
+} LOOPBACK_SERVER_STATS, *PLOOPBACK_SERVER_STATS;
+
+// This function starts a stand-in for the streaming server on the IPv4 loopback
+// address. It accepts connections from LiStartConnection() with an address of
+// 127.0.0.1 and an appversion of 7.1.431.0 and streams video and audio until
+// the control stream disconnects. The audio stream consists of empty Opus frames.
+// The configuration may be NULL to send synthetic H.264 frames. Returns 0 on
+// success or a socket error if the server ports could not be bound.
+int LiStartLoopbackServer(PLOOPBACK_SERVER_CONFIGURATION config);
+
+// This function populates statistics about the loopback server. It may be called from any thread.
+void LiGetLoopbackServerStats(PLOOPBACK_SERVER_STATS stats);
+
+// This function checks a decode unit received from the loopback server against the synthetic
+// frame the server sent. Every NAL unit must be intact and belong to the decode unit's frame.
+// Synthetic frames have as many slices as the client asked for, and firstSliceIndex receives
+// the index within its frame of the first slice in the decode unit if it isn't NULL. Returns
+// the number of slices in the decode unit or -1 if it doesn't match. It can't be used when
+// the server sends an elementary stream.
+int LiCheckLoopbackDecodeUnit(PDECODE_UNIT decodeUnit, int* firstSliceIndex);
+
+// This function stops the loopback server. Any connection to it must be stopped first.
+void LiStopLoopbackServer(void);
@@ -0,0 +1,89 @@
+#include "Limelight-internal.h"
+#include "PcmFileSink.h"
+
+// If the sink falls this far behind its schedule, it restarts the schedule
+// rather than reading a burst of periods to catch up
+#define PFS_MAX_LAG_US 1000000
+
+static void SinkThreadProc(void* context) {
+    PPCM_FILE_SINK sink = (PPCM_FILE_SINK)context;
+    uint64_t periodStartUs = PltGetMicros();
+    uint64_t periodsRead = 0;
+    uint64_t deadlineUs;
+    uint64_t nowUs;
+
+    while (!PltIsThreadInterrupted(&sink->thread)) {
+        PcmrReadFrames(sink->ring, sink->buffer, sink->periodFrames);
+        periodsRead++;
+
+        if (sink->file != NULL &&
+                fwrite(sink->buffer, sink->periodFrames * sink->ring->channelCount * sizeof(short), 1, sink->file) != 1) {
+            Limelog("PCM file sink write failed\n");
+            fclose(sink->file);
+            sink->file = NULL;
+        }
+
+        // Schedule against the start time so sleep overshoot doesn't
+        // accumulate and skew the sink's clock
+        deadlineUs = periodStartUs + periodsRead * sink->periodFrames * 1000000 / sink->sampleRate;
+        nowUs = PltGetMicros();
+        if (nowUs > deadlineUs + PFS_MAX_LAG_US) {
+            periodStartUs = nowUs;
+            periodsRead = 0;
+        }
+        else if (deadlineUs > nowUs) {
+            PltSleepMs((int)((deadlineUs - nowUs + 999) / 1000));
+        }
+    }
+}
+
+// Starts pulling periods of audio from the ring. A NULL path discards the
+// audio after it is read.
+int PfsStartSink(PPCM_FILE_SINK sink, PPCM_RING ring, const char* path,
+                 int sampleRate, int periodFrames) {
+    int err;
+
+    memset(sink, 0, sizeof(*sink));
+    sink->ring = ring;
+    sink->sampleRate = sampleRate;
+    sink->periodFrames = periodFrames;
+
+    sink->buffer = (short*)malloc((size_t)periodFrames * ring->channelCount * sizeof(short));
+    if (sink->buffer == NULL) {
+        return -1;
+    }
+
+    if (path != NULL) {
+        sink->file = fopen(path, "wb");
+        if (sink->file == NULL) {
+            Limelog("Unable to open PCM output file: %s\n", path);
+            free(sink->buffer);
+            return -1;
+        }
+    }
+
+    err = PltCreateThread("PcmSink", THREAD_ROLE_AUDIO_DECODE, SinkThreadProc, sink, &sink->thread);
+    if (err != 0) {
+        if (sink->file != NULL) {
+            fclose(sink->file);
+        }
+        free(sink->buffer);
+        return err;
+    }
+
+    return 0;
+}
+
+void PfsStopSink(PPCM_FILE_SINK sink) {
+    PltInterruptThread(&sink->thread);
+    PltJoinThread(&sink->thread);
+    PltCloseThread(&sink->thread);
+
+    if (sink->file != NULL) {
+        fclose(sink->file);
+        sink->file = NULL;
+    }
+
+    free(sink->buffer);
+    sink->buffer = NULL;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "PcmRing.h"
+#include "PlatformThreads.h"
+
+#include <stdio.h>
+
+// An audio output that pulls from a PCM ring on its own clock and writes
+// the raw samples to a file, or discards them when no file is given. It
+// stands in for a hardware audio backend on hosts without one. Passing a
+// sample rate slightly off the stream's rate simulates clock drift.
+typedef struct _PCM_FILE_SINK {
+    PPCM_RING ring;
+    FILE* file;
+    int sampleRate;
+    int periodFrames;
+    short* buffer;
+    PLT_THREAD thread;
+} PCM_FILE_SINK, *PPCM_FILE_SINK;
+
+int PfsStartSink(PPCM_FILE_SINK sink, PPCM_RING ring, const char* path,
+                 int sampleRate, int periodFrames);
+void PfsStopSink(PPCM_FILE_SINK sink);
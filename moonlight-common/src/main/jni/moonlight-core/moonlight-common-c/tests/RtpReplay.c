@@ -0,0 +1,382 @@
+#include "RtpReplay.h"
+
+#include "Limelight-internal.h"
+#include "PlatformAtomics.h"
+#include "ByteBuffer.h"
+
+#include <errno.h>
+
+// Maximum number of packets that can be held back for reordering at once
+#define REPLAY_MAX_HELD_PACKETS 64
+
+// How long to wait for the decoder thread to drain queued frames at the end
+#define REPLAY_DRAIN_TIMEOUT_MS 1000
+
+typedef struct _HELD_PACKET {
+    char* data;
+    int length;
+    unsigned int releaseAt;
+} HELD_PACKET;
+
+static DecoderRendererSubmitDecodeUnit originalSubmitDecodeUnit;
+static volatile int framesSubmitted;
+static unsigned long long totalFrameLatencyMs;
+static unsigned int maxFrameLatencyMs;
+
+static unsigned int randomState;
+
+// Deterministic so the same seed always drops and reorders the same packets
+static int nextRandomPercent(void) {
+    randomState = randomState * 1103515245 + 12345;
+    return (randomState >> 16) % 100;
+}
+
+// Measures the time from the first packet of a frame entering the FEC
+// queue until the renderer is done with the decode unit
+static int replaySubmitDecodeUnit(PDECODE_UNIT decodeUnit) {
+    unsigned long long latencyMs;
+    int ret;
+
+    ret = originalSubmitDecodeUnit(decodeUnit);
+
+    // Only count whole frames if slices are submitted individually
+    if (!(decodeUnit->flags & DU_FLAG_END_OF_FRAME)) {
+        return ret;
+    }
+
+    latencyMs = (PltGetMicros() - decodeUnit->receiveTimeUs) / 1000;
+    totalFrameLatencyMs += latencyMs;
+    if (latencyMs > maxFrameLatencyMs) {
+        maxFrameLatencyMs = (unsigned int)latencyMs;
+    }
+
+    PltAtomicAddInt(&framesSubmitted, 1);
+    return ret;
+}
+
+static void deliverPacket(char* data, int length, unsigned int* delivered) {
+    if (replayVideoPacket(data, length) < 0) {
+        Limelog("Replay: packet buffer allocation failed\n");
+    }
+
+    (*delivered)++;
+}
+
+// Delivers held packets whose turn has come, or all of them if flush is set
+static void releaseHeldPackets(HELD_PACKET* held, unsigned int* delivered, int flush) {
+    int i;
+
+    for (i = 0; i < REPLAY_MAX_HELD_PACKETS; i++) {
+        if (held[i].data != NULL && (flush || held[i].releaseAt <= *delivered)) {
+            deliverPacket(held[i].data, held[i].length, delivered);
+            free(held[i].data);
+            held[i].data = NULL;
+        }
+    }
+}
+
+// Holds a copy of the packet back for later delivery. Returns 0 if there is no room.
+static int holdPacket(HELD_PACKET* held, char* data, int length, unsigned int releaseAt) {
+    int i;
+
+    for (i = 0; i < REPLAY_MAX_HELD_PACKETS; i++) {
+        if (held[i].data == NULL) {
+            held[i].data = malloc(length);
+            if (held[i].data == NULL) {
+                return 0;
+            }
+
+            memcpy(held[i].data, data, length);
+            held[i].length = length;
+            held[i].releaseAt = releaseAt;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void waitForDecoderDrain(void) {
+    VIDEO_STREAM_STATS videoStats;
+    int lastSubmitted, submitted;
+    uint64_t lastProgressTime;
+
+    if (VideoCallbacks.capabilities & CAPABILITY_DIRECT_SUBMIT) {
+        return;
+    }
+
+    lastSubmitted = -1;
+    lastProgressTime = PltGetMillis();
+    for (;;) {
+        LiGetVideoStreamStats(&videoStats);
+        submitted = PltAtomicLoadInt(&framesSubmitted);
+        if ((unsigned int)submitted >= videoStats.depacketizerFrames) {
+            break;
+        }
+
+        // Frames flushed on queue overflow will never be submitted
+        if (submitted != lastSubmitted) {
+            lastSubmitted = submitted;
+            lastProgressTime = PltGetMillis();
+        }
+        else if (PltGetMillis() - lastProgressTime > REPLAY_DRAIN_TIMEOUT_MS) {
+            break;
+        }
+
+        PltSleepMs(1);
+    }
+}
+
+static int replayPackets(PRTP_CAPTURE_READER reader, PRTP_REPLAY_OPTIONS options, PRTP_REPLAY_STATS stats) {
+    HELD_PACKET held[REPLAY_MAX_HELD_PACKETS];
+    char* buffer;
+    int bufferSize;
+    int type, length, ret;
+    unsigned long long timestampUs, firstTimestampUs;
+    uint64_t startTime, targetTime, now;
+    unsigned int delivered;
+    int reorderDistance;
+
+    bufferSize = StreamConfig.packetSize + MAX_RTP_HEADER_SIZE;
+    buffer = malloc(bufferSize);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    memset(held, 0, sizeof(held));
+    delivered = 0;
+    firstTimestampUs = 0;
+    startTime = PltGetMillis();
+
+    reorderDistance = options->reorderDistance;
+    if (reorderDistance < 1) {
+        reorderDistance = 1;
+    }
+
+    while ((ret = RtpcReadRecord(reader, &type, buffer, bufferSize, &length, &timestampUs)) > 0) {
+        if (type == RTPC_RECORD_STREAM_START) {
+            // The next connection in the capture may use different parameters
+            Limelog("Replay: stopping at the start of the next stream\n");
+            break;
+        }
+        else if (type != RTPC_RECORD_VIDEO_PACKET) {
+            // Skip record types we don't know about
+            continue;
+        }
+
+        stats->packetsRead++;
+
+        if (options->speedMultiplier > 0) {
+            if (stats->packetsRead == 1) {
+                firstTimestampUs = timestampUs;
+            }
+
+            targetTime = startTime + (timestampUs - firstTimestampUs) / 1000 / options->speedMultiplier;
+            now = PltGetMillis();
+            if (targetTime > now) {
+                PltSleepMs((int)(targetTime - now));
+            }
+        }
+
+        if (options->lossPercent > 0 && nextRandomPercent() < options->lossPercent) {
+            stats->packetsDropped++;
+            continue;
+        }
+
+        if (options->reorderPercent > 0 && nextRandomPercent() < options->reorderPercent &&
+                holdPacket(held, buffer, length, delivered + reorderDistance)) {
+            stats->packetsReordered++;
+            continue;
+        }
+
+        deliverPacket(buffer, length, &delivered);
+        releaseHeldPackets(held, &delivered, 0);
+    }
+
+    releaseHeldPackets(held, &delivered, 1);
+
+    free(buffer);
+
+    if (ret < 0) {
+        Limelog("Replay: capture is truncated or corrupt\n");
+    }
+
+    return 0;
+}
+
+int LiReplayRtpCapture(const char* path, PRTP_REPLAY_OPTIONS options, PCONNECTION_LISTENER_CALLBACKS clCallbacks,
+    PDECODER_RENDERER_CALLBACKS drCallbacks, void* renderContext, int drFlags, PRTP_REPLAY_STATS stats) {
+    RTP_CAPTURE_READER reader;
+    RTP_CAPTURE_STREAM_INFO info;
+    RTP_REPLAY_OPTIONS defaultOptions;
+    PAUDIO_RENDERER_CALLBACKS arCallbacks;
+    char infoPayload[RTPC_STREAM_INFO_SIZE];
+    unsigned long long timestampUs;
+    uint64_t startTime;
+    int type, length;
+    int err;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (options == NULL) {
+        memset(&defaultOptions, 0, sizeof(defaultOptions));
+        defaultOptions.speedMultiplier = 1;
+        options = &defaultOptions;
+    }
+
+    err = RtpcOpenCapture(&reader, path);
+    if (err != 0) {
+        return err;
+    }
+
+    // The capture must begin with the stream parameters
+    if (RtpcReadRecord(&reader, &type, infoPayload, sizeof(infoPayload), &length, &timestampUs) <= 0 ||
+            type != RTPC_RECORD_STREAM_START ||
+            RtpcParseStreamInfo(infoPayload, length, &info) != 0 ||
+            info.packetSize <= 0 || info.videoFormat == 0) {
+        RtpcCloseCapture(&reader);
+        return -1;
+    }
+
+    memset(&StreamConfig, 0, sizeof(StreamConfig));
+    StreamConfig.packetSize = info.packetSize;
+    StreamConfig.width = info.width;
+    StreamConfig.height = info.height;
+    StreamConfig.fps = info.fps;
+    memcpy(AppVersionQuad, info.appVersionQuad, sizeof(AppVersionQuad));
+    NegotiatedVideoFormat = info.videoFormat;
+
+    // Replace missing callbacks with placeholders
+    arCallbacks = NULL;
+    fixupMissingCallbacks(&drCallbacks, &arCallbacks, &clCallbacks);
+    memcpy(&VideoCallbacks, drCallbacks, sizeof(VideoCallbacks));
+    memcpy(&ListenerCallbacks, clCallbacks, sizeof(ListenerCallbacks));
+
+    // Interpose on frame submission to measure latency
+    originalSubmitDecodeUnit = VideoCallbacks.submitDecodeUnit;
+    VideoCallbacks.submitDecodeUnit = replaySubmitDecodeUnit;
+    framesSubmitted = 0;
+    totalFrameLatencyMs = 0;
+    maxFrameLatencyMs = 0;
+
+    randomState = options->seed;
+    ConnectionInterrupted = 0;
+
+    // Frame loss and IDR requests from the depacketizer go to the control stream
+    err = initializeControlStream();
+    if (err != 0) {
+        RtpcCloseCapture(&reader);
+        return err;
+    }
+
+    initializeVideoStream();
+
+    err = startVideoReplay(renderContext, drFlags);
+    if (err == 0) {
+        startTime = PltGetMillis();
+        err = replayPackets(&reader, options, stats);
+        waitForDecoderDrain();
+        stats->elapsedMs = PltGetMillis() - startTime;
+
+        stopVideoReplay();
+    }
+
+    stats->framesSubmitted = framesSubmitted;
+    stats->totalFrameLatencyMs = totalFrameLatencyMs;
+    stats->maxFrameLatencyMs = maxFrameLatencyMs;
+    LiGetVideoStreamStats(&stats->videoStats);
+
+    destroyVideoStream();
+
+    ConnectionInterrupted = 1;
+    stopIdleControlStream();
+    destroyControlStream();
+
+    RtpcCloseCapture(&reader);
+    return err;
+}
+
+int RtpcOpenCapture(PRTP_CAPTURE_READER reader, const char* path) {
+    char header[RTPC_FILE_HEADER_SIZE];
+    BYTE_BUFFER bb;
+    int magic, version;
+
+    reader->file = fopen(path, "rb");
+    if (reader->file == NULL) {
+        return errno;
+    }
+
+    if (fread(header, sizeof(header), 1, reader->file) != 1) {
+        RtpcCloseCapture(reader);
+        return -1;
+    }
+
+    BbInitializeWrappedBuffer(&bb, header, 0, sizeof(header), BYTE_ORDER_LITTLE);
+    BbGetInt(&bb, &magic);
+    BbGetInt(&bb, &version);
+    if (magic != RTPC_MAGIC || version != RTPC_VERSION) {
+        RtpcCloseCapture(reader);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Returns 1 if a record was read, 0 at the end of the capture, or -1 if the
+// capture is truncated or the record does not fit in the buffer
+int RtpcReadRecord(PRTP_CAPTURE_READER reader, int* type, char* buffer, int bufferSize,
+                   int* length, unsigned long long* timestampUs) {
+    char header[RTPC_RECORD_HEADER_SIZE];
+    BYTE_BUFFER bb;
+    char recordType, reserved;
+    short recordLength;
+    long long timestamp;
+
+    if (fread(header, sizeof(header), 1, reader->file) != 1) {
+        return feof(reader->file) ? 0 : -1;
+    }
+
+    BbInitializeWrappedBuffer(&bb, header, 0, sizeof(header), BYTE_ORDER_LITTLE);
+    BbGet(&bb, &recordType);
+    BbGet(&bb, &reserved);
+    BbGetShort(&bb, &recordLength);
+    BbGetLong(&bb, &timestamp);
+
+    *type = (unsigned char)recordType;
+    *length = (unsigned short)recordLength;
+    *timestampUs = (unsigned long long)timestamp;
+
+    if (*length > bufferSize || fread(buffer, *length, 1, reader->file) != 1) {
+        return -1;
+    }
+
+    return 1;
+}
+
+int RtpcParseStreamInfo(char* payload, int length, PRTP_CAPTURE_STREAM_INFO info) {
+    BYTE_BUFFER bb;
+    int i;
+
+    if (length < (int)RTPC_STREAM_INFO_SIZE) {
+        return -1;
+    }
+
+    BbInitializeWrappedBuffer(&bb, payload, 0, length, BYTE_ORDER_LITTLE);
+    BbGetInt(&bb, &info->packetSize);
+    BbGetInt(&bb, &info->videoFormat);
+    BbGetInt(&bb, &info->width);
+    BbGetInt(&bb, &info->height);
+    BbGetInt(&bb, &info->fps);
+    for (i = 0; i < 4; i++) {
+        BbGetInt(&bb, &info->appVersionQuad[i]);
+    }
+
+    return 0;
+}
+
+void RtpcCloseCapture(PRTP_CAPTURE_READER reader) {
+    if (reader->file != NULL) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+}
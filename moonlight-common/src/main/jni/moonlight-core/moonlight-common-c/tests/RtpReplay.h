@@ -0,0 +1,67 @@
+#pragma once
+
+// Reads RTP captures made with LiStartRtpCapture() and replays them through the
+// video receive path. This is only built for the tests, and the library must be
+// built with LC_RTP_REPLAY defined to provide the replay hooks.
+
+#include "Limelight.h"
+#include "RtpCapture.h"
+
+#include <stdio.h>
+
+typedef struct _RTP_CAPTURE_READER {
+    FILE* file;
+} RTP_CAPTURE_READER, *PRTP_CAPTURE_READER;
+
+int RtpcOpenCapture(PRTP_CAPTURE_READER reader, const char* path);
+int RtpcReadRecord(PRTP_CAPTURE_READER reader, int* type, char* buffer, int bufferSize,
+                   int* length, unsigned long long* timestampUs);
+int RtpcParseStreamInfo(char* payload, int length, PRTP_CAPTURE_STREAM_INFO info);
+void RtpcCloseCapture(PRTP_CAPTURE_READER reader);
+
+typedef struct _RTP_REPLAY_OPTIONS {
+    // Replay speed as a multiple of the recorded speed. If this is 0, packets
+    // are replayed as fast as the pipeline can consume them.
+    int speedMultiplier;
+
+    // Percentage of packets to discard and percentage of packets to deliver
+    // reorderDistance packets later than they were received.
+    int lossPercent;
+    int reorderPercent;
+    int reorderDistance;
+
+    // Seed for the loss and reorder decisions. Replays with the same seed
+    // and options drop and reorder the same packets.
+    unsigned int seed;
+} RTP_REPLAY_OPTIONS, *PRTP_REPLAY_OPTIONS;
+
+typedef struct _RTP_REPLAY_STATS {
+    // Packets read from the capture and packets discarded or reordered
+    // according to the replay options
+    unsigned int packetsRead;
+    unsigned int packetsDropped;
+    unsigned int packetsReordered;
+
+    // Number of decode units submitted to the renderer. The latency of a frame
+    // is measured from its first packet entering the FEC queue to the return
+    // of submitDecodeUnit().
+    unsigned int framesSubmitted;
+    unsigned long long totalFrameLatencyMs;
+    unsigned int maxFrameLatencyMs;
+
+    // Wall clock time taken by the replay
+    unsigned long long elapsedMs;
+
+    // Video stream statistics at the end of the replay
+    VIDEO_STREAM_STATS videoStats;
+} RTP_REPLAY_STATS, *PRTP_REPLAY_STATS;
+
+// This function feeds a capture made with LiStartRtpCapture() through the video
+// receive path (FEC queue, depacketizer, and decode unit queue) without a connection.
+// The stream parameters are taken from the capture. Callbacks are optional like
+// LiStartConnection(). Options may be NULL to replay at the recorded speed without
+// loss or reordering. This function must not be called while a connection is active.
+// Returns 0 on success, -1 if the capture is invalid, or an errno value if the
+// capture could not be opened.
+int LiReplayRtpCapture(const char* path, PRTP_REPLAY_OPTIONS options, PCONNECTION_LISTENER_CALLBACKS clCallbacks,
+    PDECODER_RENDERER_CALLBACKS drCallbacks, void* renderContext, int drFlags, PRTP_REPLAY_STATS stats);
@@ -0,0 +1,247 @@
+// Measures how fast Annex B start codes and padding (00 00 00 and 00 00 01
+// sequences) are found in video payloads. It compares
+// AnnexBFindSpecialSequence() with the memchr() fallback and a byte-at-a-time
+// scan like the one the slow path used before, and checks that all three find
+// the same positions.
+//
+// The payloads come from RTP capture files recorded with LiStartRtpCapture(),
+// so real H.264 and HEVC streams can be measured. Parity packets are skipped.
+// Without any files, synthetic NAL data with several densities of zero bytes
+// is used instead.
+//
+// Usage: annexb_bench [capture file...]
+
+#include "../src/AnnexB.c"
+
+#include "Limelight-internal.h"
+#include "RtpReplay.h"
+
+#include <stdio.h>
+#include <time.h>
+
+// Each measurement runs for at least this long
+#define MIN_RUN_NS 200000000ULL
+
+#define SYNTHETIC_SIZE (1024 * 1024)
+
+#define NV_VIDEO_PACKET_SIZE 16
+
+typedef int (*FIND_FUNCTION)(const unsigned char* data, int length);
+
+typedef struct _SCAN_RESULT {
+    int matches;
+    unsigned long long offsetSum;
+} SCAN_RESULT;
+
+static unsigned long long nowNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int findBytewise(const unsigned char* data, int length) {
+    int offset;
+
+    for (offset = 0; offset + 3 <= length; offset++) {
+        if (isSpecialSequence(&data[offset])) {
+            return offset;
+        }
+    }
+
+    return length;
+}
+
+static int findMemchr(const unsigned char* data, int length) {
+    return findSpecialSequenceScalar(data, 0, length);
+}
+
+// Finds every sequence in the buffer the way the depacketizer walks a payload
+static SCAN_RESULT scanBuffer(FIND_FUNCTION find, const unsigned char* data, int length) {
+    SCAN_RESULT result = { 0, 0 };
+    int offset = 0;
+
+    for (;;) {
+        offset += find(&data[offset], length - offset);
+        if (offset >= length) {
+            return result;
+        }
+
+        result.matches++;
+        result.offsetSum += offset;
+        offset++;
+    }
+}
+
+// Returns 0 if the implementation disagreed with the bytewise scan
+static int benchmarkBuffer(const char* name, const unsigned char* data, int length) {
+    static const struct {
+        const char* name;
+        FIND_FUNCTION find;
+    } finders[] = {
+        { "simd", AnnexBFindSpecialSequence },
+        { "memchr", findMemchr },
+        { "bytewise", findBytewise },
+    };
+    SCAN_RESULT expected;
+    int ok = 1;
+    int i;
+
+    expected = scanBuffer(findBytewise, data, length);
+    printf("%s: %d bytes, %d sequences\n", name, length, expected.matches);
+
+    for (i = 0; i < (int)(sizeof(finders) / sizeof(finders[0])); i++) {
+        unsigned long long startNs, elapsedNs, iterations;
+        SCAN_RESULT result;
+
+        result = scanBuffer(finders[i].find, data, length);
+        if (result.matches != expected.matches || result.offsetSum != expected.offsetSum) {
+            printf("FAIL: %s found %d sequences\n", finders[i].name, result.matches);
+            ok = 0;
+            continue;
+        }
+
+        iterations = 0;
+        startNs = nowNs();
+        do {
+            scanBuffer(finders[i].find, data, length);
+            iterations++;
+            elapsedNs = nowNs() - startNs;
+        } while (elapsedNs < MIN_RUN_NS);
+
+        printf("  %-8s %6.2f GB/s\n", finders[i].name, (double)iterations * length / elapsedNs);
+    }
+
+    return ok;
+}
+
+// Gathers the payload of every video data packet in a capture into one buffer
+static unsigned char* loadCapturePayloads(const char* path, int* length) {
+    RTP_CAPTURE_READER reader;
+    char record[65536];
+    unsigned char* payloads = NULL;
+    int capacity = 0;
+    int recordLength, type, err;
+    unsigned long long timestampUs;
+
+    *length = 0;
+    if (RtpcOpenCapture(&reader, path) != 0) {
+        fprintf(stderr, "Unable to open capture %s\n", path);
+        return NULL;
+    }
+
+    while ((err = RtpcReadRecord(&reader, &type, record, sizeof(record), &recordLength, &timestampUs)) > 0) {
+        int headerLength, fecInfo, fecIndex, dataShards;
+        unsigned char* nv;
+
+        if (type != RTPC_RECORD_VIDEO_PACKET) {
+            continue;
+        }
+
+        headerLength = (record[0] & FLAG_EXTENSION) ? MAX_RTP_HEADER_SIZE : FIXED_RTP_HEADER_SIZE;
+        if (recordLength < headerLength + NV_VIDEO_PACKET_SIZE) {
+            continue;
+        }
+
+        // Parity shards aren't video data
+        nv = (unsigned char*)&record[headerLength];
+        fecInfo = nv[12] | (nv[13] << 8) | (nv[14] << 16) | ((unsigned int)nv[15] << 24);
+        fecIndex = (fecInfo & 0x3FF000) >> 12;
+        dataShards = ((unsigned int)fecInfo & 0xFFC00000) >> 22;
+        if (fecIndex >= dataShards) {
+            continue;
+        }
+
+        recordLength -= headerLength + NV_VIDEO_PACKET_SIZE;
+        if (*length + recordLength > capacity) {
+            unsigned char* newPayloads;
+
+            capacity = (*length + recordLength) * 2;
+            newPayloads = realloc(payloads, capacity);
+            if (newPayloads == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                free(payloads);
+                RtpcCloseCapture(&reader);
+                return NULL;
+            }
+            payloads = newPayloads;
+        }
+        memcpy(&payloads[*length], &nv[NV_VIDEO_PACKET_SIZE], recordLength);
+        *length += recordLength;
+    }
+
+    RtpcCloseCapture(&reader);
+
+    if (err < 0) {
+        fprintf(stderr, "Capture %s is truncated or corrupt\n", path);
+    }
+    else if (*length == 0) {
+        fprintf(stderr, "Capture %s has no video data\n", path);
+    }
+    if (err < 0 || *length == 0) {
+        free(payloads);
+        return NULL;
+    }
+
+    return payloads;
+}
+
+// Random bytes where roughly one in zeroInterval is zero, with a start code
+// every 64 KB as in a stream of large slices
+static void fillSynthetic(unsigned char* data, int length, int zeroInterval) {
+    unsigned int seed = 12345;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        seed = seed * 1103515245 + 12345;
+        if ((seed >> 16) % zeroInterval == 0) {
+            data[i] = 0;
+        }
+        else {
+            data[i] = (unsigned char)((seed >> 8) | 1);
+        }
+
+        if ((i & 0xFFFF) == 0 && i + 4 <= length) {
+            data[i] = data[i + 1] = data[i + 2] = 0;
+            data[i + 3] = 1;
+            i += 3;
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    static const int zeroIntervals[] = { 300, 40, 8 };
+    int ok = 1;
+    int i;
+
+    if (argc > 1) {
+        for (i = 1; i < argc; i++) {
+            unsigned char* payloads;
+            int length;
+
+            payloads = loadCapturePayloads(argv[i], &length);
+            if (payloads == NULL) {
+                ok = 0;
+                continue;
+            }
+
+            ok &= benchmarkBuffer(argv[i], payloads, length);
+            free(payloads);
+        }
+    }
+    else {
+        unsigned char* data = malloc(SYNTHETIC_SIZE);
+
+        for (i = 0; i < (int)(sizeof(zeroIntervals) / sizeof(zeroIntervals[0])); i++) {
+            char name[64];
+
+            fillSynthetic(data, SYNTHETIC_SIZE, zeroIntervals[i]);
+            snprintf(name, sizeof(name), "synthetic, zero bytes 1/%d", zeroIntervals[i]);
+            ok &= benchmarkBuffer(name, data, SYNTHETIC_SIZE);
+        }
+
+        free(data);
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+// Plays scripted packet arrivals through the audio jitter buffer and checks
+// what the playout thread is told to do with each packet duration: play a
+// packet, recover a missing one from the FEC data in the next, conceal it,
+// or wait. Late, duplicate, and discarded packets must be dropped, and every
+// packet must be back in the pool once the buffer is cleaned up. Everything
+// runs on one thread, so the results are fully deterministic.
+
+#include "../src/AudioJitterBuffer.c"
+
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Expects the next packet duration to return ret with the packet whose
+// sequence number is given, or no packet if it is negative
+#define EXPECT_NEXT(ret, sequenceNumber) expectNext(__LINE__, ret, sequenceNumber)
+
+// Expects the totals since the test started
+#define EXPECT_STATS(concealed, fecRecovered, late, discarded) \
+    expectStats(__LINE__, concealed, fecRecovered, late, discarded)
+
+static const char* resultNames[] = { "wait", "play", "conceal", "FEC" };
+
+static PACKET_POOL packetPool;
+static AUDIO_JITTER_BUFFER jitterBuffer;
+
+static void startTest(int minDepth, int maxDepth, int useFec) {
+    CHECK(PpInitializePool(&packetPool, sizeof(RTP_PACKET), PP_DEFAULT_SLAB_SIZE) == 0);
+    CHECK(AjbInitialize(&jitterBuffer, &packetPool, minDepth, maxDepth, useFec) == 0);
+}
+
+// Cleans up the buffer, which must return every packet it still holds
+static void endTest(void) {
+    PACKET_POOL_STATS poolStats;
+
+    AjbCleanup(&jitterBuffer);
+
+    PpGetPoolStats(&packetPool, &poolStats);
+    CHECK(poolStats.buffersInUse == 0);
+    PpDestroyPool(&packetPool);
+}
+
+static void addPacket(int sequenceNumber) {
+    PRTP_PACKET packet = PpAllocateBuffer(&packetPool);
+
+    CHECK(packet != NULL);
+    if (packet == NULL) {
+        return;
+    }
+
+    memset(packet, 0, sizeof(*packet));
+    packet->sequenceNumber = U16(sequenceNumber);
+    AjbAddPacket(&jitterBuffer, packet);
+}
+
+static void expectNext(int line, int expectedRet, int expectedSequenceNumber) {
+    PRTP_PACKET packet;
+    int ret;
+    int sequenceNumber;
+
+    ret = AjbGetNextPacket(&jitterBuffer, &packet);
+    sequenceNumber = packet != NULL ? packet->sequenceNumber : -1;
+
+    if (ret != expectedRet || sequenceNumber != (expectedSequenceNumber < 0 ? -1 : U16(expectedSequenceNumber))) {
+        printf("FAIL: %s:%d: expected %s %d, got %s %d\n", __FILE__, line,
+               resultNames[expectedRet], expectedSequenceNumber, resultNames[ret], sequenceNumber);
+        failures++;
+    }
+
+    // The packet carrying FEC data stays in the buffer to be played next
+    if (ret == AJB_RET_PLAY && packet != NULL) {
+        PpFreeBuffer(&packetPool, packet);
+    }
+}
+
+static void expectStats(int line, unsigned int concealed, unsigned int fecRecovered,
+                        unsigned int late, unsigned int discarded) {
+    AUDIO_JITTER_BUFFER_STATS stats;
+
+    AjbGetStats(&jitterBuffer, &stats);
+    if (stats.concealedPackets != concealed || stats.fecRecoveredPackets != fecRecovered ||
+            stats.latePackets != late || stats.discardedPackets != discarded) {
+        printf("FAIL: %s:%d: expected %u concealed, %u FEC recovered, %u late, %u discarded, "
+               "got %u, %u, %u, %u\n", __FILE__, line, concealed, fecRecovered, late, discarded,
+               stats.concealedPackets, stats.fecRecoveredPackets, stats.latePackets, stats.discardedPackets);
+        failures++;
+    }
+}
+
+// Playout waits for the target depth and keeps waiting for a missing packet
+// while nothing after it has arrived. Sequence numbers wrap around.
+static void testPlayout(void) {
+    startTest(3, 8, 1);
+
+    addPacket(65534);
+    addPacket(65535);
+    EXPECT_NEXT(AJB_RET_WAIT, -1);
+    addPacket(0);
+    EXPECT_NEXT(AJB_RET_PLAY, 65534);
+    EXPECT_NEXT(AJB_RET_PLAY, 65535);
+    EXPECT_NEXT(AJB_RET_PLAY, 0);
+
+    // Packet 1 is late rather than lost, so it is still played once it comes
+    EXPECT_NEXT(AJB_RET_CONCEAL, -1);
+    EXPECT_NEXT(AJB_RET_CONCEAL, -1);
+    addPacket(1);
+    EXPECT_NEXT(AJB_RET_PLAY, 1);
+    EXPECT_STATS(2, 0, 0, 0);
+
+    endTest();
+}
+
+// Packets reordered before playout starts are played in order. Once later
+// packets have arrived, a missing packet is recovered from the FEC data in
+// the packet after it, or concealed if that is missing too. A packet that
+// turns up after its playout time is dropped, and so are duplicates.
+static void testLossWithFec(void) {
+    startTest(2, 8, 1);
+
+    addPacket(11);
+    EXPECT_NEXT(AJB_RET_WAIT, -1);
+    addPacket(10);
+    EXPECT_NEXT(AJB_RET_PLAY, 10);
+    EXPECT_NEXT(AJB_RET_PLAY, 11);
+
+    addPacket(13);
+    EXPECT_NEXT(AJB_RET_FEC, 13);
+    addPacket(12);
+    EXPECT_NEXT(AJB_RET_PLAY, 13);
+    EXPECT_STATS(1, 1, 1, 0);
+
+    addPacket(14);
+    addPacket(14);
+    EXPECT_NEXT(AJB_RET_PLAY, 14);
+
+    addPacket(17);
+    EXPECT_NEXT(AJB_RET_CONCEAL, -1);
+    EXPECT_NEXT(AJB_RET_FEC, 17);
+    EXPECT_NEXT(AJB_RET_PLAY, 17);
+    EXPECT_STATS(3, 2, 1, 0);
+
+    endTest();
+}
+
+// Without FEC, every lost packet is concealed
+static void testLossWithoutFec(void) {
+    startTest(1, 8, 0);
+
+    addPacket(20);
+    EXPECT_NEXT(AJB_RET_PLAY, 20);
+    addPacket(22);
+    addPacket(23);
+    EXPECT_NEXT(AJB_RET_CONCEAL, -1);
+    EXPECT_NEXT(AJB_RET_PLAY, 22);
+    EXPECT_NEXT(AJB_RET_PLAY, 23);
+    EXPECT_STATS(1, 0, 0, 0);
+
+    endTest();
+}
+
+// A burst that leaves the buffer deeper than the target plus the hysteresis
+// is trimmed by discarding a packet, at most once per AJB_DISCARD_INTERVAL
+// packets played
+static void testDiscard(void) {
+    int i;
+
+    startTest(2, 2, 1);
+
+    for (i = 100; i <= 106; i++) {
+        addPacket(i);
+    }
+    EXPECT_NEXT(AJB_RET_PLAY, 100);
+    for (i = 1; i < AJB_DISCARD_INTERVAL; i++) {
+        addPacket(106 + i);
+        EXPECT_NEXT(AJB_RET_PLAY, 100 + i);
+    }
+    EXPECT_STATS(0, 0, 0, 0);
+
+    EXPECT_NEXT(AJB_RET_PLAY, 111);
+    EXPECT_STATS(0, 0, 0, 1);
+
+    // The buffer stays too deep, but the next discard must wait
+    for (i = 0; i < AJB_DISCARD_INTERVAL - 1; i++) {
+        addPacket(116 + i);
+        EXPECT_NEXT(AJB_RET_PLAY, 112 + i);
+    }
+    EXPECT_STATS(0, 0, 0, 1);
+
+    addPacket(125);
+    EXPECT_NEXT(AJB_RET_PLAY, 122);
+    EXPECT_STATS(0, 0, 0, 2);
+
+    // Once the depth is back down nothing else is discarded
+    EXPECT_NEXT(AJB_RET_PLAY, 123);
+    EXPECT_NEXT(AJB_RET_PLAY, 124);
+    EXPECT_NEXT(AJB_RET_PLAY, 125);
+    EXPECT_NEXT(AJB_RET_CONCEAL, -1);
+    EXPECT_STATS(1, 0, 0, 2);
+
+    endTest();
+}
+
+// After AJB_MAX_EMPTY_PACKETS packets are concealed with nothing buffered,
+// playout stops and restarts from the next packet buffered once the target
+// depth is reached, without concealing the gap
+static void testStreamPause(void) {
+    int i;
+
+    startTest(2, 8, 1);
+
+    addPacket(300);
+    addPacket(301);
+    EXPECT_NEXT(AJB_RET_PLAY, 300);
+    EXPECT_NEXT(AJB_RET_PLAY, 301);
+    for (i = 0; i < AJB_MAX_EMPTY_PACKETS; i++) {
+        EXPECT_NEXT(AJB_RET_CONCEAL, -1);
+    }
+    EXPECT_NEXT(AJB_RET_WAIT, -1);
+    EXPECT_NEXT(AJB_RET_WAIT, -1);
+    EXPECT_STATS(AJB_MAX_EMPTY_PACKETS, 0, 0, 0);
+
+    addPacket(310);
+    EXPECT_NEXT(AJB_RET_WAIT, -1);
+    addPacket(311);
+    EXPECT_NEXT(AJB_RET_PLAY, 310);
+    EXPECT_NEXT(AJB_RET_PLAY, 311);
+
+    // Packets from the gap are too late now
+    addPacket(305);
+    EXPECT_STATS(AJB_MAX_EMPTY_PACKETS, 0, 1, 0);
+
+    endTest();
+}
+
+// A packet too far ahead to buffer resets the buffer, dropping what it
+// held, and playout starts over from the packets that follow
+static void testResync(void) {
+    startTest(2, 8, 1);
+
+    addPacket(400);
+    addPacket(401);
+    EXPECT_NEXT(AJB_RET_PLAY, 400);
+
+    addPacket(401 + AJB_SLOT_COUNT);
+    EXPECT_NEXT(AJB_RET_WAIT, -1);
+    EXPECT_NEXT(AJB_RET_WAIT, -1);
+
+    addPacket(500);
+    addPacket(501);
+    EXPECT_NEXT(AJB_RET_PLAY, 500);
+    EXPECT_NEXT(AJB_RET_PLAY, 501);
+    EXPECT_STATS(0, 0, 0, 0);
+
+    endTest();
+}
+
+int main(int argc, char** argv) {
+    testPlayout();
+    testLossWithFec();
+    testLossWithoutFec();
+    testDiscard();
+    testStreamPause();
+    testResync();
+
+    if (failures != 0) {
+        printf("audio_jitter_test: %d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("audio_jitter_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+// Encrypts a long run of input messages the way the input stream does for
+// Gen 7 servers, reusing one AES-GCM context whose key is only set once, and
+// checks every message against a context freshly initialized with the key
+// and IV. The IV of each message comes from the ciphertext of the one before,
+// so a single divergence would also break every message after it.
+
+#include "../src/InputStream.c"
+
+#include <stdio.h>
+
+#define MESSAGE_COUNT 100000
+
+static int failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Encrypts the plaintext with a new context and writes the tag followed by
+// the ciphertext, like encryptData(). Returns the length written or -1.
+static int encryptWithNewContext(const unsigned char* key, const unsigned char* iv,
+                                 const unsigned char* plaintext, int plaintextLen,
+                                 unsigned char* output) {
+    EVP_CIPHER_CTX* ctx;
+    int len, finalLen;
+    int ret = -1;
+
+    ctx = EVP_CIPHER_CTX_new();
+    if (ctx == NULL) {
+        return -1;
+    }
+
+    if (EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL) == 1 &&
+            EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_IVLEN, 16, NULL) == 1 &&
+            EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv) == 1 &&
+            EVP_EncryptUpdate(ctx, &output[16], &len, plaintext, plaintextLen) == 1 &&
+            EVP_EncryptFinal_ex(ctx, &output[16 + len], &finalLen) == 1 &&
+            EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, output) == 1) {
+        ret = 16 + len + finalLen;
+    }
+
+    EVP_CIPHER_CTX_free(ctx);
+    return ret;
+}
+
+int main(int argc, char** argv) {
+    // The input stream sends messages of these sizes
+    static const int packetLengths[] = {
+        sizeof(NV_KEYBOARD_PACKET), sizeof(NV_MOUSE_MOVE_PACKET), sizeof(NV_MOUSE_BUTTON_PACKET),
+        sizeof(NV_CONTROLLER_PACKET), sizeof(NV_MULTI_CONTROLLER_PACKET), sizeof(NV_SCROLL_PACKET),
+    };
+    unsigned char key[16], iv[16];
+    unsigned char expected[MAX_INPUT_PACKET_SIZE];
+    char message[MAX_INPUT_PACKET_SIZE];
+    PACKET_HOLDER holder;
+    unsigned int seed = 1;
+    int mismatches = 0;
+    int i, j;
+
+    for (i = 0; i < 16; i++) {
+        key[i] = (unsigned char)(i * 17 + 3);
+        iv[i] = (unsigned char)(i * 29 + 101);
+    }
+
+    AppVersionQuad[0] = 7;
+    memcpy(StreamConfig.remoteInputAesKey, key, sizeof(key));
+    memcpy(StreamConfig.remoteInputAesIv, iv, sizeof(iv));
+    CHECK(initializeInputStream() == 0);
+
+    for (i = 0; i < MESSAGE_COUNT; i++) {
+        unsigned char* plaintext = (unsigned char*)&holder.packet;
+        int length, expectedLength;
+
+        holder.packetLength = packetLengths[i % (sizeof(packetLengths) / sizeof(packetLengths[0]))];
+        for (j = 0; j < holder.packetLength; j++) {
+            seed = seed * 1103515245 + 12345;
+            plaintext[j] = (unsigned char)(seed >> 16);
+        }
+
+        length = encryptMessage(&holder, message, sizeof(message));
+        expectedLength = encryptWithNewContext(key, iv, plaintext, holder.packetLength, expected);
+        CHECK(length > 4 && expectedLength > 0);
+        if (length <= 4 || expectedLength <= 0) {
+            break;
+        }
+
+        // The message is the length, the tag, and the ciphertext
+        if (length - 4 != expectedLength || memcmp(&message[4], expected, expectedLength) != 0) {
+            if (mismatches++ == 0) {
+                printf("FAIL: message %d doesn't match a new context\n", i);
+            }
+        }
+
+        // Follow the IV the input stream uses next
+        if (expectedLength >= 32) {
+            memcpy(iv, &expected[expectedLength - 16], 16);
+        }
+    }
+    CHECK(mismatches == 0);
+    CHECK(memcmp(currentAesIv, iv, sizeof(iv)) == 0);
+
+    destroyInputStream();
+
+    if (failures != 0) {
+        printf("input_crypto_test: %d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("input_crypto_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,158 @@
+// Feeds synthetic packet traces through the jitter estimator and checks the
+// loss window it derives. Packets are sent every millisecond on a 90 kHz
+// clock, and the arrival times are chosen by each trace, so the results are
+// fully deterministic.
+
+#include "Limelight-internal.h"
+#include "JitterEstimator.h"
+
+#include <stdio.h>
+
+#define CLOCK_RATE 90000
+#define PACKET_INTERVAL_US 1000
+#define TIMESTAMP_STEP (CLOCK_RATE / 1000)
+
+#define MIN_WINDOW_MS 2
+#define MAX_WINDOW_MS 50
+
+static int failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Adds the packet with the given index, arriving offsetUs after it was due
+static void addPacket(PJITTER_ESTIMATOR estimator, int index, int offsetUs) {
+    JeAddPacket(estimator, U16(1000 + index), 5000 + index * TIMESTAMP_STEP,
+                1000000ULL + (unsigned long long)index * PACKET_INTERVAL_US + offsetUs);
+}
+
+static void testCleanTrace(void) {
+    JITTER_ESTIMATOR estimator;
+    int i;
+
+    JeInitialize(&estimator, CLOCK_RATE, MIN_WINDOW_MS, MAX_WINDOW_MS);
+
+    // Nothing is known about the stream yet
+    CHECK(JeGetWindowUs(&estimator) == MAX_WINDOW_MS * 1000);
+
+    // The sequence numbers wrap during the trace
+    for (i = 0; i < 70000; i++) {
+        addPacket(&estimator, i, 0);
+    }
+
+    CHECK(JeGetJitterUs(&estimator) == 0);
+    CHECK(JeGetReorderDepth(&estimator) == 0);
+    CHECK(JeGetWindowUs(&estimator) == MIN_WINDOW_MS * 1000);
+}
+
+static void testJitteredTrace(void) {
+    JITTER_ESTIMATOR estimator;
+    int i;
+
+    JeInitialize(&estimator, CLOCK_RATE, MIN_WINDOW_MS, MAX_WINDOW_MS);
+
+    // Every other packet is 1 ms late, so each transit time differs by 1 ms
+    for (i = 0; i < 1000; i++) {
+        addPacket(&estimator, i, (i & 1) ? 1000 : 0);
+    }
+
+    CHECK(JeGetJitterUs(&estimator) >= 990 && JeGetJitterUs(&estimator) <= 1000);
+    CHECK(JeGetReorderDepth(&estimator) == 0);
+    CHECK(JeGetWindowUs(&estimator) == 4 * JeGetJitterUs(&estimator));
+
+    // The estimate settles back down once the jitter stops
+    for (; i < 2000; i++) {
+        addPacket(&estimator, i, 0);
+    }
+
+    CHECK(JeGetJitterUs(&estimator) < 10);
+    CHECK(JeGetWindowUs(&estimator) == MIN_WINDOW_MS * 1000);
+}
+
+static void testReorderedTrace(void) {
+    JITTER_ESTIMATOR estimator;
+    int i;
+
+    JeInitialize(&estimator, CLOCK_RATE, MIN_WINDOW_MS, MAX_WINDOW_MS);
+
+    for (i = 0; i < 100; i++) {
+        addPacket(&estimator, i, 0);
+    }
+
+    // Packet 100 arrives 3 packets late, 3 ms after packet 101 made it overdue
+    addPacket(&estimator, 101, 0);
+    addPacket(&estimator, 102, 0);
+    addPacket(&estimator, 103, 0);
+    addPacket(&estimator, 100, 4000);
+
+    CHECK(JeGetReorderDepth(&estimator) == 3);
+
+    // The window covers the reorder delay with 25% headroom. The packets
+    // around the gap were on time, so there is no jitter.
+    CHECK(JeGetJitterUs(&estimator) == 0);
+    CHECK(JeGetWindowUs(&estimator) == 3000 + 3000 / 4);
+
+    // A duplicate of the highest packet isn't reordering
+    addPacket(&estimator, 103, 5000);
+    CHECK(JeGetReorderDepth(&estimator) == 3);
+
+    // The reorder peak decays after a few seconds of clean packets
+    for (i = 104; i < 10000; i++) {
+        addPacket(&estimator, i, 0);
+    }
+
+    CHECK(JeGetReorderDepth(&estimator) == 0);
+    CHECK(JeGetWindowUs(&estimator) == MIN_WINDOW_MS * 1000);
+}
+
+static void testWindowClamping(void) {
+    JITTER_ESTIMATOR estimator;
+    int i;
+
+    // The jitter alone would call for an 80 ms window
+    JeInitialize(&estimator, CLOCK_RATE, MIN_WINDOW_MS, MAX_WINDOW_MS);
+    for (i = 0; i < 1000; i++) {
+        addPacket(&estimator, i, (i & 1) ? 20000 : 0);
+    }
+
+    CHECK(JeGetJitterUs(&estimator) > MAX_WINDOW_MS * 1000 / 4);
+    CHECK(JeGetWindowUs(&estimator) == MAX_WINDOW_MS * 1000);
+
+    // So would a packet that is 100 ms late
+    JeInitialize(&estimator, CLOCK_RATE, MIN_WINDOW_MS, MAX_WINDOW_MS);
+    for (i = 0; i < 10; i++) {
+        addPacket(&estimator, i, 0);
+    }
+    addPacket(&estimator, 11, 0);
+    addPacket(&estimator, 10, 100000);
+
+    CHECK(JeGetWindowUs(&estimator) == MAX_WINDOW_MS * 1000);
+
+    // A larger minimum applies even to a clean stream
+    JeInitialize(&estimator, CLOCK_RATE, 20, MAX_WINDOW_MS);
+    for (i = 0; i < 100; i++) {
+        addPacket(&estimator, i, 0);
+    }
+
+    CHECK(JeGetWindowUs(&estimator) == 20000);
+}
+
+int main(int argc, char** argv) {
+    testCleanTrace();
+    testJitteredTrace();
+    testReorderedTrace();
+    testWindowClamping();
+
+    if (failures != 0) {
+        printf("jitter_test: %d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("jitter_test: passed\n");
+    return 0;
+}
@@ -0,0 +1,575 @@
+// Runs a complete session against the loopback server and reports the
+// connection setup time, the CPU cost of the client's streams, and how long
+// IDR frame requests take to be answered. The decoder asks for an IDR frame
+// at a fixed interval, and the time until the next IDR frame arrives is
+// measured on the client side, along with the control stream's own latency
+// for getting each request onto the network. The server measures its part of
+// each request and its own CPU time, which is subtracted from the process CPU
+// time.
+//
+// With -i, a burst of input events is sent after the stream is measured, and
+// the input stream's send latency and CPU time per event are reported.
+//
+// With -p, the decoder uses the frame pacer and a thread stands in for the
+// display by reporting a vsync every refresh period. If the display refreshes
+// less often than the stream's 60 fps, several frames queue up between
+// refreshes, and the server also sends an IDR frame every so often without
+// being asked. The pacer must then discard the queued frames that an IDR
+// frame supersedes.
+//
+// With -S, the stream has several slices per frame and each is submitted as
+// soon as it arrives. With -l, the server drops and reorders video packets,
+// and some frames lose more packets than FEC can recover.
+//
+// Unless an elementary stream is given, every decode unit is checked against
+// the synthetic frame the server sent, and each frame's slices must arrive in
+// order with nothing after the decode unit that ends the frame.
+//
+// Usage: loopback_bench [-H] [-s seconds] [-i events [-c]] [-p [-r hz]] [-z] [-S] [-l] [-v] [elementary stream]
+//   -H  the stream is H.265 rather than H.264
+//   -s  length of the measured part of the session (default 5)
+//   -i  number of input events to send
+//   -c  coalesce queued input events into one send
+//   -p  pace frames to a simulated display
+//   -r  refresh rate of the simulated display (default 60)
+//   -z  use zero-copy decode units
+//   -S  submit each slice as its own decode unit
+//   -l  inject packet loss and reordering
+//   -v  print the library's log messages
+
+#include "LoopbackServer.h"
+#include "Limelight-internal.h"
+#include "PlatformAtomics.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// The stream runs for this long before measurements start
+#define WARMUP_MS 1000
+
+// The decoder requests an IDR frame after this many frames
+#define IDR_REQUEST_INTERVAL 60
+
+#define MAX_IDR_SAMPLES 1024
+
+// Input is sent as a mouse move, a controller update, and a key press or
+// release at this interval, like a player using all three at once
+#define INPUT_BURST_INTERVAL_US 1000
+#define INPUT_BURST_EVENTS 3
+
+// Time allowed for the last input events to be sent
+#define INPUT_DRAIN_MS 200
+
+// Frame rate of the stream
+#define STREAM_FPS 60
+
+// Default refresh rate of the simulated display used with -p
+#define DEFAULT_REFRESH_RATE 60
+
+// Interval between the IDR frames the server sends unasked when the
+// simulated display is slower than the stream
+#define UNREQUESTED_IDR_INTERVAL 30
+
+// Slices per frame requested with -S
+#define SLICES_PER_FRAME 4
+
+// Server packet loss and reordering used with -l. Single lost packets are
+// recovered with FEC, and every lost frame needs an IDR frame to recover.
+#define PACKET_LOSS_INTERVAL 17
+#define REORDER_INTERVAL 11
+#define FRAME_LOSS_INTERVAL 25
+
+typedef struct _CLIENT_STATS {
+    unsigned int frames;
+    unsigned int idrFrames;
+    unsigned long long videoBytes;
+    unsigned int audioSamples;
+
+    // Decode units whose contents didn't match what the server sent
+    unsigned int corruptDecodeUnits;
+
+    // Decode units that didn't end their frame, frames that never ended
+    // after some of their slices were submitted, and decode units with
+    // slices out of order or after the end of their frame
+    unsigned int sliceDecodeUnits;
+    unsigned int abandonedFrames;
+    unsigned int misorderedDecodeUnits;
+
+    // Time from returning DR_NEED_IDR to the next IDR frame being submitted
+    unsigned int idrSamples;
+    unsigned long long idrLatencyUs[MAX_IDR_SAMPLES];
+} CLIENT_STATS, *PCLIENT_STATS;
+
+// Written by the decoder and audio threads and read by the main thread
+// once the connection has stopped
+static CLIENT_STATS clientStats;
+static unsigned long long idrRequestTimeUs;
+static int framesSinceIdrRequest;
+
+// The frame whose slices are being submitted and the index of its next slice
+static int sliceFrameNumber;
+static int nextSliceIndex;
+static int sliceFrameEnded = 1;
+
+static volatile int vsyncStopping;
+static int vsyncIntervalUs;
+static int checkContents;
+static int slicesPerFrame = 1;
+
+static int verbose;
+static int connectionTerminated;
+static long terminationError;
+
+static void checkSliceOrder(PDECODE_UNIT decodeUnit, int firstSlice, int slices) {
+    if (decodeUnit->frameNumber != sliceFrameNumber) {
+        if (!sliceFrameEnded) {
+            clientStats.abandonedFrames++;
+        }
+        if (decodeUnit->frameNumber < sliceFrameNumber) {
+            clientStats.misorderedDecodeUnits++;
+        }
+
+        sliceFrameNumber = decodeUnit->frameNumber;
+        sliceFrameEnded = 0;
+        nextSliceIndex = 0;
+    }
+    else if (sliceFrameEnded) {
+        clientStats.misorderedDecodeUnits++;
+    }
+
+    if (firstSlice != nextSliceIndex) {
+        clientStats.misorderedDecodeUnits++;
+    }
+    nextSliceIndex = firstSlice + slices;
+
+    if (decodeUnit->flags & DU_FLAG_END_OF_FRAME) {
+        if (nextSliceIndex != slicesPerFrame) {
+            clientStats.misorderedDecodeUnits++;
+        }
+        sliceFrameEnded = 1;
+    }
+}
+
+static int submitDecodeUnit(PDECODE_UNIT decodeUnit) {
+    int firstSlice, slices;
+
+    clientStats.videoBytes += decodeUnit->fullLength;
+
+    if (checkContents) {
+        slices = LiCheckLoopbackDecodeUnit(decodeUnit, &firstSlice);
+        if (slices <= 0) {
+            clientStats.corruptDecodeUnits++;
+        }
+        else {
+            checkSliceOrder(decodeUnit, firstSlice, slices);
+        }
+    }
+
+    // The rest of the frame follows in later decode units
+    if (!(decodeUnit->flags & DU_FLAG_END_OF_FRAME)) {
+        clientStats.sliceDecodeUnits++;
+        return DR_OK;
+    }
+
+    clientStats.frames++;
+
+    if (decodeUnit->frameType == FRAME_TYPE_IDR) {
+        clientStats.idrFrames++;
+        if (idrRequestTimeUs != 0) {
+            if (clientStats.idrSamples < MAX_IDR_SAMPLES) {
+                clientStats.idrLatencyUs[clientStats.idrSamples++] = LiGetMicros() - idrRequestTimeUs;
+            }
+            idrRequestTimeUs = 0;
+        }
+    }
+
+    if (idrRequestTimeUs == 0 && ++framesSinceIdrRequest >= IDR_REQUEST_INTERVAL) {
+        framesSinceIdrRequest = 0;
+        idrRequestTimeUs = LiGetMicros();
+        return DR_NEED_IDR;
+    }
+
+    return DR_OK;
+}
+
+static void* vsyncThreadProc(void* context) {
+    while (!PltAtomicLoadInt(&vsyncStopping)) {
+        LiReportDisplayVsync(LiGetMicros());
+        usleep(vsyncIntervalUs);
+    }
+
+    return NULL;
+}
+
+static void decodeAndPlaySample(char* sampleData, int sampleLength) {
+    clientStats.audioSamples++;
+}
+
+static void stageFailed(int stage, long errorCode) {
+    fprintf(stderr, "Stage %d (%s) failed: %ld\n", stage, LiGetStageName(stage), errorCode);
+}
+
+static void onConnectionTerminated(long errorCode) {
+    connectionTerminated = 1;
+    terminationError = errorCode;
+}
+
+static void logMessage(const char* format, ...) {
+    va_list va;
+
+    if (!verbose) {
+        return;
+    }
+
+    va_start(va, format);
+    vfprintf(stderr, format, va);
+    va_end(va);
+}
+
+static unsigned long long getProcessCpuTimeUs(void) {
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    return (unsigned long long)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+        usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+// Returns 0 if the events weren't all sent to the server
+static int runInput(int events) {
+    LOOPBACK_SERVER_STATS startServerStats, serverStats;
+    INPUT_STREAM_STATS stats;
+    int bursts, rejected, i;
+
+    LiGetLoopbackServerStats(&startServerStats);
+    LiResetInputStreamStats();
+
+    bursts = (events + INPUT_BURST_EVENTS - 1) / INPUT_BURST_EVENTS;
+    rejected = 0;
+    for (i = 0; i < bursts; i++) {
+        // Events are rejected if the input queue is full
+        rejected += LiSendMouseMoveEvent(1, -1) != 0;
+        rejected += LiSendMultiControllerEvent(0, 1, (short)(i & 1), 0, 0, (short)i, 0, 0, 0) != 0;
+        rejected += LiSendKeyboardEvent(0x41, (i & 1) ? KEY_ACTION_UP : KEY_ACTION_DOWN, 0) != 0;
+
+        usleep(INPUT_BURST_INTERVAL_US);
+    }
+
+    usleep(INPUT_DRAIN_MS * 1000);
+
+    LiGetInputStreamStats(&stats);
+    LiGetLoopbackServerStats(&serverStats);
+
+    printf("Input: %u events (%d rejected, %u merged), %u messages in %u sends, %u received by the server\n",
+           stats.eventsQueued, rejected, stats.eventsMerged, stats.messagesSent, stats.flushes,
+           serverStats.inputPacketsReceived - startServerStats.inputPacketsReceived);
+    printf("Input send latency: p50 %u us, p95 %u us, p99 %u us, max %u us\n",
+           stats.sendLatency.p50Us, stats.sendLatency.p95Us, stats.sendLatency.p99Us, stats.sendLatency.maxUs);
+    printf("Input CPU: %.2f us per event\n",
+           stats.eventsQueued ? (double)stats.cpuTimeUs / stats.eventsQueued : 0.0);
+
+    if (stats.eventsQueued != (unsigned int)(bursts * INPUT_BURST_EVENTS - rejected) ||
+            stats.messagesSent + stats.eventsMerged != stats.eventsQueued ||
+            serverStats.inputPacketsReceived - startServerStats.inputPacketsReceived != stats.messagesSent) {
+        printf("FAIL: not all input events were sent\n");
+        return 0;
+    }
+
+    return 1;
+}
+
+static int compareLatency(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char** argv) {
+    LOOPBACK_SERVER_CONFIGURATION serverConfig;
+    LOOPBACK_SERVER_STATS startServerStats, serverStats;
+    SERVER_INFORMATION serverInfo;
+    STREAM_CONFIGURATION streamConfig;
+    CONNECTION_LISTENER_CALLBACKS clCallbacks;
+    DECODER_RENDERER_CALLBACKS drCallbacks;
+    AUDIO_RENDERER_CALLBACKS arCallbacks;
+    CONTROL_STREAM_STATS controlStats;
+    VIDEO_STREAM_STATS videoStats, finalVideoStats;
+    pthread_t vsyncThread;
+    CLIENT_STATS startClientStats;
+    unsigned long long startTimeUs, setupUs, elapsedUs;
+    unsigned long long startCpuUs, clientCpuUs, serverCpuUs;
+    unsigned int frames, idrRequests;
+    int seconds = 5;
+    int inputEvents = 0;
+    int pacing = 0;
+    int refreshRate = DEFAULT_REFRESH_RATE;
+    int zeroCopy = 0;
+    int submitSlices = 0;
+    int injectLoss = 0;
+    int ok = 1;
+    int err;
+    int opt;
+
+    memset(&serverConfig, 0, sizeof(serverConfig));
+    LiInitializeStreamConfiguration(&streamConfig);
+    while ((opt = getopt(argc, argv, "Hs:i:cpr:zSlv")) != -1) {
+        switch (opt) {
+        case 'H':
+            serverConfig.hevc = 1;
+            break;
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'i':
+            inputEvents = atoi(optarg);
+            break;
+        case 'c':
+            streamConfig.coalesceInput = 1;
+            break;
+        case 'p':
+            pacing = 1;
+            break;
+        case 'r':
+            refreshRate = atoi(optarg);
+            break;
+        case 'z':
+            zeroCopy = 1;
+            break;
+        case 'S':
+            submitSlices = 1;
+            break;
+        case 'l':
+            injectLoss = 1;
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            seconds = 0;
+            break;
+        }
+    }
+    if (seconds <= 0 || refreshRate <= 0 || argc - optind > 1) {
+        fprintf(stderr, "Usage: %s [-H] [-s seconds] [-i events [-c]] [-p [-r hz]] [-z] [-S] [-l] [-v] [elementary stream]\n", argv[0]);
+        return 1;
+    }
+    if (optind < argc) {
+        serverConfig.elementaryStreamPath = argv[optind];
+    }
+    else {
+        checkContents = 1;
+    }
+    if (submitSlices) {
+        slicesPerFrame = SLICES_PER_FRAME;
+    }
+    if (pacing && refreshRate < STREAM_FPS) {
+        serverConfig.idrInterval = UNREQUESTED_IDR_INTERVAL;
+    }
+    vsyncIntervalUs = 1000000 / refreshRate;
+    if (injectLoss) {
+        serverConfig.packetLossInterval = PACKET_LOSS_INTERVAL;
+        serverConfig.reorderInterval = REORDER_INTERVAL;
+        serverConfig.frameLossInterval = FRAME_LOSS_INTERVAL;
+    }
+
+    err = LiStartLoopbackServer(&serverConfig);
+    if (err != 0) {
+        fprintf(stderr, "Unable to start the loopback server: %d\n", err);
+        return 1;
+    }
+
+    LiInitializeServerInformation(&serverInfo);
+    serverInfo.address = "127.0.0.1";
+    serverInfo.serverInfoAppVersion = "7.1.431.0";
+    serverInfo.serverInfoGfeVersion = "3.20.0";
+
+    streamConfig.width = 1280;
+    streamConfig.height = 720;
+    streamConfig.fps = STREAM_FPS;
+    streamConfig.bitrate = 10000;
+    streamConfig.packetSize = 1024;
+    streamConfig.audioConfiguration = AUDIO_CONFIGURATION_STEREO;
+    streamConfig.supportsHevc = serverConfig.hevc;
+    streamConfig.clientRefreshRateX100 = refreshRate * 100;
+
+    LiInitializeConnectionCallbacks(&clCallbacks);
+    clCallbacks.stageFailed = stageFailed;
+    clCallbacks.connectionTerminated = onConnectionTerminated;
+    clCallbacks.logMessage = logMessage;
+
+    LiInitializeVideoCallbacks(&drCallbacks);
+    drCallbacks.submitDecodeUnit = submitDecodeUnit;
+    if (pacing) {
+        drCallbacks.capabilities |= CAPABILITY_FRAME_PACING;
+    }
+    if (zeroCopy) {
+        drCallbacks.capabilities |= CAPABILITY_ZERO_COPY_DECODE_UNITS;
+    }
+    if (submitSlices) {
+        drCallbacks.capabilities |= CAPABILITY_SLICE_SUBMIT | CAPABILITY_SLICES_PER_FRAME(SLICES_PER_FRAME);
+    }
+
+    LiInitializeAudioCallbacks(&arCallbacks);
+    arCallbacks.decodeAndPlaySample = decodeAndPlaySample;
+
+    if (pacing && pthread_create(&vsyncThread, NULL, vsyncThreadProc, NULL) != 0) {
+        fprintf(stderr, "Unable to start the vsync thread\n");
+        LiStopLoopbackServer();
+        return 1;
+    }
+
+    startTimeUs = LiGetMicros();
+    err = LiStartConnection(&serverInfo, &streamConfig, &clCallbacks,
+                            &drCallbacks, &arCallbacks, NULL, 0, NULL, 0);
+    setupUs = LiGetMicros() - startTimeUs;
+    if (err != 0) {
+        fprintf(stderr, "Unable to connect to the loopback server: %d\n", err);
+        if (pacing) {
+            PltAtomicStoreInt(&vsyncStopping, 1);
+            pthread_join(vsyncThread, NULL);
+        }
+        LiStopLoopbackServer();
+        return 1;
+    }
+
+    usleep(WARMUP_MS * 1000);
+
+    startTimeUs = LiGetMicros();
+    startCpuUs = getProcessCpuTimeUs();
+    LiGetLoopbackServerStats(&startServerStats);
+    LiResetControlStreamStats();
+    startClientStats = clientStats;
+
+    sleep(seconds);
+
+    elapsedUs = LiGetMicros() - startTimeUs;
+    clientCpuUs = getProcessCpuTimeUs() - startCpuUs;
+    LiGetLoopbackServerStats(&serverStats);
+    LiGetControlStreamStats(&controlStats);
+    LiGetVideoStreamStats(&videoStats);
+
+    if (inputEvents > 0 && !runInput(inputEvents)) {
+        ok = 0;
+    }
+
+    LiStopConnection();
+    LiStopLoopbackServer();
+
+    // Every packet buffer must have been released by now
+    LiGetVideoStreamStats(&finalVideoStats);
+
+    if (pacing) {
+        PltAtomicStoreInt(&vsyncStopping, 1);
+        pthread_join(vsyncThread, NULL);
+    }
+
+    if (connectionTerminated) {
+        fprintf(stderr, "The connection terminated early: %ld\n", terminationError);
+        ok = 0;
+    }
+
+    // The server threads run in this process too
+    serverCpuUs = serverStats.serverCpuTimeUs - startServerStats.serverCpuTimeUs;
+    clientCpuUs = clientCpuUs > serverCpuUs ? clientCpuUs - serverCpuUs : 0;
+    frames = clientStats.frames - startClientStats.frames;
+
+    printf("Connection setup: %llu ms (RTSP handshake %u ms, %u requests)\n",
+           setupUs / 1000, serverStats.handshakeMs, serverStats.rtspRequests);
+    printf("Streamed %.1f s: %u frames (%u IDR), %.2f Mbps video, %u audio packets\n",
+           elapsedUs / 1000000.0, frames, clientStats.idrFrames - startClientStats.idrFrames,
+           (clientStats.videoBytes - startClientStats.videoBytes) * 8.0 / elapsedUs,
+           clientStats.audioSamples - startClientStats.audioSamples);
+    printf("Client CPU: %.1f%% of a core, %.1f us per frame\n",
+           clientCpuUs * 100.0 / elapsedUs, frames ? (double)clientCpuUs / frames : 0.0);
+    printf("Server CPU: %.1f%% of a core\n", serverCpuUs * 100.0 / elapsedUs);
+
+    idrRequests = serverStats.idrRequests;
+    if (idrRequests != 0) {
+        printf("IDR requests: %u, server response avg %llu ms, max %u ms\n", idrRequests,
+               serverStats.totalIdrResponseMs / idrRequests, serverStats.maxIdrResponseMs);
+    }
+    if (clientStats.idrSamples != 0) {
+        qsort(clientStats.idrLatencyUs, clientStats.idrSamples, sizeof(clientStats.idrLatencyUs[0]), compareLatency);
+        printf("IDR round trip: %u samples, p50 %llu us, max %llu us\n", clientStats.idrSamples,
+               clientStats.idrLatencyUs[clientStats.idrSamples / 2],
+               clientStats.idrLatencyUs[clientStats.idrSamples - 1]);
+    }
+    printf("IDR request send: %u requests, p50 %u us, p95 %u us, p99 %u us, max %u us, %u control I/O wakeups\n",
+           controlStats.idrRequests, controlStats.idrRequestLatency.p50Us, controlStats.idrRequestLatency.p95Us,
+           controlStats.idrRequestLatency.p99Us, controlStats.idrRequestLatency.maxUs, controlStats.ioWakeups);
+    printf("Depacketizer: %u frames, %llu bytes copied\n",
+           videoStats.depacketizerFrames, videoStats.depacketizerBytesCopied);
+    if (pacing) {
+        printf("Frame pacing: %u frames paced, %u dropped, %d us decode time\n",
+               videoStats.pacedFrames, videoStats.pacingDroppedFrames, videoStats.pacingDecodeTimeUs);
+    }
+    if (injectLoss) {
+        printf("Loss: %u packets dropped, %u reordered, %u frames recovered with FEC, %u unrecoverable\n",
+               serverStats.videoPacketsDropped, serverStats.videoPacketsReordered,
+               videoStats.fecFramesRecovered, videoStats.fecFramesUnrecoverable);
+    }
+    if (submitSlices) {
+        printf("Slices: %u decode units before the end of their frame, %u frames abandoned\n",
+               clientStats.sliceDecodeUnits, clientStats.abandonedFrames);
+    }
+
+    if (frames == 0 || clientStats.audioSamples == startClientStats.audioSamples) {
+        printf("FAIL: no video or audio was received\n");
+        ok = 0;
+    }
+    if (clientStats.idrSamples == 0) {
+        printf("FAIL: no IDR frame request was answered\n");
+        ok = 0;
+    }
+    if (controlStats.idrRequests == 0 || controlStats.idrRequestLatency.samples == 0) {
+        printf("FAIL: no IDR frame request latency was recorded\n");
+        ok = 0;
+    }
+    if (clientStats.corruptDecodeUnits != 0) {
+        printf("FAIL: %u decode units didn't match what the server sent\n", clientStats.corruptDecodeUnits);
+        ok = 0;
+    }
+    if (zeroCopy ? videoStats.depacketizerBytesCopied != 0 : videoStats.depacketizerBytesCopied == 0) {
+        printf("FAIL: the depacketizer copied %llu bytes\n", videoStats.depacketizerBytesCopied);
+        ok = 0;
+    }
+    if (pacing && videoStats.pacedFrames == 0) {
+        printf("FAIL: no frames were paced\n");
+        ok = 0;
+    }
+    if (serverConfig.idrInterval != 0 && videoStats.pacingDroppedFrames == 0) {
+        printf("FAIL: no queued frames were superseded by an IDR frame\n");
+        ok = 0;
+    }
+    if (clientStats.misorderedDecodeUnits != 0) {
+        printf("FAIL: %u decode units had slices out of order\n", clientStats.misorderedDecodeUnits);
+        ok = 0;
+    }
+    if (finalVideoStats.packetPoolBuffersInUse != 0) {
+        printf("FAIL: %d packet buffers were never released\n", finalVideoStats.packetPoolBuffersInUse);
+        ok = 0;
+    }
+    if (injectLoss && (videoStats.fecFramesRecovered == 0 || videoStats.fecFramesUnrecoverable == 0)) {
+        printf("FAIL: the injected loss wasn't both recovered and unrecoverable\n");
+        ok = 0;
+    }
+    if (submitSlices && checkContents && clientStats.sliceDecodeUnits == 0) {
+        printf("FAIL: no slices were submitted ahead of their frame\n");
+        ok = 0;
+    }
+    if (submitSlices && injectLoss && checkContents && clientStats.abandonedFrames == 0) {
+        printf("FAIL: no frame was abandoned after its first slices were submitted\n");
+        ok = 0;
+    }
+    if (!submitSlices && clientStats.abandonedFrames != 0) {
+        printf("FAIL: %u frames were submitted in parts\n", clientStats.abandonedFrames);
+        ok = 0;
+    }
+
+    return ok ? 0 : 1;
+}
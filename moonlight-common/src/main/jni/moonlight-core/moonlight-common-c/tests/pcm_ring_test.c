@@ -0,0 +1,326 @@
+// Checks the PCM ring's priming, underrun and overflow handling, adaptive
+// target, and clock drift compensation. The first tests step the writer and
+// reader by hand, so they are deterministic. The last ones play audio in real
+// time into a PCM file sink whose clock runs slightly fast or slow.
+
+#include "Limelight-internal.h"
+#include "PcmRing.h"
+#include "PcmFileSink.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define CHANNEL_COUNT 2
+#define SAMPLE_RATE 48000
+#define PERIOD_FRAMES 240
+#define CAPACITY_FRAMES 8192
+#define MIN_TARGET_FRAMES 960
+#define MAX_TARGET_FRAMES 4800
+
+// The ring's target moves in steps of this size and it compensates for
+// drift once the fill level is half a step away from the target
+#define TARGET_STEP_FRAMES 240
+#define DRIFT_TOLERANCE_FRAMES (TARGET_STEP_FRAMES / 2)
+
+// Length of each real time run and the sink's clock error in parts per million
+#define SINK_RUN_MS 3000
+#define SINK_DRIFT_PPM 3000
+
+static int failures;
+
+// Room for reads large enough to drain the ring
+static short drainSamples[CAPACITY_FRAMES * CHANNEL_COUNT];
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// Each frame holds its index in the stream, so the reader can tell which
+// frames it got
+static int nextWriteFrame;
+
+static int writeFrames(PPCM_RING ring, int frameCount) {
+    short samples[CAPACITY_FRAMES * CHANNEL_COUNT];
+    int i;
+
+    for (i = 0; i < frameCount; i++) {
+        samples[i * CHANNEL_COUNT] = (short)(nextWriteFrame + i);
+        samples[i * CHANNEL_COUNT + 1] = (short)~(nextWriteFrame + i);
+    }
+
+    if (!PcmrWriteFrames(ring, samples, frameCount)) {
+        return 0;
+    }
+
+    nextWriteFrame += frameCount;
+    return 1;
+}
+
+static int isSilence(const short* samples, int frameCount) {
+    int i;
+
+    for (i = 0; i < frameCount * CHANNEL_COUNT; i++) {
+        if (samples[i] != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void initializeRing(PPCM_RING ring) {
+    nextWriteFrame = 1;
+    if (PcmrInitializeRing(ring, CHANNEL_COUNT, CAPACITY_FRAMES, MIN_TARGET_FRAMES, MAX_TARGET_FRAMES) != 0) {
+        printf("FAIL: unable to initialize the ring\n");
+        exit(1);
+    }
+}
+
+static void testPrimingAndUnderrun(void) {
+    short samples[PERIOD_FRAMES * CHANNEL_COUNT];
+    PCM_RING_STATS stats;
+    PCM_RING ring;
+    int i;
+
+    initializeRing(&ring);
+
+    // Nothing is played until the target is buffered
+    for (i = 0; i < MIN_TARGET_FRAMES / PERIOD_FRAMES; i++) {
+        PcmrReadFrames(&ring, samples, PERIOD_FRAMES);
+        CHECK(isSilence(samples, PERIOD_FRAMES));
+        writeFrames(&ring, PERIOD_FRAMES);
+    }
+
+    // Then the frames come out in order
+    PcmrReadFrames(&ring, samples, PERIOD_FRAMES);
+    for (i = 0; i < PERIOD_FRAMES; i++) {
+        CHECK(samples[i * CHANNEL_COUNT] == (short)(1 + i));
+        CHECK(samples[i * CHANNEL_COUNT + 1] == (short)~(1 + i));
+    }
+
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.fillFrames == MIN_TARGET_FRAMES - PERIOD_FRAMES);
+    CHECK(stats.targetFrames == MIN_TARGET_FRAMES);
+
+    // Reading faster than the writer drains the ring and raises the target
+    for (i = 0; i < MIN_TARGET_FRAMES / PERIOD_FRAMES; i++) {
+        PcmrReadFrames(&ring, samples, PERIOD_FRAMES);
+    }
+
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.underruns == 1);
+    CHECK(stats.fillFrames == 0);
+    CHECK(stats.targetFrames == MIN_TARGET_FRAMES + TARGET_STEP_FRAMES);
+
+    // The ring must be primed to the new target before playing again
+    writeFrames(&ring, MIN_TARGET_FRAMES);
+    PcmrReadFrames(&ring, samples, PERIOD_FRAMES);
+    CHECK(isSilence(samples, PERIOD_FRAMES));
+    writeFrames(&ring, TARGET_STEP_FRAMES);
+    PcmrReadFrames(&ring, samples, PERIOD_FRAMES);
+    CHECK(!isSilence(samples, PERIOD_FRAMES));
+
+    // Each underrun raises the target until it reaches the maximum
+    for (i = 0; i < 20; i++) {
+        PcmrGetStats(&ring, &stats);
+        if (stats.fillFrames < stats.targetFrames) {
+            writeFrames(&ring, stats.targetFrames - stats.fillFrames);
+        }
+        PcmrReadFrames(&ring, drainSamples, stats.targetFrames + PERIOD_FRAMES);
+    }
+
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.targetFrames == MAX_TARGET_FRAMES);
+
+    PcmrDestroyRing(&ring);
+}
+
+static void testOverflow(void) {
+    PCM_RING_STATS stats;
+    PCM_RING ring;
+
+    initializeRing(&ring);
+
+    CHECK(writeFrames(&ring, CAPACITY_FRAMES - PERIOD_FRAMES));
+    CHECK(writeFrames(&ring, PERIOD_FRAMES));
+    CHECK(!writeFrames(&ring, 1));
+
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.overflows == 1);
+    CHECK(stats.fillFrames == CAPACITY_FRAMES);
+
+    PcmrDestroyRing(&ring);
+}
+
+// Plays periods while the writer adds extraFrames more (or fewer) frames
+// than were read every fourth period, as if its clock were off by 0.1%
+static void runDriftingWriter(PPCM_RING ring, int periods, int extraFrames) {
+    short samples[PERIOD_FRAMES * CHANNEL_COUNT];
+    int i;
+
+    for (i = 0; i < periods; i++) {
+        PcmrReadFrames(ring, samples, PERIOD_FRAMES);
+        writeFrames(ring, PERIOD_FRAMES + ((i % 4) == 3 ? extraFrames : 0));
+    }
+}
+
+static void testDriftCompensation(void) {
+    PCM_RING_STATS stats;
+    PCM_RING ring;
+
+    // A fast writer has frames dropped to hold the fill level near the target
+    initializeRing(&ring);
+    writeFrames(&ring, MIN_TARGET_FRAMES);
+    runDriftingWriter(&ring, 4000, 1);
+
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.framesDropped > 0);
+    CHECK(stats.framesInserted == 0);
+    CHECK(stats.underruns == 0 && stats.overflows == 0);
+    CHECK(stats.fillFrames <= stats.targetFrames + DRIFT_TOLERANCE_FRAMES + PERIOD_FRAMES);
+    PcmrDestroyRing(&ring);
+
+    // A slow writer has frames repeated instead of running dry
+    initializeRing(&ring);
+    writeFrames(&ring, MIN_TARGET_FRAMES);
+    runDriftingWriter(&ring, 4000, -1);
+
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.framesInserted > 0);
+    CHECK(stats.framesDropped == 0);
+    CHECK(stats.underruns == 0 && stats.overflows == 0);
+    CHECK(stats.fillFrames >= stats.targetFrames - DRIFT_TOLERANCE_FRAMES - PERIOD_FRAMES);
+    PcmrDestroyRing(&ring);
+}
+
+static void testTargetRecovery(void) {
+    short samples[PERIOD_FRAMES * CHANNEL_COUNT];
+    PCM_RING_STATS stats;
+    PCM_RING ring;
+
+    initializeRing(&ring);
+
+    // One underrun raises the target a step
+    writeFrames(&ring, MIN_TARGET_FRAMES);
+    PcmrReadFrames(&ring, samples, PERIOD_FRAMES);
+    PcmrReadFrames(&ring, drainSamples, MIN_TARGET_FRAMES);
+    writeFrames(&ring, MIN_TARGET_FRAMES + TARGET_STEP_FRAMES);
+
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.underruns == 1);
+    CHECK(stats.targetFrames == MIN_TARGET_FRAMES + TARGET_STEP_FRAMES);
+
+    // The fill level is measured over 1 second windows. 9 seconds with
+    // spare audio buffered isn't enough to lower the target.
+    runDriftingWriter(&ring, 9 * SAMPLE_RATE / PERIOD_FRAMES, 0);
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.targetFrames == MIN_TARGET_FRAMES + TARGET_STEP_FRAMES);
+
+    // But 10 seconds is
+    runDriftingWriter(&ring, SAMPLE_RATE / PERIOD_FRAMES + 1, 0);
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.underruns == 1);
+    CHECK(stats.targetFrames == MIN_TARGET_FRAMES);
+
+    // The surplus audio is then dropped
+    runDriftingWriter(&ring, 2 * SAMPLE_RATE / PERIOD_FRAMES, 0);
+    PcmrGetStats(&ring, &stats);
+    CHECK(stats.framesDropped > 0);
+    CHECK(stats.fillFrames <= MIN_TARGET_FRAMES + DRIFT_TOLERANCE_FRAMES + PERIOD_FRAMES);
+
+    PcmrDestroyRing(&ring);
+}
+
+// Writes periods on the stream's clock while the sink reads on its own
+static void runSink(int sinkSampleRate, const char* path, PPCM_RING_STATS stats) {
+    PCM_FILE_SINK sink;
+    PCM_RING ring;
+    uint64_t startUs, deadlineUs, nowUs;
+    int periods;
+
+    initializeRing(&ring);
+    if (PfsStartSink(&sink, &ring, path, sinkSampleRate, PERIOD_FRAMES) != 0) {
+        printf("FAIL: unable to start the sink\n");
+        failures++;
+        PcmrDestroyRing(&ring);
+        return;
+    }
+
+    startUs = PltGetMicros();
+    for (periods = 0; periods < SINK_RUN_MS * (SAMPLE_RATE / 1000) / PERIOD_FRAMES; periods++) {
+        writeFrames(&ring, PERIOD_FRAMES);
+
+        deadlineUs = startUs + (uint64_t)(periods + 1) * PERIOD_FRAMES * 1000000 / SAMPLE_RATE;
+        nowUs = PltGetMicros();
+        if (deadlineUs > nowUs) {
+            PltSleepMs((int)((deadlineUs - nowUs + 999) / 1000));
+        }
+    }
+
+    PfsStopSink(&sink);
+    PcmrGetStats(&ring, stats);
+    PcmrDestroyRing(&ring);
+}
+
+static void testFileSink(void) {
+    char path[] = "/tmp/pcm_ring_test.XXXXXX";
+    PCM_RING_STATS stats;
+    FILE* file;
+    long length;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        printf("FAIL: unable to create a temporary file\n");
+        failures++;
+        return;
+    }
+    close(fd);
+
+    // A sink running fast is fed repeated frames
+    runSink(SAMPLE_RATE + SAMPLE_RATE / 1000 * SINK_DRIFT_PPM / 1000, path, &stats);
+    printf("fast sink: fill %d target %d underruns %u inserted %u dropped %u\n", stats.fillFrames,
+           stats.targetFrames, stats.underruns, stats.framesInserted, stats.framesDropped);
+    CHECK(stats.framesInserted > 0);
+    CHECK(stats.overflows == 0);
+
+    // Everything the sink read was written out in whole periods
+    file = fopen(path, "rb");
+    CHECK(file != NULL);
+    if (file != NULL) {
+        fseek(file, 0, SEEK_END);
+        length = ftell(file);
+        fclose(file);
+
+        CHECK(length > 0);
+        CHECK(length % (PERIOD_FRAMES * CHANNEL_COUNT * sizeof(short)) == 0);
+    }
+    unlink(path);
+
+    // A sink running slow has frames dropped
+    runSink(SAMPLE_RATE - SAMPLE_RATE / 1000 * SINK_DRIFT_PPM / 1000, NULL, &stats);
+    printf("slow sink: fill %d target %d underruns %u inserted %u dropped %u\n", stats.fillFrames,
+           stats.targetFrames, stats.underruns, stats.framesInserted, stats.framesDropped);
+    CHECK(stats.framesDropped > 0);
+    CHECK(stats.overflows == 0);
+}
+
+int main(int argc, char** argv) {
+    testPrimingAndUnderrun();
+    testOverflow();
+    testDriftCompensation();
+    testTargetRecovery();
+    testFileSink();
+
+    if (failures != 0) {
+        printf("pcm_ring_test: %d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("pcm_ring_test: passed\n");
+    return 0;
+}
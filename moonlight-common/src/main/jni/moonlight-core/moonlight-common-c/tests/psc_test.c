@@ -0,0 +1,275 @@
+// Checks when the parameter set cache reports an IDR frame's parameter sets
+// as unchanged. Renderers skip reconfiguring the decoder on that result, so
+// reporting a change as unchanged would leave the decoder with a stale
+// configuration. The sets must differ in any way or in number, sets too large
+// or too many to remember must never match, and submitting through the
+// depacketizer must report a change after the renderer returns DR_NEED_IDR.
+
+#include "Limelight-internal.h"
+#include "Video.h"
+#include "ParameterSetCache.h"
+
+#include <stdio.h>
+
+static int failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+// A frame's buffer list: parameter sets followed by the picture data
+typedef struct _TEST_FRAME {
+    LENTRY entries[PSC_MAX_SETS + 2];
+    int entryCount;
+} TEST_FRAME, *PTEST_FRAME;
+
+static char vps[] = { 0x40, 0x01, 0x0c, 0x01, 0xff, 0xff };
+static char sps[] = { 0x67, 0x64, 0x00, 0x28, 0xac, 0xd9, 0x40, 0x50 };
+static char pps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0 };
+
+// Differs from pps in its last byte, and by one extra byte
+static char changedPps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc1 };
+static char longerPps[] = { 0x68, 0xeb, 0xe3, 0xcb, 0x22, 0xc0, 0x80 };
+
+static char largestSet[PSC_MAX_SET_SIZE];
+static char oversizedSet[PSC_MAX_SET_SIZE + 1];
+
+static char picture[] = { 0x65, 0x88, 0x84, 0x00, 0x33 };
+static char otherPicture[] = { 0x65, 0x88, 0x80, 0x10, 0x00, 0x01 };
+
+static void startFrame(PTEST_FRAME frame) {
+    memset(frame, 0, sizeof(*frame));
+}
+
+static void addBuffer(PTEST_FRAME frame, int bufferType, char* data, int length) {
+    PLENTRY entry = &frame->entries[frame->entryCount];
+
+    LC_ASSERT(frame->entryCount < (int)(sizeof(frame->entries) / sizeof(frame->entries[0])));
+
+    entry->data = data;
+    entry->length = length;
+    entry->bufferType = bufferType;
+    if (frame->entryCount > 0) {
+        frame->entries[frame->entryCount - 1].next = entry;
+    }
+    frame->entryCount++;
+}
+
+// Builds an H.264 IDR frame with the given PPS
+static void buildFrame(PTEST_FRAME frame, char* ppsData, int ppsLength, char* pictureData, int pictureLength) {
+    startFrame(frame);
+    addBuffer(frame, BUFFER_TYPE_SPS, sps, sizeof(sps));
+    addBuffer(frame, BUFFER_TYPE_PPS, ppsData, ppsLength);
+    addBuffer(frame, BUFFER_TYPE_PICDATA, pictureData, pictureLength);
+}
+
+static void testChanges(void) {
+    PARAMETER_SET_CACHE cache;
+    TEST_FRAME frame;
+
+    PscInitialize(&cache);
+
+    // Nothing to compare the first sets against
+    buildFrame(&frame, pps, sizeof(pps), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+
+    // Only the picture data differs
+    buildFrame(&frame, pps, sizeof(pps), otherPicture, sizeof(otherPicture));
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+
+    // The SPS still matches, so the changed PPS must replace the old one
+    buildFrame(&frame, changedPps, sizeof(changedPps), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+    buildFrame(&frame, pps, sizeof(pps), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+
+    buildFrame(&frame, longerPps, sizeof(longerPps), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    buildFrame(&frame, pps, sizeof(pps), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+
+    // The same bytes as a different kind of parameter set
+    startFrame(&frame);
+    addBuffer(&frame, BUFFER_TYPE_SPS, sps, sizeof(sps));
+    addBuffer(&frame, BUFFER_TYPE_VPS, pps, sizeof(pps));
+    addBuffer(&frame, BUFFER_TYPE_PICDATA, picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+
+    CHECK(cache.changes == 6 && cache.repeats == 3);
+}
+
+static void testSetCount(void) {
+    PARAMETER_SET_CACHE cache;
+    TEST_FRAME frame;
+
+    PscInitialize(&cache);
+
+    buildFrame(&frame, pps, sizeof(pps), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+
+    // A VPS added ahead of the same SPS and PPS
+    startFrame(&frame);
+    addBuffer(&frame, BUFFER_TYPE_VPS, vps, sizeof(vps));
+    addBuffer(&frame, BUFFER_TYPE_SPS, sps, sizeof(sps));
+    addBuffer(&frame, BUFFER_TYPE_PPS, pps, sizeof(pps));
+    addBuffer(&frame, BUFFER_TYPE_PICDATA, picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+
+    // A set added or removed at the end, after sets that all match
+    startFrame(&frame);
+    addBuffer(&frame, BUFFER_TYPE_VPS, vps, sizeof(vps));
+    addBuffer(&frame, BUFFER_TYPE_SPS, sps, sizeof(sps));
+    addBuffer(&frame, BUFFER_TYPE_PICDATA, picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+    startFrame(&frame);
+    addBuffer(&frame, BUFFER_TYPE_VPS, vps, sizeof(vps));
+    addBuffer(&frame, BUFFER_TYPE_SPS, sps, sizeof(sps));
+    addBuffer(&frame, BUFFER_TYPE_PPS, pps, sizeof(pps));
+    addBuffer(&frame, BUFFER_TYPE_PICDATA, picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+
+    // More sets than the cache holds are never reported as unchanged
+    startFrame(&frame);
+    addBuffer(&frame, BUFFER_TYPE_VPS, vps, sizeof(vps));
+    addBuffer(&frame, BUFFER_TYPE_SPS, sps, sizeof(sps));
+    addBuffer(&frame, BUFFER_TYPE_PPS, pps, sizeof(pps));
+    addBuffer(&frame, BUFFER_TYPE_PPS, changedPps, sizeof(changedPps));
+    addBuffer(&frame, BUFFER_TYPE_PPS, longerPps, sizeof(longerPps));
+    addBuffer(&frame, BUFFER_TYPE_PICDATA, picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(cache.setCount == 0);
+
+    // The sets before them weren't remembered either
+    startFrame(&frame);
+    addBuffer(&frame, BUFFER_TYPE_VPS, vps, sizeof(vps));
+    addBuffer(&frame, BUFFER_TYPE_SPS, sps, sizeof(sps));
+    addBuffer(&frame, BUFFER_TYPE_PPS, pps, sizeof(pps));
+    addBuffer(&frame, BUFFER_TYPE_PICDATA, picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+}
+
+static void testSetSize(void) {
+    PARAMETER_SET_CACHE cache;
+    TEST_FRAME frame;
+
+    memset(largestSet, 0x5a, sizeof(largestSet));
+    memset(oversizedSet, 0x5a, sizeof(oversizedSet));
+
+    PscInitialize(&cache);
+
+    buildFrame(&frame, largestSet, sizeof(largestSet), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+
+    // A set too large to remember is never reported as unchanged, and
+    // neither is the next frame after it
+    buildFrame(&frame, oversizedSet, sizeof(oversizedSet), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    buildFrame(&frame, largestSet, sizeof(largestSet), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+}
+
+static void testInvalidate(void) {
+    PARAMETER_SET_CACHE cache;
+    TEST_FRAME frame;
+
+    PscInitialize(&cache);
+
+    buildFrame(&frame, pps, sizeof(pps), picture, sizeof(picture));
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+
+    PscInvalidate(&cache);
+    CHECK(PscUpdate(&cache, frame.entries) == 0);
+    CHECK(PscUpdate(&cache, frame.entries) == 1);
+}
+
+static int lastFlags;
+static int nextResult;
+
+static int submitDecodeUnit(PDECODE_UNIT decodeUnit) {
+    lastFlags = decodeUnit->flags;
+    return nextResult;
+}
+
+// Submits a frame through the depacketizer with the renderer returning
+// result, and returns the flags the renderer saw
+static int submitFrame(PTEST_FRAME frame, int frameType, int result) {
+    QUEUED_DECODE_UNIT qdu;
+    int i;
+
+    memset(&qdu, 0, sizeof(qdu));
+    qdu.decodeUnit.frameType = frameType;
+    qdu.decodeUnit.flags = DU_FLAG_END_OF_FRAME;
+    qdu.decodeUnit.bufferList = frame->entries;
+    for (i = 0; i < frame->entryCount; i++) {
+        qdu.decodeUnit.fullLength += frame->entries[i].length;
+    }
+
+    lastFlags = 0;
+    nextResult = result;
+    CHECK(submitQueuedDecodeUnit(&qdu) == result);
+    return lastFlags;
+}
+
+static void testDecoderRefresh(void) {
+    VIDEO_STREAM_STATS stats;
+    TEST_FRAME idrFrame, frame;
+
+    LiInitializeVideoCallbacks(&VideoCallbacks);
+    VideoCallbacks.submitDecodeUnit = submitDecodeUnit;
+    VideoCallbacks.capabilities = CAPABILITY_DIRECT_SUBMIT;
+    NegotiatedVideoFormat = VIDEO_FORMAT_H264;
+    initializeVideoDepacketizer(1024);
+
+    buildFrame(&idrFrame, pps, sizeof(pps), picture, sizeof(picture));
+    startFrame(&frame);
+    addBuffer(&frame, BUFFER_TYPE_PICDATA, otherPicture, sizeof(otherPicture));
+
+    CHECK(submitFrame(&idrFrame, FRAME_TYPE_IDR, DR_OK) == (DU_FLAG_END_OF_FRAME | DU_FLAG_PARAMETER_SETS_CHANGED));
+    CHECK(submitFrame(&frame, FRAME_TYPE_PFRAME, DR_OK) == DU_FLAG_END_OF_FRAME);
+    CHECK(submitFrame(&idrFrame, FRAME_TYPE_IDR, DR_OK) == (DU_FLAG_END_OF_FRAME | DU_FLAG_PARAMETER_SETS_UNCHANGED));
+
+    // The renderer may have reset its decoder, so the same sets must be
+    // given to it again
+    CHECK(submitFrame(&frame, FRAME_TYPE_PFRAME, DR_NEED_IDR) == DU_FLAG_END_OF_FRAME);
+    CHECK(submitFrame(&idrFrame, FRAME_TYPE_IDR, DR_OK) == (DU_FLAG_END_OF_FRAME | DU_FLAG_PARAMETER_SETS_CHANGED));
+    CHECK(submitFrame(&idrFrame, FRAME_TYPE_IDR, DR_OK) == (DU_FLAG_END_OF_FRAME | DU_FLAG_PARAMETER_SETS_UNCHANGED));
+
+    // Even when the IDR frame itself was rejected
+    CHECK(submitFrame(&idrFrame, FRAME_TYPE_IDR, DR_NEED_IDR) == (DU_FLAG_END_OF_FRAME | DU_FLAG_PARAMETER_SETS_UNCHANGED));
+    CHECK(submitFrame(&idrFrame, FRAME_TYPE_IDR, DR_OK) == (DU_FLAG_END_OF_FRAME | DU_FLAG_PARAMETER_SETS_CHANGED));
+
+    getVideoDepacketizerStats(&stats);
+    CHECK(stats.parameterSetChanges == 3 && stats.parameterSetRepeats == 3);
+
+    destroyVideoDepacketizer();
+}
+
+int main(int argc, char** argv) {
+    testChanges();
+    testSetCount();
+    testSetSize();
+    testInvalidate();
+    testDecoderRefresh();
+
+    if (failures != 0) {
+        printf("psc_test: %d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("psc_test: passed\n");
+    return 0;
+}
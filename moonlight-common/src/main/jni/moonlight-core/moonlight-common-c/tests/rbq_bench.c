@@ -0,0 +1,250 @@
+// Compares the lock-free ring with the linked blocking queue through the Lbq*
+// API. The contention run has several producers offering to one waiting
+// consumer, with one producer occasionally flushing the queue as the video
+// receive thread does on overflow. The ping-pong run passes an item back and
+// forth between two threads to measure the wakeup latency of a waiting
+// consumer. Every item must be consumed or flushed exactly once.
+//
+// Usage: rbq_bench [producers] [items per producer]
+
+#include "Limelight-internal.h"
+#include "LinkedBlockingQueue.h"
+#include "PlatformAtomics.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <time.h>
+
+#define QUEUE_BOUND 15
+
+// One producer flushes the queue after this many of its offers
+#define FLUSH_INTERVAL 1000
+
+#define PING_PONG_ROUND_TRIPS 20000
+
+#define MAX_PRODUCERS 16
+
+typedef struct _BENCH_ITEM {
+    LINKED_BLOCKING_QUEUE_ENTRY entry;
+    int producer;
+    int index;
+} BENCH_ITEM, *PBENCH_ITEM;
+
+typedef struct _PRODUCER_CONTEXT {
+    PLT_THREAD thread;
+    int index;
+    PBENCH_ITEM items;
+} PRODUCER_CONTEXT;
+
+static LINKED_BLOCKING_QUEUE queue;
+static LINKED_BLOCKING_QUEUE pongQueue;
+static int producerCount;
+static int itemsPerProducer;
+static unsigned char* seen;
+static volatile int duplicates;
+static volatile int flushedItems;
+static BENCH_ITEM endItem;
+
+static unsigned long long nowNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int initializeQueue(PLINKED_BLOCKING_QUEUE queueHead, int lockFree) {
+    if (lockFree) {
+        return LbqInitializeLockFreeQueue(queueHead, QUEUE_BOUND);
+    }
+    else {
+        return LbqInitializeLinkedBlockingQueue(queueHead, QUEUE_BOUND);
+    }
+}
+
+// Records an item leaving the queue by either path
+static void markSeen(PBENCH_ITEM item) {
+    unsigned char* flag = &seen[item->producer * itemsPerProducer + item->index];
+
+    if (*flag) {
+        PltAtomicAddInt(&duplicates, 1);
+    }
+    *flag = 1;
+}
+
+static void offerUntilQueued(PBENCH_ITEM item) {
+    while (LbqOfferQueueItem(&queue, item, &item->entry) == LBQ_BOUND_EXCEEDED) {
+        sched_yield();
+    }
+}
+
+static void ProducerThreadProc(void* context) {
+    PRODUCER_CONTEXT* producer = (PRODUCER_CONTEXT*)context;
+    PLINKED_BLOCKING_QUEUE_ENTRY entry;
+    int i;
+
+    for (i = 0; i < itemsPerProducer; i++) {
+        offerUntilQueued(&producer->items[i]);
+
+        if (producer->index == 0 && (i % FLUSH_INTERVAL) == FLUSH_INTERVAL - 1) {
+            for (entry = LbqFlushQueueItems(&queue); entry != NULL; entry = entry->flink) {
+                markSeen((PBENCH_ITEM)entry->data);
+                PltAtomicAddInt(&flushedItems, 1);
+            }
+        }
+    }
+}
+
+static void ConsumerThreadProc(void* context) {
+    PBENCH_ITEM item;
+
+    for (;;) {
+        if (LbqWaitForQueueElement(&queue, (void**)&item) != LBQ_SUCCESS || item == &endItem) {
+            return;
+        }
+        markSeen(item);
+    }
+}
+
+// Returns the average time per item or 0 if an item was lost or duplicated
+static double runContention(int lockFree) {
+    PRODUCER_CONTEXT producers[MAX_PRODUCERS];
+    PLT_THREAD consumer;
+    unsigned long long startNs, elapsedNs;
+    int total = producerCount * itemsPerProducer;
+    int missing;
+    int i, j;
+
+    initializeQueue(&queue, lockFree);
+    seen = calloc(total, 1);
+    duplicates = 0;
+    flushedItems = 0;
+
+    for (i = 0; i < producerCount; i++) {
+        producers[i].index = i;
+        producers[i].items = malloc(itemsPerProducer * sizeof(BENCH_ITEM));
+        for (j = 0; j < itemsPerProducer; j++) {
+            producers[i].items[j].producer = i;
+            producers[i].items[j].index = j;
+        }
+    }
+
+    startNs = nowNs();
+    PltCreateThread("BenchConsumer", THREAD_ROLE_DEFAULT, ConsumerThreadProc, NULL, &consumer);
+    for (i = 0; i < producerCount; i++) {
+        PltCreateThread("BenchProducer", THREAD_ROLE_DEFAULT, ProducerThreadProc, &producers[i], &producers[i].thread);
+    }
+    for (i = 0; i < producerCount; i++) {
+        PltJoinThread(&producers[i].thread);
+        PltCloseThread(&producers[i].thread);
+    }
+
+    // Everything offered before the end marker is consumed before it
+    offerUntilQueued(&endItem);
+    PltJoinThread(&consumer);
+    PltCloseThread(&consumer);
+    elapsedNs = nowNs() - startNs;
+
+    missing = 0;
+    for (i = 0; i < total; i++) {
+        if (!seen[i]) {
+            missing++;
+        }
+    }
+
+    printf("  %-4s contention: %d producers, %d items, %d flushed, %.0f ns/item\n",
+           lockFree ? "ring" : "list", producerCount, total, flushedItems, (double)elapsedNs / total);
+    if (missing != 0 || duplicates != 0) {
+        printf("FAIL: %d items lost and %d duplicated\n", missing, duplicates);
+    }
+
+    free(seen);
+    for (i = 0; i < producerCount; i++) {
+        free(producers[i].items);
+    }
+    LbqDestroyLinkedBlockingQueue(&queue);
+
+    return (missing != 0 || duplicates != 0) ? 0 : (double)elapsedNs / total;
+}
+
+static void PongThreadProc(void* context) {
+    PBENCH_ITEM item;
+
+    for (;;) {
+        if (LbqWaitForQueueElement(&queue, (void**)&item) != LBQ_SUCCESS) {
+            return;
+        }
+        LbqOfferQueueItem(&pongQueue, item, &item->entry);
+        if (item == &endItem) {
+            return;
+        }
+    }
+}
+
+static int compareUll(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static int runPingPong(int lockFree) {
+    static unsigned long long roundTripNs[PING_PONG_ROUND_TRIPS];
+    BENCH_ITEM ball;
+    PBENCH_ITEM item;
+    PLT_THREAD pong;
+    unsigned long long startNs, totalNs;
+    int i;
+
+    initializeQueue(&queue, lockFree);
+    initializeQueue(&pongQueue, lockFree);
+    PltCreateThread("BenchPong", THREAD_ROLE_DEFAULT, PongThreadProc, NULL, &pong);
+
+    totalNs = 0;
+    for (i = 0; i < PING_PONG_ROUND_TRIPS; i++) {
+        startNs = nowNs();
+        LbqOfferQueueItem(&queue, &ball, &ball.entry);
+        if (LbqWaitForQueueElement(&pongQueue, (void**)&item) != LBQ_SUCCESS || item != &ball) {
+            printf("FAIL: ping-pong returned the wrong item\n");
+            return -1;
+        }
+        roundTripNs[i] = nowNs() - startNs;
+        totalNs += roundTripNs[i];
+    }
+
+    LbqOfferQueueItem(&queue, &endItem, &endItem.entry);
+    LbqWaitForQueueElement(&pongQueue, (void**)&item);
+    PltJoinThread(&pong);
+    PltCloseThread(&pong);
+    LbqDestroyLinkedBlockingQueue(&queue);
+    LbqDestroyLinkedBlockingQueue(&pongQueue);
+
+    qsort(roundTripNs, PING_PONG_ROUND_TRIPS, sizeof(roundTripNs[0]), compareUll);
+    printf("  %-4s ping-pong round trip: avg %llu ns, p50 %llu ns, p99 %llu ns\n",
+           lockFree ? "ring" : "list", totalNs / PING_PONG_ROUND_TRIPS,
+           roundTripNs[PING_PONG_ROUND_TRIPS / 2], roundTripNs[PING_PONG_ROUND_TRIPS * 99 / 100]);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int failed = 0;
+    int lockFree;
+
+    producerCount = argc > 1 ? atoi(argv[1]) : 3;
+    itemsPerProducer = argc > 2 ? atoi(argv[2]) : 200000;
+    if (producerCount <= 0 || producerCount > MAX_PRODUCERS || itemsPerProducer <= 0) {
+        fprintf(stderr, "Usage: %s [producers (1-%d)] [items per producer]\n", argv[0], MAX_PRODUCERS);
+        return 2;
+    }
+
+    printf("Queue bound %d\n", QUEUE_BOUND);
+    for (lockFree = 0; lockFree <= 1; lockFree++) {
+        if (runContention(lockFree) == 0) {
+            failed = 1;
+        }
+        if (runPingPong(lockFree) != 0) {
+            failed = 1;
+        }
+    }
+
+    return failed;
+}
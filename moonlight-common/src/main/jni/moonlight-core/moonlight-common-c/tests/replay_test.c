@@ -0,0 +1,182 @@
+// Records a short session against the loopback server with LiStartRtpCapture()
+// and replays the capture through the video receive path, first as it was
+// received and then with packet loss and reordering injected. Every frame a
+// replay submits must match what the server sent, a clean replay must submit
+// every frame the live session did, and replays with the same seed must drop,
+// reorder, and submit exactly the same packets and frames.
+
+#include "LoopbackServer.h"
+#include "RtpReplay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SESSION_MS 1500
+
+// The live decoder asks for an IDR frame this often, so replays with
+// unrecoverable loss don't stall until the end of the capture
+#define IDR_REQUEST_INTERVAL 30
+
+static int failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+typedef struct _REPLAY_RESULT {
+    RTP_REPLAY_STATS stats;
+    unsigned int corruptDecodeUnits;
+
+    // Hash of the number and length of every submitted frame in order
+    unsigned int frameHash;
+} REPLAY_RESULT, *PREPLAY_RESULT;
+
+static unsigned int liveFrames;
+static REPLAY_RESULT* currentResult;
+
+static int liveSubmitDecodeUnit(PDECODE_UNIT decodeUnit) {
+    return ++liveFrames % IDR_REQUEST_INTERVAL == 0 ? DR_NEED_IDR : DR_OK;
+}
+
+static int replaySubmitDecodeUnit(PDECODE_UNIT decodeUnit) {
+    if (LiCheckLoopbackDecodeUnit(decodeUnit, NULL) <= 0) {
+        currentResult->corruptDecodeUnits++;
+    }
+
+    currentResult->frameHash = (currentResult->frameHash ^ (unsigned int)decodeUnit->frameNumber) * 16777619;
+    currentResult->frameHash = (currentResult->frameHash ^ (unsigned int)decodeUnit->fullLength) * 16777619;
+    return DR_OK;
+}
+
+// Returns 0 if the session couldn't be recorded
+static int recordSession(const char* path) {
+    SERVER_INFORMATION serverInfo;
+    STREAM_CONFIGURATION streamConfig;
+    DECODER_RENDERER_CALLBACKS drCallbacks;
+    int err;
+
+    if (LiStartLoopbackServer(NULL) != 0) {
+        printf("Unable to start the loopback server\n");
+        return 0;
+    }
+
+    err = LiStartRtpCapture(path);
+    if (err != 0) {
+        printf("Unable to start capturing: %d\n", err);
+        LiStopLoopbackServer();
+        return 0;
+    }
+
+    LiInitializeServerInformation(&serverInfo);
+    serverInfo.address = "127.0.0.1";
+    serverInfo.serverInfoAppVersion = "7.1.431.0";
+    serverInfo.serverInfoGfeVersion = "3.20.0";
+
+    LiInitializeStreamConfiguration(&streamConfig);
+    streamConfig.width = 1280;
+    streamConfig.height = 720;
+    streamConfig.fps = 60;
+    streamConfig.bitrate = 10000;
+    streamConfig.packetSize = 1024;
+    streamConfig.audioConfiguration = AUDIO_CONFIGURATION_STEREO;
+
+    LiInitializeVideoCallbacks(&drCallbacks);
+    drCallbacks.submitDecodeUnit = liveSubmitDecodeUnit;
+
+    err = LiStartConnection(&serverInfo, &streamConfig, NULL, &drCallbacks, NULL, NULL, 0, NULL, 0);
+    if (err == 0) {
+        usleep(SESSION_MS * 1000);
+        LiStopConnection();
+    }
+    else {
+        printf("Unable to connect to the loopback server: %d\n", err);
+    }
+
+    LiStopRtpCapture();
+    LiStopLoopbackServer();
+    return err == 0;
+}
+
+static void replay(const char* path, PRTP_REPLAY_OPTIONS options, PREPLAY_RESULT result) {
+    DECODER_RENDERER_CALLBACKS drCallbacks;
+    int err;
+
+    memset(result, 0, sizeof(*result));
+    result->frameHash = 2166136261U;
+    currentResult = result;
+
+    // Submitting on the replay thread keeps the decode unit queue from
+    // overflowing, so nothing depends on thread timing
+    LiInitializeVideoCallbacks(&drCallbacks);
+    drCallbacks.submitDecodeUnit = replaySubmitDecodeUnit;
+    drCallbacks.capabilities = CAPABILITY_DIRECT_SUBMIT;
+
+    err = LiReplayRtpCapture(path, options, NULL, &drCallbacks, NULL, 0, &result->stats);
+    CHECK(err == 0);
+
+    printf("%u packets (%u dropped, %u reordered): %u frames, %u FEC recovered, %u unrecoverable\n",
+           result->stats.packetsRead, result->stats.packetsDropped, result->stats.packetsReordered,
+           result->stats.framesSubmitted, result->stats.videoStats.fecFramesRecovered,
+           result->stats.videoStats.fecFramesUnrecoverable);
+}
+
+int main(int argc, char** argv) {
+    char path[] = "/tmp/replay_test_XXXXXX";
+    RTP_REPLAY_OPTIONS options;
+    REPLAY_RESULT clean, lossy, repeated;
+    int fd;
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        printf("Unable to create the capture file\n");
+        return 1;
+    }
+    close(fd);
+
+    if (!recordSession(path)) {
+        unlink(path);
+        return 1;
+    }
+
+    memset(&options, 0, sizeof(options));
+    replay(path, &options, &clean);
+    CHECK(clean.stats.packetsRead != 0);
+    CHECK(clean.stats.packetsDropped == 0 && clean.stats.packetsReordered == 0);
+    CHECK(clean.stats.framesSubmitted >= liveFrames);
+    CHECK(clean.stats.videoStats.fecFramesUnrecoverable == 0);
+    CHECK(clean.corruptDecodeUnits == 0);
+
+    options.lossPercent = 8;
+    options.reorderPercent = 5;
+    options.reorderDistance = 3;
+    options.seed = 12345;
+    replay(path, &options, &lossy);
+    CHECK(lossy.stats.packetsDropped != 0 && lossy.stats.packetsReordered != 0);
+    CHECK(lossy.stats.videoStats.fecFramesRecovered != 0);
+    CHECK(lossy.stats.framesSubmitted != 0 && lossy.stats.framesSubmitted <= clean.stats.framesSubmitted);
+    CHECK(lossy.corruptDecodeUnits == 0);
+
+    replay(path, &options, &repeated);
+    CHECK(repeated.stats.packetsDropped == lossy.stats.packetsDropped);
+    CHECK(repeated.stats.packetsReordered == lossy.stats.packetsReordered);
+    CHECK(repeated.stats.framesSubmitted == lossy.stats.framesSubmitted);
+    CHECK(repeated.stats.videoStats.fecFramesRecovered == lossy.stats.videoStats.fecFramesRecovered);
+    CHECK(repeated.frameHash == lossy.frameHash);
+    CHECK(repeated.corruptDecodeUnits == 0);
+
+    unlink(path);
+
+    if (failures != 0) {
+        printf("replay_test: %d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("replay_test: passed\n");
+    return 0;
+}
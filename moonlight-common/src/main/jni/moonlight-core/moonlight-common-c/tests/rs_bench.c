@@ -0,0 +1,271 @@
+// Measures reed_solomon_encode() and reed_solomon_reconstruct() throughput with
+// each GF(2^8) multiply kernel this CPU supports and checks that every kernel
+// produces the same output as the scalar code. Shard sizes that aren't a
+// multiple of the SIMD width are only checked, so each kernel's scalar tail is
+// covered too.
+//
+// Usage: rs_bench [data shards] [parity shards]
+
+#include "../reedsolomon/rs.c"
+
+#include <time.h>
+
+// Each measurement runs for at least this long
+#define MIN_RUN_NS 200000000ULL
+
+typedef struct _BENCH_KERNEL {
+    const char* name;
+    gf_mul_kernel kernel;
+} BENCH_KERNEL;
+
+static const int shardSizes[] = { 64, 256, 1024, 1408, 4096 };
+static const int checkedShardSizes[] = { 1, 31, 33, 1001 };
+
+static unsigned long long nowNs(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int getKernels(BENCH_KERNEL* kernels) {
+    int count = 0;
+
+    kernels[count].name = "scalar";
+    kernels[count++].kernel = NULL;
+
+#if defined(RS_SIMD_NEON)
+    kernels[count].name = "neon";
+    kernels[count++].kernel = mul_neon;
+#elif defined(RS_SIMD_X86)
+    {
+        int ssse3, avx2;
+
+        x86_cpu_features(&ssse3, &avx2);
+        if (ssse3) {
+            kernels[count].name = "ssse3";
+            kernels[count++].kernel = mul_ssse3;
+        }
+        if (avx2) {
+            kernels[count].name = "avx2";
+            kernels[count++].kernel = mul_avx2;
+        }
+    }
+#endif
+
+    return count;
+}
+
+// Fills the data shards with a fixed pseudo-random pattern
+static void fillShards(unsigned char** shards, int dataShards, int shardSize) {
+    unsigned int seed = 12345;
+    int i, j;
+
+    for (i = 0; i < dataShards; i++) {
+        for (j = 0; j < shardSize; j++) {
+            seed = seed * 1103515245 + 12345;
+            shards[i][j] = (unsigned char)(seed >> 16);
+        }
+    }
+}
+
+// Erases the first parity-count data shards, as a burst of lost packets would
+static void eraseShards(unsigned char** shards, unsigned char* marks, int dataShards, int parityShards, int shardSize) {
+    int i;
+
+    memset(marks, 0, dataShards + parityShards);
+    for (i = 0; i < parityShards && i < dataShards; i++) {
+        memset(shards[i], 0, shardSize);
+        marks[i] = 1;
+    }
+}
+
+// Encodes and reconstructs one set of shards with each kernel and compares the
+// results against the scalar kernel's. Returns 0 if they all match.
+static int checkKernels(reed_solomon* rs, BENCH_KERNEL* kernels, int kernelCount,
+                        int dataShards, int parityShards, int shardSize) {
+    int totalShards = dataShards + parityShards;
+    unsigned char* shards[DATA_SHARDS_MAX];
+    unsigned char* expected[DATA_SHARDS_MAX];
+    unsigned char marks[DATA_SHARDS_MAX];
+    int failed = 0;
+    int k, i;
+
+    for (i = 0; i < totalShards; i++) {
+        shards[i] = malloc(shardSize);
+        expected[i] = malloc(shardSize);
+        if (shards[i] == NULL || expected[i] == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+
+    for (k = 0; k < kernelCount; k++) {
+        simd_mul = kernels[k].kernel;
+
+        fillShards(shards, dataShards, shardSize);
+        reed_solomon_encode(rs, shards, totalShards, shardSize);
+        if (k == 0) {
+            for (i = 0; i < totalShards; i++) {
+                memcpy(expected[i], shards[i], shardSize);
+            }
+        }
+        else {
+            for (i = dataShards; i < totalShards; i++) {
+                if (memcmp(expected[i], shards[i], shardSize) != 0) {
+                    printf("FAIL: %s parity differs from scalar at shard size %d\n", kernels[k].name, shardSize);
+                    failed = 1;
+                    break;
+                }
+            }
+        }
+
+        eraseShards(shards, marks, dataShards, parityShards, shardSize);
+        if (reed_solomon_reconstruct(rs, shards, marks, totalShards, shardSize) != 0) {
+            printf("FAIL: %s reconstruction failed at shard size %d\n", kernels[k].name, shardSize);
+            failed = 1;
+        }
+        for (i = 0; i < dataShards; i++) {
+            if (memcmp(expected[i], shards[i], shardSize) != 0) {
+                printf("FAIL: %s reconstructed data differs at shard size %d\n", kernels[k].name, shardSize);
+                failed = 1;
+                break;
+            }
+        }
+    }
+
+    for (i = 0; i < totalShards; i++) {
+        free(shards[i]);
+        free(expected[i]);
+    }
+
+    return failed;
+}
+
+int main(int argc, char** argv) {
+    BENCH_KERNEL kernels[3];
+    int kernelCount;
+    int dataShards, parityShards, totalShards;
+    unsigned char** shards;
+    unsigned char** expected;
+    unsigned char* marks;
+    reed_solomon* rs;
+    int failed = 0;
+    int s, k, i;
+
+    dataShards = argc > 1 ? atoi(argv[1]) : 40;
+    parityShards = argc > 2 ? atoi(argv[2]) : 8;
+    totalShards = dataShards + parityShards;
+    if (dataShards <= 0 || parityShards <= 0 || totalShards > DATA_SHARDS_MAX) {
+        fprintf(stderr, "Usage: %s [data shards] [parity shards]\n", argv[0]);
+        return 2;
+    }
+
+    reed_solomon_init();
+    kernelCount = getKernels(kernels);
+
+    rs = reed_solomon_new(dataShards, parityShards);
+    shards = malloc(totalShards * sizeof(*shards));
+    expected = malloc(totalShards * sizeof(*expected));
+    marks = malloc(totalShards);
+    if (rs == NULL || shards == NULL || expected == NULL || marks == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    printf("%d data + %d parity shards, %d erased for reconstruction\n", dataShards, parityShards,
+           parityShards < dataShards ? parityShards : dataShards);
+
+    for (s = 0; s < (int)(sizeof(checkedShardSizes) / sizeof(checkedShardSizes[0])); s++) {
+        if (checkKernels(rs, kernels, kernelCount, dataShards, parityShards, checkedShardSizes[s]) != 0) {
+            failed = 1;
+        }
+    }
+
+    printf("%-8s %6s %12s %12s\n", "kernel", "size", "encode GB/s", "recon GB/s");
+
+    for (s = 0; s < (int)(sizeof(shardSizes) / sizeof(shardSizes[0])); s++) {
+        int shardSize = shardSizes[s];
+
+        for (i = 0; i < totalShards; i++) {
+            shards[i] = malloc(shardSize);
+            expected[i] = malloc(shardSize);
+            if (shards[i] == NULL || expected[i] == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                return 1;
+            }
+        }
+
+        for (k = 0; k < kernelCount; k++) {
+            unsigned long long startNs, elapsedNs, iterations;
+            double encodeGbps, reconGbps;
+
+            simd_mul = kernels[k].kernel;
+
+            // Encode once to check the output against the scalar kernel's
+            fillShards(shards, dataShards, shardSize);
+            reed_solomon_encode(rs, shards, totalShards, shardSize);
+            if (k == 0) {
+                for (i = 0; i < totalShards; i++) {
+                    memcpy(expected[i], shards[i], shardSize);
+                }
+            }
+            else {
+                for (i = dataShards; i < totalShards; i++) {
+                    if (memcmp(expected[i], shards[i], shardSize) != 0) {
+                        printf("FAIL: %s parity differs from scalar at shard size %d\n", kernels[k].name, shardSize);
+                        failed = 1;
+                        break;
+                    }
+                }
+            }
+
+            iterations = 0;
+            startNs = nowNs();
+            do {
+                reed_solomon_encode(rs, shards, totalShards, shardSize);
+                iterations++;
+                elapsedNs = nowNs() - startNs;
+            } while (elapsedNs < MIN_RUN_NS);
+            encodeGbps = (double)iterations * dataShards * shardSize / elapsedNs;
+
+            // Every reconstruction must restore the original data
+            eraseShards(shards, marks, dataShards, parityShards, shardSize);
+            if (reed_solomon_reconstruct(rs, shards, marks, totalShards, shardSize) != 0) {
+                printf("FAIL: %s reconstruction failed at shard size %d\n", kernels[k].name, shardSize);
+                failed = 1;
+            }
+            for (i = 0; i < dataShards; i++) {
+                if (memcmp(expected[i], shards[i], shardSize) != 0) {
+                    printf("FAIL: %s reconstructed data differs at shard size %d\n", kernels[k].name, shardSize);
+                    failed = 1;
+                    break;
+                }
+            }
+
+            iterations = 0;
+            startNs = nowNs();
+            do {
+                eraseShards(shards, marks, dataShards, parityShards, shardSize);
+                reed_solomon_reconstruct(rs, shards, marks, totalShards, shardSize);
+                iterations++;
+                elapsedNs = nowNs() - startNs;
+            } while (elapsedNs < MIN_RUN_NS);
+            reconGbps = (double)iterations * dataShards * shardSize / elapsedNs;
+
+            printf("%-8s %6d %12.2f %12.2f\n", kernels[k].name, shardSize, encodeGbps, reconGbps);
+        }
+
+        for (i = 0; i < totalShards; i++) {
+            free(shards[i]);
+            free(expected[i]);
+        }
+    }
+
+    reed_solomon_release(rs);
+    free(shards);
+    free(expected);
+    free(marks);
+
+    return failed;
+}
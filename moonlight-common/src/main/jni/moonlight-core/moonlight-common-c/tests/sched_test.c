@@ -0,0 +1,58 @@
+// Checks that measuring scheduling latency reports a result for every thread
+// role and leaves the scheduling used for new threads as it found it.
+
+#include "Limelight-internal.h"
+#include "PlatformThreads.h"
+
+#include <stdio.h>
+
+#define MEASURE_MS 100
+
+static int failures;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("FAIL: %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++; \
+        } \
+    } while (0)
+
+int main(int argc, char** argv) {
+    THREAD_SCHEDULING initialScheduling[THREAD_ROLE_COUNT];
+    THREAD_SCHEDULING finalScheduling[THREAD_ROLE_COUNT];
+    STREAM_CONFIGURATION streamConfig;
+    SCHEDULING_LATENCY_STATS stats;
+    int i;
+
+    // Nice values can always be raised without privileges
+    memset(initialScheduling, 0, sizeof(initialScheduling));
+    for (i = 0; i < THREAD_ROLE_COUNT; i++) {
+        initialScheduling[i].niceValue = 1;
+    }
+    PltSetThreadScheduling(initialScheduling);
+
+    LiInitializeStreamConfiguration(&streamConfig);
+    for (i = 0; i < THREAD_ROLE_COUNT; i++) {
+        streamConfig.threadScheduling[i].niceValue = 2 + i;
+        streamConfig.threadScheduling[i].cpuAffinityMask = 1;
+    }
+
+    CHECK(LiMeasureSchedulingLatency(&streamConfig, MEASURE_MS, 1, &stats) == 0);
+    for (i = 0; i < THREAD_ROLE_COUNT; i++) {
+        CHECK(stats.wakeupLatency[i].samples > 0);
+        printf("role %d: %u wakeups, p50 %u us, p99 %u us\n", i, stats.wakeupLatency[i].samples,
+               stats.wakeupLatency[i].p50Us, stats.wakeupLatency[i].p99Us);
+    }
+
+    PltGetThreadScheduling(finalScheduling);
+    CHECK(memcmp(initialScheduling, finalScheduling, sizeof(initialScheduling)) == 0);
+
+    if (failures != 0) {
+        printf("sched_test: %d checks failed\n", failures);
+        return 1;
+    }
+
+    printf("sched_test: passed\n");
+    return 0;
+}
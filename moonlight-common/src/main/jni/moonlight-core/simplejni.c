@@ -80,4 +80,46 @@ Java_com_limelight_nvstream_jni_MoonBridge_findExternalAddressIP4(JNIEnv *env, j
         __android_log_print(ANDROID_LOG_ERROR, "moonlight-common-c", "STUN failed to get WAN address: %d", err);
         return NULL;
     }
-}
\ No newline at end of file
+}
+
+static void putLatencyPercentiles(jint* values, PLATENCY_PERCENTILES percentiles) {
+    values[0] = percentiles->samples;
+    values[1] = percentiles->p50Us;
+    values[2] = percentiles->p95Us;
+    values[3] = percentiles->p99Us;
+    values[4] = percentiles->maxUs;
+}
+
+JNIEXPORT void JNICALL
+Java_com_limelight_nvstream_jni_MoonBridge_getPipelineStats(JNIEnv *env, jclass clazz, jintArray stats) {
+    PIPELINE_STATS pipelineStats;
+    jint values[6 * 5];
+    jsize length;
+
+    LiGetPipelineStats(&pipelineStats);
+
+    // This must match the layout described in MoonBridge
+    putLatencyPercentiles(&values[0 * 5], &pipelineStats.receive);
+    putLatencyPercentiles(&values[1 * 5], &pipelineStats.fecRecovery);
+    putLatencyPercentiles(&values[2 * 5], &pipelineStats.reassembly);
+    putLatencyPercentiles(&values[3 * 5], &pipelineStats.decodeUnitQueue);
+    putLatencyPercentiles(&values[4 * 5], &pipelineStats.submit);
+    putLatencyPercentiles(&values[5 * 5], &pipelineStats.total);
+
+    length = (*env)->GetArrayLength(env, stats);
+    if (length > (jsize)(sizeof(values) / sizeof(values[0]))) {
+        length = sizeof(values) / sizeof(values[0]);
+    }
+    (*env)->SetIntArrayRegion(env, stats, 0, length, values);
+}
+
+JNIEXPORT void JNICALL
+Java_com_limelight_nvstream_jni_MoonBridge_resetPipelineStats(JNIEnv *env, jclass clazz) {
+    LiResetPipelineStats();
+}
+
+JNIEXPORT void JNICALL
+Java_com_limelight_nvstream_jni_MoonBridge_reportDisplayVsync(JNIEnv *env, jclass clazz, jlong vsyncTimeNanos) {
+    // System.nanoTime() and LiGetMicros() both use CLOCK_MONOTONIC
+    LiReportDisplayVsync((unsigned long long)vsyncTimeNanos / 1000);
+}